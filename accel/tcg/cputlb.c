@@ -22,6 +22,7 @@
 #include "hw/core/tcg-cpu-ops.h"
 #include "exec/exec-all.h"
 #include "exec/memory.h"
+#include "exec/address-spaces.h"
 #include "exec/cpu_ldst.h"
 #include "exec/cputlb.h"
 #include "exec/memory-internal.h"
@@ -271,6 +272,117 @@ static inline void tlb_n_used_entries_dec(CPUArchState *env, uintptr_t mmu_idx)
     env_tlb(env)->d[mmu_idx].n_used_entries--;
 }
 
+/*
+ * Per-vCPU ring of the guest RAM pages that were written through the
+ * TLB_NOTDIRTY slow path while dirty tracking is active, similar to
+ * KVM's dirty ring.  Only the vCPU thread pushes and advances @head,
+ * without atomics on the shared dirty bitmaps; harvesting moves the
+ * pages into the DIRTY_MEMORY_MIGRATION bitmap under @lock and
+ * advances @tail.  The indices are free running and masked with
+ * @size - 1 when accessing @pages.
+ */
+struct CPUTLBDirtyRing {
+    QemuSpin lock;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    ram_addr_t pages[];
+};
+
+/* Number of entries in each vCPU's dirty ring, or 0 if disabled. */
+uint32_t tcg_dirty_ring_size;
+
+static uint32_t tlb_dirty_ring_harvest(CPUTLBDirtyRing *ring)
+{
+    ram_addr_t start = 0, length = 0;
+    uint32_t head, tail, count;
+
+    qemu_spin_lock(&ring->lock);
+    head = qatomic_load_acquire(&ring->head);
+    count = head - ring->tail;
+    for (tail = ring->tail; tail != head; tail++) {
+        ram_addr_t page = ring->pages[tail & (ring->size - 1)];
+
+        /* Pass runs of consecutive pages to the bitmap in one go. */
+        if (length && page == start + length) {
+            length += TARGET_PAGE_SIZE;
+            continue;
+        }
+        if (length) {
+            cpu_physical_memory_set_dirty_range(start, length,
+                                                1 << DIRTY_MEMORY_MIGRATION);
+        }
+        start = page;
+        length = TARGET_PAGE_SIZE;
+    }
+    if (length) {
+        cpu_physical_memory_set_dirty_range(start, length,
+                                            1 << DIRTY_MEMORY_MIGRATION);
+    }
+    /* Only now may the vCPU reuse the entries. */
+    qatomic_store_release(&ring->tail, head);
+    qemu_spin_unlock(&ring->lock);
+    return count;
+}
+
+/* Called from the vCPU thread, the only one that advances @head. */
+static void tlb_dirty_ring_push(CPUTLBDirtyRing *ring, ram_addr_t page)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = qatomic_load_acquire(&ring->tail);
+
+    /* Stores to the same page often come in a row. */
+    if (head != tail && ring->pages[(head - 1) & (ring->size - 1)] == page) {
+        return;
+    }
+    if (head - tail == ring->size) {
+        tlb_dirty_ring_harvest(ring);
+    }
+    ring->pages[head & (ring->size - 1)] = page;
+    qatomic_store_release(&ring->head, head + 1);
+}
+
+static void tlb_dirty_ring_harvest_all(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUTLBDirtyRing *ring = env_tlb(cpu->env_ptr)->c.dirty_ring;
+        uint32_t count;
+
+        if (ring) {
+            count = tlb_dirty_ring_harvest(ring);
+            trace_tlb_dirty_ring_harvest(cpu->cpu_index, count);
+        }
+    }
+}
+
+static void tlb_dirty_ring_log_sync_global(MemoryListener *listener,
+                                           bool last_stage)
+{
+    tlb_dirty_ring_harvest_all();
+}
+
+static void tlb_dirty_ring_log_global_stop(MemoryListener *listener)
+{
+    /* Pages pushed while tracking was on must still reach the bitmap. */
+    tlb_dirty_ring_harvest_all();
+}
+
+static MemoryListener tlb_dirty_ring_listener = {
+    .name = "tcg-dirty-ring",
+    .log_sync_global = tlb_dirty_ring_log_sync_global,
+    .log_global_stop = tlb_dirty_ring_log_global_stop,
+    .priority = 10,
+};
+
+void tlb_dirty_ring_init(uint32_t size)
+{
+    assert(is_power_of_2(size));
+    tcg_dirty_ring_size = size;
+    memory_listener_register(&tlb_dirty_ring_listener, &address_space_memory);
+}
+
 void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -285,13 +397,32 @@ void tlb_init(CPUState *cpu)
     for (i = 0; i < NB_MMU_MODES; i++) {
         tlb_mmu_init(&env_tlb(env)->d[i], &env_tlb(env)->f[i], now);
     }
+
+    env_tlb(env)->c.dirty_ring = NULL;
+    if (tcg_dirty_ring_size) {
+        CPUTLBDirtyRing *ring;
+
+        ring = g_malloc0(sizeof(*ring) +
+                         tcg_dirty_ring_size * sizeof(ring->pages[0]));
+        qemu_spin_init(&ring->lock);
+        ring->size = tcg_dirty_ring_size;
+        env_tlb(env)->c.dirty_ring = ring;
+    }
 }
 
 void tlb_destroy(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
+    CPUTLBDirtyRing *ring = env_tlb(env)->c.dirty_ring;
     int i;
 
+    if (ring) {
+        /* Do not lose the pages that the vCPU wrote last. */
+        tlb_dirty_ring_harvest(ring);
+        qemu_spin_destroy(&ring->lock);
+        env_tlb(env)->c.dirty_ring = NULL;
+        g_free(ring);
+    }
     qemu_spin_destroy(&env_tlb(env)->c.lock);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &env_tlb(env)->d[i];
@@ -1496,12 +1627,39 @@ static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
 {
     ram_addr_t ram_addr = mem_vaddr + full->xlat_section;
 
+    CPUTLBDirtyRing *ring = env_tlb(cpu->env_ptr)->c.dirty_ring;
+
     trace_memory_notdirty_write_access(mem_vaddr, ram_addr, size);
 
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
         tb_invalidate_phys_range_fast(ram_addr, size, retaddr);
     }
 
+    if (ring && qatomic_read(&global_dirty_tracking)) {
+        ram_addr_t page = ram_addr & TARGET_PAGE_MASK;
+        ram_addr_t last = (ram_addr + size - 1) & TARGET_PAGE_MASK;
+
+        /*
+         * Record the pages in the ring instead of the migration bitmap,
+         * which is brought up to date when migration syncs it.  Only
+         * touch the VGA bitmap if it still has clean pages.
+         */
+        for (; page <= last; page += TARGET_PAGE_SIZE) {
+            tlb_dirty_ring_push(ring, page);
+        }
+        if (cpu_physical_memory_range_includes_clean(ram_addr, size,
+                                                     1 << DIRTY_MEMORY_VGA)) {
+            cpu_physical_memory_set_dirty_range(ram_addr, size,
+                                                1 << DIRTY_MEMORY_VGA);
+        }
+        if (cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_VGA) &&
+            cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
+            trace_memory_notdirty_set_dirty(mem_vaddr);
+            tlb_set_dirty(cpu, mem_vaddr);
+        }
+        return;
+    }
+
     /*
      * Set both VGA and migration bits for simplicity and to remove
      * the notdirty callback faster.
@@ -67,6 +67,8 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
                                    uintptr_t retaddr);
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
+extern uint32_t tcg_dirty_ring_size;
+void tlb_dirty_ring_init(uint32_t size);
 #endif /* CONFIG_SOFTMMU */
 
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
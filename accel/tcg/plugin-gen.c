@@ -80,6 +80,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -113,15 +114,37 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Compute in @ptr the address of the executing vCPU's counter, i.e.
+ * base + cpu_index * stride. Both base and stride are filled in later;
+ * when the stride is 0 only the movi of the base is kept.
+ */
+static void gen_empty_counter_ptr(TCGv_ptr ptr)
+{
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr offset = tcg_temp_ebb_new_ptr();
+
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    /* the second operand is replaced with the stride */
+    tcg_gen_mul_i32(cpu_index, cpu_index, cpu_index);
+    tcg_gen_ext_i32_ptr(offset, cpu_index);
+    tcg_gen_movi_ptr(ptr, 0);
+    tcg_gen_add_ptr(ptr, ptr, offset);
+
+    tcg_temp_free_ptr(offset);
+    tcg_temp_free_i32(cpu_index);
+}
+
+/*
+ * This is the template for an addi_i64. A store of an immediate only
+ * copies the final st_i64, replacing its value.
  */
 static void gen_empty_inline_cb(void)
 {
     TCGv_i64 val = tcg_temp_ebb_new_i64();
     TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
 
-    tcg_gen_movi_ptr(ptr, 0);
+    gen_empty_counter_ptr(ptr);
     tcg_gen_ld_i64(val, ptr, 0);
     /* pass an immediate != 0 so that it doesn't get optimized away */
     tcg_gen_addi_i64(val, val, 0xdeadface);
@@ -130,6 +153,35 @@ static void gen_empty_inline_cb(void)
     tcg_temp_free_i64(val);
 }
 
+/*
+ * A udata callback skipped by a branch unless the vCPU's counter
+ * compares true with an immediate. The condition, the immediate and
+ * the label are all replaced when filling it in.
+ */
+static void gen_empty_cond_cb(void)
+{
+    TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
+    TCGv_ptr udata = tcg_temp_ebb_new_ptr();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGv_ptr ptr = tcg_temp_ebb_new_ptr();
+    TCGLabel *skip = gen_new_label();
+
+    gen_empty_counter_ptr(ptr);
+    tcg_gen_ld_i64(val, ptr, 0);
+    tcg_gen_brcondi_i64(TCG_COND_EQ, val, 0xdeadface, skip);
+
+    tcg_gen_movi_ptr(udata, 0);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+    gen_set_label(skip);
+
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_i32(cpu_index);
+}
+
 static void gen_empty_mem_cb(TCGv_i64 addr, uint32_t info)
 {
     TCGv_i32 cpu_index = tcg_temp_ebb_new_i32();
@@ -194,6 +246,7 @@ static void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_COND, gen_empty_cond_cb);
         break;
     default:
         g_assert_not_reached();
@@ -260,6 +313,13 @@ static TCGOp *copy_op(TCGOp **begin_op, TCGOp *op, TCGOpcode opc)
     return op;
 }
 
+/* skip an op of the empty callback that is not needed */
+static void skip_op(TCGOp **begin_op, TCGOpcode opc)
+{
+    *begin_op = QTAILQ_NEXT(*begin_op, link);
+    tcg_debug_assert(*begin_op && (*begin_op)->opc == opc);
+}
+
 static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -287,6 +347,16 @@ static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
+static void skip_ld_i64(TCGOp **begin_op)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        skip_op(begin_op, INDEX_op_ld_i32);
+        skip_op(begin_op, INDEX_op_ld_i32);
+    } else {
+        skip_op(begin_op, INDEX_op_ld_i64);
+    }
+}
+
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -300,6 +370,33 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
+/* st_i64 of an immediate in place of the value */
+static TCGOp *copy_st_i64_imm(TCGOp **begin_op, TCGOp *op, uint64_t v)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        /* 2x st_i32, the first one to the lower address */
+        op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[0] = tcgv_i32_arg(tcg_constant_i32(HOST_BIG_ENDIAN ?
+                                                    v >> 32 : v));
+        op = copy_op(begin_op, op, INDEX_op_st_i32);
+        op->args[0] = tcgv_i32_arg(tcg_constant_i32(HOST_BIG_ENDIAN ?
+                                                    v : v >> 32));
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_st_i64);
+        op->args[0] = tcgv_i64_arg(tcg_constant_i64(v));
+    }
+    return op;
+}
+
+static void skip_add_i64(TCGOp **begin_op)
+{
+    if (TCG_TARGET_REG_BITS == 32) {
+        skip_op(begin_op, INDEX_op_add2_i32);
+    } else {
+        skip_op(begin_op, INDEX_op_add_i64);
+    }
+}
+
 static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -315,6 +412,78 @@ static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
     return op;
 }
 
+static TCGOp *copy_brcond_i64(TCGOp **begin_op, TCGOp *op, TCGCond cond,
+                              uint64_t v, TCGLabel *l)
+{
+    TCGLabelUse *u = tcg_malloc(sizeof(TCGLabelUse));
+
+    if (TCG_TARGET_REG_BITS == 32) {
+        op = copy_op(begin_op, op, INDEX_op_brcond2_i32);
+        op->args[2] = tcgv_i32_arg(tcg_constant_i32(v));
+        op->args[3] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
+        op->args[4] = cond;
+        op->args[5] = label_arg(l);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_brcond_i64);
+        op->args[1] = tcgv_i64_arg(tcg_constant_i64(v));
+        op->args[2] = cond;
+        op->args[3] = label_arg(l);
+    }
+    u->op = op;
+    QSIMPLEQ_INSERT_TAIL(&l->branches, u, next);
+    return op;
+}
+
+static TCGOp *copy_set_label(TCGOp **begin_op, TCGOp *op, TCGLabel *l)
+{
+    op = copy_op(begin_op, op, INDEX_op_set_label);
+    op->args[0] = label_arg(l);
+    l->present = 1;
+    return op;
+}
+
+/*
+ * Fill in gen_empty_counter_ptr(). A shared counter does not depend on
+ * the vCPU, so only its address is kept.
+ */
+static TCGOp *copy_counter_ptr(TCGOp **begin_op, TCGOp *op, void *base,
+                               size_t stride)
+{
+    if (!stride) {
+        skip_op(begin_op, INDEX_op_ld_i32);
+        skip_op(begin_op, INDEX_op_mul_i32);
+        skip_op(begin_op, UINTPTR_MAX == UINT32_MAX ?
+                          INDEX_op_mov_i32 : INDEX_op_ext_i32_i64);
+        op = copy_const_ptr(begin_op, op, base);
+        skip_op(begin_op, UINTPTR_MAX == UINT32_MAX ?
+                          INDEX_op_add_i32 : INDEX_op_add_i64);
+        return op;
+    }
+
+    /* ld_i32 cpu_index */
+    op = copy_op(begin_op, op, INDEX_op_ld_i32);
+
+    /* mul_i32 by the stride */
+    op = copy_op(begin_op, op, INDEX_op_mul_i32);
+    op->args[2] = tcgv_i32_arg(tcg_constant_i32(stride));
+
+    /* ext_i32_ptr */
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_mov_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_ext_i32_i64);
+    }
+
+    /* const_ptr base, add_ptr */
+    op = copy_const_ptr(begin_op, op, base);
+    if (UINTPTR_MAX == UINT32_MAX) {
+        op = copy_op(begin_op, op, INDEX_op_add_i32);
+    } else {
+        op = copy_op(begin_op, op, INDEX_op_add_i64);
+    }
+    return op;
+}
+
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -382,17 +551,82 @@ static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    size_t stride;
+    void *base = plugin_dyn_cb_counter(cb, cb->inline_insn.entry, &stride);
+
+    /* counter address */
+    op = copy_counter_ptr(&begin_op, op, base, stride);
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        /* ld_i64 */
+        op = copy_ld_i64(&begin_op, op);
+
+        /* add_i64 */
+        op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+
+        /* st_i64 */
+        op = copy_st_i64(&begin_op, op);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        skip_ld_i64(&begin_op);
+        skip_add_i64(&begin_op);
 
-    /* ld_i64 */
+        /* st_i64 of the immediate */
+        op = copy_st_i64_imm(&begin_op, op, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    return op;
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* NEVER and ALWAYS are handled at registration */
+        g_assert_not_reached();
+    }
+}
+
+static TCGOp *append_cond_cb(const struct qemu_plugin_dyn_cb *cb,
+                             TCGOp *begin_op, TCGOp *op, int *unused)
+{
+    TCGCond skip_cond = tcg_invert_cond(plugin_cond_to_tcgcond(cb->cond.cond));
+    TCGLabel *skip = gen_new_label();
+    size_t stride;
+    void *base = plugin_dyn_cb_counter(cb, cb->cond.entry, &stride);
+    int cb_idx;
+
+    /* counter address, ld_i64 */
+    op = copy_counter_ptr(&begin_op, op, base, stride);
     op = copy_ld_i64(&begin_op, op);
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+    /* branch over the call unless the condition holds */
+    op = copy_brcond_i64(&begin_op, op, skip_cond, cb->cond.imm, skip);
 
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+    /* const_ptr, ld_i32, call */
+    op = copy_const_ptr(&begin_op, op, cb->userp);
+    op = copy_op(&begin_op, op, INDEX_op_ld_i32);
+    op = copy_call(&begin_op, op, HELPER(plugin_vcpu_udata_cb),
+                   cb->f.vcpu_udata, &cb_idx);
+
+    /* set_label */
+    op = copy_set_label(&begin_op, op, skip);
 
     return op;
 }
@@ -485,6 +719,12 @@ inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
     inject_cb_type(cbs, begin_op, append_inline_cb, ok);
 }
 
+static void
+inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_cb_type(cbs, begin_op, append_cond_cb, op_ok);
+}
+
 static void
 inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
 {
@@ -597,6 +837,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond(const struct qemu_plugin_tb *ptb,
+                               TCGOp *begin_op)
+{
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -613,6 +859,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond(const struct qemu_plugin_tb *ptb,
+                                 TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -679,6 +933,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND:
+                type = "cond";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -727,6 +984,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_tb_inline(plugin_tb, op);
                     break;
+                case PLUGIN_GEN_CB_COND:
+                    plugin_gen_tb_cond(plugin_tb, op);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -743,6 +1003,9 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                 case PLUGIN_GEN_CB_INLINE:
                     plugin_gen_insn_inline(plugin_tb, op, insn_idx);
                     break;
+                case PLUGIN_GEN_CB_COND:
+                    plugin_gen_insn_cond(plugin_tb, op, insn_idx);
+                    break;
                 case PLUGIN_GEN_ENABLE_MEM_HELPER:
                     plugin_gen_enable_mem_helper(plugin_tb, op, insn_idx);
                     break;
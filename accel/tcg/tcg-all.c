@@ -47,9 +47,13 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t dirty_ring_size;
 };
 typedef struct TCGState TCGState;
 
+/* Same limit as the per-vCPU dirty rings of KVM: 512 KiB per vCPU */
+#define TCG_DIRTY_RING_MAX_ENTRIES 65536
+
 #define TYPE_TCG_ACCEL ACCEL_CLASS_NAME("tcg")
 
 DECLARE_INSTANCE_CHECKER(TCGState, TCG_STATE,
@@ -122,6 +126,10 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init(tcg_ctx);
+
+    if (s->dirty_ring_size) {
+        tlb_dirty_ring_init(s->dirty_ring_size);
+    }
 #endif
 
     return 0;
@@ -181,6 +189,41 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+#ifdef CONFIG_SOFTMMU
+static void tcg_get_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_dirty_ring_size(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "dirty-ring-size must be a power of two.");
+        return;
+    }
+    if (value > TCG_DIRTY_RING_MAX_ENTRIES) {
+        error_setg(errp, "dirty-ring-size must not be larger than %u.",
+                   TCG_DIRTY_RING_MAX_ENTRIES);
+        return;
+    }
+
+    s->dirty_ring_size = value;
+}
+#endif
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -240,6 +283,14 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+#ifdef CONFIG_SOFTMMU
+    object_class_property_add(oc, "dirty-ring-size", "uint32",
+        tcg_get_dirty_ring_size, tcg_set_dirty_ring_size,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-size",
+        "Size of per-vCPU dirty page ring (default: 0, i.e. use bitmap)");
+#endif
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
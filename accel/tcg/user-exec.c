@@ -23,6 +23,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translate-all.h"
 #include "exec/helper-proto.h"
@@ -144,6 +145,12 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Modifications of pageflags_root are serialized by the mmap_lock, and
+ * bump pageflags_seq so that lockless lookups can detect them.
+ */
+static QemuSeqLock pageflags_seq;
+
 static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
 {
     IntervalTreeNode *n;
@@ -152,6 +159,28 @@ static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
     return n ? container_of(n, PageFlagsNode, itree) : NULL;
 }
 
+/*
+ * Like pageflags_find, but may be called without the mmap_lock, within
+ * an RCU read-side critical section.  See util/interval-tree.c re
+ * lockless lookups: no false positives but there are false negatives.
+ * A negative result is only trusted if the tree was not modified
+ * during the lookup; otherwise the lookup is retried.
+ */
+static PageFlagsNode *pageflags_lookup(target_ulong start, target_ulong last)
+{
+    PageFlagsNode *p;
+    unsigned seq;
+
+    if (have_mmap_lock()) {
+        return pageflags_find(start, last);
+    }
+    do {
+        seq = seqlock_read_begin(&pageflags_seq);
+        p = pageflags_find(start, last);
+    } while (!p && seqlock_read_retry(&pageflags_seq, seq));
+    return p;
+}
+
 static PageFlagsNode *pageflags_next(PageFlagsNode *p, target_ulong start,
                                      target_ulong last)
 {
@@ -207,23 +236,10 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageFlagsNode *p = pageflags_find(address, address);
-
-    /*
-     * See util/interval-tree.c re lockless lookups: no false positives but
-     * there are false negatives.  If we find nothing, retry with the mmap
-     * lock acquired.
-     */
-    if (p) {
-        return p->flags;
-    }
-    if (have_mmap_lock()) {
-        return 0;
-    }
+    PageFlagsNode *p;
 
-    mmap_lock();
-    p = pageflags_find(address, address);
-    mmap_unlock();
+    RCU_READ_LOCK_GUARD();
+    p = pageflags_lookup(address, address);
     return p ? p->flags : 0;
 }
 
@@ -238,7 +254,10 @@ static void pageflags_create(target_ulong start, target_ulong last, int flags)
     interval_tree_insert(&p->itree, &pageflags_root);
 }
 
-/* A subroutine of page_set_flags: remove everything in [start,last]. */
+/*
+ * A subroutine of page_set_flags: remove everything in [start,last].
+ * Must be called within a pageflags_seq write section.
+ */
 static bool pageflags_unset(target_ulong start, target_ulong last)
 {
     bool inval_tb = false;
@@ -335,7 +354,10 @@ static void pageflags_create_merge(target_ulong start, target_ulong last,
 #endif
 #define PAGE_STICKY  (PAGE_ANON | PAGE_PASSTHROUGH | PAGE_TARGET_STICKY)
 
-/* A subroutine of page_set_flags: add flags to [start,last]. */
+/*
+ * A subroutine of page_set_flags: add flags to [start,last].
+ * Must be called within a pageflags_seq write section.
+ */
 static bool pageflags_set_clear(target_ulong start, target_ulong last,
                                 int set_flags, int clear_flags)
 {
@@ -509,12 +531,23 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
 
     if (!flags || reset) {
         page_reset_target_data(start, last);
+    }
+
+    /*
+     * With PAGE_RESET the range is briefly empty between the unset and
+     * the set; one write section keeps lockless lookups from trusting
+     * a miss there.
+     */
+    seqlock_write_begin(&pageflags_seq);
+    if (!flags || reset) {
         inval_tb |= pageflags_unset(start, last);
     }
     if (flags) {
         inval_tb |= pageflags_set_clear(start, last, flags,
                                         ~(reset ? 0 : PAGE_STICKY));
     }
+    seqlock_write_end(&pageflags_seq);
+
     if (inval_tb) {
         tb_invalidate_phys_range(start, last);
     }
@@ -523,7 +556,6 @@ void page_set_flags(target_ulong start, target_ulong last, int flags)
 bool page_check_range(target_ulong start, target_ulong len, int flags)
 {
     target_ulong last;
-    int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
     bool ret;
 
     if (len == 0) {
@@ -535,25 +567,14 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         return false; /* wrap around */
     }
 
-    locked = have_mmap_lock();
+    RCU_READ_LOCK_GUARD();
     while (true) {
-        PageFlagsNode *p = pageflags_find(start, last);
+        PageFlagsNode *p = pageflags_lookup(start, last);
         int missing;
 
         if (!p) {
-            if (!locked) {
-                /*
-                 * Lockless lookups have false negatives.
-                 * Retry with the lock held.
-                 */
-                mmap_lock();
-                locked = -1;
-                p = pageflags_find(start, last);
-            }
-            if (!p) {
-                ret = false; /* entire region invalid */
-                break;
-            }
+            ret = false; /* entire region invalid */
+            break;
         }
         if (start < p->itree.start) {
             ret = false; /* initial bytes invalid */
@@ -590,11 +611,6 @@ bool page_check_range(target_ulong start, target_ulong len, int flags)
         }
         start = p->itree.last + 1;
     }
-
-    /* Release the lock if acquired locally. */
-    if (locked < 0) {
-        mmap_unlock();
-    }
     return ret;
 }
 
@@ -677,7 +693,9 @@ void page_protect(tb_page_addr_t address)
     }
 
     if (prot & PAGE_WRITE) {
+        seqlock_write_begin(&pageflags_seq);
         pageflags_set_clear(start, last, 0, PAGE_WRITE);
+        seqlock_write_end(&pageflags_seq);
         mprotect(g2h_untagged(start), qemu_host_page_size,
                  prot & (PAGE_READ | PAGE_EXEC) ? PROT_READ : PROT_NONE);
     }
@@ -731,13 +749,16 @@ int page_unprotect(target_ulong address, uintptr_t pc)
             start = address & TARGET_PAGE_MASK;
             len = TARGET_PAGE_SIZE;
             prot = p->flags | PAGE_WRITE;
+            seqlock_write_begin(&pageflags_seq);
             pageflags_set_clear(start, start + len - 1, PAGE_WRITE, 0);
+            seqlock_write_end(&pageflags_seq);
             current_tb_invalidated = tb_invalidate_phys_page_unwind(start, pc);
         } else {
             start = address & qemu_host_page_mask;
             len = qemu_host_page_size;
             prot = 0;
 
+            seqlock_write_begin(&pageflags_seq);
             for (i = 0; i < len; i += TARGET_PAGE_SIZE) {
                 target_ulong addr = start + i;
 
@@ -750,12 +771,16 @@ int page_unprotect(target_ulong address, uintptr_t pc)
                                             PAGE_WRITE, 0);
                     }
                 }
-                /*
-                 * Since the content will be modified, we must invalidate
-                 * the corresponding translated code.
-                 */
+            }
+            seqlock_write_end(&pageflags_seq);
+
+            /*
+             * Since the content will be modified, we must invalidate
+             * the corresponding translated code.
+             */
+            for (i = 0; i < len; i += TARGET_PAGE_SIZE) {
                 current_tb_invalidated |=
-                    tb_invalidate_phys_page_unwind(addr, pc);
+                    tb_invalidate_phys_page_unwind(start + i, pc);
             }
         }
         if (prot & PAGE_EXEC) {
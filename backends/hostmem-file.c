@@ -18,6 +18,7 @@
 #include "sysemu/hostmem.h"
 #include "qom/object_interfaces.h"
 #include "qom/object.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 
 OBJECT_DECLARE_SIMPLE_TYPE(HostMemoryBackendFile, MEMORY_BACKEND_FILE)
 
@@ -31,6 +32,8 @@ struct HostMemoryBackendFile {
     bool discard_data;
     bool is_pmem;
     bool readonly;
+    bool is_template;
+    bool discard_disabled;
 };
 
 static void
@@ -40,9 +43,11 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
     error_setg(errp, "backend '%s' not supported on this host",
                object_get_typename(OBJECT(backend)));
 #else
+    ERRP_GUARD();
     HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(backend);
     uint32_t ram_flags;
     gchar *name;
+    int ret;
 
     if (!backend->size) {
         error_setg(errp, "can't create backend with size 0");
@@ -53,16 +58,47 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
         return;
     }
 
+    if (fb->is_template) {
+        if (backend->share) {
+            error_setg(errp, "'template' requires 'share=off'");
+            return;
+        }
+        if (backend->prealloc) {
+            /* Preallocation would write to and copy every page. */
+            error_setg(errp, "'template' is incompatible with 'prealloc'");
+            return;
+        }
+
+        /*
+         * A discarded page of a private file mapping reads back the
+         * template instead of zeroes, and punching a hole would modify
+         * the image.
+         */
+        ret = ram_block_discard_disable(true);
+        if (ret) {
+            error_setg_errno(errp, -ret, "'template' is incompatible with "
+                             "devices that discard RAM");
+            return;
+        }
+        fb->discard_disabled = true;
+    }
+
     name = host_memory_backend_get_name(backend);
     ram_flags = backend->share ? RAM_SHARED : 0;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
     ram_flags |= fb->is_pmem ? RAM_PMEM : 0;
+    ram_flags |= fb->is_template ? RAM_TEMPLATE : 0;
     ram_flags |= RAM_NAMED_FILE;
     memory_region_init_ram_from_file(&backend->mr, OBJECT(backend), name,
                                      backend->size, fb->align, ram_flags,
                                      fb->mem_path, fb->offset, fb->readonly,
                                      errp);
     g_free(name);
+
+    if (*errp && fb->discard_disabled) {
+        ram_block_discard_disable(false);
+        fb->discard_disabled = false;
+    }
 #endif
 }
 
@@ -201,6 +237,28 @@ static void file_memory_backend_set_readonly(Object *obj, bool value,
     fb->readonly = value;
 }
 
+static bool file_memory_backend_get_template(Object *obj, Error **errp)
+{
+    HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(obj);
+
+    return fb->is_template;
+}
+
+static void file_memory_backend_set_template(Object *obj, bool value,
+                                             Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property 'template' of %s.",
+                   object_get_typename(obj));
+        return;
+    }
+
+    fb->is_template = value;
+}
+
 static void file_backend_unparent(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -243,12 +301,20 @@ file_backend_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "readonly",
         file_memory_backend_get_readonly,
         file_memory_backend_set_readonly);
+    object_class_property_add_bool(oc, "template",
+        file_memory_backend_get_template,
+        file_memory_backend_set_template);
+    object_class_property_set_description(oc, "template",
+        "Map a read-only RAM image privately, copying pages on write");
 }
 
 static void file_backend_instance_finalize(Object *o)
 {
     HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(o);
 
+    if (fb->discard_disabled) {
+        ram_block_discard_disable(false);
+    }
     g_free(fb->mem_path);
 }
 
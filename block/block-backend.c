@@ -1543,13 +1543,18 @@ typedef struct BlkAioEmAIOCB {
     BlkRwCo rwco;
     int64_t bytes;
     bool has_returned;
+    /*
+     * The request is processed and completed in the AioContext of the
+     * submitter, which need not be the BlockBackend's home AioContext.
+     */
+    AioContext *ctx;
 } BlkAioEmAIOCB;
 
 static AioContext *blk_aio_em_aiocb_get_aio_context(BlockAIOCB *acb_)
 {
     BlkAioEmAIOCB *acb = container_of(acb_, BlkAioEmAIOCB, common);
 
-    return blk_get_aio_context(acb->rwco.blk);
+    return acb->ctx;
 }
 
 static const AIOCBInfo blk_aio_em_aiocb_info = {
@@ -1593,14 +1598,14 @@ static BlockAIOCB *blk_aio_prwv(BlockBackend *blk, int64_t offset,
     };
     acb->bytes = bytes;
     acb->has_returned = false;
+    acb->ctx = qemu_get_current_aio_context();
 
     co = qemu_coroutine_create(co_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
@@ -1899,14 +1904,14 @@ BlockAIOCB *blk_aio_zone_report(BlockBackend *blk, int64_t offset,
     };
     acb->bytes = (int64_t)(uintptr_t)nr_zones,
     acb->has_returned = false;
+    acb->ctx = qemu_get_current_aio_context();
 
     co = qemu_coroutine_create(blk_aio_zone_report_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
@@ -1940,14 +1945,14 @@ BlockAIOCB *blk_aio_zone_mgmt(BlockBackend *blk, BlockZoneOp op,
     };
     acb->bytes = len;
     acb->has_returned = false;
+    acb->ctx = qemu_get_current_aio_context();
 
     co = qemu_coroutine_create(blk_aio_zone_mgmt_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
 
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
@@ -1980,13 +1985,13 @@ BlockAIOCB *blk_aio_zone_append(BlockBackend *blk, int64_t *offset,
     };
     acb->bytes = (int64_t)(uintptr_t)offset;
     acb->has_returned = false;
+    acb->ctx = qemu_get_current_aio_context();
 
     co = qemu_coroutine_create(blk_aio_zone_append_entry, acb);
-    aio_co_enter(blk_get_aio_context(blk), co);
+    aio_co_enter(acb->ctx, co);
     acb->has_returned = true;
     if (acb->rwco.ret != NOT_DONE) {
-        replay_bh_schedule_oneshot_event(blk_get_aio_context(blk),
-                                         blk_aio_complete_bh, acb);
+        replay_bh_schedule_oneshot_event(acb->ctx, blk_aio_complete_bh, acb);
     }
 
     return &acb->common;
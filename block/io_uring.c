@@ -12,11 +12,15 @@
 #include <liburing.h>
 #include "block/aio.h"
 #include "qemu/queue.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "trace.h"
 
 /* Only used for assertions.  */
@@ -25,12 +29,40 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/*
+ * Registered files are indexed by their file descriptor, so only file
+ * descriptors below this limit can be registered.
+ */
+#define LURING_MAX_FIXED_FILES 1024
+
+/* Number of fixed buffer slots of each ring */
+#define LURING_MAX_FIXED_BUFS 4096
+
+/* The kernel does not accept fixed buffers larger than this */
+#define LURING_FIXED_BUF_MAX_SIZE (1 * GiB)
+
+/* Maximum number of host memory ranges registered with luring_register_buf */
+#define LURING_MAX_FIXED_RANGES 64
+
+/*
+ * A host memory range registered as fixed buffers.  The range is split
+ * into LURING_FIXED_BUF_MAX_SIZE chunks, which occupy consecutive slots
+ * starting at @first_slot in every ring.
+ */
+typedef struct LuringFixedRange {
+    void *host;
+    size_t size;
+    unsigned first_slot;
+    unsigned refcnt;
+} LuringFixedRange;
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
     bool is_read;
+    bool fixed_buf;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
     /*
@@ -57,8 +89,42 @@ typedef struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Fixed buffers and registered files, see luring_register_buf() */
+    QLIST_ENTRY(LuringState) next;
+    bool fixed_bufs_ok;
+    bool fixed_files_ok;
+
+    /* Protected by luring_fixed_lock */
+    bool fixed_range_ok[LURING_MAX_FIXED_RANGES];
+
+    /*
+     * Only accessed from AioContext home thread.  Copy of the ranges that
+     * are registered with this ring, refreshed by luring_sync_fixed().
+     */
+    LuringFixedRange fixed_ranges[LURING_MAX_FIXED_RANGES];
+    unsigned fixed_gen;
+    DECLARE_BITMAP(fixed_files, LURING_MAX_FIXED_FILES);
 } LuringState;
 
+/*
+ * Fixed buffers are registered in every ring, so that requests can use
+ * them regardless of the thread they are submitted from.  The ranges
+ * and the list of rings are protected by luring_fixed_lock; each ring
+ * picks up changes in its own thread when luring_fixed_gen changes.
+ */
+static QemuMutex luring_fixed_lock;
+static QLIST_HEAD(, LuringState) luring_states =
+    QLIST_HEAD_INITIALIZER(luring_states);
+static LuringFixedRange luring_fixed_ranges[LURING_MAX_FIXED_RANGES];
+static DECLARE_BITMAP(luring_fixed_slots, LURING_MAX_FIXED_BUFS);
+static unsigned luring_fixed_gen;
+
+static void __attribute__((constructor)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed_lock);
+}
+
 /**
  * luring_resubmit:
  *
@@ -71,6 +137,33 @@ static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
     s->io_q.in_queue++;
 }
 
+/**
+ * luring_unfix_buf:
+ *
+ * Turn a request using a fixed buffer into a vectored request on the same
+ * file and offset.
+ */
+static void luring_unfix_buf(LuringAIOCB *luringcb)
+{
+    struct io_uring_sqe *sqes = &luringcb->sqeq;
+    uint8_t flags = sqes->flags;
+
+    if (!luringcb->fixed_buf) {
+        return;
+    }
+
+    if (luringcb->is_read) {
+        io_uring_prep_readv(sqes, sqes->fd, luringcb->qiov->iov,
+                            luringcb->qiov->niov, sqes->off);
+    } else {
+        io_uring_prep_writev(sqes, sqes->fd, luringcb->qiov->iov,
+                             luringcb->qiov->niov, sqes->off);
+    }
+    sqes->flags = flags;
+    io_uring_sqe_set_data(sqes, luringcb);
+    luringcb->fixed_buf = false;
+}
+
 /**
  * luring_resubmit_short_read:
  *
@@ -85,6 +178,9 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     trace_luring_resubmit_short_read(s, luringcb, nread);
 
+    /* The rest is read with a vectored request */
+    luring_unfix_buf(luringcb);
+
     /* Update read position */
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
@@ -180,6 +276,16 @@ static void luring_process_completions(LuringState *s)
                 luring_resubmit(s, luringcb);
                 continue;
             }
+
+            /*
+             * The fixed buffer was unregistered after the request was
+             * prepared; this only happens while guest RAM is going away.
+             */
+            if (ret == -EFAULT && luringcb->fixed_buf) {
+                luring_unfix_buf(luringcb);
+                luring_resubmit(s, luringcb);
+                continue;
+            }
         } else if (!luringcb->qiov) {
             goto end;
         } else if (total_bytes == luringcb->qiov->size) {
@@ -316,6 +422,344 @@ static void luring_unplug_fn(void *opaque)
     }
 }
 
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+/* Register (@add) or unregister the chunks of @r in the ring of @s */
+static bool luring_update_bufs(LuringState *s, const LuringFixedRange *r,
+                               bool add)
+{
+    unsigned nr = DIV_ROUND_UP(r->size, LURING_FIXED_BUF_MAX_SIZE);
+    g_autofree struct iovec *iov = g_new0(struct iovec, nr);
+    unsigned i;
+    int ret;
+
+    for (i = 0; add && i < nr; i++) {
+        size_t offset = (size_t)i * LURING_FIXED_BUF_MAX_SIZE;
+
+        iov[i].iov_base = r->host + offset;
+        iov[i].iov_len = MIN(r->size - offset, LURING_FIXED_BUF_MAX_SIZE);
+    }
+
+    ret = io_uring_register_buffers_update_tag(&s->ring, r->first_slot, iov,
+                                               NULL, nr);
+    trace_luring_update_bufs(s, r->host, r->size, add, ret);
+    return ret == nr;
+}
+
+/**
+ * luring_register_buf:
+ * @host: start of the host memory range
+ * @size: length of the host memory range
+ *
+ * Register a host memory range as fixed buffers in every io_uring ring,
+ * current and future.  Requests whose buffer is fully inside a registered
+ * range skip page pinning in the kernel.  Registering the same range more
+ * than once only takes a reference.
+ *
+ * The kernel keeps the pages pinned, so RAM discards are disabled while any
+ * range is registered.  Returns false if that is not possible.  Running out
+ * of slots is not fatal, requests on the range just keep using ordinary
+ * iovecs.
+ */
+bool luring_register_buf(void *host, size_t size, Error **errp)
+{
+    unsigned nr = DIV_ROUND_UP(size, LURING_FIXED_BUF_MAX_SIZE);
+    LuringFixedRange *r = NULL;
+    LuringState *s;
+    unsigned long slot;
+    int i, ret;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    for (i = 0; i < LURING_MAX_FIXED_RANGES; i++) {
+        LuringFixedRange *cur = &luring_fixed_ranges[i];
+
+        if (cur->refcnt && cur->host == host && cur->size == size) {
+            cur->refcnt++;
+            return true;
+        }
+        if (!cur->refcnt && !r) {
+            r = cur;
+        }
+    }
+
+    slot = bitmap_find_next_zero_area(luring_fixed_slots,
+                                      LURING_MAX_FIXED_BUFS, 0, nr, 0);
+    if (!r || slot >= LURING_MAX_FIXED_BUFS) {
+        trace_luring_register_buf_full(host, size);
+        return true;
+    }
+
+    ret = ram_block_discard_disable(true);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+        return false;
+    }
+    bitmap_set(luring_fixed_slots, slot, nr);
+
+    *r = (LuringFixedRange) {
+        .host = host,
+        .size = size,
+        .first_slot = slot,
+        .refcnt = 1,
+    };
+    i = r - luring_fixed_ranges;
+    QLIST_FOREACH(s, &luring_states, next) {
+        s->fixed_range_ok[i] = s->fixed_bufs_ok &&
+                               luring_update_bufs(s, r, true);
+    }
+    qatomic_inc(&luring_fixed_gen);
+    return true;
+}
+
+/**
+ * luring_unregister_buf:
+ * @host: start of the host memory range
+ * @size: length of the host memory range
+ *
+ * Drop a reference taken by luring_register_buf() and unregister the range
+ * from every ring when the last one goes away.
+ */
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringState *s;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    for (i = 0; i < LURING_MAX_FIXED_RANGES; i++) {
+        LuringFixedRange *r = &luring_fixed_ranges[i];
+
+        if (!r->refcnt || r->host != host || r->size != size) {
+            continue;
+        }
+        if (--r->refcnt) {
+            return;
+        }
+
+        QLIST_FOREACH(s, &luring_states, next) {
+            if (s->fixed_range_ok[i]) {
+                luring_update_bufs(s, r, false);
+                s->fixed_range_ok[i] = false;
+            }
+        }
+        bitmap_clear(luring_fixed_slots, r->first_slot,
+                     DIV_ROUND_UP(r->size, LURING_FIXED_BUF_MAX_SIZE));
+        *r = (LuringFixedRange) {};
+        qatomic_inc(&luring_fixed_gen);
+        ram_block_discard_disable(false);
+        return;
+    }
+}
+
+typedef struct {
+    LuringState *s;
+    int fd;
+    unsigned *pending;
+} LuringUnregisterFile;
+
+/* Context: BH in the AioContext of the ring */
+static void luring_unregister_file_bh(void *opaque)
+{
+    LuringUnregisterFile *data = opaque;
+    LuringState *s = data->s;
+    int fd = -1;
+
+    if (test_and_clear_bit(data->fd, s->fixed_files)) {
+        io_uring_register_files_update(&s->ring, data->fd, &fd, 1);
+        trace_luring_unregister_file(s, data->fd);
+    }
+
+    qatomic_dec(data->pending);
+    aio_wait_kick();
+    g_free(data);
+}
+
+/**
+ * luring_unregister_file:
+ * @bs: the BlockDriverState that owns @fd
+ * @fd: file descriptor that is about to be closed
+ *
+ * Must be called before closing a file descriptor that was passed to
+ * luring_co_submit().  Every ring drops the registered file in its own
+ * AioContext before this returns, so that the file (and the locks held
+ * on it) goes away with the descriptor and no ring uses it once the
+ * descriptor number is reused.  The caller must hold the AioContext lock
+ * of @bs and ensure that there are no requests in flight on @fd.
+ */
+void luring_unregister_file(BlockDriverState *bs, int fd)
+{
+    unsigned pending = 0;
+    LuringState *s;
+
+    if (fd < 0 || fd >= LURING_MAX_FIXED_FILES) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_fixed_lock) {
+        QLIST_FOREACH(s, &luring_states, next) {
+            LuringUnregisterFile *data;
+
+            if (!s->fixed_files_ok) {
+                continue;
+            }
+
+            data = g_new(LuringUnregisterFile, 1);
+            *data = (LuringUnregisterFile) {
+                .s = s,
+                .fd = fd,
+                .pending = &pending,
+            };
+            qatomic_inc(&pending);
+            aio_bh_schedule_oneshot(s->aio_context,
+                                    luring_unregister_file_bh, data);
+        }
+    }
+
+    AIO_WAIT_WHILE(bdrv_get_aio_context(bs), qatomic_read(&pending));
+}
+
+/*
+ * Pick up changes to the fixed buffers.  Prepared but not yet submitted sqes
+ * may refer to the old ones, so this is only done when the submit queue is
+ * empty.
+ */
+static void luring_sync_fixed(LuringState *s)
+{
+    int i;
+
+    if (s->io_q.in_queue) {
+        return;
+    }
+
+    if (s->fixed_gen != qatomic_read(&luring_fixed_gen)) {
+        QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+        for (i = 0; i < LURING_MAX_FIXED_RANGES; i++) {
+            if (s->fixed_range_ok[i]) {
+                s->fixed_ranges[i] = luring_fixed_ranges[i];
+            } else {
+                s->fixed_ranges[i] = (LuringFixedRange) {};
+            }
+        }
+        s->fixed_gen = luring_fixed_gen;
+    }
+}
+
+/* Return the fixed buffer slot that covers @qiov, or -1 */
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    void *base;
+    size_t len;
+    int i;
+
+    if (!s->fixed_bufs_ok || qiov->niov != 1) {
+        return -1;
+    }
+
+    base = qiov->iov[0].iov_base;
+    len = qiov->iov[0].iov_len;
+    for (i = 0; i < LURING_MAX_FIXED_RANGES; i++) {
+        LuringFixedRange *r = &s->fixed_ranges[i];
+        size_t offset;
+
+        if (!r->size || base < r->host || base >= r->host + r->size) {
+            continue;
+        }
+
+        offset = base - r->host;
+        if (len > r->size - offset ||
+            offset / LURING_FIXED_BUF_MAX_SIZE !=
+            (offset + len - 1) / LURING_FIXED_BUF_MAX_SIZE) {
+            return -1;
+        }
+        return r->first_slot + offset / LURING_FIXED_BUF_MAX_SIZE;
+    }
+    return -1;
+}
+
+/* Whether @fd is (or could be made) a registered file of the ring */
+static bool luring_fixed_file(LuringState *s, int fd)
+{
+    int ret;
+
+    if (!s->fixed_files_ok || fd < 0 || fd >= LURING_MAX_FIXED_FILES) {
+        return false;
+    }
+
+    if (!test_bit(fd, s->fixed_files)) {
+        ret = io_uring_register_files_update(&s->ring, fd, &fd, 1);
+        trace_luring_register_file(s, fd, ret);
+        if (ret != 1) {
+            return false;
+        }
+        set_bit(fd, s->fixed_files);
+    }
+    return true;
+}
+
+static void luring_init_fixed(LuringState *s)
+{
+    int i;
+
+    s->fixed_bufs_ok =
+        !io_uring_register_buffers_sparse(&s->ring, LURING_MAX_FIXED_BUFS);
+    s->fixed_files_ok =
+        !io_uring_register_files_sparse(&s->ring, LURING_MAX_FIXED_FILES);
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+    for (i = 0; i < LURING_MAX_FIXED_RANGES; i++) {
+        LuringFixedRange *r = &luring_fixed_ranges[i];
+
+        s->fixed_range_ok[i] = r->refcnt && s->fixed_bufs_ok &&
+                               luring_update_bufs(s, r, true);
+    }
+    /* Force luring_sync_fixed() to copy the ranges */
+    s->fixed_gen = luring_fixed_gen - 1;
+    QLIST_INSERT_HEAD(&luring_states, s, next);
+}
+
+static void luring_cleanup_fixed(LuringState *s)
+{
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+    QLIST_REMOVE(s, next);
+}
+#else
+bool luring_register_buf(void *host, size_t size, Error **errp)
+{
+    return true;
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+}
+
+void luring_unregister_file(BlockDriverState *bs, int fd)
+{
+}
+
+static void luring_sync_fixed(LuringState *s)
+{
+}
+
+static int luring_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    return -1;
+}
+
+static bool luring_fixed_file(LuringState *s, int fd)
+{
+    return false;
+}
+
+static void luring_init_fixed(LuringState *s)
+{
+}
+
+static void luring_cleanup_fixed(LuringState *s)
+{
+}
+#endif
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
@@ -331,20 +775,40 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
     int ret;
+    int buf_index = -1;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
 
+    luring_sync_fixed(s);
+
+    if (type == QEMU_AIO_WRITE || type == QEMU_AIO_READ) {
+        buf_index = luring_fixed_buf(s, luringcb->qiov);
+        luringcb->fixed_buf = buf_index >= 0;
+    }
+
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (luringcb->fixed_buf) {
+            io_uring_prep_write_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                      luringcb->qiov->iov[0].iov_len, offset,
+                                      buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_ZONE_APPEND:
         io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
                              luringcb->qiov->niov, offset);
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (luringcb->fixed_buf) {
+            io_uring_prep_read_fixed(sqes, fd, luringcb->qiov->iov[0].iov_base,
+                                     luringcb->qiov->iov[0].iov_len, offset,
+                                     buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -354,6 +818,10 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (luring_fixed_file(s, fd)) {
+        /* Registered files are indexed by their file descriptor */
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -431,12 +899,14 @@ LuringState *luring_init(Error **errp)
     }
 
     ioq_init(&s->io_q);
+    luring_init_fixed(s);
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    luring_cleanup_fixed(s);
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
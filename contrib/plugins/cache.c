@@ -113,6 +113,17 @@ static uint64_t l1_dmisses;
 static uint64_t l2_mem_accesses;
 static uint64_t l2_misses;
 
+/*
+ * With do_inline, an instruction fetched from the same icache block as
+ * the previous instruction of its TB is assumed to hit, as that fetch
+ * left the block in the cache. Rather than calling back into the
+ * simulator we only count those hits inline, per vCPU, and add them to
+ * the accesses at exit. This is an approximation: the block may have
+ * been evicted in between by another vCPU sharing the cache.
+ */
+static bool do_inline;
+static struct qemu_plugin_scoreboard *implicit_ihits;
+
 static int pow_of_two(int num)
 {
     g_assert((num & (num - 1)) == 0);
@@ -467,6 +478,8 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     size_t n_insns;
     size_t i;
     InsnData *data;
+    int iblksize_shift = l1_icaches[0]->blksize_shift;
+    uint64_t prev_iblk = 0;
 
     n_insns = qemu_plugin_tb_n_insns(tb);
     for (i = 0; i < n_insns; i++) {
@@ -500,8 +513,27 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                          QEMU_PLUGIN_CB_NO_REGS,
                                          rw, data);
 
-        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                               QEMU_PLUGIN_CB_NO_REGS, data);
+        if (do_inline && i > 0 &&
+            effective_addr >> iblksize_shift == prev_iblk) {
+            qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+                insn, QEMU_PLUGIN_INLINE_ADD_U64,
+                qemu_plugin_scoreboard_u64(implicit_ihits), 1);
+        } else {
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                                   QEMU_PLUGIN_CB_NO_REGS,
+                                                   data);
+        }
+        prev_iblk = effective_addr >> iblksize_shift;
+    }
+}
+
+static void sum_implicit_ihits(void)
+{
+    qemu_plugin_u64 hits = qemu_plugin_scoreboard_u64(implicit_ihits);
+    int i;
+
+    for (i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        l1_icaches[i % cores]->accesses += qemu_plugin_u64_get(hits, i);
     }
 }
 
@@ -703,6 +735,11 @@ finish:
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    if (do_inline) {
+        sum_implicit_ihits();
+        qemu_plugin_scoreboard_free(implicit_ihits);
+    }
+
     log_stats();
     log_top_insns();
 
@@ -804,6 +841,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "inline") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_inline)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -847,6 +889,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
+    if (do_inline) {
+        implicit_ihits = qemu_plugin_scoreboard_new(sizeof(uint64_t));
+    }
+
     l1_dcache_locks = g_new0(GMutex, cores);
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
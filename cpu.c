@@ -145,6 +145,10 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_exec_realizefn(cpu, errp);
     }
 
+#ifndef CONFIG_USER_ONLY
+    cpu->qom_path = object_get_canonical_path(OBJECT(cpu));
+#endif
+
     /* Wait until cpu initialization complete before exposing cpu. */
     cpu_list_add(cpu);
 
@@ -185,6 +189,8 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     }
 
     cpu_list_remove(cpu);
+    g_free(cpu->qom_path);
+    cpu->qom_path = NULL;
     /*
      * Now that the vCPU has been removed from the RCU list, we can call
      * tcg_exec_unrealizefn, which may free fields using call_rcu.
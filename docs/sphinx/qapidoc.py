@@ -338,7 +338,7 @@ def visit_alternate_type(self, name, info, ifcond, features, variants):
 
     def visit_command(self, name, info, ifcond, features, arg_type,
                       ret_type, gen, success_response, boxed, allow_oob,
-                      allow_preconfig, coroutine):
+                      allow_preconfig, coroutine, no_bql):
         doc = self._cur_doc
         self._add_doc('Command',
                       self._nodes_for_arguments(doc,
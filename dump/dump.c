@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "elf.h"
 #include "qemu/bswap.h"
 #include "exec/target_page.h"
@@ -38,6 +39,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -979,6 +983,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1090,6 +1099,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1442,179 +1456,432 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
 
-static void write_dump_pages(DumpState *s, Error **errp)
+/*
+ * Pages are compressed in batches of about DUMP_BATCH_SIZE bytes by up to
+ * DUMP_MAX_COMPRESS_THREADS worker threads.  The dump thread keeps two
+ * batches per worker in flight, and writes them out in order as soon as
+ * they are compressed, so that the layout of the file is the same as if
+ * the pages had been compressed one by one.
+ */
+#define DUMP_BATCH_SIZE             (256 * KiB)
+#define DUMP_MAX_COMPRESS_THREADS   16
+
+typedef enum DumpPageKind {
+    DUMP_PAGE_DATA,
+    DUMP_PAGE_ZERO,
+    DUMP_PAGE_SAME,     /* same contents as the previous page */
+} DumpPageKind;
+
+typedef struct DumpPage {
+    uint8_t *data;      /* contents of the page */
+    DumpPageKind kind;
+    uint8_t *out;       /* data to write, either compressed or @data */
+    uint32_t size;      /* size of @out */
+    uint32_t flags;     /* compression format of @out, 0 for plaintext */
+} DumpPage;
+
+typedef struct DumpBatch {
+    QSIMPLEQ_ENTRY(DumpBatch) next;
+    bool done;          /* protected by DumpPageWriter.lock */
+    unsigned int n_pages;
+    uint8_t *copy;      /* pages that are not contiguous in host memory */
+    uint8_t *out;       /* compressed pages, len_buf_out bytes each */
+    DumpPage pages[];
+} DumpBatch;
+
+typedef struct DumpPageWriter DumpPageWriter;
+
+/* Per-thread compression state */
+typedef struct DumpCompressContext {
+    DumpPageWriter *w;
+    QemuThread thread;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+} DumpCompressContext;
+
+struct DumpPageWriter {
+    DumpState *s;
+    size_t len_buf_out;
+    unsigned int batch_pages;
+
+    /* ring of batches, in the order they are written */
+    DumpBatch **batches;
+    unsigned int n_batches;
+    unsigned int head;
+    unsigned int in_flight;
+
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    QSIMPLEQ_HEAD(, DumpBatch) queue;
+    bool quit;
+    unsigned int n_threads;
+    DumpCompressContext *contexts;
+
+    /* only accessed by the dump thread */
+    DataCache page_desc;
+    DataCache page_data;
+    off_t offset_data;
+    PageDescriptor pd_zero;
+    PageDescriptor pd;
+};
+
+static void dump_compress_page(DumpPageWriter *w, DumpCompressContext *ctx,
+                               DumpPage *p, const uint8_t *prev,
+                               uint8_t *buf_out)
+{
+    DumpState *s = w->s;
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = w->len_buf_out;
+    bool ok = false;
+
+    if (buffer_is_zero(p->data, page_size)) {
+        p->kind = DUMP_PAGE_ZERO;
+        return;
+    }
+    if (prev && !memcmp(prev, p->data, page_size)) {
+        p->kind = DUMP_PAGE_SAME;
+        return;
+    }
+
+    /*
+     * only one compression format will be used here, for
+     * s->flag_compress is set. But when compression fails to work,
+     * we fall back to save in plaintext.
+     */
+    switch (s->flag_compress) {
+    case DUMP_DH_COMPRESSED_ZLIB:
+        ok = compress2(buf_out, (uLongf *)&size_out, p->data, page_size,
+                       Z_BEST_SPEED) == Z_OK;
+        break;
+#ifdef CONFIG_LZO
+    case DUMP_DH_COMPRESSED_LZO:
+        ok = lzo1x_1_compress(p->data, page_size, buf_out,
+                              (lzo_uint *)&size_out, ctx->wrkmem) == LZO_E_OK;
+        break;
+#endif
+#ifdef CONFIG_SNAPPY
+    case DUMP_DH_COMPRESSED_SNAPPY:
+        ok = snappy_compress((char *)p->data, page_size, (char *)buf_out,
+                             &size_out) == SNAPPY_OK;
+        break;
+#endif
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        size_out = ZSTD_compressCCtx(ctx->zstd, buf_out, size_out, p->data,
+                                     page_size, 1);
+        ok = !ZSTD_isError(size_out);
+        break;
+#endif
+    }
+
+    p->kind = DUMP_PAGE_DATA;
+    if (ok && size_out < page_size) {
+        p->flags = s->flag_compress;
+        p->out = buf_out;
+        p->size = size_out;
+    } else {
+        p->flags = 0;
+        p->out = p->data;
+        p->size = page_size;
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
 {
-    int ret = 0;
-    DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
+    DumpCompressContext *ctx = opaque;
+    DumpPageWriter *w = ctx->w;
+
+    qemu_mutex_lock(&w->lock);
+    for (;;) {
+        DumpBatch *b;
+
+        while (QSIMPLEQ_EMPTY(&w->queue) && !w->quit) {
+            qemu_cond_wait(&w->work_cond, &w->lock);
+        }
+        if (QSIMPLEQ_EMPTY(&w->queue)) {
+            break;
+        }
+        b = QSIMPLEQ_FIRST(&w->queue);
+        QSIMPLEQ_REMOVE_HEAD(&w->queue, next);
+        qemu_mutex_unlock(&w->lock);
+
+        for (unsigned int i = 0; i < b->n_pages; i++) {
+            dump_compress_page(w, ctx, &b->pages[i],
+                               i ? b->pages[i - 1].data : NULL,
+                               b->out + i * w->len_buf_out);
+        }
+
+        qemu_mutex_lock(&w->lock);
+        b->done = true;
+        qemu_cond_signal(&w->done_cond);
+    }
+    qemu_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static bool dump_page_writer_start(DumpPageWriter *w, DumpState *s,
+                                   Error **errp)
+{
+    size_t page_size = s->dump_info.page_size;
+    unsigned int i;
+
+    w->s = s;
+    w->len_buf_out = get_len_buf_out(page_size, s->flag_compress);
+    assert(w->len_buf_out != 0);
+    w->batch_pages = MAX(DUMP_BATCH_SIZE / page_size, 1);
+    w->n_threads = MIN(MAX(g_get_num_processors(), 1),
+                       DUMP_MAX_COMPRESS_THREADS);
+
+    w->contexts = g_new0(DumpCompressContext, w->n_threads);
+    for (i = 0; i < w->n_threads; i++) {
+        w->contexts[i].w = w;
 #ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
+        w->contexts[i].wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
 #endif
-    uint8_t *buf_out = NULL;
-    off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
-    uint8_t *buf;
-    GuestPhysBlock *block_iter = NULL;
-    uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+#ifdef CONFIG_ZSTD
+        if (s->flag_compress == DUMP_DH_COMPRESSED_ZSTD) {
+            w->contexts[i].zstd = ZSTD_createCCtx();
+            if (!w->contexts[i].zstd) {
+                error_setg(errp, "dump: failed to create zstd context");
+                return false;
+            }
+        }
+#endif
+    }
 
-    /* get offset of page_desc and page_data in dump file */
-    offset_desc = s->offset_page;
-    offset_data = offset_desc + sizeof(PageDescriptor) * s->num_dumpable;
+    w->n_batches = 2 * w->n_threads;
+    w->batches = g_new0(DumpBatch *, w->n_batches);
+    for (i = 0; i < w->n_batches; i++) {
+        DumpBatch *b = g_malloc0(sizeof(DumpBatch) +
+                                 w->batch_pages * sizeof(DumpPage));
+
+        b->copy = g_malloc(w->batch_pages * page_size);
+        b->out = g_malloc(w->batch_pages * w->len_buf_out);
+        w->batches[i] = b;
+    }
+
+    qemu_mutex_init(&w->lock);
+    qemu_cond_init(&w->work_cond);
+    qemu_cond_init(&w->done_cond);
+    QSIMPLEQ_INIT(&w->queue);
+    for (i = 0; i < w->n_threads; i++) {
+        qemu_thread_create(&w->contexts[i].thread, "dump-compress",
+                           dump_compress_thread, &w->contexts[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    return true;
+}
 
-    prepare_data_cache(&page_desc, s, offset_desc);
-    prepare_data_cache(&page_data, s, offset_data);
+static void dump_page_writer_stop(DumpPageWriter *w)
+{
+    unsigned int i;
 
-    /* prepare buffer to store compressed data */
-    len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
-    assert(len_buf_out != 0);
+    if (w->batches) {
+        /* drop the batches that nobody has picked up yet */
+        qemu_mutex_lock(&w->lock);
+        QSIMPLEQ_INIT(&w->queue);
+        w->quit = true;
+        qemu_cond_broadcast(&w->work_cond);
+        qemu_mutex_unlock(&w->lock);
+
+        for (i = 0; i < w->n_threads; i++) {
+            qemu_thread_join(&w->contexts[i].thread);
+        }
 
+        qemu_cond_destroy(&w->done_cond);
+        qemu_cond_destroy(&w->work_cond);
+        qemu_mutex_destroy(&w->lock);
+
+        for (i = 0; i < w->n_batches; i++) {
+            g_free(w->batches[i]->copy);
+            g_free(w->batches[i]->out);
+            g_free(w->batches[i]);
+        }
+        g_free(w->batches);
+    }
+
+    for (i = 0; w->contexts && i < w->n_threads; i++) {
 #ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+        g_free(w->contexts[i].wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+        ZSTD_freeCCtx(w->contexts[i].zstd);
 #endif
+    }
+    g_free(w->contexts);
+}
+
+static void dump_page_writer_submit(DumpPageWriter *w, DumpBatch *b)
+{
+    qemu_mutex_lock(&w->lock);
+    b->done = false;
+    QSIMPLEQ_INSERT_TAIL(&w->queue, b, next);
+    qemu_cond_signal(&w->work_cond);
+    qemu_mutex_unlock(&w->lock);
+    w->in_flight++;
+}
+
+/* Wait for the oldest batch in flight and write it to the file */
+static bool dump_page_writer_flush_one(DumpPageWriter *w, Error **errp)
+{
+    DumpState *s = w->s;
+    DumpBatch *b = w->batches[w->head];
+    int ret;
+
+    qemu_mutex_lock(&w->lock);
+    while (!b->done) {
+        qemu_cond_wait(&w->done_cond, &w->lock);
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    w->head = (w->head + 1) % w->n_batches;
+    w->in_flight--;
+
+    for (unsigned int i = 0; i < b->n_pages; i++) {
+        DumpPage *p = &b->pages[i];
+
+        switch (p->kind) {
+        case DUMP_PAGE_ZERO:
+            ret = write_cache(&w->page_desc, &w->pd_zero,
+                              sizeof(PageDescriptor), false);
+            break;
+        case DUMP_PAGE_SAME:
+            /* point to the data of the previous page */
+            ret = write_cache(&w->page_desc, &w->pd,
+                              sizeof(PageDescriptor), false);
+            break;
+        case DUMP_PAGE_DATA:
+            ret = write_cache(&w->page_data, p->out, p->size, false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                return false;
+            }
 
-    buf_out = g_malloc(len_buf_out);
+            w->pd.flags = cpu_to_dump32(s, p->flags);
+            w->pd.size = cpu_to_dump32(s, p->size);
+            w->pd.page_flags = cpu_to_dump64(s, 0);
+            w->pd.offset = cpu_to_dump64(s, w->offset_data);
+            w->offset_data += p->size;
+
+            ret = write_cache(&w->page_desc, &w->pd, sizeof(PageDescriptor),
+                              false);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write page desc");
+            return false;
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+    return true;
+}
+
+static void write_dump_pages(DumpState *s, Error **errp)
+{
+    DumpPageWriter w = {};
+    DumpBatch *b = NULL;
+    uint32_t page_size = s->dump_info.page_size;
+    off_t offset_desc;
+    uint8_t *buf;
+    GuestPhysBlock *block_iter = NULL;
+    uint64_t pfn_iter;
+    int ret;
+
+    /* get offset of page_desc and page_data in dump file */
+    offset_desc = s->offset_page;
+    w.offset_data = offset_desc + sizeof(PageDescriptor) * s->num_dumpable;
+
+    prepare_data_cache(&w.page_desc, s, offset_desc);
+    prepare_data_cache(&w.page_data, s, w.offset_data);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
      * uses the same page_data
      */
-    pd_zero.size = cpu_to_dump32(s, s->dump_info.page_size);
-    pd_zero.flags = cpu_to_dump32(s, 0);
-    pd_zero.offset = cpu_to_dump64(s, offset_data);
-    pd_zero.page_flags = cpu_to_dump64(s, 0);
-    buf = g_malloc0(s->dump_info.page_size);
-    ret = write_cache(&page_data, buf, s->dump_info.page_size, false);
+    w.pd_zero.size = cpu_to_dump32(s, page_size);
+    w.pd_zero.flags = cpu_to_dump32(s, 0);
+    w.pd_zero.offset = cpu_to_dump64(s, w.offset_data);
+    w.pd_zero.page_flags = cpu_to_dump64(s, 0);
+    buf = g_malloc0(page_size);
+    ret = write_cache(&w.page_data, buf, page_size, false);
     g_free(buf);
     if (ret < 0) {
         error_setg(errp, "dump: failed to write page data (zero page)");
         goto out;
     }
 
-    offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
+    w.offset_data += page_size;
+
+    if (!dump_page_writer_start(&w, s, errp)) {
+        goto out;
+    }
 
     /*
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
+    for (;;) {
+        if (!b) {
+            if (w.in_flight == w.n_batches &&
+                !dump_page_writer_flush_one(&w, errp)) {
                 goto out;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
+            b = w.batches[(w.head + w.in_flight) % w.n_batches];
+            b->n_pages = 0;
+        }
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+        buf = b->copy + b->n_pages * page_size;
+        if (!get_next_page(&block_iter, &pfn_iter, &buf, s)) {
+            break;
+        }
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
+        b->pages[b->n_pages++].data = buf;
+        if (b->n_pages == w.batch_pages) {
+            dump_page_writer_submit(&w, b);
+            b = NULL;
+        }
+    }
+    if (b && b->n_pages) {
+        dump_page_writer_submit(&w, b);
+    }
+
+    while (w.in_flight) {
+        if (!dump_page_writer_flush_one(&w, errp)) {
+            goto out;
         }
-        s->written_size += s->dump_info.page_size;
     }
 
-    ret = write_cache(&page_desc, NULL, 0, true);
+    ret = write_cache(&w.page_desc, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_desc");
         goto out;
     }
-    ret = write_cache(&page_data, NULL, 0, true);
+    ret = write_cache(&w.page_data, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_data");
         goto out;
     }
 
 out:
-    free_data_cache(&page_desc);
-    free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
+    dump_page_writer_stop(&w);
+    free_data_cache(&w.page_desc);
+    free_data_cache(&w.page_data);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1946,6 +2213,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -2107,7 +2378,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
         detach_p = detach;
     }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -2122,6 +2393,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP
         && !win_dump_available(errp)) {
         return;
@@ -2207,6 +2485,11 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+#endif
+
     if (win_dump_available(NULL)) {
         QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
     }
@@ -14,6 +14,8 @@
 #include "qemu/osdep.h"
 #include "qom/object_interfaces.h"
 #include "qapi/error.h"
+#include "qapi/qapi-builtin-visit.h"
+#include "qemu/bitmap.h"
 #include "block/thread-pool.h"
 #include "sysemu/event-loop-base.h"
 
@@ -77,6 +79,65 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
     return;
 }
 
+static void event_loop_base_get_affinity(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+    uint16List *host_cpus = NULL;
+    uint16List **tail = &host_cpus;
+    unsigned long value;
+
+    value = find_first_bit(base->thread_pool_affinity,
+                           base->thread_pool_affinity_nbits);
+    while (value < base->thread_pool_affinity_nbits) {
+        QAPI_LIST_APPEND(tail, value);
+        value = find_next_bit(base->thread_pool_affinity,
+                              base->thread_pool_affinity_nbits, value + 1);
+    }
+
+    visit_type_uint16List(v, name, &host_cpus, errp);
+    qapi_free_uint16List(host_cpus);
+}
+
+static void event_loop_base_set_affinity(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(obj);
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+    uint16List *l, *host_cpus = NULL;
+    unsigned long nbits = 0;
+
+    if (!visit_type_uint16List(v, name, &host_cpus, errp)) {
+        return;
+    }
+
+    for (l = host_cpus; l; l = l->next) {
+        nbits = MAX(nbits, l->value + 1);
+    }
+
+    g_free(base->thread_pool_affinity);
+    base->thread_pool_affinity = NULL;
+    base->thread_pool_affinity_nbits = nbits;
+    if (nbits) {
+        base->thread_pool_affinity = bitmap_new(nbits);
+        for (l = host_cpus; l; l = l->next) {
+            set_bit(l->value, base->thread_pool_affinity);
+        }
+    }
+    qapi_free_uint16List(host_cpus);
+
+    if (bc->update_params) {
+        bc->update_params(base, errp);
+    }
+}
+
+static void event_loop_base_instance_finalize(Object *obj)
+{
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    g_free(base->thread_pool_affinity);
+}
+
 static void event_loop_base_complete(UserCreatable *uc, Error **errp)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(uc);
@@ -117,6 +178,10 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &thread_pool_max_info);
+    object_class_property_add(klass, "thread-pool-affinity", "int",
+                              event_loop_base_get_affinity,
+                              event_loop_base_set_affinity,
+                              NULL, NULL);
 }
 
 static const TypeInfo event_loop_base_info = {
@@ -124,6 +189,7 @@ static const TypeInfo event_loop_base_info = {
     .parent = TYPE_OBJECT,
     .instance_size = sizeof(EventLoopBase),
     .instance_init = event_loop_base_instance_init,
+    .instance_finalize = event_loop_base_instance_finalize,
     .class_size = sizeof(EventLoopBaseClass),
     .class_init = event_loop_base_class_init,
     .abstract = true,
@@ -94,6 +94,7 @@ typedef struct FsDriverEntry {
     FsThrottle fst;
     mode_t fmode;
     mode_t dmode;
+    uint64_t path_cache_ttl;
 } FsDriverEntry;
 
 struct FsContext {
@@ -107,6 +108,8 @@ struct FsContext {
     void *private;
     mode_t fmode;
     mode_t dmode;
+    /* milliseconds the local backend caches resolved directories for */
+    uint64_t path_cache_ttl;
 };
 
 struct V9fsPath {
@@ -59,6 +59,7 @@ static FsDriverTable FsDrivers[] = {
             "fmode",
             "dmode",
             "multidevs",
+            "path_cache_ttl",
             "throttling.bps-total",
             "throttling.bps-read",
             "throttling.bps-write",
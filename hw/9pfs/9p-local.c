@@ -31,6 +31,8 @@
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/lockable.h"
+#include "qemu/timer.h"
 #include <libgen.h>
 #ifdef CONFIG_LINUX
 #include <linux/fs.h>
@@ -53,15 +55,179 @@
 #define BTRFS_SUPER_MAGIC 0x9123683E
 #endif
 
+/*
+ * Resolving a path opens each of its components in turn, so that symbolic
+ * links are never followed. For deep trees this means a long chain of
+ * openat() calls for every request. With the path_cache_ttl option, the
+ * directories opened on the way are kept open for that many milliseconds
+ * and later lookups start from the deepest cached one.
+ *
+ * Renames and removals done through 9p drop the affected entries. Changes
+ * made directly on the host are only seen once the entries expire.
+ *
+ * A walk that runs concurrently with a rename may have opened a directory
+ * under its old name, so each invalidation bumps a generation count and
+ * walks only add entries if it did not change since they started.
+ */
+#define LOCAL_PATH_CACHE_MAX 256
+
+typedef struct LocalPathCacheEntry {
+    char *path;
+    int fd;
+    int64_t expires;
+    QTAILQ_ENTRY(LocalPathCacheEntry) next;
+} LocalPathCacheEntry;
+
 typedef struct {
     int mountfd;
+    /* directory path cache, NULL if disabled */
+    GHashTable *path_cache;
+    QTAILQ_HEAD(, LocalPathCacheEntry) path_cache_lru;
+    QemuMutex path_cache_lock;
+    int64_t path_cache_ttl;
+    uint64_t path_cache_gen;
 } LocalData;
 
+static void local_path_cache_drop(LocalData *data, LocalPathCacheEntry *e)
+{
+    g_hash_table_remove(data->path_cache, e->path);
+    QTAILQ_REMOVE(&data->path_cache_lru, e, next);
+    close(e->fd);
+    g_free(e->path);
+    g_free(e);
+}
+
+/* Returns a new file descriptor for directory @path if it is cached */
+static int local_path_cache_get(LocalData *data, const char *path)
+{
+    LocalPathCacheEntry *e;
+    int fd;
+
+    e = g_hash_table_lookup(data->path_cache, path);
+    if (!e) {
+        return -1;
+    }
+
+    if (get_clock() >= e->expires) {
+        local_path_cache_drop(data, e);
+        return -1;
+    }
+
+    fd = qemu_dup(e->fd);
+    if (fd != -1) {
+        QTAILQ_REMOVE(&data->path_cache_lru, e, next);
+        QTAILQ_INSERT_HEAD(&data->path_cache_lru, e, next);
+    }
+    return fd;
+}
+
+/*
+ * Adds directory @path, opened as @fd, to the cache, unless the cache was
+ * invalidated since generation @gen
+ */
+static void local_path_cache_put(LocalData *data, const char *path, int fd,
+                                 uint64_t gen)
+{
+    LocalPathCacheEntry *e;
+    int cached_fd;
+
+    QEMU_LOCK_GUARD(&data->path_cache_lock);
+
+    if (data->path_cache_gen != gen) {
+        return;
+    }
+    cached_fd = qemu_dup(fd);
+    if (cached_fd == -1) {
+        return;
+    }
+
+    e = g_hash_table_lookup(data->path_cache, path);
+    if (e) {
+        local_path_cache_drop(data, e);
+    } else if (g_hash_table_size(data->path_cache) >= LOCAL_PATH_CACHE_MAX) {
+        local_path_cache_drop(data, QTAILQ_LAST(&data->path_cache_lru));
+    }
+
+    e = g_new(LocalPathCacheEntry, 1);
+    e->path = g_strdup(path);
+    e->fd = cached_fd;
+    e->expires = get_clock() + data->path_cache_ttl;
+    QTAILQ_INSERT_HEAD(&data->path_cache_lru, e, next);
+    g_hash_table_insert(data->path_cache, e->path, e);
+}
+
+/*
+ * Looks up the deepest cached directory on the way to @path, not counting
+ * the rightmost path element. On success, advances @path to the remaining
+ * elements and returns a new file descriptor for the directory. @gen is
+ * set to the generation that the walk must pass to local_path_cache_put().
+ */
+static int local_path_cache_lookup(LocalData *data, const char **path,
+                                   uint64_t *gen)
+{
+    g_autofree char *dir = g_strdup(*path);
+    char *c;
+    int fd;
+
+    QEMU_LOCK_GUARD(&data->path_cache_lock);
+
+    *gen = data->path_cache_gen;
+    while ((c = strrchr(dir, '/'))) {
+        *c = 0;
+        fd = local_path_cache_get(data, dir);
+        if (fd != -1) {
+            *path += c - dir + 1;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+/* Drops @path and everything below it from the cache */
+static void local_path_cache_invalidate(FsContext *fs_ctx, const char *path)
+{
+    LocalData *data = fs_ctx->private;
+    LocalPathCacheEntry *e, *next_e;
+    size_t len = strlen(path);
+
+    if (!data->path_cache) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&data->path_cache_lock);
+
+    data->path_cache_gen++;
+    QTAILQ_FOREACH_SAFE(e, &data->path_cache_lru, next, next_e) {
+        if (!strncmp(e->path, path, len) &&
+            (e->path[len] == 0 || e->path[len] == '/')) {
+            local_path_cache_drop(data, e);
+        }
+    }
+}
+
+static void local_path_cache_invalidate_at(FsContext *fs_ctx,
+                                           V9fsPath *dir, const char *name)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir->data, name);
+
+    local_path_cache_invalidate(fs_ctx, path);
+}
+
 int local_open_nofollow(FsContext *fs_ctx, const char *path, int flags,
                         mode_t mode)
 {
     LocalData *data = fs_ctx->private;
+    const char *start = path;
     int fd = data->mountfd;
+    uint64_t gen = 0;
+
+    if (data->path_cache) {
+        int cached_fd = local_path_cache_lookup(data, &path, &gen);
+
+        if (cached_fd != -1) {
+            fd = cached_fd;
+        }
+    }
 
     while (*path && fd != -1) {
         const char *c;
@@ -78,6 +244,11 @@ int local_open_nofollow(FsContext *fs_ctx, const char *path, int flags,
             head[c - path] = 0;
             path = c + 1;
             next_fd = openat_dir(fd, head);
+            if (data->path_cache && next_fd != -1) {
+                g_autofree char *dir = g_strndup(start, c - start);
+
+                local_path_cache_put(data, dir, next_fd, gen);
+            }
         } else {
             /* Rightmost path element */
             next_fd = openat_file(fd, head, flags, mode);
@@ -94,9 +265,31 @@ int local_open_nofollow(FsContext *fs_ctx, const char *path, int flags,
     return fd;
 }
 
+/*
+ * The returned file descriptor may share its file offset with the path
+ * cache, so it must only be used as the directory of *at() calls.
+ */
 int local_opendir_nofollow(FsContext *fs_ctx, const char *path)
 {
-    return local_open_nofollow(fs_ctx, path, O_DIRECTORY | O_RDONLY, 0);
+    LocalData *data = fs_ctx->private;
+    uint64_t gen = 0;
+    int fd;
+
+    if (data->path_cache) {
+        qemu_mutex_lock(&data->path_cache_lock);
+        gen = data->path_cache_gen;
+        fd = local_path_cache_get(data, path);
+        qemu_mutex_unlock(&data->path_cache_lock);
+        if (fd != -1) {
+            return fd;
+        }
+    }
+
+    fd = local_open_nofollow(fs_ctx, path, O_DIRECTORY | O_RDONLY, 0);
+    if (data->path_cache && fd != -1) {
+        local_path_cache_put(data, path, fd, gen);
+    }
+    return fd;
 }
 
 static void renameat_preserve_errno(int odirfd, const char *opath, int ndirfd,
@@ -521,7 +714,8 @@ static int local_opendir(FsContext *ctx,
     int dirfd;
     DIR *stream;
 
-    dirfd = local_opendir_nofollow(ctx, fs_path->data);
+    /* readdir needs a file offset of its own */
+    dirfd = local_open_nofollow(ctx, fs_path->data, O_DIRECTORY | O_RDONLY, 0);
     if (dirfd == -1) {
         return -1;
     }
@@ -1156,6 +1350,9 @@ static int local_remove(FsContext *ctx, const char *path)
     }
 
     err = local_unlinkat_common(ctx, dirfd, name, flags);
+    if (!err) {
+        local_path_cache_invalidate(ctx, path);
+    }
 err_out:
     close_preserve_errno(dirfd);
 out:
@@ -1296,6 +1493,8 @@ static int local_renameat(FsContext *ctx, V9fsPath *olddir,
     if (ret < 0) {
         goto out;
     }
+    local_path_cache_invalidate_at(ctx, olddir, old_name);
+    local_path_cache_invalidate_at(ctx, newdir, new_name);
 
     if (ctx->export_flags & V9FS_SM_MAPPED_FILE) {
         int omap_dirfd, nmap_dirfd;
@@ -1383,6 +1582,9 @@ static int local_unlinkat(FsContext *ctx, V9fsPath *dir,
     }
 
     ret = local_unlinkat_common(ctx, dirfd, name, flags);
+    if (!ret) {
+        local_path_cache_invalidate_at(ctx, dir, name);
+    }
     close_preserve_errno(dirfd);
     return ret;
 }
@@ -1439,7 +1641,7 @@ static int local_ioc_getversion_init(FsContext *ctx, LocalData *data, Error **er
 
 static int local_init(FsContext *ctx, Error **errp)
 {
-    LocalData *data = g_malloc(sizeof(*data));
+    LocalData *data = g_malloc0(sizeof(*data));
 
     data->mountfd = open(ctx->fs_root, O_DIRECTORY | O_RDONLY);
     if (data->mountfd == -1) {
@@ -1467,6 +1669,13 @@ static int local_init(FsContext *ctx, Error **errp)
     }
     ctx->export_flags |= V9FS_PATHNAME_FSCONTEXT;
 
+    if (ctx->path_cache_ttl) {
+        data->path_cache = g_hash_table_new(g_str_hash, g_str_equal);
+        QTAILQ_INIT(&data->path_cache_lru);
+        qemu_mutex_init(&data->path_cache_lock);
+        data->path_cache_ttl = ctx->path_cache_ttl * SCALE_MS;
+    }
+
     ctx->private = data;
     return 0;
 
@@ -1483,6 +1692,14 @@ static void local_cleanup(FsContext *ctx)
         return;
     }
 
+    if (data->path_cache) {
+        while (!QTAILQ_EMPTY(&data->path_cache_lru)) {
+            local_path_cache_drop(data, QTAILQ_FIRST(&data->path_cache_lru));
+        }
+        g_hash_table_destroy(data->path_cache);
+        qemu_mutex_destroy(&data->path_cache_lock);
+    }
+
     close(data->mountfd);
     g_free(data);
 }
@@ -1567,6 +1784,7 @@ static int local_parse_opts(QemuOpts *opts, FsDriverEntry *fse, Error **errp)
         }
     }
 
+    fse->path_cache_ttl = qemu_opt_get_number(opts, "path_cache_ttl", 0);
     fse->path = g_strdup(path);
 
     return 0;
@@ -2270,6 +2270,18 @@ static int v9fs_xattr_read(V9fsState *s, V9fsPDU *pdu, V9fsFidState *fidp,
     return offset;
 }
 
+static void v9fs_free_dirents(struct V9fsDirEnt *e)
+{
+    struct V9fsDirEnt *next = NULL;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e->st);
+        g_free(e);
+    }
+}
+
 static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
                                                   V9fsFidState *fidp,
                                                   uint32_t max_count)
@@ -2278,9 +2290,9 @@ static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
     V9fsStat v9stat;
     int len, err = 0;
     int32_t count = 0;
-    struct stat stbuf;
     off_t saved_dir_pos;
-    struct dirent *dent;
+    struct V9fsDirEnt *entries = NULL;
+    struct V9fsDirEnt *e;
 
     /* save the directory position */
     saved_dir_pos = v9fs_co_telldir(pdu, fidp);
@@ -2288,57 +2300,54 @@ static int coroutine_fn v9fs_do_readdir_with_stat(V9fsPDU *pdu,
         return saved_dir_pos;
     }
 
-    while (1) {
-        v9fs_path_init(&path);
-
-        v9fs_readdir_lock(&fidp->fs.dir);
+    /*
+     * Fetch the entries together with their stats from the fs driver in one
+     * rush. @max_count is based on the smaller 9P2000.L entries there, so
+     * some of them may not fit in the response below.
+     */
+    err = v9fs_co_readdir_many(pdu, fidp, &entries, saved_dir_pos, max_count,
+                               true);
+    if (err < 0) {
+        goto out;
+    }
+    err = 0;
 
-        err = v9fs_co_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
-        }
-        err = v9fs_co_name_to_path(pdu, &fidp->path, dent->d_name, &path);
-        if (err < 0) {
-            break;
-        }
-        err = v9fs_co_lstat(pdu, &path, &stbuf);
+    for (e = entries; e; e = e->next) {
+        v9fs_path_init(&path);
+        err = v9fs_co_name_to_path(pdu, &fidp->path, e->dent->d_name, &path);
         if (err < 0) {
+            v9fs_path_free(&path);
             break;
         }
-        err = stat_to_v9stat(pdu, &path, dent->d_name, &stbuf, &v9stat);
+        err = stat_to_v9stat(pdu, &path, e->dent->d_name, e->st, &v9stat);
+        v9fs_path_free(&path);
         if (err < 0) {
             break;
         }
         if ((count + v9stat.size + 2) > max_count) {
-            v9fs_readdir_unlock(&fidp->fs.dir);
-
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
+            /* Ran out of buffer */
             v9fs_stat_free(&v9stat);
-            v9fs_path_free(&path);
-            return count;
+            break;
         }
 
         /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
         len = pdu_marshal(pdu, 11 + count, "S", &v9stat);
-
-        v9fs_readdir_unlock(&fidp->fs.dir);
-
+        v9fs_stat_free(&v9stat);
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_stat_free(&v9stat);
-            v9fs_path_free(&path);
-            return len;
+            err = len;
+            break;
         }
         count += len;
-        v9fs_stat_free(&v9stat);
-        v9fs_path_free(&path);
-        saved_dir_pos = qemu_dirent_off(dent);
+        saved_dir_pos = qemu_dirent_off(e->dent);
     }
 
-    v9fs_readdir_unlock(&fidp->fs.dir);
+    /* Set dir back to the position after the last returned entry */
+    if (e) {
+        v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
+    }
 
-    v9fs_path_free(&path);
+out:
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -2453,18 +2462,6 @@ size_t v9fs_readdir_response_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
-static void v9fs_free_dirents(struct V9fsDirEnt *e)
-{
-    struct V9fsDirEnt *next = NULL;
-
-    for (; e; e = next) {
-        next = e->next;
-        g_free(e->dent);
-        g_free(e->st);
-        g_free(e);
-    }
-}
-
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
                                         off_t offset, int32_t max_count)
 {
@@ -4246,6 +4243,7 @@ int v9fs_device_realize_common(V9fsState *s, const V9fsTransport *t,
 
     s->ctx.fmode = fse->fmode;
     s->ctx.dmode = fse->dmode;
+    s->ctx.path_cache_ttl = fse->path_cache_ttl;
 
     s->fids = g_hash_table_new(NULL, NULL);
     qemu_co_rwlock_init(&s->rename_lock);
@@ -1178,15 +1178,26 @@ static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
     virtio_blk_handle_vq(s, vq);
 }
 
-static void virtio_blk_dma_restart_bh(void *opaque)
+/* Context: any, the AioContext that processes virtqueue @queue_index */
+static AioContext *virtio_blk_vq_aio_context(VirtIOBlock *s,
+                                             unsigned queue_index)
 {
-    VirtIOBlock *s = opaque;
+    if (s->dataplane && s->dataplane_started) {
+        return virtio_blk_data_plane_vq_aio_context(s->dataplane, queue_index);
+    }
+    return blk_get_aio_context(s->conf.conf.blk);
+}
 
-    VirtIOBlockReq *req = s->rq;
+/*
+ * Resubmit the requests of one virtqueue, in the AioContext that
+ * processes that virtqueue.
+ */
+static void virtio_blk_dma_restart_bh(void *opaque)
+{
+    VirtIOBlockReq *req = opaque;
+    VirtIOBlock *s = req->dev;
     MultiReqBuffer mrb = {};
 
-    s->rq = NULL;
-
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     while (req) {
         VirtIOBlockReq *next = req->next;
@@ -1219,16 +1230,45 @@ static void virtio_blk_dma_restart_cb(void *opaque, bool running,
                                       RunState state)
 {
     VirtIOBlock *s = opaque;
+    uint16_t num_queues = s->conf.num_queues;
+    g_autofree VirtIOBlockReq **vq_rq = NULL;
+    AioContext *ctx;
+    VirtIOBlockReq *rq;
 
     if (!running) {
         return;
     }
 
-    /* Paired with dec in virtio_blk_dma_restart_bh() */
-    blk_inc_in_flight(s->conf.conf.blk);
+    ctx = blk_get_aio_context(s->conf.conf.blk);
+    aio_context_acquire(ctx);
+    rq = s->rq;
+    s->rq = NULL;
+    aio_context_release(ctx);
+
+    /* Split the device-wide s->rq request list into per-vq request lists */
+    vq_rq = g_new0(VirtIOBlockReq *, num_queues);
+    while (rq) {
+        VirtIOBlockReq *next = rq->next;
+        uint16_t idx = virtio_get_queue_index(rq->vq);
+
+        /* Only num_queues vqs were created so vq_rq[idx] is within bounds */
+        assert(idx < num_queues);
+        rq->next = vq_rq[idx];
+        vq_rq[idx] = rq;
+        rq = next;
+    }
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        if (!vq_rq[i]) {
+            continue;
+        }
+
+        /* Paired with dec in virtio_blk_dma_restart_bh() */
+        blk_inc_in_flight(s->conf.conf.blk);
 
-    aio_bh_schedule_oneshot(blk_get_aio_context(s->conf.conf.blk),
-            virtio_blk_dma_restart_bh, s);
+        aio_bh_schedule_oneshot(virtio_blk_vq_aio_context(s, i),
+                                virtio_blk_dma_restart_bh, vq_rq[i]);
+    }
 }
 
 static void virtio_blk_reset(VirtIODevice *vdev)
@@ -1511,7 +1551,6 @@ static void virtio_blk_drained_begin(void *opaque)
 {
     VirtIOBlock *s = opaque;
     VirtIODevice *vdev = VIRTIO_DEVICE(opaque);
-    AioContext *ctx = blk_get_aio_context(s->conf.conf.blk);
 
     if (!s->dataplane || !s->dataplane_started) {
         return;
@@ -1519,7 +1558,8 @@ static void virtio_blk_drained_begin(void *opaque)
 
     for (uint16_t i = 0; i < s->conf.num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
-        virtio_queue_aio_detach_host_notifier(vq, ctx);
+        virtio_queue_aio_detach_host_notifier(vq,
+                                              virtio_blk_vq_aio_context(s, i));
     }
 }
 
@@ -1528,7 +1568,6 @@ static void virtio_blk_drained_end(void *opaque)
 {
     VirtIOBlock *s = opaque;
     VirtIODevice *vdev = VIRTIO_DEVICE(opaque);
-    AioContext *ctx = blk_get_aio_context(s->conf.conf.blk);
 
     if (!s->dataplane || !s->dataplane_started) {
         return;
@@ -1536,7 +1575,8 @@ static void virtio_blk_drained_end(void *opaque)
 
     for (uint16_t i = 0; i < s->conf.num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(vdev, i);
-        virtio_queue_aio_attach_host_notifier(vq, ctx);
+        virtio_queue_aio_attach_host_notifier(vq,
+                                              virtio_blk_vq_aio_context(s, i));
     }
 }
 
@@ -1722,6 +1762,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIOBlock,
+                                         conf.iothread_vq_mapping_list),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
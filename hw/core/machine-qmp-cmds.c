@@ -8,6 +8,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "exec/cpu-common.h"
 #include "hw/acpi/vmgenid.h"
 #include "hw/boards.h"
 #include "hw/intc/intc.h"
@@ -19,6 +20,7 @@
 #include "qapi/qmp/qobject.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/type-helpers.h"
+#include "qemu/lockable.h"
 #include "qemu/main-loop.h"
 #include "qemu/uuid.h"
 #include "qom/qom-qobject.h"
@@ -31,21 +33,25 @@
 /*
  * fast means: we NEVER interrupt vCPU threads to retrieve
  * information from KVM.
+ *
+ * This may run without the BQL, see 'no-bql' in the schema.  The CPU
+ * list lock keeps CPUs from going away; the QOM tree is not walked.
  */
 CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
 {
-    MachineState *ms = MACHINE(qdev_get_machine());
+    MachineState *ms = current_machine;
     MachineClass *mc = MACHINE_GET_CLASS(ms);
     CpuInfoFastList *head = NULL, **tail = &head;
     SysEmuTarget target = qapi_enum_parse(&SysEmuTarget_lookup, target_name(),
                                           -1, &error_abort);
     CPUState *cpu;
 
+    QEMU_LOCK_GUARD(&qemu_cpu_list_lock);
     CPU_FOREACH(cpu) {
         CpuInfoFast *value = g_malloc0(sizeof(*value));
 
         value->cpu_index = cpu->cpu_index;
-        value->qom_path = object_get_canonical_path(OBJECT(cpu));
+        value->qom_path = g_strdup(cpu->qom_path);
         value->thread_id = cpu->thread_id;
 
         if (mc->cpu_index_to_instance_props) {
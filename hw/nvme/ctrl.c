@@ -147,6 +147,15 @@
  *   a secondary controller. The default 0 resolves to
  *   `(sriov_vq_flexible / sriov_max_vfs)`.
  *
+ * - `iothread-qp-mapping`
+ *   Process the I/O queue pairs in IOThreads instead of the main loop. This
+ *   takes a list of IOThreads, optionally with the I/O queue identifiers to
+ *   assign to each of them in `vqs`; without them the queues are assigned
+ *   round-robin. A submission queue is processed in the IOThread of its
+ *   completion queue. The Admin queues are always processed in the main loop.
+ *   The namespaces are moved to the AioContext of the first IOThread in the
+ *   list. This cannot be combined with an nvme-subsys device.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -201,6 +210,8 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/hostmem.h"
+#include "sysemu/iothread.h"
+#include "block/aio-wait.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pcie_sriov.h"
 #include "migration/vmstate.h"
@@ -254,6 +265,8 @@ static const uint32_t nvme_feature_cap[NVME_FID_MAX] = {
     [NVME_ERROR_RECOVERY]           = NVME_FEAT_CAP_CHANGE | NVME_FEAT_CAP_NS,
     [NVME_VOLATILE_WRITE_CACHE]     = NVME_FEAT_CAP_CHANGE,
     [NVME_NUMBER_OF_QUEUES]         = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_COALESCING]     = NVME_FEAT_CAP_CHANGE,
+    [NVME_INTERRUPT_VECTOR_CONF]    = NVME_FEAT_CAP_CHANGE,
     [NVME_ASYNCHRONOUS_EVENT_CONF]  = NVME_FEAT_CAP_CHANGE,
     [NVME_TIMESTAMP]                = NVME_FEAT_CAP_CHANGE,
     [NVME_HOST_BEHAVIOR_SUPPORT]    = NVME_FEAT_CAP_CHANGE,
@@ -311,6 +324,7 @@ static const uint32_t nvme_cse_iocs_zoned[256] = {
 };
 
 static void nvme_process_sq(void *opaque);
+static void nvme_process_deferred(void *opaque);
 static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst);
 static inline uint64_t nvme_get_timestamp(const NvmeCtrl *n);
 
@@ -685,7 +699,7 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
             return;
         } else {
             assert(cq->vector < 32);
-            if (!n->cq_pending) {
+            if (!qatomic_read(&n->cq_pending)) {
                 n->irq_status &= ~(1 << cq->vector);
             }
             nvme_irq_check(n);
@@ -693,6 +707,130 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/*
+ * The queues of an I/O queue pair that is processed in an IOThread are
+ * protected by the AioContext lock of the IOThread, all other queues by the
+ * BQL.
+ */
+static void nvme_queue_acquire(AioContext *ctx)
+{
+    if (ctx != qemu_get_aio_context()) {
+        aio_context_acquire(ctx);
+    }
+}
+
+static void nvme_queue_release(AioContext *ctx)
+{
+    if (ctx != qemu_get_aio_context()) {
+        aio_context_release(ctx);
+    }
+}
+
+/*
+ * With iothread-qp-mapping the namespace BlockBackends live in the AioContext
+ * of the first IOThread, so the main loop takes its lock around block layer
+ * calls. It must not be held while waiting for another IOThread.
+ */
+static void nvme_blk_acquire(NvmeCtrl *n)
+{
+    if (n->ns_aio_context) {
+        aio_context_acquire(n->ns_aio_context);
+    }
+}
+
+static void nvme_blk_release(NvmeCtrl *n)
+{
+    if (n->ns_aio_context) {
+        aio_context_release(n->ns_aio_context);
+    }
+}
+
+/*
+ * Assert or deassert the interrupt of @cq depending on whether it holds
+ * entries the host has not consumed yet. The interrupt state belongs to the
+ * main loop, so IOThreads leave the update to nvme_irq_bh().
+ */
+static void nvme_irq_update(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (cq->ctx != qemu_get_aio_context()) {
+        qatomic_set(&cq->irq_kick, true);
+        qemu_bh_schedule(n->irq_bh);
+        return;
+    }
+
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    } else {
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+    NvmeCQueue *cq;
+    bool empty;
+    int i;
+
+    for (i = 1; i <= n->params.max_ioqpairs; i++) {
+        cq = n->cq[i];
+        if (!cq || !qatomic_xchg(&cq->irq_kick, false)) {
+            continue;
+        }
+
+        nvme_queue_acquire(cq->ctx);
+        empty = cq->tail == cq->head;
+        nvme_queue_release(cq->ctx);
+
+        if (empty) {
+            nvme_irq_deassert(n, cq);
+        } else {
+            nvme_irq_assert(n, cq);
+        }
+    }
+}
+
+/*
+ * Interrupt Coalescing: the interrupt of an I/O completion queue is held back
+ * until the aggregation threshold is exceeded or the aggregation time has
+ * passed, so that a burst of completions costs a single interrupt.
+ */
+static void nvme_irq_coalesce(NvmeCtrl *n, NvmeCQueue *cq, uint32_t posted)
+{
+    uint16_t intc = n->features.int_coalescing;
+    uint8_t time = NVME_INTC_TIME(intc);
+
+    if (cq->cqid && time && !test_bit(cq->vector, n->features.intvc_cd)) {
+        cq->coalesced += posted;
+        if (cq->coalesced && cq->coalesced <= NVME_INTC_THR(intc)) {
+            if (!timer_pending(cq->coalesce_timer)) {
+                /* the aggregation time is in 100 microsecond increments */
+                timer_mod(cq->coalesce_timer,
+                          qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                          time * 100 * SCALE_US);
+            }
+            trace_pci_nvme_irq_coalesce(cq->cqid, cq->coalesced);
+            return;
+        }
+    }
+
+    cq->coalesced = 0;
+    timer_del(cq->coalesce_timer);
+    nvme_irq_update(n, cq);
+}
+
+static void nvme_irq_coalesce_timer(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    nvme_queue_acquire(cq->ctx);
+    if (cq->coalesced) {
+        cq->coalesced = 0;
+        nvme_irq_update(cq->ctrl, cq);
+    }
+    nvme_queue_release(cq->ctx);
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -1487,9 +1625,13 @@ static void nvme_post_cqes(void *opaque)
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
-    bool pending = cq->head != cq->tail;
+    uint32_t posted = 0;
+    bool pending;
     int ret;
 
+    nvme_queue_acquire(cq->ctx);
+    pending = cq->head != cq->tail;
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -1520,14 +1662,16 @@ static void nvme_post_cqes(void *opaque)
         nvme_inc_cq_tail(cq);
         nvme_sg_unmap(&req->sg);
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
+        posted++;
     }
     if (cq->tail != cq->head) {
         if (cq->irq_enabled && !pending) {
-            n->cq_pending++;
+            qatomic_inc(&n->cq_pending);
         }
 
-        nvme_irq_assert(n, cq);
+        nvme_irq_coalesce(n, cq, posted);
     }
+    nvme_queue_release(cq->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -1543,10 +1687,12 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
                                       req->status, req->cmd.opcode);
     }
 
+    nvme_queue_acquire(cq->ctx);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
 
     qemu_bh_schedule(cq->bh);
+    nvme_queue_release(cq->ctx);
 }
 
 static void nvme_process_aers(void *opaque)
@@ -2130,6 +2276,10 @@ static inline bool nvme_is_write(NvmeRequest *req)
            rw->opcode == NVME_CMD_WRITE_ZEROES;
 }
 
+/*
+ * The commands that use these AIOCBs are started from the main loop, and
+ * blk_aio_*() completes requests in the AioContext of the submitter.
+ */
 static AioContext *nvme_get_aio_context(BlockAIOCB *acb)
 {
     return qemu_get_aio_context();
@@ -4501,17 +4651,19 @@ static void nvme_cq_notifier(EventNotifier *e)
         return;
     }
 
+    nvme_queue_acquire(cq->ctx);
     nvme_update_cq_head(cq);
 
     if (cq->tail == cq->head) {
         if (cq->irq_enabled) {
-            n->cq_pending--;
+            qatomic_dec(&n->cq_pending);
         }
 
-        nvme_irq_deassert(n, cq);
+        nvme_irq_update(n, cq);
     }
 
     qemu_bh_schedule(cq->bh);
+    nvme_queue_release(cq->ctx);
 }
 
 static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
@@ -4525,7 +4677,12 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    if (cq->ctx == qemu_get_aio_context()) {
+        event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    } else {
+        aio_set_event_notifier(cq->ctx, &cq->notifier, nvme_cq_notifier,
+                               NULL, NULL);
+    }
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
@@ -4543,6 +4700,33 @@ static void nvme_sq_notifier(EventNotifier *e)
     nvme_process_sq(sq);
 }
 
+/*
+ * With shadow doorbells the host only writes the doorbell register when the
+ * event index asks for it, so an IOThread that polls the shadow tail picks up
+ * new commands without any exit.
+ */
+static bool nvme_sq_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+    uint32_t tail;
+
+    /* only this IOThread moves the head and pops free requests */
+    if (QTAILQ_EMPTY(&sq->req_list)) {
+        return false;
+    }
+
+    ldl_le_pci_dma(PCI_DEVICE(sq->ctrl), sq->db_addr, &tail,
+                   MEMTXATTRS_UNSPECIFIED);
+
+    return tail != sq->head;
+}
+
+static void nvme_sq_poll_ready(EventNotifier *e)
+{
+    nvme_process_sq(container_of(e, NvmeSQueue, notifier));
+}
+
 static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
 {
     NvmeCtrl *n = sq->ctrl;
@@ -4554,23 +4738,78 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    if (sq->ctx == qemu_get_aio_context()) {
+        event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    } else {
+        aio_set_event_notifier(sq->ctx, &sq->notifier, nvme_sq_notifier,
+                               nvme_sq_poll, nvme_sq_poll_ready);
+    }
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+/* Context: BH in the IOThread of the queue */
+static void nvme_sq_detach_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    if (sq->ioeventfd_enabled) {
+        aio_set_event_notifier(sq->ctx, &sq->notifier, NULL, NULL, NULL);
+    }
+    qemu_bh_delete(sq->bh);
+    sq->bh = NULL;
+}
+
+/*
+ * Stop processing @sq in its IOThread. Commands that were already submitted
+ * still complete there, so callers drain the namespaces afterwards.
+ */
+static void nvme_sq_detach(NvmeSQueue *sq)
+{
+    if (sq->ctx != qemu_get_aio_context() && sq->bh) {
+        aio_wait_bh_oneshot(sq->ctx, nvme_sq_detach_bh, sq);
+    }
+}
+
+static void nvme_drain_namespaces(NvmeCtrl *n)
+{
+    NvmeNamespace *ns;
+    int i;
+
+    nvme_blk_acquire(n);
+    for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
+        ns = nvme_ns(n, i);
+        if (!ns) {
+            continue;
+        }
+
+        nvme_ns_drain(ns);
+    }
+    nvme_blk_release(n);
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
 
     n->sq[sq->sqid] = NULL;
-    qemu_bh_delete(sq->bh);
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
+    }
+    nvme_sq_detach(sq);
+    if (sq->bh) {
+        qemu_bh_delete(sq->bh);
+    }
+    if (sq->defer_bh) {
+        qemu_bh_delete(sq->defer_bh);
+    }
+    if (sq->ioeventfd_enabled) {
+        if (sq->ctx == qemu_get_aio_context()) {
+            event_notifier_set_handler(&sq->notifier, NULL);
+        }
         event_notifier_cleanup(&sq->notifier);
     }
     g_free(sq->io_req);
@@ -4595,16 +4834,31 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
-    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
-        r = QTAILQ_FIRST(&sq->out_req_list);
-        assert(r->aiocb);
-        blk_aio_cancel(r->aiocb);
+    if (sq->ctx == qemu_get_aio_context()) {
+        while (!QTAILQ_EMPTY(&sq->out_req_list)) {
+            r = QTAILQ_FIRST(&sq->out_req_list);
+            assert(r->aiocb);
+            blk_aio_cancel(r->aiocb);
+        }
+    } else {
+        /* AIOCBs of an IOThread cannot be cancelled from the main loop */
+        nvme_sq_detach(sq);
+        qemu_bh_cancel(sq->defer_bh);
+        nvme_drain_namespaces(n);
+
+        while (!QTAILQ_EMPTY(&sq->defer_list)) {
+            r = QTAILQ_FIRST(&sq->defer_list);
+            QTAILQ_REMOVE(&sq->defer_list, r, entry);
+            QTAILQ_INSERT_TAIL(&sq->req_list, r, entry);
+        }
     }
 
     assert(QTAILQ_EMPTY(&sq->out_req_list));
 
     if (!nvme_check_cqid(n, sq->cqid)) {
         cq = n->cq[sq->cqid];
+
+        nvme_queue_acquire(cq->ctx);
         QTAILQ_REMOVE(&cq->sq_list, sq, entry);
 
         nvme_post_cqes(cq);
@@ -4614,6 +4868,7 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
                 QTAILQ_INSERT_TAIL(&sq->req_list, r, entry);
             }
         }
+        nvme_queue_release(cq->ctx);
     }
 
     nvme_free_sq(sq, n);
@@ -4636,13 +4891,23 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
 
     QTAILQ_INIT(&sq->req_list);
     QTAILQ_INIT(&sq->out_req_list);
+    QTAILQ_INIT(&sq->defer_list);
     for (i = 0; i < sq->size; i++) {
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
-                                 &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    /* the submission queue is processed where its completions are posted */
+    assert(n->cq[cqid]);
+    cq = n->cq[cqid];
+    sq->ctx = cq->ctx;
+
+    sq->bh = aio_bh_new_guarded(sq->ctx, nvme_process_sq, sq,
+                                &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    if (sq->ctx != qemu_get_aio_context()) {
+        sq->defer_bh = qemu_bh_new_guarded(nvme_process_deferred, sq,
+                                           &DEVICE(n)->mem_reentrancy_guard);
+    }
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -4655,9 +4920,9 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
 
-    assert(n->cq[cqid]);
-    cq = n->cq[cqid];
+    nvme_queue_acquire(cq->ctx);
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
+    nvme_queue_release(cq->ctx);
     n->sq[sqid] = sq;
 }
 
@@ -5215,17 +5480,50 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+/* Context: BH in the AioContext of the queue */
+static void nvme_cq_detach_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    if (cq->ioeventfd_enabled) {
+        if (cq->ctx == qemu_get_aio_context()) {
+            event_notifier_set_handler(&cq->notifier, NULL);
+        } else {
+            aio_set_event_notifier(cq->ctx, &cq->notifier, NULL, NULL, NULL);
+        }
+    }
+    qemu_bh_delete(cq->bh);
+    cq->bh = NULL;
+    timer_free(cq->coalesce_timer);
+    cq->coalesce_timer = NULL;
+}
+
+/* Stop posting completions and raising interrupts for @cq */
+static void nvme_cq_detach(NvmeCQueue *cq)
+{
+    if (!cq->bh) {
+        return;
+    }
+
+    if (cq->ctx == qemu_get_aio_context()) {
+        nvme_cq_detach_bh(cq);
+    } else {
+        aio_wait_bh_oneshot(cq->ctx, nvme_cq_detach_bh, cq);
+    }
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
     uint16_t offset = (cq->cqid << 3) + (1 << 2);
 
     n->cq[cq->cqid] = NULL;
-    qemu_bh_delete(cq->bh);
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
+    }
+    nvme_cq_detach(cq);
+    if (cq->ioeventfd_enabled) {
         event_notifier_cleanup(&cq->notifier);
     }
     if (msix_enabled(pci)) {
@@ -5254,7 +5552,7 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
     }
 
     if (cq->irq_enabled && cq->tail != cq->head) {
-        n->cq_pending--;
+        qatomic_dec(&n->cq_pending);
     }
 
     nvme_irq_deassert(n, cq);
@@ -5273,6 +5571,8 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         msix_vector_use(pci, vector);
     }
     cq->ctrl = n;
+    cq->ctx = cqid && n->qp_aio_context ? n->qp_aio_context[cqid] :
+                                          qemu_get_aio_context();
     cq->cqid = cqid;
     cq->size = size;
     cq->dma_addr = dma_addr;
@@ -5282,6 +5582,11 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->head = cq->tail = 0;
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
+    cq->bh = aio_bh_new_guarded(cq->ctx, nvme_post_cqes, cq,
+                                &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->coalesced = 0;
+    cq->coalesce_timer = aio_timer_new(cq->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                       nvme_irq_coalesce_timer, cq);
     if (n->dbbuf_enabled) {
         cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
         cq->ei_addr = n->dbbuf_eis + (cqid << 3) + (1 << 2);
@@ -5293,8 +5598,6 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
-                                 &DEVICE(cq->ctrl)->mem_reentrancy_guard);
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5987,6 +6290,20 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         result = n->features.async_config;
         goto out;
+    case NVME_INTERRUPT_COALESCING:
+        result = n->features.int_coalescing;
+        goto out;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        result = iv;
+        if (iv == n->admin_cq.vector || test_bit(iv, n->features.intvc_cd)) {
+            result |= NVME_INTVC_NOCOALESCING;
+        }
+        goto out;
     case NVME_TIMESTAMP:
         return nvme_get_feature_timestamp(n, req);
     case NVME_HOST_BEHAVIOR_SUPPORT:
@@ -6147,6 +6464,7 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     uint8_t fid = NVME_GETSETFEAT_FID(dw10);
     uint8_t save = NVME_SETFEAT_SAVE(dw10);
     uint16_t status;
+    uint16_t iv;
     int i;
 
     trace_pci_nvme_setfeat(nvme_cid(req), nsid, fid, save, dw11);
@@ -6235,7 +6553,9 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
             }
 
             if (!(dw11 & 0x1) && blk_enable_write_cache(ns->blkconf.blk)) {
+                nvme_blk_acquire(n);
                 blk_flush(ns->blkconf.blk);
+                nvme_blk_release(n);
             }
 
             blk_set_enable_write_cache(ns->blkconf.blk, dw11 & 1);
@@ -6266,6 +6586,26 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeRequest *req)
     case NVME_ASYNCHRONOUS_EVENT_CONF:
         n->features.async_config = dw11;
         break;
+    case NVME_INTERRUPT_COALESCING:
+        n->features.int_coalescing = dw11 & 0xffff;
+        break;
+    case NVME_INTERRUPT_VECTOR_CONF:
+        iv = dw11 & 0xffff;
+        if (iv >= n->conf_ioqpairs + 1) {
+            return NVME_INVALID_FIELD | NVME_DNR;
+        }
+
+        /* coalescing never applies to the Admin Completion Queue vector */
+        if (iv == n->admin_cq.vector) {
+            break;
+        }
+
+        if (dw11 & NVME_INTVC_NOCOALESCING) {
+            set_bit(iv, n->features.intvc_cd);
+        } else {
+            clear_bit(iv, n->features.intvc_cd);
+        }
+        break;
     case NVME_TIMESTAMP:
         return nvme_set_feature_timestamp(n, req);
     case NVME_HOST_BEHAVIOR_SUPPORT:
@@ -6639,7 +6979,9 @@ static uint16_t nvme_format(NvmeCtrl *n, NvmeRequest *req)
     }
 
     req->aiocb = &iocb->common;
+    nvme_blk_acquire(n);
     nvme_do_format(iocb);
+    nvme_blk_release(n);
 
     return NVME_NO_COMPLETE;
 
@@ -6826,7 +7168,6 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
     /* Save shadow buffer base addr for use during queue creation */
     n->dbbuf_dbs = dbs_addr;
     n->dbbuf_eis = eis_addr;
-    n->dbbuf_enabled = true;
 
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
         NvmeSQueue *sq = n->sq[i];
@@ -6838,9 +7179,11 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
              * nvme_process_db() uses this hard-coded way to calculate
              * doorbell offsets. Be consistent with that here.
              */
+            nvme_queue_acquire(sq->ctx);
             sq->db_addr = dbs_addr + (i << 3);
             sq->ei_addr = eis_addr + (i << 3);
             stl_le_pci_dma(pci, sq->db_addr, sq->tail, MEMTXATTRS_UNSPECIFIED);
+            nvme_queue_release(sq->ctx);
 
             if (n->params.ioeventfd && sq->sqid != 0) {
                 if (!nvme_init_sq_ioeventfd(sq)) {
@@ -6851,9 +7194,11 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
 
         if (cq) {
             /* CAP.DSTRD is 0, so offset of ith cq db_addr is (i<<3)+(1<<2) */
+            nvme_queue_acquire(cq->ctx);
             cq->db_addr = dbs_addr + (i << 3) + (1 << 2);
             cq->ei_addr = eis_addr + (i << 3) + (1 << 2);
             stl_le_pci_dma(pci, cq->db_addr, cq->head, MEMTXATTRS_UNSPECIFIED);
+            nvme_queue_release(cq->ctx);
 
             if (n->params.ioeventfd && cq->cqid != 0) {
                 if (!nvme_init_cq_ioeventfd(cq)) {
@@ -6863,6 +7208,9 @@ static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
         }
     }
 
+    /* IOThreads may use the shadow doorbells as soon as this is set */
+    qatomic_set(&n->dbbuf_enabled, true);
+
     trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
 
     return NVME_SUCCESS;
@@ -6998,6 +7346,93 @@ static void nvme_update_sq_tail(NvmeSQueue *sq)
     trace_pci_nvme_update_sq_tail(sq->sqid, sq->tail);
 }
 
+/*
+ * Plain reads and writes of a namespace without zones, metadata, Flexible Data
+ * Placement or Deallocated or Unwritten Logical Block errors only touch the
+ * request itself, so an IOThread can run them. Returns the namespace of such
+ * a command, or NULL if the command must run in the main loop.
+ */
+static NvmeNamespace *nvme_io_cmd_iothread_ns(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeNamespace *ns;
+
+    if (req->cmd.opcode != NVME_CMD_READ &&
+        req->cmd.opcode != NVME_CMD_WRITE) {
+        return NULL;
+    }
+
+    ns = nvme_ns(n, le32_to_cpu(req->cmd.nsid));
+    if (!ns || ns->params.zoned || ns->lbaf.ms ||
+        (ns->endgrp && ns->endgrp->fdp.enabled) ||
+        NVME_ERR_REC_DULBE(ns->features.err_rec)) {
+        return NULL;
+    }
+
+    return ns;
+}
+
+/* Context: the AioContext of the queue, lock held */
+static void nvme_defer_io_cmd(NvmeSQueue *sq, NvmeRequest *req)
+{
+    QTAILQ_REMOVE(&sq->out_req_list, req, entry);
+    QTAILQ_INSERT_TAIL(&sq->defer_list, req, entry);
+    qemu_bh_schedule(sq->defer_bh);
+}
+
+/* Context: main loop, runs the commands an IOThread deferred */
+static void nvme_process_deferred(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    NvmeCtrl *n = sq->ctrl;
+    NvmeRequest *req;
+    uint16_t status;
+
+    for (;;) {
+        aio_context_acquire(sq->ctx);
+        req = QTAILQ_FIRST(&sq->defer_list);
+        if (req) {
+            QTAILQ_REMOVE(&sq->defer_list, req, entry);
+            QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
+        }
+        aio_context_release(sq->ctx);
+
+        if (!req) {
+            break;
+        }
+
+        nvme_blk_acquire(n);
+        status = nvme_io_cmd(n, req);
+        nvme_blk_release(n);
+        if (status != NVME_NO_COMPLETE) {
+            req->status = status;
+            nvme_enqueue_req_completion(nvme_cq(req), req);
+        }
+    }
+}
+
+/*
+ * Submit an I/O command from the IOThread of its queue. The BlockBackend
+ * lives in the AioContext of the first IOThread, whose lock the other
+ * IOThreads take like the main loop does. The queue lock is dropped
+ * meanwhile, as the main loop takes the queue lock while holding that one.
+ */
+static uint16_t nvme_io_cmd_iothread(NvmeCtrl *n, NvmeNamespace *ns,
+                                     NvmeRequest *req)
+{
+    NvmeSQueue *sq = req->sq;
+    uint16_t status;
+
+    assert(blk_get_aio_context(ns->blkconf.blk) == n->ns_aio_context);
+
+    aio_context_release(sq->ctx);
+    aio_context_acquire(n->ns_aio_context);
+    status = nvme_io_cmd(n, req);
+    aio_context_release(n->ns_aio_context);
+    aio_context_acquire(sq->ctx);
+
+    return status;
+}
+
 static void nvme_process_sq(void *opaque)
 {
     NvmeSQueue *sq = opaque;
@@ -7008,8 +7443,11 @@ static void nvme_process_sq(void *opaque)
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
+    NvmeNamespace *ns;
 
-    if (n->dbbuf_enabled) {
+    nvme_queue_acquire(sq->ctx);
+
+    if (qatomic_read(&n->dbbuf_enabled)) {
         nvme_update_sq_tail(sq);
     }
 
@@ -7030,18 +7468,31 @@ static void nvme_process_sq(void *opaque)
         req->cqe.cid = cmd.cid;
         memcpy(&req->cmd, &cmd, sizeof(NvmeCmd));
 
-        status = sq->sqid ? nvme_io_cmd(n, req) :
-            nvme_admin_cmd(n, req);
+        if (!sq->sqid) {
+            status = nvme_admin_cmd(n, req);
+        } else if (sq->ctx == qemu_get_aio_context()) {
+            status = nvme_io_cmd(n, req);
+        } else {
+            ns = nvme_io_cmd_iothread_ns(n, req);
+            if (ns) {
+                status = nvme_io_cmd_iothread(n, ns, req);
+            } else {
+                nvme_defer_io_cmd(sq, req);
+                status = NVME_NO_COMPLETE;
+            }
+        }
         if (status != NVME_NO_COMPLETE) {
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
 
-        if (n->dbbuf_enabled) {
+        if (qatomic_read(&n->dbbuf_enabled)) {
             nvme_update_sq_eventidx(sq);
             nvme_update_sq_tail(sq);
         }
     }
+
+    nvme_queue_release(sq->ctx);
 }
 
 static void nvme_update_msixcap_ts(PCIDevice *pci_dev, uint32_t table_size)
@@ -7086,16 +7537,23 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
 {
     PCIDevice *pci_dev = PCI_DEVICE(n);
     NvmeSecCtrlEntry *sctrl;
-    NvmeNamespace *ns;
     int i;
 
-    for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
-        ns = nvme_ns(n, i);
-        if (!ns) {
-            continue;
+    /* no new commands may start in IOThreads while draining */
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i] != NULL && n->sq[i]->defer_bh) {
+            nvme_sq_detach(n->sq[i]);
+            qemu_bh_cancel(n->sq[i]->defer_bh);
         }
+    }
 
-        nvme_ns_drain(ns);
+    nvme_drain_namespaces(n);
+
+    /* completions must not be posted while the submission queues go away */
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->cq[i] != NULL && n->cq[i]->ctx != qemu_get_aio_context()) {
+            nvme_cq_detach(n->cq[i]);
+        }
     }
 
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
@@ -7165,6 +7623,7 @@ static void nvme_ctrl_shutdown(NvmeCtrl *n)
         memory_region_msync(&n->pmr.dev->mr, 0, n->pmr.dev->size);
     }
 
+    nvme_blk_acquire(n);
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -7173,6 +7632,7 @@ static void nvme_ctrl_shutdown(NvmeCtrl *n)
 
         nvme_ns_shutdown(ns);
     }
+    nvme_blk_release(n);
 }
 
 static void nvme_select_iocs(NvmeCtrl *n)
@@ -7632,6 +8092,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
+        nvme_queue_acquire(cq->ctx);
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
         cq->head = new_head;
         if (!qid && n->dbbuf_enabled) {
@@ -7647,11 +8108,12 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         if (cq->tail == cq->head) {
             if (cq->irq_enabled) {
-                n->cq_pending--;
+                qatomic_dec(&n->cq_pending);
             }
 
             nvme_irq_deassert(n, cq);
         }
+        nvme_queue_release(cq->ctx);
     } else {
         /* Submission queue doorbell write */
 
@@ -7693,6 +8155,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_sq(sq->sqid, new_tail);
 
+        nvme_queue_acquire(sq->ctx);
         sq->tail = new_tail;
         if (!qid && n->dbbuf_enabled) {
             /*
@@ -7712,6 +8175,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         }
 
         qemu_bh_schedule(sq->bh);
+        nvme_queue_release(sq->ctx);
     }
 }
 
@@ -7768,6 +8232,67 @@ static const MemoryRegionOps nvme_cmb_ops = {
     },
 };
 
+/* Returns true if every I/O queue pair is assigned to one existing IOThread */
+static bool nvme_check_iothread_qp_mapping(IOThreadVirtQueueMappingList *list,
+                                           uint32_t max_ioqpairs,
+                                           Error **errp)
+{
+    g_autofree unsigned long *qids = bitmap_new(max_ioqpairs + 1);
+    g_autoptr(GHashTable) iothreads =
+        g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (IOThreadVirtQueueMappingList *node = list; node; node = node->next) {
+        const char *name = node->value->iothread;
+        uint16List *qid;
+
+        if (!iothread_by_id(name)) {
+            error_setg(errp, "IOThread \"%s\" object does not exist", name);
+            return false;
+        }
+
+        if (!g_hash_table_add(iothreads, (gpointer)name)) {
+            error_setg(errp,
+                       "duplicate IOThread name \"%s\" in iothread-qp-mapping",
+                       name);
+            return false;
+        }
+
+        if (node != list && !!node->value->vqs != !!list->value->vqs) {
+            error_setg(errp, "either all items in iothread-qp-mapping "
+                             "must have vqs or none of them must have it");
+            return false;
+        }
+
+        for (qid = node->value->vqs; qid; qid = qid->next) {
+            if (!qid->value || qid->value > max_ioqpairs) {
+                error_setg(errp, "queue identifier %u for IOThread \"%s\" "
+                           "must be between 1 and max_ioqpairs %u in "
+                           "iothread-qp-mapping", qid->value, name,
+                           max_ioqpairs);
+                return false;
+            }
+
+            if (test_and_set_bit(qid->value, qids)) {
+                error_setg(errp, "cannot assign queue %u to IOThread \"%s\" "
+                           "because it is already assigned", qid->value, name);
+                return false;
+            }
+        }
+    }
+
+    if (list->value->vqs) {
+        for (uint32_t i = 1; i <= max_ioqpairs; i++) {
+            if (!test_bit(i, qids)) {
+                error_setg(errp, "missing queue %u IOThread assignment in "
+                           "iothread-qp-mapping", i);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 static bool nvme_check_params(NvmeCtrl *n, Error **errp)
 {
     NvmeParams *params = &n->params;
@@ -7900,9 +8425,68 @@ static bool nvme_check_params(NvmeCtrl *n, Error **errp)
         }
     }
 
+    if (n->iothread_qp_mapping) {
+        if (n->subsys) {
+            error_setg(errp, "iothread-qp-mapping is unavailable with an "
+                       "nvme-subsys device");
+            return false;
+        }
+
+        if (!nvme_check_iothread_qp_mapping(n->iothread_qp_mapping,
+                                            params->max_ioqpairs, errp)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
+/* Context: QEMU global mutex held */
+static void nvme_init_qp_aio_context(NvmeCtrl *n)
+{
+    IOThreadVirtQueueMappingList *node;
+    uint32_t max_ioqpairs = n->params.max_ioqpairs;
+    size_t num_iothreads = 0;
+    size_t cur_iothread = 0;
+
+    for (node = n->iothread_qp_mapping; node; node = node->next) {
+        num_iothreads++;
+    }
+
+    n->qp_aio_context = g_new0(AioContext *, max_ioqpairs + 1);
+    n->qp_aio_context[0] = qemu_get_aio_context();
+    n->ns_aio_context = iothread_get_aio_context(
+        iothread_by_id(n->iothread_qp_mapping->value->iothread));
+
+    for (node = n->iothread_qp_mapping; node; node = node->next) {
+        IOThread *iothread = iothread_by_id(node->value->iothread);
+        AioContext *ctx = iothread_get_aio_context(iothread);
+
+        /* Released in nvme_exit() */
+        object_ref(OBJECT(iothread));
+
+        if (node->value->vqs) {
+            uint16List *qid;
+
+            /* Explicit queue:IOThread assignment */
+            for (qid = node->value->vqs; qid; qid = qid->next) {
+                n->qp_aio_context[qid->value] = ctx;
+            }
+        } else {
+            /* Round-robin queue:IOThread assignment */
+            for (uint32_t i = cur_iothread + 1; i <= max_ioqpairs;
+                 i += num_iothreads) {
+                n->qp_aio_context[i] = ctx;
+            }
+        }
+
+        cur_iothread++;
+    }
+
+    n->irq_bh = qemu_bh_new_guarded(nvme_irq_bh, n,
+                                    &DEVICE(n)->mem_reentrancy_guard);
+}
+
 static void nvme_init_state(NvmeCtrl *n)
 {
     NvmePriCtrlCap *cap = &n->pri_ctrl_cap;
@@ -7930,6 +8514,12 @@ static void nvme_init_state(NvmeCtrl *n)
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
     QTAILQ_INIT(&n->aer_queue);
+    n->features.intvc_cd = bitmap_new(MAX(n->params.msix_qsize,
+                                          n->params.max_ioqpairs + 1));
+
+    if (n->iothread_qp_mapping) {
+        nvme_init_qp_aio_context(n);
+    }
 
     list->numcntl = cpu_to_le16(max_vfs);
     for (i = 0; i < max_vfs; i++) {
@@ -8294,6 +8884,33 @@ static int nvme_init_subsys(NvmeCtrl *n, Error **errp)
     return 0;
 }
 
+/* Context: QEMU global mutex held */
+static int nvme_ns_set_aio_context(NvmeNamespace *ns, AioContext *ctx,
+                                   Error **errp)
+{
+    AioContext *old_context = blk_get_aio_context(ns->blkconf.blk);
+    int ret;
+
+    aio_context_acquire(old_context);
+    ret = blk_set_aio_context(ns->blkconf.blk, ctx, errp);
+    aio_context_release(old_context);
+
+    return ret;
+}
+
+/*
+ * Move the BlockBackend of @ns to the IOThread that processes the I/O queue
+ * pairs of @n before the namespace is attached.
+ */
+bool nvme_attach_ns_aio_context(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
+{
+    if (!n->ns_aio_context) {
+        return true;
+    }
+
+    return nvme_ns_set_aio_context(ns, n->ns_aio_context, errp) == 0;
+}
+
 void nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns)
 {
     uint32_t nsid = ns->params.nsid;
@@ -8346,6 +8963,10 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
             return;
         }
 
+        if (!nvme_attach_ns_aio_context(n, ns, errp)) {
+            return;
+        }
+
         nvme_attach_ns(n, ns);
     }
 }
@@ -8372,6 +8993,26 @@ static void nvme_exit(PCIDevice *pci_dev)
     g_free(n->cq);
     g_free(n->sq);
     g_free(n->aer_reqs);
+    g_free(n->features.intvc_cd);
+
+    if (n->iothread_qp_mapping) {
+        IOThreadVirtQueueMappingList *node;
+
+        /* Try to switch the namespaces back to the main loop */
+        for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
+            ns = nvme_ns(n, i);
+            if (ns) {
+                nvme_ns_set_aio_context(ns, qemu_get_aio_context(), NULL);
+            }
+        }
+
+        for (node = n->iothread_qp_mapping; node; node = node->next) {
+            object_unref(OBJECT(iothread_by_id(node->value->iothread)));
+        }
+
+        qemu_bh_delete(n->irq_bh);
+        g_free(n->qp_aio_context);
+    }
 
     if (n->params.cmb_size_mb) {
         g_free(n->cmb.buf);
@@ -8407,6 +9048,8 @@ static Property nvme_props[] = {
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-qp-mapping", NvmeCtrl,
+                                         iothread_qp_mapping),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
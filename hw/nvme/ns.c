@@ -705,9 +705,13 @@ void nvme_ns_cleanup(NvmeNamespace *ns)
 static void nvme_ns_unrealize(DeviceState *dev)
 {
     NvmeNamespace *ns = NVME_NS(dev);
+    AioContext *ctx = blk_get_aio_context(ns->blkconf.blk);
 
+    /* the controller may have moved the namespace to an IOThread */
+    aio_context_acquire(ctx);
     nvme_ns_drain(ns);
     nvme_ns_shutdown(ns);
+    aio_context_release(ctx);
     nvme_ns_cleanup(ns);
 }
 
@@ -788,6 +792,10 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
 
     }
 
+    if (!nvme_attach_ns_aio_context(n, ns, errp)) {
+        return;
+    }
+
     nvme_attach_ns(n, ns);
 }
 
@@ -21,6 +21,7 @@
 #include "qemu/uuid.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "block/nvme.h"
 
@@ -470,6 +471,7 @@ typedef struct NvmeSQueue {
     uint64_t    dma_addr;
     uint64_t    db_addr;
     uint64_t    ei_addr;
+    AioContext  *ctx;
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
@@ -477,6 +479,10 @@ typedef struct NvmeSQueue {
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
     QTAILQ_ENTRY(NvmeSQueue) entry;
+
+    /* commands handed from an IOThread to the main loop */
+    QEMUBH      *defer_bh;
+    QTAILQ_HEAD(, NvmeRequest) defer_list;
 } NvmeSQueue;
 
 typedef struct NvmeCQueue {
@@ -491,11 +497,19 @@ typedef struct NvmeCQueue {
     uint64_t    dma_addr;
     uint64_t    db_addr;
     uint64_t    ei_addr;
+    AioContext  *ctx;
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
+
+    /* interrupt coalescing */
+    QEMUTimer   *coalesce_timer;
+    uint32_t    coalesced;
+
+    /* the main loop must update the interrupt state of this queue */
+    bool        irq_kick;
 } NvmeCQueue;
 
 #define TYPE_NVME "nvme"
@@ -552,6 +566,12 @@ typedef struct NvmeCtrl {
     uint64_t    dbbuf_eis;
     bool        dbbuf_enabled;
 
+    /* AioContext of each queue pair, see iothread-qp-mapping */
+    IOThreadVirtQueueMappingList *iothread_qp_mapping;
+    AioContext  **qp_aio_context;
+    AioContext  *ns_aio_context;    /* of the namespace BlockBackends */
+    QEMUBH      *irq_bh;
+
     struct {
         MemoryRegion mem;
         uint8_t      *buf;
@@ -594,6 +614,8 @@ typedef struct NvmeCtrl {
 
         uint32_t                async_config;
         NvmeHostBehaviorSupport hbs;
+        uint16_t                int_coalescing;
+        unsigned long           *intvc_cd;  /* Coalescing Disable per vector */
     } features;
 
     NvmePriCtrlCap  pri_ctrl_cap;
@@ -669,6 +691,7 @@ static inline NvmeSecCtrlEntry *nvme_sctrl_for_cntlid(NvmeCtrl *n,
 }
 
 void nvme_attach_ns(NvmeCtrl *n, NvmeNamespace *ns);
+bool nvme_attach_ns_aio_context(NvmeCtrl *n, NvmeNamespace *ns, Error **errp);
 uint16_t nvme_bounce_data(NvmeCtrl *n, void *ptr, uint32_t len,
                           NvmeTxDirection dir, NvmeRequest *req);
 uint16_t nvme_bounce_mdata(NvmeCtrl *n, void *ptr, uint32_t len,
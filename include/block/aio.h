@@ -204,6 +204,9 @@ struct AioContext {
 
     int thread_pool_min;
     int thread_pool_max;
+    /* Host CPUs that thread pool workers run on, NULL if unrestricted */
+    unsigned long *thread_pool_affinity;
+    unsigned long thread_pool_affinity_nbits;
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -728,4 +731,15 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
  */
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp);
+
+/**
+ * aio_context_set_thread_pool_affinity:
+ * @ctx: the aio context
+ * @host_cpus: bitmap of the host CPUs that workers may run on, or NULL
+ *             to leave the affinity of new workers unchanged
+ * @nbits: size of @host_cpus
+ */
+void aio_context_set_thread_pool_affinity(AioContext *ctx,
+                                          unsigned long *host_cpus,
+                                          unsigned long nbits, Error **errp);
 #endif
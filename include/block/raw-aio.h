@@ -74,6 +74,11 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
+
+/* Fixed buffers and registered files, shared by all rings */
+bool luring_register_buf(void *host, size_t size, Error **errp);
+void luring_unregister_buf(void *host, size_t size);
+void luring_unregister_file(BlockDriverState *bs, int fd);
 #endif
 
 #ifdef _WIN32
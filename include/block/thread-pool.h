@@ -38,6 +38,15 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
 int coroutine_fn thread_pool_submit_co(ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPoolFunc *func, void *arg);
 
+/*
+ * Requests submitted between thread_pool_batch_begin() and
+ * thread_pool_batch_end() are queued right away, but idle workers are
+ * only woken up once, by thread_pool_batch_end().  Must be called from
+ * the AioContext of @pool; thread_pool_batch_begin() is idempotent.
+ */
+void thread_pool_batch_begin(ThreadPool *pool);
+void thread_pool_batch_end(ThreadPool *pool);
+
 void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
 
 #endif
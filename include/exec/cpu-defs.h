@@ -168,6 +168,8 @@ typedef struct CPUTLBDesc {
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+typedef struct CPUTLBDirtyRing CPUTLBDirtyRing;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -188,6 +190,11 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /*
+     * Ring of guest RAM pages written while dirty tracking is active,
+     * or NULL if the TCG dirty ring is disabled.
+     */
+    CPUTLBDirtyRing *dirty_ring;
 } CPUTLBCommon;
 
 /*
@@ -25,6 +25,8 @@
 #include "qemu/queue.h"
 #include "qemu/int128.h"
 #include "qemu/notify.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
 #include "qom/object.h"
 #include "qemu/rcu.h"
 
@@ -235,6 +237,12 @@ typedef struct IOMMUTLBEvent {
 /* RAM is an mmap-ed named file */
 #define RAM_NAMED_FILE (1 << 9)
 
+/*
+ * RAM is a private copy-on-write mapping of a template file, which is
+ * opened read-only and must already hold the full size of the RAM.
+ */
+#define RAM_TEMPLATE (1 << 10)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
@@ -1079,6 +1087,13 @@ struct MemoryListener {
 /**
  * struct AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
+typedef struct AddressSpaceMapClient {
+    QEMUBH *bh;
+    QLIST_ENTRY(AddressSpaceMapClient) link;
+} AddressSpaceMapClient;
+
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE (4096)
+
 struct AddressSpace {
     /* private: */
     struct rcu_head rcu;
@@ -1092,6 +1107,17 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Maximum total size of the bounce buffers used by address_space_map() */
+    size_t max_bounce_buffer_size;
+    /* Total size of bounce buffers currently allocated, atomically accessed */
+    size_t bounce_buffer_size;
+    /* Number of bounce buffers allocated and of maps that found none free */
+    Stat64 bounce_buffer_maps;
+    Stat64 bounce_buffer_stalls;
+    /* List of callbacks to invoke when bounce buffers free up */
+    QemuMutex map_client_list_lock;
+    QLIST_HEAD(, AddressSpaceMapClient) map_client_list;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -1108,6 +1134,13 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+
+    /* Where each MemoryRegion was rendered, keyed by MemoryRegion */
+    GHashTable *visits;
+    /* Address windows invalidated by the current memory transaction */
+    GArray *dirty;
+    /* The next update must render the whole view again */
+    bool rerender;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
@@ -1331,7 +1364,7 @@ void memory_region_init_resizeable_ram(MemoryRegion *mr,
  * @align: alignment of the region base address; if 0, the default alignment
  *         (getpagesize()) will be used.
  * @ram_flags: RamBlock flags. Supported flags: RAM_SHARED, RAM_PMEM,
- *             RAM_NORESERVE,
+ *             RAM_NORESERVE, RAM_TEMPLATE.
  * @path: the path in which to allocate the RAM.
  * @offset: offset within the file referenced by path
  * @readonly: true to open @path for reading, false for read/write.
@@ -2831,9 +2864,11 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, hwaddr len,
  * May map a subset of the requested range, given by and returned in @plen.
  * May return %NULL and set *@plen to zero(0), if resources needed to perform
  * the mapping are exhausted.
+ * Regions that are not directly accessible, such as MMIO, are mapped through
+ * bounce buffers, whose total size is limited per address space.
  * Use only for reads OR writes - not for read-modify-write operations.
- * Use cpu_register_map_client() to know when retrying the map operation is
- * likely to succeed.
+ * Use address_space_register_map_client() to know when retrying the map
+ * operation is likely to succeed.
  *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
@@ -2858,6 +2893,27 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          bool is_write, hwaddr access_len);
 
+/* address_space_register_map_client: Register a callback to invoke when
+ * resources for address_space_map() are available again.
+ *
+ * address_space_map may fail when there are not enough resources available,
+ * such as when bounce buffer memory would exceed the limit. The callback can
+ * be used to retry the address_space_map operation. Note that the callback
+ * gets automatically removed after firing.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to invoke when address_space_map() retry is appropriate
+ */
+void address_space_register_map_client(AddressSpace *as, QEMUBH *bh);
+
+/* address_space_unregister_map_client: Unregister a callback that has
+ * previously been registered and not fired yet.
+ *
+ * @as: #AddressSpace to be accessed
+ * @bh: callback to unregister
+ */
+void address_space_unregister_map_client(AddressSpace *as, QEMUBH *bh);
+
 
 /* Internal functions, part of the implementation of address_space_read.  */
 MemTxResult address_space_read_full(AddressSpace *as, hwaddr addr,
@@ -108,7 +108,7 @@ long qemu_maxrampagesize(void);
  *  @size: the size in bytes of the ram block
  *  @mr: the memory region where the ram block is
  *  @ram_flags: RamBlock flags. Supported flags: RAM_SHARED, RAM_PMEM,
- *              RAM_NORESERVE.
+ *              RAM_NORESERVE, RAM_TEMPLATE.
  *  @mem_path or @fd: specify the backing file or device
  *  @offset: Offset into target file
  *  @readonly: true to open @path for reading, false for read/write.
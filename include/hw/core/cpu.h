@@ -268,6 +268,8 @@ struct qemu_work_item;
 /**
  * CPUState:
  * @cpu_index: CPU index (informative).
+ * @qom_path: Canonical QOM path, cached when the CPU is added to the CPU
+ *   list so that it can be reported without the BQL.
  * @cluster_index: Identifies which cluster this CPU is in.
  *   For boards which don't define clusters or for "loose" CPUs not assigned
  *   to a cluster this will be UNASSIGNED_CLUSTER_INDEX; otherwise it will
@@ -415,6 +417,7 @@ struct CPUState {
 
     /* TODO Move common fields from CPUArchState here. */
     int cpu_index;
+    char *qom_path;
     int cluster_index;
     uint32_t tcg_cflags;
     uint32_t halted;
@@ -20,6 +20,7 @@
 #include "sysemu/iothread.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/block-ram-registrar.h"
+#include "qapi/qapi-types-virtio.h"
 #include "qom/object.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
@@ -37,6 +38,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -31,6 +31,16 @@ typedef ssize_t (FilterReceiveIOV)(NetFilterState *nc,
                                    int iovcnt,
                                    NetPacketSent *sent_cb);
 
+/*
+ * Same as FilterReceiveIOV, but a filter that steals the packet may keep
+ * a reference to @buf instead of copying it.
+ */
+typedef ssize_t (FilterReceiveBuf)(NetFilterState *nc,
+                                   NetClientState *sender,
+                                   unsigned flags,
+                                   NetPacketBuf *buf,
+                                   NetPacketSent *sent_cb);
+
 typedef void (FilterStatusChanged) (NetFilterState *nf, Error **errp);
 
 typedef void (FilterHandleEvent) (NetFilterState *nf, int event, Error **errp);
@@ -43,6 +53,7 @@ struct NetFilterClass {
     FilterCleanup *cleanup;
     FilterStatusChanged *status_changed;
     FilterHandleEvent *handle_event;
+    FilterReceiveBuf *receive_buf;
     /* mandatory */
     FilterReceiveIOV *receive_iov;
 };
@@ -70,6 +81,13 @@ ssize_t qemu_netfilter_receive(NetFilterState *nf,
                                int iovcnt,
                                NetPacketSent *sent_cb);
 
+ssize_t qemu_netfilter_receive_buf(NetFilterState *nf,
+                                   NetFilterDirection direction,
+                                   NetClientState *sender,
+                                   unsigned flags,
+                                   NetPacketBuf *buf,
+                                   NetPacketSent *sent_cb);
+
 /* pass the packet to the next filter */
 ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
                                     unsigned flags,
@@ -77,6 +95,12 @@ ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
                                     int iovcnt,
                                     void *opaque);
 
+/* same, for use as the NetQueueDeliverBufFunc of a filter's queue */
+ssize_t qemu_netfilter_pass_buf_to_next(NetClientState *sender,
+                                        unsigned flags,
+                                        NetPacketBuf *buf,
+                                        void *opaque);
+
 void colo_notify_filters_event(int event, Error **errp);
 
 #endif /* QEMU_NET_FILTER_H */
@@ -26,9 +26,37 @@
 
 
 typedef struct NetPacket NetPacket;
+typedef struct NetPacketBuf NetPacketBuf;
 typedef struct NetQueue NetQueue;
 
 typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
+typedef void (NetPacketBufRelease) (void *opaque);
+
+/*
+ * A reference counted packet.  Queues and filters that hold on to a
+ * NetPacketBuf take a reference instead of copying the data, which stays
+ * where its owner put it until the last reference is dropped; then
+ * @release is called with @opaque.  The owner must not modify the data
+ * in the meanwhile.
+ */
+struct NetPacketBuf {
+    unsigned ref;
+    size_t size;
+    NetPacketBufRelease *release;
+    void *opaque;
+    int iovcnt;
+    struct iovec iov[];
+};
+
+/* Wrap @iov without copying the data it points to */
+NetPacketBuf *net_packet_buf_new(const struct iovec *iov, int iovcnt,
+                                 NetPacketBufRelease *release, void *opaque);
+/* Copy @iov into a new buffer, for data that the caller does not own */
+NetPacketBuf *net_packet_buf_copy(const struct iovec *iov, int iovcnt);
+NetPacketBuf *net_packet_buf_ref(NetPacketBuf *buf);
+void net_packet_buf_unref(NetPacketBuf *buf);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(NetPacketBuf, net_packet_buf_unref)
 
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
@@ -44,8 +72,26 @@ typedef ssize_t (NetQueueDeliverFunc)(NetClientState *sender,
                                       int iovcnt,
                                       void *opaque);
 
+/*
+ * Same as NetQueueDeliverFunc, but the callee may keep a reference to
+ * @buf instead of copying it.
+ */
+typedef ssize_t (NetQueueDeliverBufFunc)(NetClientState *sender,
+                                         unsigned flags,
+                                         NetPacketBuf *buf,
+                                         void *opaque);
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque);
 
+/*
+ * Create a queue whose queued packets are handed to @deliver_buf when it
+ * is flushed; @deliver is still used for packets that are delivered
+ * right away.
+ */
+NetQueue *qemu_new_net_queue_buf(NetQueueDeliverFunc *deliver,
+                                 NetQueueDeliverBufFunc *deliver_buf,
+                                 void *opaque);
+
 void qemu_net_queue_append_iov(NetQueue *queue,
                                NetClientState *sender,
                                unsigned flags,
@@ -53,6 +99,12 @@ void qemu_net_queue_append_iov(NetQueue *queue,
                                int iovcnt,
                                NetPacketSent *sent_cb);
 
+void qemu_net_queue_append_buf(NetQueue *queue,
+                               NetClientState *sender,
+                               unsigned flags,
+                               NetPacketBuf *buf,
+                               NetPacketSent *sent_cb);
+
 void qemu_del_net_queue(NetQueue *queue);
 
 ssize_t qemu_net_queue_receive(NetQueue *queue,
@@ -77,6 +129,12 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 int iovcnt,
                                 NetPacketSent *sent_cb);
 
+ssize_t qemu_net_queue_send_buf(NetQueue *queue,
+                                NetClientState *sender,
+                                unsigned flags,
+                                NetPacketBuf *buf,
+                                NetPacketSent *sent_cb);
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
 
@@ -17,6 +17,8 @@
 typedef struct JSONLexer {
     int start_state, state;
     GString *token;
+    const char *buf;
+    size_t tok_begin, tok_end;
     int x, y;
 } JSONLexer;
 
@@ -27,8 +29,8 @@ typedef struct JSONMessageParser {
     JSONLexer lexer;
     int brace_count;
     int bracket_count;
-    GQueue tokens;
-    uint64_t token_size;
+    GArray *tokens;
+    GString *token_text;
 } JSONMessageParser;
 
 void json_message_parser_init(JSONMessageParser *parser,
@@ -281,6 +281,24 @@ void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
  */
 void qemu_coroutine_dec_pool_size(unsigned int additional_pool_size);
 
+typedef struct CoroutinePoolStats {
+    /* coroutines created, respectively destroyed, by the backend */
+    uint64_t allocated;
+    uint64_t freed;
+    /* resizes of the adaptive per-thread pools */
+    uint64_t pool_grows;
+    uint64_t pool_shrinks;
+    /* batches moved from the global pool to a per-thread pool */
+    uint64_t release_pool_refills;
+    unsigned int release_pool_size;
+    unsigned int pool_max_size;
+} CoroutinePoolStats;
+
+/**
+ * Fill @stats with the counters of the coroutine pool
+ */
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats);
+
 #include "qemu/lockable.h"
 
 /**
@@ -189,6 +189,9 @@ char *freq_to_str(uint64_t freq_hz);
 
 bool buffer_is_zero(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
+size_t buffer_copy_changed(void *dst, const void *src, size_t len,
+                           size_t chunk, unsigned long *changed);
+bool test_buffer_copy_changed_next_accel(void);
 
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
@@ -74,9 +74,15 @@ enum plugin_dyn_cb_type {
 enum plugin_dyn_cb_subtype {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_INLINE,
+    PLUGIN_CB_COND,
     PLUGIN_N_CB_SUBTYPES,
 };
 
+struct qemu_plugin_scoreboard {
+    GArray *data;
+    QLIST_ENTRY(qemu_plugin_scoreboard) entry;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -91,12 +97,37 @@ struct qemu_plugin_dyn_cb {
     /* fields specific to each dyn_cb type go here */
     union {
         struct {
+            /* @entry.score is NULL for ops on the single counter at @userp */
+            qemu_plugin_u64 entry;
             enum qemu_plugin_op op;
             uint64_t imm;
         } inline_insn;
+        struct {
+            qemu_plugin_u64 entry;
+            enum qemu_plugin_cond cond;
+            uint64_t imm;
+        } cond;
     };
 };
 
+/*
+ * Return the address of the counter of vCPU 0 for an inline op or a
+ * conditional callback, and in *@stride the distance to the counter of
+ * the next vCPU. Ops registered on a plain pointer share one counter
+ * between all vCPUs, i.e. have a stride of 0.
+ */
+static inline void *plugin_dyn_cb_counter(const struct qemu_plugin_dyn_cb *cb,
+                                          qemu_plugin_u64 entry,
+                                          size_t *stride)
+{
+    if (!entry.score) {
+        *stride = 0;
+        return cb->userp;
+    }
+    *stride = g_array_get_element_size(entry.score->data);
+    return entry.score->data->data + entry.offset;
+}
+
 /* Internal context for instrumenting an instruction */
 struct qemu_plugin_insn {
     GByteArray *data;
@@ -36,5 +36,7 @@ struct EventLoopBase {
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
     int64_t thread_pool_max;
+    unsigned long *thread_pool_affinity;
+    unsigned long thread_pool_affinity_nbits;
 };
 #endif
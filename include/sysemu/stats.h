@@ -42,4 +42,10 @@ void add_stats_schema(StatsSchemaList **, StatsProvider, StatsTarget,
  */
 bool apply_str_list_filter(const char *string, strList *list);
 
+/*
+ * Register the "coroutine" provider, which reports the coroutine pool
+ * counters for the "vm" target.
+ */
+void coroutine_stats_init(void);
+
 #endif /* STATS_H */
@@ -173,6 +173,14 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
 
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_thread_pool_affinity(iothread->ctx,
+                                         base->thread_pool_affinity,
+                                         base->thread_pool_affinity_nbits,
+                                         errp);
 }
 
 
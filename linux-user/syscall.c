@@ -138,6 +138,7 @@
 #include "qemu/guest-random.h"
 #include "qemu/selfmap.h"
 #include "user/syscall-trace.h"
+#include "trace/control.h"
 #include "special-errno.h"
 #include "qapi/error.h"
 #include "fd-trans.h"
@@ -6647,6 +6648,7 @@ static void *clone_func(void *arg)
 
     rcu_register_thread();
     tcg_register_thread();
+    trace_init_thread();
     env = info->env;
     cpu = env_cpu(env);
     thread_cpu = cpu;
@@ -0,0 +1,358 @@
+/*
+ * Multifd XBZRLE delta encoding implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "trace.h"
+#include "options.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "multifd.h"
+
+/*
+ * Every page of a packet is preceded by one encoding byte.  XBZRLE
+ * pages additionally carry a big endian 16 bit length, like the
+ * RAM_SAVE_FLAG_XBZRLE pages sent on the main channel.
+ */
+#define MULTIFD_XBZRLE_RAW      0
+#define MULTIFD_XBZRLE_ZERO     1
+#define MULTIFD_XBZRLE_SAME     2
+#define MULTIFD_XBZRLE_DELTA    3
+
+#define MULTIFD_XBZRLE_HDR_LEN  3
+
+struct xbzrle_data {
+    /* cache of the pages last sent through this channel */
+    PageCache *cache;
+    /* copy of the page being encoded, of size qemu_target_page_size() */
+    uint8_t *current_buf;
+    /* zeroed page used to refresh the cache on zero pages */
+    uint8_t *zero_page;
+    /* encoded packet buffer */
+    uint8_t *zbuff;
+    /* size of encoded packet buffer */
+    uint32_t zbuff_len;
+};
+
+static uint32_t xbzrle_packet_len(uint32_t page_count, uint32_t page_size)
+{
+    return page_count * (page_size + MULTIFD_XBZRLE_HDR_LEN);
+}
+
+/* Multifd XBZRLE encoding */
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Each channel gets its own slice of xbzrle-cache-size.  Pages are
+ * always routed to the same channel, so the slice only ever holds
+ * pages that were sent through this channel.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+    uint64_t cache_size = migrate_xbzrle_cache_size() /
+                          migrate_multifd_channels();
+    Error *local_err = NULL;
+
+    x->cache = cache_init(cache_size, p->page_size, &local_err);
+    if (!x->cache) {
+        error_propagate_prepend(errp, local_err, "multifd %u: ", p->id);
+        g_free(x);
+        return -1;
+    }
+    x->current_buf = g_try_malloc(p->page_size);
+    x->zero_page = g_try_malloc0(p->page_size);
+    x->zbuff_len = xbzrle_packet_len(p->page_count, p->page_size);
+    x->zbuff = g_try_malloc(x->zbuff_len);
+    if (!x->current_buf || !x->zero_page || !x->zbuff) {
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffers",
+                   p->id);
+        cache_fini(x->cache);
+        g_free(x->current_buf);
+        g_free(x->zero_page);
+        g_free(x->zbuff);
+        g_free(x);
+        return -1;
+    }
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Release the page cache and buffers.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+
+    cache_fini(x->cache);
+    x->cache = NULL;
+    g_free(x->current_buf);
+    x->current_buf = NULL;
+    g_free(x->zero_page);
+    x->zero_page = NULL;
+    g_free(x->zbuff);
+    x->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode every page against the copy cached by this channel.  Pages
+ * that are not cached, or whose delta would not be smaller than the
+ * page itself, are sent raw.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    RAMBlock *block = p->pages->block;
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    uint32_t out_size = 0;
+    uint32_t delta_pages = 0;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num; i++) {
+        ram_addr_t addr = block->offset + p->normal[i];
+        uint8_t *out = x->zbuff + out_size;
+        uint8_t *prev;
+        int encoded_len;
+
+        /*
+         * The guest might be running, so encode a stable copy; that
+         * copy is also what ends up in the cache.
+         */
+        memcpy(x->current_buf, block->host + p->normal[i], p->page_size);
+
+        if (buffer_is_zero(x->current_buf, p->page_size)) {
+            /* We don't care if this fails as long as it updated an old one */
+            cache_insert(x->cache, addr, x->zero_page, generation);
+            out[0] = MULTIFD_XBZRLE_ZERO;
+            out_size += 1;
+            continue;
+        }
+
+        if (!cache_is_cached(x->cache, addr, generation)) {
+            cache_insert(x->cache, addr, x->current_buf, generation);
+            goto send_raw;
+        }
+
+        prev = get_cached_data(x->cache, addr);
+        encoded_len = xbzrle_encode_buffer(prev, x->current_buf, p->page_size,
+                                           out + MULTIFD_XBZRLE_HDR_LEN,
+                                           p->page_size);
+        if (encoded_len == 0) {
+            out[0] = MULTIFD_XBZRLE_SAME;
+            out_size += 1;
+            continue;
+        }
+
+        memcpy(prev, x->current_buf, p->page_size);
+        if (encoded_len < 0) {
+            goto send_raw;
+        }
+
+        out[0] = MULTIFD_XBZRLE_DELTA;
+        stw_be_p(out + 1, encoded_len);
+        out_size += MULTIFD_XBZRLE_HDR_LEN + encoded_len;
+        delta_pages++;
+        continue;
+
+send_raw:
+        out[0] = MULTIFD_XBZRLE_RAW;
+        memcpy(out + 1, x->current_buf, p->page_size);
+        out_size += 1 + p->page_size;
+    }
+
+    trace_multifd_xbzrle_send_prepare(p->id, p->normal_num, delta_pages,
+                                      out_size);
+
+    p->iov[p->iovs_num].iov_base = x->zbuff;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Allocate the buffer for the encoded packet.  Deltas are applied on
+ * top of guest memory, so no cache is needed on this side.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->zbuff_len = xbzrle_packet_len(p->page_count, p->page_size);
+    x->zbuff = g_try_malloc(x->zbuff_len);
+    if (!x->zbuff) {
+        g_free(x);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = x;
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->data;
+
+    g_free(x->zbuff);
+    x->zbuff = NULL;
+    g_free(p->data);
+    p->data = NULL;
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the encoded buffer, and apply every record to its page.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size > x->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u size max %u",
+                   p->id, in_size, x->zbuff_len);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)x->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *host = p->host + p->normal[i];
+        uint16_t encoded_len;
+        uint8_t enc;
+
+        if (pos >= in_size) {
+            goto truncated;
+        }
+        enc = x->zbuff[pos++];
+
+        switch (enc) {
+        case MULTIFD_XBZRLE_ZERO:
+            if (!buffer_is_zero(host, p->page_size)) {
+                memset(host, 0, p->page_size);
+            }
+            break;
+        case MULTIFD_XBZRLE_SAME:
+            break;
+        case MULTIFD_XBZRLE_RAW:
+            if (in_size - pos < p->page_size) {
+                goto truncated;
+            }
+            memcpy(host, x->zbuff + pos, p->page_size);
+            pos += p->page_size;
+            break;
+        case MULTIFD_XBZRLE_DELTA:
+            if (in_size - pos < 2) {
+                goto truncated;
+            }
+            encoded_len = lduw_be_p(x->zbuff + pos);
+            pos += 2;
+            if (encoded_len > p->page_size || in_size - pos < encoded_len) {
+                goto truncated;
+            }
+            if (xbzrle_decode_buffer(x->zbuff + pos, encoded_len, host,
+                                     p->page_size) == -1) {
+                error_setg(errp, "multifd %u: failed to decode XBZRLE page "
+                           "at offset " RAM_ADDR_FMT, p->id, p->normal[i]);
+                return -1;
+            }
+            pos += encoded_len;
+            break;
+        default:
+            error_setg(errp, "multifd %u: unknown page encoding %u",
+                       p->id, enc);
+            return -1;
+        }
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: truncated XBZRLE packet of size %u",
+               p->id, in_size);
+    return -1;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages,
+    .page_affine = true,
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
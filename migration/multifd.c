@@ -372,6 +372,11 @@ struct {
     int exiting;
     /* multifd ops */
     MultiFDMethods *ops;
+    /*
+     * pages waiting to be sent, one per channel.  Only used when the
+     * ops are page affine, otherwise 'pages' is used for all channels.
+     */
+    MultiFDPages_t **affine_pages;
 } *multifd_send_state;
 
 /*
@@ -438,11 +443,114 @@ static int multifd_send_pages(QEMUFile *f)
     return 1;
 }
 
+/*
+ * Page affine methods (see MultiFDMethods) keep state about each page
+ * inside the channel that sent it, so instead of handing the pages to
+ * whichever channel is free, every channel gets its own pages array
+ * and stripes of MULTIFD_PACKET_SIZE bytes of ram_addr_t space are
+ * always sent through the same channel.  As each channel is a FIFO,
+ * this also guarantees that the destination receives the updates of a
+ * page in the order they were generated.
+ */
+
+bool multifd_send_page_affine(void)
+{
+    return migrate_multifd() && multifd_ops[migrate_multifd_compression()] &&
+           multifd_ops[migrate_multifd_compression()]->page_affine;
+}
+
+static int multifd_page_channel(RAMBlock *block, ram_addr_t offset)
+{
+    return ((block->offset + offset) / MULTIFD_PACKET_SIZE) %
+           migrate_multifd_channels();
+}
+
+static int multifd_send_affine_pages(int id)
+{
+    MultiFDSendParams *p = &multifd_send_state->params[id];
+    MultiFDPages_t *pages = multifd_send_state->affine_pages[id];
+
+    if (qatomic_read(&multifd_send_state->exiting)) {
+        return -1;
+    }
+
+    /*
+     * Keep channels_ready accounting the same as multifd_send_pages(),
+     * multifd_send_sync_main() depends on it.  The token we take may
+     * belong to another channel, but 'p' posts a new one as soon as
+     * it finishes its current job.
+     */
+    qemu_sem_wait(&multifd_send_state->channels_ready);
+    qemu_mutex_lock(&p->mutex);
+    while (p->pending_job && !p->quit) {
+        qemu_cond_wait(&p->cond_idle, &p->mutex);
+    }
+    if (p->quit) {
+        error_report("%s: channel %d has already quit!", __func__, id);
+        qemu_mutex_unlock(&p->mutex);
+        return -1;
+    }
+    p->pending_job++;
+    assert(!p->pages->num);
+    assert(!p->pages->block);
+
+    p->packet_num = multifd_send_state->packet_num++;
+    multifd_send_state->affine_pages[id] = p->pages;
+    p->pages = pages;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 1;
+}
+
+static int multifd_queue_affine_page(RAMBlock *block, ram_addr_t offset)
+{
+    int id = multifd_page_channel(block, offset);
+    MultiFDPages_t *pages = multifd_send_state->affine_pages[id];
+
+    if (pages->block && pages->block != block) {
+        if (multifd_send_affine_pages(id) < 0) {
+            return -1;
+        }
+        pages = multifd_send_state->affine_pages[id];
+    }
+
+    pages->block = block;
+    pages->offset[pages->num] = offset;
+    pages->num++;
+
+    if (pages->num == pages->allocated) {
+        if (multifd_send_affine_pages(id) < 0) {
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+static int multifd_flush_affine_pages(void)
+{
+    int i;
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        if (multifd_send_state->affine_pages[i]->num &&
+            multifd_send_affine_pages(i) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset)
 {
     MultiFDPages_t *pages = multifd_send_state->pages;
     bool changed = false;
 
+    if (multifd_send_state->affine_pages) {
+        return multifd_queue_affine_page(block, offset);
+    }
+
     if (!pages->block) {
         pages->block = block;
     }
@@ -503,6 +611,7 @@ static void multifd_send_terminate_threads(Error *err)
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
         qemu_sem_post(&p->sem);
+        qemu_cond_broadcast(&p->cond_idle);
         if (p->c) {
             qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
         }
@@ -537,6 +646,7 @@ void multifd_save_cleanup(void)
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
         qemu_sem_destroy(&p->sem_sync);
+        qemu_cond_destroy(&p->cond_idle);
         g_free(p->name);
         p->name = NULL;
         multifd_pages_clear(p->pages);
@@ -559,6 +669,13 @@ void multifd_save_cleanup(void)
     multifd_send_state->params = NULL;
     multifd_pages_clear(multifd_send_state->pages);
     multifd_send_state->pages = NULL;
+    if (multifd_send_state->affine_pages) {
+        for (i = 0; i < migrate_multifd_channels(); i++) {
+            multifd_pages_clear(multifd_send_state->affine_pages[i]);
+        }
+        g_free(multifd_send_state->affine_pages);
+        multifd_send_state->affine_pages = NULL;
+    }
     g_free(multifd_send_state);
     multifd_send_state = NULL;
 }
@@ -594,6 +711,12 @@ int multifd_send_sync_main(QEMUFile *f)
             return -1;
         }
     }
+    if (multifd_send_state->affine_pages) {
+        if (multifd_flush_affine_pages() < 0) {
+            error_report("%s: multifd_send_affine_pages fail", __func__);
+            return -1;
+        }
+    }
 
     /*
      * When using zero-copy, it's necessary to flush the pages before any of
@@ -732,6 +855,7 @@ static void *multifd_send_thread(void *opaque)
             stat64_add(&mig_stats.transferred, p->next_packet_size);
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
+            qemu_cond_signal(&p->cond_idle);
             qemu_mutex_unlock(&p->mutex);
 
             if (flags & MULTIFD_FLAG_SYNC) {
@@ -922,6 +1046,10 @@ int multifd_save_setup(Error **errp)
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
     qatomic_set(&multifd_send_state->exiting, 0);
     multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    if (multifd_send_state->ops->page_affine) {
+        multifd_send_state->affine_pages = g_new0(MultiFDPages_t *,
+                                                  thread_count);
+    }
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -929,6 +1057,11 @@ int multifd_save_setup(Error **errp)
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem, 0);
         qemu_sem_init(&p->sem_sync, 0);
+        qemu_cond_init(&p->cond_idle);
+        if (multifd_send_state->affine_pages) {
+            multifd_send_state->affine_pages[i] =
+                multifd_pages_init(page_count);
+        }
         p->quit = false;
         p->pending_job = 0;
         p->id = i;
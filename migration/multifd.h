@@ -23,6 +23,7 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 int multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+bool multifd_send_page_affine(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -33,6 +34,7 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -92,6 +94,8 @@ typedef struct {
     QemuSemaphore sem;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* signaled when pending_job drops, for page affine methods */
+    QemuCond cond_idle;
 
     /* this mutex protects the following parameters */
     QemuMutex mutex;
@@ -204,6 +208,12 @@ typedef struct {
     void (*recv_cleanup)(MultiFDRecvParams *p);
     /* Read all pages */
     int (*recv_pages)(MultiFDRecvParams *p, Error **errp);
+    /*
+     * The method keeps per-channel state about the pages it sent, so
+     * a given page must always go through the same channel, and zero
+     * pages must not be sent on the main channel.
+     */
+    bool page_affine;
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
@@ -355,6 +355,12 @@ static int test_ramblock_postcopiable(RAMBlock *rb, Error **errp)
         return 1;
     }
 
+    if (qemu_ram_is_template(rb)) {
+        error_setg(errp, "Postcopy is not supported with the template "
+                   "block %s", block_name);
+        return 1;
+    }
+
     if (rb->fd >= 0) {
         fs = qemu_fd_getfs(rb->fd);
         if (fs != QEMU_FS_TYPE_TMPFS && fs != QEMU_FS_TYPE_HUGETLBFS) {
@@ -2141,6 +2141,14 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
+    /*
+     * Page affine multifd methods detect zero pages themselves, the
+     * channel must see every page it is responsible for.
+     */
+    if (multifd_send_page_affine() && !migration_in_postcopy()) {
+        return ram_save_multifd_page(pss->pss_channel, block, offset);
+    }
+
     res = save_zero_page(pss, pss->pss_channel, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -3881,6 +3889,7 @@ static int ram_load_precopy(QEMUFile *f)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
     int flags = 0, ret = 0, invalid_flags = 0, len = 0, i = 0;
+    g_autofree uint8_t *template_buf = NULL;
     /* ADVISE is earlier, it shows the source has the postcopy capability on */
     bool postcopy_advised = migration_incoming_postcopy_advised();
     if (!migrate_compress()) {
@@ -3890,6 +3899,7 @@ static int ram_load_precopy(QEMUFile *f)
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
         ram_addr_t addr, total_ram_bytes;
         void *host = NULL, *host_bak = NULL;
+        bool from_template = false;
         uint8_t ch;
 
         /*
@@ -3922,6 +3932,7 @@ static int ram_load_precopy(QEMUFile *f)
                                                     RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
+            from_template = block && qemu_ram_is_template(block);
             /*
              * After going into COLO stage, we should not load the page
              * into SVM's memory directly, we put them into colo_cache firstly.
@@ -3999,7 +4010,8 @@ static int ram_load_precopy(QEMUFile *f)
                     }
                     if (migrate_ignore_shared()) {
                         hwaddr addr = qemu_get_be64(f);
-                        if (migrate_ram_is_ignored(block) &&
+                        if ((migrate_ram_is_ignored(block) ||
+                             qemu_ram_is_template(block)) &&
                             block->mr->addr != addr) {
                             error_report("Mismatched GPAs for block %s "
                                          "%" PRId64 "!= %" PRId64,
@@ -4026,6 +4038,23 @@ static int ram_load_precopy(QEMUFile *f)
             break;
 
         case RAM_SAVE_FLAG_PAGE:
+            if (from_template) {
+                uint8_t *buf;
+
+                /*
+                 * Keep sharing the template's page with other guests
+                 * unless the incoming page actually differs from it.
+                 */
+                if (!template_buf) {
+                    template_buf = g_malloc(TARGET_PAGE_SIZE);
+                }
+                buf = template_buf;
+                qemu_get_buffer_in_place(f, &buf, TARGET_PAGE_SIZE);
+                if (memcmp(host, buf, TARGET_PAGE_SIZE) != 0) {
+                    memcpy(host, buf, TARGET_PAGE_SIZE);
+                }
+                break;
+            }
             qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
             break;
 
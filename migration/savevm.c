@@ -1603,11 +1603,9 @@ void qemu_savevm_state_cleanup(void)
     }
 }
 
-static int qemu_savevm_state(QEMUFile *f, Error **errp)
+static int qemu_savevm_state_begin(QEMUFile *f, Error **errp)
 {
-    int ret;
     MigrationState *ms = migrate_get_current();
-    MigrationStatus status;
 
     if (migration_is_running(ms->state)) {
         error_setg(errp, QERR_MIGRATION_ACTIVE);
@@ -1630,11 +1628,19 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
     qemu_savevm_state_setup(f);
     qemu_mutex_lock_iothread();
 
-    while (qemu_file_get_error(f) == 0) {
-        if (qemu_savevm_state_iterate(f, false) > 0) {
-            break;
-        }
-    }
+    return 0;
+}
+
+/*
+ * Write whatever is left of the state and tear down the migration
+ * state set up by qemu_savevm_state_begin().  Nothing is written if
+ * @f already has an error.
+ */
+static int qemu_savevm_state_end(QEMUFile *f, Error **errp)
+{
+    int ret;
+    MigrationState *ms = migrate_get_current();
+    MigrationStatus status;
 
     ret = qemu_file_get_error(f);
     if (ret == 0) {
@@ -1660,6 +1666,24 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
     return ret;
 }
 
+static int qemu_savevm_state(QEMUFile *f, Error **errp)
+{
+    int ret;
+
+    ret = qemu_savevm_state_begin(f, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    while (qemu_file_get_error(f) == 0) {
+        if (qemu_savevm_state_iterate(f, false) > 0) {
+            break;
+        }
+    }
+
+    return qemu_savevm_state_end(f, errp);
+}
+
 void qemu_savevm_live_state(QEMUFile *f)
 {
     /* save QEMU_VM_SECTION_END section */
@@ -2917,32 +2941,33 @@ int qemu_loadvm_approve_switchover(void)
     return migrate_send_rp_switchover_ack(mis);
 }
 
-bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
-                  bool has_devices, strList *devices, Error **errp)
+/*
+ * Check that a snapshot can be taken and return the node that the VM
+ * state is saved to, or NULL on error.
+ */
+static BlockDriverState *save_snapshot_prepare(const char *name,
+                                               bool overwrite,
+                                               const char *vmstate,
+                                               bool has_devices,
+                                               strList *devices,
+                                               Error **errp)
 {
-    BlockDriverState *bs;
-    QEMUSnapshotInfo sn1, *sn = &sn1;
-    int ret = -1, ret2;
-    QEMUFile *f;
-    int saved_vm_running;
-    uint64_t vm_state_size;
-    g_autoptr(GDateTime) now = g_date_time_new_now_local();
-    AioContext *aio_context;
+    int ret2;
 
     GLOBAL_STATE_CODE();
 
     if (migration_is_blocked(errp)) {
-        return false;
+        return NULL;
     }
 
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow making snapshot "
                    "right now. Try once more later.");
-        return false;
+        return NULL;
     }
 
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
-        return false;
+        return NULL;
     }
 
     /* Delete old snapshots of the same name */
@@ -2950,32 +2975,41 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         if (overwrite) {
             if (bdrv_all_delete_snapshot(name, has_devices,
                                          devices, errp) < 0) {
-                return false;
+                return NULL;
             }
         } else {
             ret2 = bdrv_all_has_snapshot(name, has_devices, devices, errp);
             if (ret2 < 0) {
-                return false;
+                return NULL;
             }
             if (ret2 == 1) {
                 error_setg(errp,
                            "Snapshot '%s' already exists in one or more devices",
                            name);
-                return false;
+                return NULL;
             }
         }
     }
 
-    bs = bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
-    if (bs == NULL) {
-        return false;
-    }
-    aio_context = bdrv_get_aio_context(bs);
-
-    saved_vm_running = runstate_is_running();
+    return bdrv_all_find_vmstate_bs(vmstate, has_devices, devices, errp);
+}
 
-    global_state_store();
-    vm_stop(RUN_STATE_SAVE_VM);
+/*
+ * Save the VM state to @bs and create the snapshot on all devices,
+ * with the VM stopped.  If @live_file is not NULL, the iterable state
+ * has already been written to it while the VM was running and only
+ * the remainder is saved here.  @live_file is closed in all cases.
+ */
+static int save_snapshot_stopped(BlockDriverState *bs, const char *name,
+                                 QEMUFile *live_file, bool has_devices,
+                                 strList *devices, Error **errp)
+{
+    QEMUSnapshotInfo sn1, *sn = &sn1;
+    int ret = -1, ret2;
+    QEMUFile *f;
+    uint64_t vm_state_size;
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    AioContext *aio_context = bdrv_get_aio_context(bs);
 
     bdrv_drain_all_begin();
 
@@ -3001,12 +3035,17 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
     }
 
     /* save the VM state */
-    f = qemu_fopen_bdrv(bs, 1);
-    if (!f) {
-        error_setg(errp, "Could not open VM state file");
-        goto the_end;
+    if (live_file) {
+        f = live_file;
+        ret = qemu_savevm_state_end(f, errp);
+    } else {
+        f = qemu_fopen_bdrv(bs, 1);
+        if (!f) {
+            error_setg(errp, "Could not open VM state file");
+            goto the_end;
+        }
+        ret = qemu_savevm_state(f, errp);
     }
-    ret = qemu_savevm_state(f, errp);
     vm_state_size = qemu_file_transferred_noflush(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
@@ -3041,6 +3080,29 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
 
     bdrv_drain_all_end();
 
+    return ret;
+}
+
+bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
+                  bool has_devices, strList *devices, Error **errp)
+{
+    BlockDriverState *bs;
+    int saved_vm_running;
+    int ret;
+
+    bs = save_snapshot_prepare(name, overwrite, vmstate, has_devices, devices,
+                               errp);
+    if (bs == NULL) {
+        return false;
+    }
+
+    saved_vm_running = runstate_is_running();
+
+    global_state_store();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    ret = save_snapshot_stopped(bs, name, NULL, has_devices, devices, errp);
+
     if (saved_vm_running) {
         vm_start();
     }
@@ -3267,8 +3329,23 @@ typedef struct SnapshotJob {
     Coroutine *co;
     Error **errp;
     bool ret;
+
+    /* Only used by snapshot-save with live=true */
+    bool live;
+    BlockDriverState *vmstate_bs;
+    Error *vmstate_blocker;
+    QEMUFile *file;
+    int64_t start_time;
+    uint64_t transferred;
+    bool converged;
 } SnapshotJob;
 
+/*
+ * Give up on convergence after this many dirty bitmap syncs; whatever
+ * is still dirty is then written with the VM stopped.
+ */
+#define SNAPSHOT_LIVE_MAX_SYNCS 16
+
 static void qmp_snapshot_job_free(SnapshotJob *s)
 {
     g_free(s->tag);
@@ -3277,6 +3354,39 @@ static void qmp_snapshot_job_free(SnapshotJob *s)
 }
 
 
+/*
+ * The VM state is written to vmstate_bs from several bottom halves while
+ * the monitor keeps running, so pin the node and keep it from being
+ * deleted or snapshotted behind our back until the job is done with it.
+ */
+static void snapshot_save_live_hold_vmstate(SnapshotJob *s)
+{
+    bdrv_ref(s->vmstate_bs);
+    error_setg(&s->vmstate_blocker,
+               "snapshot-save job '%s' is writing the VM state",
+               s->common.id);
+    bdrv_op_block(s->vmstate_bs, BLOCK_OP_TYPE_INTERNAL_SNAPSHOT,
+                  s->vmstate_blocker);
+    bdrv_op_block(s->vmstate_bs, BLOCK_OP_TYPE_INTERNAL_SNAPSHOT_DELETE,
+                  s->vmstate_blocker);
+    bdrv_op_block(s->vmstate_bs, BLOCK_OP_TYPE_DRIVE_DEL,
+                  s->vmstate_blocker);
+}
+
+static void snapshot_save_live_release_vmstate(SnapshotJob *s)
+{
+    AioContext *aio_context = bdrv_get_aio_context(s->vmstate_bs);
+
+    bdrv_op_unblock_all(s->vmstate_bs, s->vmstate_blocker);
+    error_free(s->vmstate_blocker);
+    s->vmstate_blocker = NULL;
+
+    aio_context_acquire(aio_context);
+    bdrv_unref(s->vmstate_bs);
+    aio_context_release(aio_context);
+    s->vmstate_bs = NULL;
+}
+
 static void snapshot_load_job_bh(void *opaque)
 {
     Job *job = opaque;
@@ -3313,6 +3423,129 @@ static void snapshot_save_job_bh(void *opaque)
     aio_co_wake(s->co);
 }
 
+/*
+ * Live snapshot-save: RAM and other iterable state are streamed to the
+ * vmstate area while the guest keeps running, like precopy migration.
+ * The VM is only stopped once the remaining state can be written
+ * within downtime-limit; the disk snapshots are created at that same
+ * point, so that they are consistent with the saved VM state.
+ */
+static void snapshot_save_live_begin_bh(void *opaque)
+{
+    Job *job = opaque;
+    SnapshotJob *s = container_of(job, SnapshotJob, common);
+    AioContext *aio_context;
+
+    s->ret = false;
+    s->vmstate_bs = save_snapshot_prepare(s->tag, false, s->vmstate,
+                                          true, s->devices, s->errp);
+    if (!s->vmstate_bs) {
+        goto out;
+    }
+    snapshot_save_live_hold_vmstate(s);
+
+    aio_context = bdrv_get_aio_context(s->vmstate_bs);
+    aio_context_acquire(aio_context);
+    s->file = qemu_fopen_bdrv(s->vmstate_bs, 1);
+    if (!s->file) {
+        error_setg(s->errp, "Could not open VM state file");
+    } else if (qemu_savevm_state_begin(s->file, s->errp) < 0) {
+        qemu_fclose(s->file);
+        s->file = NULL;
+    }
+    aio_context_release(aio_context);
+
+    s->start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    s->ret = s->file != NULL;
+    if (!s->ret) {
+        snapshot_save_live_release_vmstate(s);
+    }
+
+out:
+    if (!s->ret) {
+        qmp_snapshot_job_free(s);
+    }
+    aio_co_wake(s->co);
+}
+
+static void snapshot_save_live_iterate_bh(void *opaque)
+{
+    Job *job = opaque;
+    SnapshotJob *s = container_of(job, SnapshotJob, common);
+    AioContext *aio_context = bdrv_get_aio_context(s->vmstate_bs);
+    uint64_t must_precopy = 0, can_postcopy = 0;
+    uint64_t transferred, threshold;
+    int64_t elapsed;
+    int ret;
+
+    aio_context_acquire(aio_context);
+    ret = qemu_savevm_state_iterate(s->file, false);
+    aio_context_release(aio_context);
+
+    transferred = qemu_file_transferred(s->file);
+    job_progress_update(&s->common, transferred - s->transferred);
+    s->transferred = transferred;
+
+    if (ret != 0 || qemu_file_get_error(s->file)) {
+        s->converged = true;
+        goto out;
+    }
+
+    /* Bytes that can be written within downtime-limit at the current rate */
+    elapsed = MAX(qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - s->start_time, 1);
+    threshold = transferred * migrate_downtime_limit() / elapsed;
+
+    qemu_savevm_state_pending_estimate(&must_precopy, &can_postcopy);
+    if (must_precopy + can_postcopy <= threshold) {
+        qemu_savevm_state_pending_exact(&must_precopy, &can_postcopy);
+    }
+    job_progress_set_remaining(&s->common, must_precopy + can_postcopy);
+
+    s->converged = must_precopy + can_postcopy <= threshold ||
+        stat64_get(&mig_stats.dirty_sync_count) >= SNAPSHOT_LIVE_MAX_SYNCS;
+
+out:
+    aio_co_wake(s->co);
+}
+
+static void snapshot_save_live_complete_bh(void *opaque)
+{
+    Job *job = opaque;
+    SnapshotJob *s = container_of(job, SnapshotJob, common);
+    int saved_vm_running = runstate_is_running();
+
+    global_state_store();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    s->ret = save_snapshot_stopped(s->vmstate_bs, s->tag, s->file,
+                                   true, s->devices, s->errp) == 0;
+    s->file = NULL;
+    snapshot_save_live_release_vmstate(s);
+
+    if (saved_vm_running) {
+        vm_start();
+    }
+
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+}
+
+static void snapshot_save_live_cancel_bh(void *opaque)
+{
+    Job *job = opaque;
+    SnapshotJob *s = container_of(job, SnapshotJob, common);
+
+    qemu_file_set_error(s->file, -ECANCELED);
+    qemu_savevm_state_end(s->file, NULL);
+    qemu_fclose(s->file);
+    s->file = NULL;
+    s->ret = false;
+    snapshot_save_live_release_vmstate(s);
+
+    qmp_snapshot_job_free(s);
+    aio_co_wake(s->co);
+}
+
 static void snapshot_delete_job_bh(void *opaque)
 {
     Job *job = opaque;
@@ -3326,11 +3559,47 @@ static void snapshot_delete_job_bh(void *opaque)
     aio_co_wake(s->co);
 }
 
+static int coroutine_fn snapshot_save_live_run(Job *job)
+{
+    SnapshotJob *s = container_of(job, SnapshotJob, common);
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            snapshot_save_live_begin_bh, job);
+    qemu_coroutine_yield();
+    if (!s->ret) {
+        return -1;
+    }
+
+    /*
+     * Each iteration is bounded in time by the save handlers; going
+     * through a BH every time lets the main loop run in between.
+     */
+    while (!s->converged && !job_is_cancelled(job)) {
+        job_pause_point(job);
+        if (job_is_cancelled(job)) {
+            break;
+        }
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                snapshot_save_live_iterate_bh, job);
+        qemu_coroutine_yield();
+    }
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            job_is_cancelled(job) ?
+                            snapshot_save_live_cancel_bh :
+                            snapshot_save_live_complete_bh, job);
+    qemu_coroutine_yield();
+    return s->ret ? 0 : -1;
+}
+
 static int coroutine_fn snapshot_save_job_run(Job *job, Error **errp)
 {
     SnapshotJob *s = container_of(job, SnapshotJob, common);
     s->errp = errp;
     s->co = qemu_coroutine_self();
+    if (s->live) {
+        return snapshot_save_live_run(job);
+    }
     aio_bh_schedule_oneshot(qemu_get_aio_context(),
                             snapshot_save_job_bh, job);
     qemu_coroutine_yield();
@@ -3383,6 +3652,7 @@ void qmp_snapshot_save(const char *job_id,
                        const char *tag,
                        const char *vmstate,
                        strList *devices,
+                       bool has_live, bool live,
                        Error **errp)
 {
     SnapshotJob *s;
@@ -3397,6 +3667,7 @@ void qmp_snapshot_save(const char *job_id,
     s->tag = g_strdup(tag);
     s->vmstate = g_strdup(vmstate);
     s->devices = QAPI_CLONE(strList, devices);
+    s->live = has_live && live;
 
     job_start(&s->common);
 }
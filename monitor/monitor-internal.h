@@ -151,6 +151,8 @@ typedef struct {
     QemuMutex qmp_queue_lock;
     /* Input queue that holds all the parsed QMP requests */
     GQueue *qmp_requests;
+    /* In-band requests queued or being dispatched, under qmp_queue_lock */
+    unsigned int qmp_requests_in_flight;
 } MonitorQMP;
 
 /**
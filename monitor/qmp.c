@@ -31,6 +31,7 @@
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlist.h"
+#include "qemu/rcu.h"
 #include "trace.h"
 
 /*
@@ -95,6 +96,7 @@ static void monitor_qmp_cleanup_req_queue_locked(MonitorQMP *mon)
 {
     while (!g_queue_is_empty(mon->qmp_requests)) {
         qmp_request_free(g_queue_pop_head(mon->qmp_requests));
+        mon->qmp_requests_in_flight--;
     }
 }
 
@@ -354,6 +356,9 @@ void coroutine_fn monitor_qmp_dispatcher_co(void *data)
             monitor_resume(&mon->common);
         }
 
+        WITH_QEMU_LOCK_GUARD(&mon->qmp_queue_lock) {
+            mon->qmp_requests_in_flight--;
+        }
         qmp_request_free(req_obj);
 
         /*
@@ -378,6 +383,51 @@ void qmp_dispatcher_co_wake(void)
     }
 }
 
+/*
+ * Execute a 'no-bql' command right away in the monitor I/O thread.
+ * Only done when no earlier in-band request of @mon is queued or
+ * running, so that responses are still sent in order; the check stays
+ * valid after dropping the lock because requests of @mon are only
+ * queued from this thread.
+ *
+ * Return whether the command was executed.
+ */
+static bool monitor_qmp_dispatch_no_bql(MonitorQMP *mon, QDict *qdict)
+{
+    const char *command;
+    const QmpCommand *cmd;
+
+    if (!mon->common.use_io_thread) {
+        return false;
+    }
+
+    command = qdict_get_try_str(qdict, "execute");
+    cmd = command ? qmp_find_command(mon->commands, command) : NULL;
+    if (!cmd || !(cmd->options & QCO_NO_BQL)) {
+        return false;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&mon->qmp_queue_lock) {
+        if (mon->qmp_requests_in_flight) {
+            return false;
+        }
+    }
+
+    if (trace_event_get_state(TRACE_MONITOR_QMP_CMD_NO_BQL)) {
+        QObject *id = qdict_get(qdict, "id");
+        GString *id_json;
+
+        id_json = id ? qobject_to_json(id) : g_string_new(NULL);
+        trace_monitor_qmp_cmd_no_bql(id_json->str);
+        g_string_free(id_json, true);
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        monitor_qmp_dispatch(mon, QOBJECT(qdict));
+    }
+    return true;
+}
+
 static void handle_qmp_command(void *opaque, QObject *req, Error *err)
 {
     MonitorQMP *mon = opaque;
@@ -407,6 +457,11 @@ static void handle_qmp_command(void *opaque, QObject *req, Error *err)
         return;
     }
 
+    if (qdict && monitor_qmp_dispatch_no_bql(mon, qdict)) {
+        qobject_unref(req);
+        return;
+    }
+
     req_obj = g_new0(QMPRequest, 1);
     req_obj->mon = mon;
     req_obj->req = req;
@@ -436,6 +491,7 @@ static void handle_qmp_command(void *opaque, QObject *req, Error *err)
                                           mon->qmp_requests->length);
         assert(mon->qmp_requests->length < QMP_REQ_QUEUE_LEN_MAX);
         g_queue_push_tail(mon->qmp_requests, req_obj);
+        mon->qmp_requests_in_flight++;
     }
 
     /* Kick the dispatcher routine */
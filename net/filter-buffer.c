@@ -56,11 +56,10 @@ static void filter_buffer_release_timer(void *opaque)
 }
 
 /* filter APIs */
-static ssize_t filter_buffer_receive_iov(NetFilterState *nf,
+static ssize_t filter_buffer_receive_buf(NetFilterState *nf,
                                          NetClientState *sender,
                                          unsigned flags,
-                                         const struct iovec *iov,
-                                         int iovcnt,
+                                         NetPacketBuf *buf,
                                          NetPacketSent *sent_cb)
 {
     FilterBufferState *s = FILTER_BUFFER(nf);
@@ -79,9 +78,20 @@ static ssize_t filter_buffer_receive_iov(NetFilterState *nf,
      * the packets without caring about the receiver. This is suboptimal.
      * May need more thoughts (e.g keeping sent_cb).
      */
-    qemu_net_queue_append_iov(s->incoming_queue, sender, flags,
-                              iov, iovcnt, NULL);
-    return iov_size(iov, iovcnt);
+    qemu_net_queue_append_buf(s->incoming_queue, sender, flags, buf, NULL);
+    return buf->size;
+}
+
+static ssize_t filter_buffer_receive_iov(NetFilterState *nf,
+                                         NetClientState *sender,
+                                         unsigned flags,
+                                         const struct iovec *iov,
+                                         int iovcnt,
+                                         NetPacketSent *sent_cb)
+{
+    g_autoptr(NetPacketBuf) buf = net_packet_buf_copy(iov, iovcnt);
+
+    return filter_buffer_receive_buf(nf, sender, flags, buf, sent_cb);
 }
 
 static void filter_buffer_cleanup(NetFilterState *nf)
@@ -126,7 +136,9 @@ static void filter_buffer_setup(NetFilterState *nf, Error **errp)
         return;
     }
 
-    s->incoming_queue = qemu_new_net_queue(qemu_netfilter_pass_to_next, nf);
+    s->incoming_queue = qemu_new_net_queue_buf(qemu_netfilter_pass_to_next,
+                                               qemu_netfilter_pass_buf_to_next,
+                                               nf);
     filter_buffer_setup_timer(nf);
 }
 
@@ -183,6 +195,7 @@ static void filter_buffer_class_init(ObjectClass *oc, void *data)
     nfc->setup = filter_buffer_setup;
     nfc->cleanup = filter_buffer_cleanup;
     nfc->receive_iov = filter_buffer_receive_iov;
+    nfc->receive_buf = filter_buffer_receive_buf;
     nfc->status_changed = filter_buffer_status_changed;
 }
 
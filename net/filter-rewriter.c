@@ -249,6 +249,25 @@ static int handle_secondary_tcp_pkt(RewriterState *rf,
     return 0;
 }
 
+/*
+ * Pass a rewritten packet on.  The data was already copied out of the
+ * sender's buffers, so the queue can take it over instead of copying it
+ * once more.
+ */
+static void colo_rewriter_send(RewriterState *s, NetClientState *sender,
+                               Packet *pkt)
+{
+    struct iovec iov = {
+        .iov_base = pkt->data,
+        .iov_len = pkt->size,
+    };
+    g_autoptr(NetPacketBuf) buf = net_packet_buf_new(&iov, 1, g_free,
+                                                     pkt->data);
+
+    packet_destroy_partial(pkt, NULL);
+    qemu_net_queue_send_buf(s->incoming_queue, sender, 0, buf, NULL);
+}
+
 static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
                                          NetClientState *sender,
                                          unsigned flags,
@@ -294,9 +313,7 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
         if (sender == nf->netdev) {
             /* NET_FILTER_DIRECTION_TX */
             if (!handle_primary_tcp_pkt(s, conn, pkt, &key)) {
-                qemu_net_queue_send(s->incoming_queue, sender, 0,
-                (const uint8_t *)pkt->data, pkt->size, NULL);
-                packet_destroy(pkt, NULL);
+                colo_rewriter_send(s, sender, pkt);
                 pkt = NULL;
                 /*
                  * We block the packet here,after rewrite pkt
@@ -307,9 +324,7 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
         } else {
             /* NET_FILTER_DIRECTION_RX */
             if (!handle_secondary_tcp_pkt(s, conn, pkt, &key)) {
-                qemu_net_queue_send(s->incoming_queue, sender, 0,
-                (const uint8_t *)pkt->data, pkt->size, NULL);
-                packet_destroy(pkt, NULL);
+                colo_rewriter_send(s, sender, pkt);
                 pkt = NULL;
                 /*
                  * We block the packet here,after rewrite pkt
@@ -384,7 +399,9 @@ static void colo_rewriter_setup(NetFilterState *nf, Error **errp)
                                                       connection_key_equal,
                                                       g_free,
                                                       NULL);
-    s->incoming_queue = qemu_new_net_queue(qemu_netfilter_pass_to_next, nf);
+    s->incoming_queue = qemu_new_net_queue_buf(qemu_netfilter_pass_to_next,
+                                               qemu_netfilter_pass_buf_to_next,
+                                               nf);
 }
 
 static bool filter_rewriter_get_vnet_hdr(Object *obj, Error **errp)
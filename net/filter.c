@@ -45,6 +45,30 @@ ssize_t qemu_netfilter_receive(NetFilterState *nf,
     return 0;
 }
 
+ssize_t qemu_netfilter_receive_buf(NetFilterState *nf,
+                                   NetFilterDirection direction,
+                                   NetClientState *sender,
+                                   unsigned flags,
+                                   NetPacketBuf *buf,
+                                   NetPacketSent *sent_cb)
+{
+    NetFilterClass *nfc = NETFILTER_GET_CLASS(OBJECT(nf));
+
+    if (qemu_can_skip_netfilter(nf)) {
+        return 0;
+    }
+    if (nf->direction == direction ||
+        nf->direction == NET_FILTER_DIRECTION_ALL) {
+        if (nfc->receive_buf) {
+            return nfc->receive_buf(nf, sender, flags, buf, sent_cb);
+        }
+        return nfc->receive_iov(nf, sender, flags, buf->iov, buf->iovcnt,
+                                sent_cb);
+    }
+
+    return 0;
+}
+
 static NetFilterState *netfilter_next(NetFilterState *nf,
                                       NetFilterDirection dir)
 {
@@ -119,6 +143,53 @@ out:
     return iov_size(iov, iovcnt);
 }
 
+ssize_t qemu_netfilter_pass_buf_to_next(NetClientState *sender,
+                                        unsigned flags,
+                                        NetPacketBuf *buf,
+                                        void *opaque)
+{
+    int ret = 0;
+    int direction;
+    NetFilterState *nf = opaque;
+    NetFilterState *next = NULL;
+
+    if (!sender || !sender->peer) {
+        /* no receiver, or sender been deleted, no need to pass it further */
+        goto out;
+    }
+
+    if (nf->direction == NET_FILTER_DIRECTION_ALL) {
+        if (sender == nf->netdev) {
+            /* This packet is sent by netdev itself */
+            direction = NET_FILTER_DIRECTION_TX;
+        } else {
+            direction = NET_FILTER_DIRECTION_RX;
+        }
+    } else {
+        direction = nf->direction;
+    }
+
+    /* See qemu_netfilter_pass_to_next() for why sent_cb is NULL */
+    next = netfilter_next(nf, direction);
+    while (next) {
+        ret = qemu_netfilter_receive_buf(next, direction, sender, flags, buf,
+                                         NULL);
+        if (ret) {
+            return ret;
+        }
+        next = netfilter_next(next, direction);
+    }
+
+    if (sender && sender->peer) {
+        qemu_net_queue_send_buf(sender->peer->incoming_queue,
+                                sender, flags, buf, NULL);
+    }
+
+out:
+    /* no receiver, or sender been deleted */
+    return buf->size;
+}
+
 static char *netfilter_get_netdev_id(Object *obj, Error **errp)
 {
     NetFilterState *nf = NETFILTER(obj);
@@ -23,6 +23,8 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/atomic.h"
+#include "qemu/iov.h"
 #include "qemu/queue.h"
 #include "net/net.h"
 
@@ -38,15 +40,19 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Queued packets are kept in a NetPacketBuf.  Packets passed as plain
+ * buffers or iovecs are copied into one, since the sender may reuse its
+ * memory as soon as we return; packets passed as a NetPacketBuf are only
+ * referenced.
  */
 
 struct NetPacket {
     QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
-    int size;
+    NetPacketBuf *buf;
     NetPacketSent *sent_cb;
-    uint8_t data[];
 };
 
 struct NetQueue {
@@ -54,12 +60,70 @@ struct NetQueue {
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
+    NetQueueDeliverBufFunc *deliver_buf;
 
     QTAILQ_HEAD(, NetPacket) packets;
 
     unsigned delivering : 1;
 };
 
+NetPacketBuf *net_packet_buf_new(const struct iovec *iov, int iovcnt,
+                                 NetPacketBufRelease *release, void *opaque)
+{
+    NetPacketBuf *buf;
+
+    buf = g_malloc(sizeof(NetPacketBuf) + iovcnt * sizeof(struct iovec));
+    buf->ref = 1;
+    buf->size = iov_size(iov, iovcnt);
+    buf->release = release;
+    buf->opaque = opaque;
+    buf->iovcnt = iovcnt;
+    memcpy(buf->iov, iov, iovcnt * sizeof(struct iovec));
+
+    return buf;
+}
+
+NetPacketBuf *net_packet_buf_copy(const struct iovec *iov, int iovcnt)
+{
+    size_t size = iov_size(iov, iovcnt);
+    NetPacketBuf *buf;
+
+    /* Header, a single iovec and the data, all in one allocation */
+    buf = g_malloc(sizeof(NetPacketBuf) + sizeof(struct iovec) + size);
+    buf->ref = 1;
+    buf->size = size;
+    buf->release = NULL;
+    buf->opaque = NULL;
+    buf->iovcnt = 1;
+    buf->iov[0].iov_base = &buf->iov[1];
+    buf->iov[0].iov_len = size;
+    iov_to_buf(iov, iovcnt, 0, buf->iov[0].iov_base, size);
+
+    return buf;
+}
+
+NetPacketBuf *net_packet_buf_ref(NetPacketBuf *buf)
+{
+    qatomic_inc(&buf->ref);
+    return buf;
+}
+
+void net_packet_buf_unref(NetPacketBuf *buf)
+{
+    if (qatomic_fetch_dec(&buf->ref) == 1) {
+        if (buf->release) {
+            buf->release(buf->opaque);
+        }
+        g_free(buf);
+    }
+}
+
+static void net_packet_free(NetPacket *packet)
+{
+    net_packet_buf_unref(packet->buf);
+    g_free(packet);
+}
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 {
     NetQueue *queue;
@@ -78,41 +142,66 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     return queue;
 }
 
+NetQueue *qemu_new_net_queue_buf(NetQueueDeliverFunc *deliver,
+                                 NetQueueDeliverBufFunc *deliver_buf,
+                                 void *opaque)
+{
+    NetQueue *queue = qemu_new_net_queue(deliver, opaque);
+
+    queue->deliver_buf = deliver_buf;
+    return queue;
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
 
     QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
         QTAILQ_REMOVE(&queue->packets, packet, entry);
-        g_free(packet);
+        net_packet_free(packet);
     }
 
     g_free(queue);
 }
 
-static void qemu_net_queue_append(NetQueue *queue,
+static bool qemu_net_queue_full(NetQueue *queue, NetPacketSent *sent_cb)
+{
+    /* drop if queue full and no callback */
+    return queue->nq_count >= queue->nq_maxlen && !sent_cb;
+}
+
+static void qemu_net_queue_insert(NetQueue *queue,
                                   NetClientState *sender,
                                   unsigned flags,
-                                  const uint8_t *buf,
-                                  size_t size,
+                                  NetPacketBuf *buf,
                                   NetPacketSent *sent_cb)
 {
-    NetPacket *packet;
+    NetPacket *packet = g_new(NetPacket, 1);
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
-    }
-    packet = g_malloc(sizeof(NetPacket) + size);
     packet->sender = sender;
     packet->flags = flags;
-    packet->size = size;
+    packet->buf = buf;
     packet->sent_cb = sent_cb;
-    memcpy(packet->data, buf, size);
 
     queue->nq_count++;
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
+static void qemu_net_queue_append(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  const uint8_t *buf,
+                                  size_t size,
+                                  NetPacketSent *sent_cb)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size
+    };
+
+    qemu_net_queue_append_iov(queue, sender, flags, &iov, 1, sent_cb);
+}
+
 void qemu_net_queue_append_iov(NetQueue *queue,
                                NetClientState *sender,
                                unsigned flags,
@@ -120,32 +209,24 @@ void qemu_net_queue_append_iov(NetQueue *queue,
                                int iovcnt,
                                NetPacketSent *sent_cb)
 {
-    NetPacket *packet;
-    size_t max_len = 0;
-    int i;
-
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    if (qemu_net_queue_full(queue, sent_cb)) {
+        return;
     }
-    for (i = 0; i < iovcnt; i++) {
-        max_len += iov[i].iov_len;
-    }
-
-    packet = g_malloc(sizeof(NetPacket) + max_len);
-    packet->sender = sender;
-    packet->sent_cb = sent_cb;
-    packet->flags = flags;
-    packet->size = 0;
-
-    for (i = 0; i < iovcnt; i++) {
-        size_t len = iov[i].iov_len;
+    qemu_net_queue_insert(queue, sender, flags,
+                          net_packet_buf_copy(iov, iovcnt), sent_cb);
+}
 
-        memcpy(packet->data + packet->size, iov[i].iov_base, len);
-        packet->size += len;
+void qemu_net_queue_append_buf(NetQueue *queue,
+                               NetClientState *sender,
+                               unsigned flags,
+                               NetPacketBuf *buf,
+                               NetPacketSent *sent_cb)
+{
+    if (qemu_net_queue_full(queue, sent_cb)) {
+        return;
     }
-
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_insert(queue, sender, flags, net_packet_buf_ref(buf),
+                          sent_cb);
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -182,6 +263,25 @@ static ssize_t qemu_net_queue_deliver_iov(NetQueue *queue,
     return ret;
 }
 
+static ssize_t qemu_net_queue_deliver_buf(NetQueue *queue,
+                                          NetClientState *sender,
+                                          unsigned flags,
+                                          NetPacketBuf *buf)
+{
+    ssize_t ret = -1;
+
+    if (!queue->deliver_buf) {
+        return qemu_net_queue_deliver_iov(queue, sender, flags,
+                                          buf->iov, buf->iovcnt);
+    }
+
+    queue->delivering = 1;
+    ret = queue->deliver_buf(sender, flags, buf, queue->opaque);
+    queue->delivering = 0;
+
+    return ret;
+}
+
 ssize_t qemu_net_queue_receive(NetQueue *queue,
                                const uint8_t *data,
                                size_t size)
@@ -254,6 +354,30 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+ssize_t qemu_net_queue_send_buf(NetQueue *queue,
+                                NetClientState *sender,
+                                unsigned flags,
+                                NetPacketBuf *buf,
+                                NetPacketSent *sent_cb)
+{
+    ssize_t ret;
+
+    if (queue->delivering || !qemu_can_send_packet(sender)) {
+        qemu_net_queue_append_buf(queue, sender, flags, buf, sent_cb);
+        return 0;
+    }
+
+    ret = qemu_net_queue_deliver_buf(queue, sender, flags, buf);
+    if (ret == 0) {
+        qemu_net_queue_append_buf(queue, sender, flags, buf, sent_cb);
+        return 0;
+    }
+
+    qemu_net_queue_flush(queue);
+
+    return ret;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
@@ -265,7 +389,7 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            net_packet_free(packet);
         }
     }
 }
@@ -283,11 +407,10 @@ bool qemu_net_queue_flush(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         queue->nq_count--;
 
-        ret = qemu_net_queue_deliver(queue,
-                                     packet->sender,
-                                     packet->flags,
-                                     packet->data,
-                                     packet->size);
+        ret = qemu_net_queue_deliver_buf(queue,
+                                         packet->sender,
+                                         packet->flags,
+                                         packet->buf);
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
@@ -298,7 +421,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        net_packet_free(packet);
     }
     return true;
 }
@@ -31,6 +31,9 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+#include <liburing.h>
+#endif
 
 #include "net/eth.h"
 #include "net/net.h"
@@ -40,12 +43,25 @@
 #include "qapi/error.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 
 #include "net/tap.h"
 
 #include "net/vhost_net.h"
+#include "trace.h"
+
+/* Upper limit for the rx-batch option */
+#define TAP_RX_BATCH_MAX 256
+
+/* io_uring buffer group of the receive buffers */
+#define TAP_RX_BGID 0
+
+typedef struct TapRxPacket {
+    unsigned slot;
+    int len;
+} TapRxPacket;
 
 typedef struct TAPState {
     NetClientState nc;
@@ -61,16 +77,54 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+
+    /*
+     * Batched receive: rx_batch buffers of NET_BUFSIZE bytes, the FIFO of
+     * packets read into them but not yet delivered, and the buffers that
+     * are free for tap_read_packet().  When the multishot io_uring read is
+     * in use the free buffers are owned by the kernel instead.
+     */
+    unsigned rx_batch;
+    uint8_t *rx_bufs;
+    TapRxPacket *rx_pending;
+    unsigned rx_head;
+    unsigned rx_count;
+    unsigned *rx_free;
+    unsigned rx_nfree;
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    struct io_uring *rx_ring;
+    struct io_uring_buf_ring *rx_br;
+    uint64_t rx_gen;
+    bool rx_armed;
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
                           int fd, Error **errp);
 
 static void tap_send(void *opaque);
+static void tap_send_completed(NetClientState *nc, ssize_t len);
 static void tap_writable(void *opaque);
 
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+static void tap_rx_uring_arm(TAPState *s, bool enable);
+#endif
+
 static void tap_update_fd_handler(TAPState *s)
 {
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    if (s->rx_ring) {
+        /* Packets are read by the kernel and show up on the ring instead */
+        qemu_set_fd_handler(s->rx_ring->ring_fd,
+                            s->read_poll && s->enabled ? tap_send : NULL,
+                            NULL, s);
+        qemu_set_fd_handler(s->fd, NULL,
+                            s->write_poll && s->enabled ? tap_writable : NULL,
+                            s);
+        tap_rx_uring_arm(s, s->read_poll && s->enabled);
+        return;
+    }
+#endif
     qemu_set_fd_handler(s->fd,
                         s->read_poll && s->enabled ? tap_send : NULL,
                         s->write_poll && s->enabled ? tap_writable : NULL,
@@ -173,9 +227,246 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 }
 #endif
 
+static uint8_t *tap_rx_buf(TAPState *s, unsigned slot)
+{
+    return s->rx_bufs + (size_t)slot * NET_BUFSIZE;
+}
+
+static void tap_rx_push(TAPState *s, unsigned slot, int len)
+{
+    TapRxPacket *p;
+
+    assert(s->rx_count < s->rx_batch);
+    p = &s->rx_pending[(s->rx_head + s->rx_count) % s->rx_batch];
+    p->slot = slot;
+    p->len = len;
+    s->rx_count++;
+}
+
+/* Give a buffer back once the packet in it was delivered or queued */
+static void tap_rx_release(TAPState *s, unsigned slot)
+{
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    if (s->rx_ring) {
+        io_uring_buf_ring_add(s->rx_br, tap_rx_buf(s, slot), NET_BUFSIZE,
+                              slot, io_uring_buf_ring_mask(s->rx_batch), 0);
+        io_uring_buf_ring_advance(s->rx_br, 1);
+        return;
+    }
+#endif
+    s->rx_free[s->rx_nfree++] = slot;
+}
+
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+/*
+ * Start or cancel the multishot read.  Each request gets a new generation
+ * number as user_data, so that completions of a cancelled request are not
+ * mistaken for the end of the current one.
+ */
+static void tap_rx_uring_arm(TAPState *s, bool enable)
+{
+    struct io_uring_sqe *sqe;
+
+    if (enable == s->rx_armed ||
+        (enable && s->rx_count == s->rx_batch)) {
+        return;
+    }
+
+    sqe = io_uring_get_sqe(s->rx_ring);
+    assert(sqe);
+    if (enable) {
+        io_uring_prep_read_multishot(sqe, s->fd, 0, 0, TAP_RX_BGID);
+        io_uring_sqe_set_data64(sqe, ++s->rx_gen);
+    } else {
+        io_uring_prep_cancel64(sqe, s->rx_gen, 0);
+        io_uring_sqe_set_data64(sqe, 0);
+    }
+    io_uring_submit(s->rx_ring);
+    s->rx_armed = enable;
+}
+
+static void tap_rx_uring_cleanup(TAPState *s)
+{
+    g_autofree bool *busy = g_new0(bool, s->rx_batch);
+    unsigned i;
+
+    qemu_set_fd_handler(s->rx_ring->ring_fd, NULL, NULL, NULL);
+    io_uring_free_buf_ring(s->rx_ring, s->rx_br, s->rx_batch, TAP_RX_BGID);
+    io_uring_queue_exit(s->rx_ring);
+    g_free(s->rx_ring);
+    s->rx_ring = NULL;
+    s->rx_br = NULL;
+    s->rx_armed = false;
+
+    /* Everything that is not waiting for delivery is free again */
+    for (i = 0; i < s->rx_count; i++) {
+        busy[s->rx_pending[(s->rx_head + i) % s->rx_batch].slot] = true;
+    }
+    s->rx_nfree = 0;
+    for (i = 0; i < s->rx_batch; i++) {
+        if (!busy[i]) {
+            s->rx_free[s->rx_nfree++] = i;
+        }
+    }
+}
+
+static void tap_rx_uring_init(TAPState *s)
+{
+    unsigned i;
+    int ret;
+
+    s->rx_ring = g_new0(struct io_uring, 1);
+    ret = io_uring_queue_init(8, s->rx_ring, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+    s->rx_br = io_uring_setup_buf_ring(s->rx_ring, s->rx_batch, TAP_RX_BGID,
+                                       0, &ret);
+    if (!s->rx_br) {
+        io_uring_queue_exit(s->rx_ring);
+        goto fail;
+    }
+    for (i = 0; i < s->rx_batch; i++) {
+        io_uring_buf_ring_add(s->rx_br, tap_rx_buf(s, i), NET_BUFSIZE, i,
+                              io_uring_buf_ring_mask(s->rx_batch), i);
+    }
+    io_uring_buf_ring_advance(s->rx_br, s->rx_batch);
+    s->rx_nfree = 0;
+    return;
+
+fail:
+    trace_tap_rx_uring_fallback(s, ret);
+    g_free(s->rx_ring);
+    s->rx_ring = NULL;
+}
+
+/* Move the packets that the kernel read into the FIFO */
+static void tap_rx_uring_reap(TAPState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    while (io_uring_peek_cqe(s->rx_ring, &cqe) == 0) {
+        uint64_t gen = io_uring_cqe_get_data64(cqe);
+        unsigned flags = cqe->flags;
+        int res = cqe->res;
+
+        io_uring_cqe_seen(s->rx_ring, cqe);
+
+        if (flags & IORING_CQE_F_BUFFER) {
+            unsigned slot = flags >> IORING_CQE_BUFFER_SHIFT;
+
+            if (res > 0) {
+                tap_rx_push(s, slot, res);
+            } else {
+                tap_rx_release(s, slot);
+            }
+        }
+
+        if (gen != s->rx_gen || (flags & IORING_CQE_F_MORE)) {
+            continue;
+        }
+
+        /*
+         * The current request is over.  Running out of buffers is
+         * expected, tap_send_batch() starts a new read once some are
+         * released; anything else means the kernel cannot do multishot
+         * reads on this file, so go back to plain reads.
+         */
+        s->rx_armed = false;
+        if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+            trace_tap_rx_uring_fallback(s, res);
+            tap_rx_uring_cleanup(s);
+            tap_update_fd_handler(s);
+            return;
+        }
+    }
+}
+#endif
+
+static void tap_rx_fill(TAPState *s)
+{
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    if (s->rx_ring) {
+        tap_rx_uring_reap(s);
+        return;
+    }
+#endif
+
+    while (s->rx_nfree) {
+        unsigned slot = s->rx_free[s->rx_nfree - 1];
+        int size;
+
+        size = tap_read_packet(s->fd, tap_rx_buf(s, slot), NET_BUFSIZE);
+        if (size <= 0) {
+            break;
+        }
+        s->rx_nfree--;
+        tap_rx_push(s, slot, size);
+    }
+}
+
+/*
+ * Deliver the packets in the FIFO to the peer.  Returns false if the peer
+ * stopped accepting them; the remaining ones are then delivered from
+ * tap_send_completed().
+ */
+static bool tap_rx_flush(TAPState *s)
+{
+    while (s->rx_count) {
+        TapRxPacket *p = &s->rx_pending[s->rx_head];
+        uint8_t *buf = tap_rx_buf(s, p->slot);
+        int size = p->len;
+        uint8_t min_pkt[ETH_ZLEN];
+        size_t min_pktsz = sizeof(min_pkt);
+
+        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+            buf  += s->host_vnet_hdr_len;
+            size -= s->host_vnet_hdr_len;
+        }
+
+        if (net_peer_needs_padding(&s->nc)) {
+            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+                buf = min_pkt;
+                size = min_pktsz;
+            }
+        }
+
+        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+
+        /* The packet was either consumed or copied into the peer's queue */
+        s->rx_head = (s->rx_head + 1) % s->rx_batch;
+        s->rx_count--;
+        tap_rx_release(s, p->slot);
+
+        if (size == 0) {
+            tap_read_poll(s, false);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tap_send_batch(TAPState *s)
+{
+    tap_rx_fill(s);
+    if (!tap_rx_flush(s)) {
+        return;
+    }
+
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    if (s->rx_ring && s->read_poll && s->enabled) {
+        tap_rx_uring_arm(s, true);
+    }
+#endif
+}
+
 static void tap_send_completed(NetClientState *nc, ssize_t len)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->rx_batch && !tap_rx_flush(s)) {
+        return;
+    }
     tap_read_poll(s, true);
 }
 
@@ -185,6 +476,11 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    if (s->rx_batch) {
+        tap_send_batch(s);
+        return;
+    }
+
     while (true) {
         uint8_t *buf = s->buf;
         uint8_t min_pkt[ETH_ZLEN];
@@ -347,10 +643,45 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    if (s->rx_ring) {
+        tap_rx_uring_cleanup(s);
+    }
+#endif
+    g_free(s->rx_bufs);
+    g_free(s->rx_pending);
+    g_free(s->rx_free);
     close(s->fd);
     s->fd = -1;
 }
 
+/*
+ * Read up to @batch packets at a time and deliver them in one go.  On
+ * Linux a multishot io_uring read lets the kernel fill the buffers as
+ * packets arrive, so that no system call is needed per packet.
+ */
+static void tap_rx_init(TAPState *s, unsigned batch)
+{
+    unsigned i;
+
+    s->rx_batch = pow2ceil(batch);
+    s->rx_bufs = g_malloc((size_t)s->rx_batch * NET_BUFSIZE);
+    s->rx_pending = g_new(TapRxPacket, s->rx_batch);
+    s->rx_free = g_new(unsigned, s->rx_batch);
+    for (i = 0; i < s->rx_batch; i++) {
+        s->rx_free[i] = s->rx_batch - 1 - i;
+    }
+    s->rx_nfree = s->rx_batch;
+
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    tap_rx_uring_init(s);
+    trace_tap_rx_init(s, s->rx_batch, !!s->rx_ring);
+#else
+    trace_tap_rx_init(s, s->rx_batch, false);
+#endif
+    tap_update_fd_handler(s);
+}
+
 static void tap_poll(NetClientState *nc, bool enable)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -700,6 +1031,10 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         goto failed;
     }
 
+    if (tap->has_rx_batch && tap->rx_batch > 1) {
+        tap_rx_init(s, tap->rx_batch);
+    }
+
     if (tap->fd || tap->fds) {
         qemu_set_info_str(&s->nc, "fd=%d", fd);
     } else if (tap->helper) {
@@ -835,6 +1170,11 @@ int net_init_tap(const Netdev *netdev, const char *name,
         return -1;
     }
 
+    if (tap->has_rx_batch && tap->rx_batch > TAP_RX_BATCH_MAX) {
+        error_setg(errp, "rx-batch must be at most %d", TAP_RX_BATCH_MAX);
+        return -1;
+    }
+
     if (tap->fd) {
         if (tap->ifname || tap->script || tap->downscript ||
             tap->has_vnet_hdr || tap->helper || tap->has_queues ||
@@ -1661,6 +1661,18 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Smallest range of a source image that gets its own planning coroutine */
+#define CONVERT_PLAN_MIN_SECTORS (1 * GiB / BDRV_SECTOR_SIZE)
+
+/*
+ * One entry of the extent map built before copying.  An extent ends where
+ * the next one starts, or at the end of the last source image.
+ */
+typedef struct ConvertExtent {
+    int64_t sector_num;
+    int ret;    /* BDRV_BLOCK_ZERO and BDRV_BLOCK_DATA bits of block status */
+} ConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1673,6 +1685,7 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    GArray *extents;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1707,45 +1720,90 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
-static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+static void convert_add_extent(GArray *extents, int64_t sector_num, int ret)
 {
-    int64_t src_cur_offset;
-    int ret, n, src_cur;
-    bool post_backing_zero = false;
+    ConvertExtent extent = {
+        .sector_num = sector_num,
+        .ret = ret & (BDRV_BLOCK_ZERO | BDRV_BLOCK_DATA),
+    };
 
-    convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+    if (extents->len &&
+        g_array_index(extents, ConvertExtent, extents->len - 1).ret ==
+        extent.ret) {
+        return;
+    }
+    g_array_append_val(extents, extent);
+}
 
-    assert(s->total_sectors > sector_num);
-    n = MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS);
+/*
+ * Return the extent containing @sector_num and store in @extent_end the
+ * first sector after it.
+ */
+static const ConvertExtent *convert_find_extent(ImgConvertState *s,
+                                                int64_t sector_num,
+                                                int64_t *extent_end)
+{
+    ConvertExtent *extents = (ConvertExtent *)s->extents->data;
+    guint lo = 0, hi = s->extents->len;
 
-    if (s->target_backing_sectors >= 0) {
-        if (sector_num >= s->target_backing_sectors) {
-            post_backing_zero = true;
-        } else if (sector_num + n > s->target_backing_sectors) {
-            /* Split requests around target_backing_sectors (because
-             * starting from there, zeros are handled differently) */
-            n = s->target_backing_sectors - sector_num;
+    assert(hi > 0 && extents[0].sector_num <= sector_num);
+    while (hi - lo > 1) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (extents[mid].sector_num <= sector_num) {
+            lo = mid;
+        } else {
+            hi = mid;
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
-        uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
-        int64_t count;
-        int tail;
-        BlockDriverState *src_bs = blk_bs(s->src[src_cur]);
-        BlockDriverState *base;
+    *extent_end = lo + 1 < s->extents->len ? extents[lo + 1].sector_num
+                                           : s->total_sectors;
+    return &extents[lo];
+}
 
-        if (s->target_has_backing) {
-            base = bdrv_cow_bs(bdrv_skip_filters(src_bs));
-        } else {
-            base = NULL;
-        }
+typedef struct ConvertPlanTask {
+    ImgConvertState *s;
+    int src_cur;
+    int64_t src_cur_offset;
+    int64_t sector_num;
+    int64_t end;
+    GArray *extents;
+    int ret;
+} ConvertPlanTask;
+
+/*
+ * Record the allocation status of [t->sector_num, t->end) in t->extents.
+ * The whole backing chain above the target's backing file is looked at,
+ * so that the copy phase never needs to query block status again.
+ */
+static void coroutine_fn convert_co_plan(void *opaque)
+{
+    ConvertPlanTask *t = opaque;
+    ImgConvertState *s = t->s;
+    BlockDriverState *src_bs = blk_bs(s->src[t->src_cur]);
+    BlockDriverState *base;
+    int64_t sector_num = t->sector_num;
+
+    GRAPH_RDLOCK_GUARD();
+
+    if (s->target_has_backing) {
+        base = bdrv_cow_bs(bdrv_skip_filters(src_bs));
+    } else {
+        base = NULL;
+    }
+
+    while (sector_num < t->end && s->ret == -EINPROGRESS) {
+        uint64_t offset = (sector_num - t->src_cur_offset) * BDRV_SECTOR_SIZE;
+        int n = MIN(t->end - sector_num, BDRV_REQUEST_MAX_SECTORS);
+        int64_t count;
+        int ret;
 
         do {
             count = n * BDRV_SECTOR_SIZE;
 
-            ret = bdrv_block_status_above(src_bs, base, offset, count, &count,
-                                          NULL, NULL);
+            ret = bdrv_co_block_status_above(src_bs, base, offset, count,
+                                             &count, NULL, NULL);
 
             if (ret < 0) {
                 if (s->salvage) {
@@ -1765,12 +1823,125 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
                 } else {
                     error_report("error while reading block status at offset "
                                  "%" PRIu64 ": %s", offset, strerror(-ret));
-                    return ret;
+                    t->ret = ret;
+                    s->ret = ret;
+                    goto out;
                 }
             }
         } while (ret < 0);
 
-        n = DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
+        convert_add_extent(t->extents, sector_num, ret);
+        sector_num += DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
+    }
+
+out:
+    s->running_coroutines--;
+}
+
+/*
+ * Build the extent map of all source images.  Every source is split into
+ * ranges that are queried by concurrent coroutines, so that metadata reads
+ * of different parts of the backing chain overlap instead of being done
+ * one at a time.
+ */
+static int convert_plan(ImgConvertState *s)
+{
+    g_autofree ConvertPlanTask *tasks = NULL;
+    int64_t src_cur_offset = 0;
+    int64_t seg;
+    int num_tasks = 0;
+    int i;
+
+    seg = MAX(DIV_ROUND_UP(s->total_sectors, s->num_coroutines),
+              CONVERT_PLAN_MIN_SECTORS);
+    for (i = 0; i < s->src_num; i++) {
+        num_tasks += DIV_ROUND_UP(s->src_sectors[i], seg);
+    }
+    tasks = g_new0(ConvertPlanTask, num_tasks);
+
+    s->ret = -EINPROGRESS;
+    num_tasks = 0;
+    for (i = 0; i < s->src_num; i++) {
+        int64_t src_end = src_cur_offset + s->src_sectors[i];
+        int64_t sector_num = src_cur_offset;
+        /* keep the ranges aligned so that extents are not split needlessly */
+        int64_t src_seg = QEMU_ALIGN_UP(seg, s->src_alignment[i]);
+
+        while (sector_num < src_end) {
+            ConvertPlanTask *t = &tasks[num_tasks++];
+
+            *t = (ConvertPlanTask) {
+                .s = s,
+                .src_cur = i,
+                .src_cur_offset = src_cur_offset,
+                .sector_num = sector_num,
+                .end = MIN(sector_num + src_seg, src_end),
+                .extents = g_array_new(false, false, sizeof(ConvertExtent)),
+            };
+            sector_num = t->end;
+        }
+        src_cur_offset = src_end;
+    }
+
+    s->running_coroutines = num_tasks;
+    for (i = 0; i < num_tasks; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(convert_co_plan,
+                                                   &tasks[i]));
+    }
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+    s->ret = 0;
+
+    s->extents = g_array_new(false, false, sizeof(ConvertExtent));
+    for (i = 0; i < num_tasks; i++) {
+        ConvertPlanTask *t = &tasks[i];
+        guint j;
+
+        if (t->ret < 0 && !s->ret) {
+            s->ret = t->ret;
+        }
+        for (j = 0; j < t->extents->len; j++) {
+            ConvertExtent *extent = &g_array_index(t->extents, ConvertExtent,
+                                                   j);
+            convert_add_extent(s->extents, extent->sector_num, extent->ret);
+        }
+        g_array_free(t->extents, true);
+    }
+
+    return s->ret;
+}
+
+static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+{
+    int64_t src_cur_offset;
+    int ret, n, src_cur;
+    bool post_backing_zero = false;
+
+    convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+
+    assert(s->total_sectors > sector_num);
+    n = MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS);
+
+    if (s->target_backing_sectors >= 0) {
+        if (sector_num >= s->target_backing_sectors) {
+            post_backing_zero = true;
+        } else if (sector_num + n > s->target_backing_sectors) {
+            /* Split requests around target_backing_sectors (because
+             * starting from there, zeros are handled differently) */
+            n = s->target_backing_sectors - sector_num;
+        }
+    }
+
+    if (s->sector_next_status <= sector_num) {
+        const ConvertExtent *extent;
+        int64_t extent_end;
+        int tail;
+
+        extent = convert_find_extent(s, sector_num, &extent_end);
+        n = MIN(n, extent_end - sector_num);
+        n = MIN(n, s->src_sectors[src_cur] - (sector_num - src_cur_offset));
+        ret = extent->ret;
 
         /*
          * Avoid that s->sector_next_status becomes unaligned to the source
@@ -1991,14 +2162,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
             qemu_co_mutex_unlock(&s->lock);
             break;
         }
-        WITH_GRAPH_RDLOCK_GUARD() {
-            n = convert_iteration_sectors(s, s->sector_num);
-        }
-        if (n < 0) {
-            qemu_co_mutex_unlock(&s->lock);
-            s->ret = n;
-            break;
-        }
+        n = convert_iteration_sectors(s, s->sector_num);
         /* save current sector and allocation status to local variables */
         sector_num = s->sector_num;
         status = s->status;
@@ -2017,7 +2181,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = s->copy_range && status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
@@ -2106,11 +2270,14 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
+    /* Plan the copy */
+    ret = convert_plan(s);
+    if (ret < 0) {
+        goto out;
+    }
+
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
-        if (n < 0) {
-            return n;
-        }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
         {
             s->allocated_sectors += n;
@@ -2133,15 +2300,16 @@ static int convert_do_copy(ImgConvertState *s)
         main_loop_wait(false);
     }
 
-    if (s->compressed && !s->ret) {
+    ret = s->ret;
+    if (s->compressed && !ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
-        if (ret < 0) {
-            return ret;
-        }
     }
 
-    return s->ret;
+out:
+    g_array_free(s->extents, true);
+    s->extents = NULL;
+    return ret;
 }
 
 /* Check that bitmaps can be copied, or output an error */
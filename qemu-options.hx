@@ -185,7 +185,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
-    "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-size=n (KVM/TCG dirty ring GFN count, default 0)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -244,6 +244,13 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+        With the TCG accelerator, it enables a per-vCPU ring of guest pages
+        that were written while dirty tracking is active; the rings are
+        harvested into the dirty bitmap whenever migration synchronizes
+        it.  Each entry takes 8 bytes.  It should be a power of two no
+        larger than 65536, and by default the ring is disabled
+        (dirty-ring-size=0).
+
     ``notify-vmexit=run|internal-error|disable,notify-window=n``
         Enables or disables notify VM exit support on x86 host and specify
         the corresponding notify window to trigger the VM exit if enabled.
@@ -1711,6 +1718,7 @@ ERST
 DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     "-fsdev local,id=id,path=path,security_model=mapped-xattr|mapped-file|passthrough|none\n"
     " [,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode]\n"
+    " [,path_cache_ttl=ms]\n"
     " [[,throttling.bps-total=b]|[[,throttling.bps-read=r][,throttling.bps-write=w]]]\n"
     " [[,throttling.iops-total=i]|[[,throttling.iops-read=r][,throttling.iops-write=w]]]\n"
     " [[,throttling.bps-total-max=bm]|[[,throttling.bps-read-max=rm][,throttling.bps-write-max=wm]]]\n"
@@ -1722,7 +1730,7 @@ DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     QEMU_ARCH_ALL)
 
 SRST
-``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode] [,throttling.option=value[,throttling.option=value[,...]]]``
+``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode] [,path_cache_ttl=ms] [,throttling.option=value[,throttling.option=value[,...]]]``
   \ 
 ``-fsdev proxy,id=id,socket=socket[,writeout=writeout][,readonly=on]``
   \
@@ -1797,6 +1805,15 @@ SRST
         host. Works only with security models "mapped-xattr" and
         "mapped-file".
 
+    ``path_cache_ttl=ms``
+        Keeps the directories that were opened while resolving paths
+        open for ms milliseconds, so that later requests do not have to
+        resolve every path component again. Renames and removals made
+        by the guest take effect immediately, while directories renamed
+        or removed directly on the host may still be reached under their
+        old path until the timeout expires. The default is 0, which
+        disables the cache.
+
     ``throttling.bps-total=b,throttling.bps-read=r,throttling.bps-write=w``
         Specify bandwidth throttling limits in bytes per second, either
         for all request types or for reads or writes only.
@@ -1839,13 +1856,14 @@ ERST
 DEF("virtfs", HAS_ARG, QEMU_OPTION_virtfs,
     "-virtfs local,path=path,mount_tag=tag,security_model=mapped-xattr|mapped-file|passthrough|none\n"
     "        [,id=id][,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode][,multidevs=remap|forbid|warn]\n"
+    "        [,path_cache_ttl=ms]\n"
     "-virtfs proxy,mount_tag=tag,socket=socket[,id=id][,writeout=immediate][,readonly=on]\n"
     "-virtfs proxy,mount_tag=tag,sock_fd=sock_fd[,id=id][,writeout=immediate][,readonly=on]\n"
     "-virtfs synth,mount_tag=tag[,id=id][,readonly=on]\n",
     QEMU_ARCH_ALL)
 
 SRST
-``-virtfs local,path=path,mount_tag=mount_tag ,security_model=security_model[,writeout=writeout][,readonly=on] [,fmode=fmode][,dmode=dmode][,multidevs=multidevs]``
+``-virtfs local,path=path,mount_tag=mount_tag ,security_model=security_model[,writeout=writeout][,readonly=on] [,fmode=fmode][,dmode=dmode][,multidevs=multidevs] [,path_cache_ttl=ms]``
   \ 
 ``-virtfs proxy,socket=socket,mount_tag=mount_tag [,writeout=writeout][,readonly=on]``
   \ 
@@ -1930,6 +1948,15 @@ SRST
         host. Works only with security models "mapped-xattr" and
         "mapped-file".
 
+    ``path_cache_ttl=ms``
+        Keeps the directories that were opened while resolving paths
+        open for ms milliseconds, so that later requests do not have to
+        resolve every path component again. Renames and removals made
+        by the guest take effect immediately, while directories renamed
+        or removed directly on the host may still be reached under their
+        old path until the timeout expires. The default is 0, which
+        disables the cache.
+
     ``mount_tag=mount_tag``
         Specifies the tag name to be used by the guest to mount this
         export point.
@@ -2772,7 +2799,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "-netdev tap,id=str[,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile]\n"
     "         [,br=bridge][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off]\n"
     "         [,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
-    "         [,poll-us=n]\n"
+    "         [,poll-us=n][,rx-batch=n]\n"
     "                configure a host TAP network backend with ID 'str'\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
@@ -2795,6 +2822,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
     "                use 'poll-us=n' to specify the maximum number of microseconds that could be\n"
     "                spent on busy polling for vhost net\n"
+    "                use 'rx-batch=n' to read and deliver up to n packets at a time\n"
     "-netdev bridge,id=str[,br=bridge][,helper=helper]\n"
     "                configure a host TAP network backend with ID 'str' that is\n"
     "                connected to a bridge (default=" DEFAULT_BRIDGE_INTERFACE ")\n"
@@ -4530,13 +4558,14 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]\n" \
+    "                [,rrsnapshot-period=N][,rrsnapshot-budget=size]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off][,rrsnapshot-period=N][,rrsnapshot-budget=size]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4578,6 +4607,13 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    ``rrcompress=on`` compresses the log with zstd while recording.
+    Compressed logs are detected automatically in replay mode.
+    In replay mode, ``rrsnapshot-period=N`` keeps a VM snapshot in memory
+    every N instructions for reverse debugging. ``rrsnapshot-budget``
+    limits the memory used by these snapshots, in addition to one copy of
+    guest RAM (256M by default). The snapshots do not cover disk contents,
+    so ``rrsnapshot-period`` cannot be used together with writable disks.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -4833,11 +4869,11 @@ SRST
 ERST
 
 DEF("trace", HAS_ARG, QEMU_OPTION_trace,
-    "-trace [[enable=]<pattern>][,events=<file>][,file=<file>]\n"
+    "-trace [[enable=]<pattern>][,events=<file>][,file=<file>][,bufsize=<size>]\n"
     "                specify tracing options\n",
     QEMU_ARCH_ALL)
 SRST
-``-trace [[enable=]pattern][,events=file][,file=file]``
+``-trace [[enable=]pattern][,events=file][,file=file][,bufsize=size]``
   .. include:: ../qemu-option-trace.rst.inc
 
 ERST
@@ -4976,7 +5012,7 @@ SRST
     they are specified. Note that the 'id' property must be set. These
     objects are placed in the '/objects' path.
 
-    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,offset=offset,readonly=on|off``
+    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,offset=offset,readonly=on|off,template=on|off``
         Creates a memory file backend object, which can be used to back
         the guest RAM with huge pages.
 
@@ -5066,6 +5102,20 @@ SRST
         The ``readonly`` option specifies whether the backing file is opened
         read-only or read-write (default).
 
+        Setting the ``template`` option to ``on`` uses the backing file as a
+        RAM image saved by an earlier guest: the file is opened read-only
+        and mapped privately, so that guests started from the same image
+        share the pages they do not modify.  It requires ``share=off``, and
+        the file must already be as large as the backend.  RAM discards are
+        disabled, so virtio-balloon does not free memory and virtio-mem
+        cannot be used; postcopy migration is not supported either.  To
+        create the image, run the original guest with ``share=on`` and save
+        its device state with the ``x-ignore-shared`` migration capability,
+        for example ``migrate "exec:cat > vmstate"``; start each copy with
+        the template backend, the same capability and
+        ``-incoming "exec:cat vmstate"``.  Pages that are present in the
+        incoming stream are only copied when they differ from the image.
+
     ``-object memory-backend-ram,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave``
         Creates a memory backend object, which can be used to back the
         guest RAM. Memory backend objects offer more control than the
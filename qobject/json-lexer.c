@@ -277,9 +277,41 @@ void json_lexer_init(JSONLexer *lexer, bool enable_interpolation)
     lexer->start_state = lexer->state = enable_interpolation
         ? IN_START_INTERP : IN_START;
     lexer->token = g_string_sized_new(3);
+    lexer->buf = NULL;
+    lexer->tok_begin = lexer->tok_end = 0;
     lexer->x = lexer->y = 0;
 }
 
+/*
+ * The text of the current token is lexer->token followed by
+ * lexer->buf[tok_begin..tok_end).  Tokens are only copied into
+ * lexer->token when they span more than one json_lexer_feed() call,
+ * otherwise they are passed on straight from the input buffer.
+ */
+static size_t json_lexer_token_len(JSONLexer *lexer)
+{
+    return lexer->token->len + lexer->tok_end - lexer->tok_begin;
+}
+
+static void json_lexer_emit(JSONLexer *lexer, JSONTokenType type)
+{
+    const char *str = lexer->buf + lexer->tok_begin;
+    size_t len = lexer->tok_end - lexer->tok_begin;
+
+    if (lexer->token->len) {
+        g_string_append_len(lexer->token, str, len);
+        str = lexer->token->str;
+        len = lexer->token->len;
+    }
+    json_message_process_token(lexer, str, len, type, lexer->x, lexer->y);
+}
+
+static void json_lexer_reset_token(JSONLexer *lexer)
+{
+    g_string_truncate(lexer->token, 0);
+    lexer->tok_begin = lexer->tok_end;
+}
+
 static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
 {
     int new_state;
@@ -295,7 +327,7 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
         new_state = next_state(lexer, ch, flush, &char_consumed);
         if (char_consumed) {
             assert(!flush);
-            g_string_append_c(lexer->token, ch);
+            lexer->tok_end++;
         }
 
         switch (new_state) {
@@ -310,20 +342,18 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
         case JSON_FLOAT:
         case JSON_KEYWORD:
         case JSON_STRING:
-            json_message_process_token(lexer, lexer->token, new_state,
-                                       lexer->x, lexer->y);
+            json_lexer_emit(lexer, new_state);
             /* fall through */
         case IN_START:
-            g_string_truncate(lexer->token, 0);
+            json_lexer_reset_token(lexer);
             new_state = lexer->start_state;
             break;
         case JSON_ERROR:
-            json_message_process_token(lexer, lexer->token, JSON_ERROR,
-                                       lexer->x, lexer->y);
+            json_lexer_emit(lexer, JSON_ERROR);
             new_state = IN_RECOVERY;
             /* fall through */
         case IN_RECOVERY:
-            g_string_truncate(lexer->token, 0);
+            json_lexer_reset_token(lexer);
             break;
         default:
             break;
@@ -334,10 +364,9 @@ static void json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
     /* Do not let a single token grow to an arbitrarily large size,
      * this is a security consideration.
      */
-    if (lexer->token->len > MAX_TOKEN_SIZE) {
-        json_message_process_token(lexer, lexer->token, lexer->state,
-                                   lexer->x, lexer->y);
-        g_string_truncate(lexer->token, 0);
+    if (json_lexer_token_len(lexer) > MAX_TOKEN_SIZE) {
+        json_lexer_emit(lexer, lexer->state);
+        json_lexer_reset_token(lexer);
         lexer->state = lexer->start_state;
     }
 }
@@ -346,17 +375,29 @@ void json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
 {
     size_t i;
 
+    lexer->buf = buffer;
+    lexer->tok_begin = lexer->tok_end = 0;
+
     for (i = 0; i < size; i++) {
         json_lexer_feed_char(lexer, buffer[i], false);
     }
+
+    /* Save the start of a token that continues in the next buffer */
+    g_string_append_len(lexer->token, buffer + lexer->tok_begin,
+                        lexer->tok_end - lexer->tok_begin);
+    lexer->buf = NULL;
+    lexer->tok_begin = lexer->tok_end = 0;
 }
 
 void json_lexer_flush(JSONLexer *lexer)
 {
+    /* Tokens pending at this point are all in lexer->token */
+    lexer->buf = "";
     json_lexer_feed_char(lexer, 0, true);
+    lexer->buf = NULL;
     assert(lexer->state == lexer->start_state);
-    json_message_process_token(lexer, lexer->token, JSON_END_OF_INPUT,
-                               lexer->x, lexer->y);
+    json_message_process_token(lexer, lexer->token->str, lexer->token->len,
+                               JSON_END_OF_INPUT, lexer->x, lexer->y);
 }
 
 void json_lexer_destroy(JSONLexer *lexer)
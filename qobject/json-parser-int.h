@@ -35,7 +35,17 @@ typedef enum json_token_type {
     JSON_MAX = JSON_END_OF_INPUT
 } JSONTokenType;
 
-typedef struct JSONToken JSONToken;
+/*
+ * Tokens of a message are kept in one array, and their text in one
+ * string, so that they don't need to be allocated one at a time.
+ */
+typedef struct JSONToken {
+    JSONTokenType type;
+    int x;
+    int y;
+    size_t offset;              /* of the text in the token string */
+    const char *str;            /* the text, set by json_parser_parse() */
+} JSONToken;
 
 /* json-lexer.c */
 void json_lexer_init(JSONLexer *lexer, bool enable_interpolation);
@@ -44,11 +54,11 @@ void json_lexer_flush(JSONLexer *lexer);
 void json_lexer_destroy(JSONLexer *lexer);
 
 /* json-streamer.c */
-void json_message_process_token(JSONLexer *lexer, GString *input,
+void json_message_process_token(JSONLexer *lexer, const char *str, size_t len,
                                 JSONTokenType type, int x, int y);
 
 /* json-parser.c */
-JSONToken *json_token(JSONTokenType type, int x, int y, GString *tokstr);
-QObject *json_parser_parse(GQueue *tokens, va_list *ap, Error **errp);
+QObject *json_parser_parse(GArray *tokens, GString *token_text, va_list *ap,
+                           Error **errp);
 
 #endif
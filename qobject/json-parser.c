@@ -24,17 +24,11 @@
 #include "qapi/qmp/qstring.h"
 #include "json-parser-int.h"
 
-struct JSONToken {
-    JSONTokenType type;
-    int x;
-    int y;
-    char str[];
-};
-
 typedef struct JSONParserContext {
     Error *err;
-    JSONToken *current;
-    GQueue *buf;
+    JSONToken *tokens;
+    size_t n_tokens;
+    size_t pos;
     va_list *ap;
 } JSONParserContext;
 
@@ -139,7 +133,21 @@ static QString *parse_string(JSONParserContext *ctxt, JSONToken *token)
 
     assert(*ptr == '"' || *ptr == '\'');
     quote = *ptr++;
-    str = g_string_new(NULL);
+
+    /*
+     * Most strings are plain ASCII without escapes, create those
+     * straight from the token.
+     */
+    for (beg = ptr; *ptr != quote; ptr++) {
+        if (*ptr == '\\' || (*ptr == '%' && ctxt->ap) ||
+            (uint8_t)*ptr >= 0x80) {
+            break;
+        }
+    }
+    if (*ptr == quote) {
+        return qstring_from_substr(beg, 0, ptr - beg);
+    }
+    str = g_string_new_len(beg, ptr - beg);
 
     while (*ptr != quote) {
         assert(*ptr);
@@ -235,20 +243,20 @@ out:
     return NULL;
 }
 
-/* Note: the token object returned by parser_context_peek_token or
- * parser_context_pop_token is deleted as soon as parser_context_pop_token
- * is called again.
- */
 static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
 {
-    g_free(ctxt->current);
-    ctxt->current = g_queue_pop_head(ctxt->buf);
-    return ctxt->current;
+    if (ctxt->pos == ctxt->n_tokens) {
+        return NULL;
+    }
+    return &ctxt->tokens[ctxt->pos++];
 }
 
 static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
 {
-    return g_queue_peek_head(ctxt->buf);
+    if (ctxt->pos == ctxt->n_tokens) {
+        return NULL;
+    }
+    return &ctxt->tokens[ctxt->pos];
 }
 
 /**
@@ -559,32 +567,26 @@ static QObject *parse_value(JSONParserContext *ctxt)
     }
 }
 
-JSONToken *json_token(JSONTokenType type, int x, int y, GString *tokstr)
-{
-    JSONToken *token = g_malloc(sizeof(JSONToken) + tokstr->len + 1);
-
-    token->type = type;
-    memcpy(token->str, tokstr->str, tokstr->len);
-    token->str[tokstr->len] = 0;
-    token->x = x;
-    token->y = y;
-    return token;
-}
-
-QObject *json_parser_parse(GQueue *tokens, va_list *ap, Error **errp)
+QObject *json_parser_parse(GArray *tokens, GString *token_text, va_list *ap,
+                           Error **errp)
 {
-    JSONParserContext ctxt = { .buf = tokens, .ap = ap };
+    JSONParserContext ctxt = {
+        .tokens = &g_array_index(tokens, JSONToken, 0),
+        .n_tokens = tokens->len,
+        .ap = ap,
+    };
     QObject *result;
+    size_t i;
+
+    /* token_text does not move anymore, point the tokens into it */
+    for (i = 0; i < ctxt.n_tokens; i++) {
+        ctxt.tokens[i].str = token_text->str + ctxt.tokens[i].offset;
+    }
 
     result = parse_value(&ctxt);
-    assert(ctxt.err || g_queue_is_empty(ctxt.buf));
+    assert(ctxt.err || ctxt.pos == ctxt.n_tokens);
 
     error_propagate(errp, ctxt.err);
 
-    while (!g_queue_is_empty(ctxt.buf)) {
-        parser_context_pop_token(&ctxt);
-    }
-    g_free(ctxt.current);
-
     return result;
 }
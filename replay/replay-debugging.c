@@ -11,6 +11,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "sysemu/replay.h"
 #include "sysemu/runstate.h"
 #include "replay-internal.h"
@@ -184,6 +185,8 @@ static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
 {
     char *snapshot = NULL;
     int64_t snapshot_icount;
+    int64_t mem_icount;
+    bool reload = false;
 
     if (replay_mode != REPLAY_MODE_PLAY) {
         error_setg(errp, "replay must be enabled to seek");
@@ -191,14 +194,43 @@ static void replay_seek(int64_t icount, QEMUTimerCB callback, Error **errp)
     }
 
     snapshot = replay_find_nearest_snapshot(icount, &snapshot_icount);
-    if (snapshot) {
+    /* Prefer the in-memory snapshots unless there is a later one on disk */
+    mem_icount = replay_snapshot_find(icount);
+    if (mem_icount != -1 && mem_icount >= snapshot_icount) {
         if (icount < replay_get_current_icount()
+            || replay_get_current_icount() < mem_icount) {
+            bool running = runstate_is_running();
+            Error *local_err = NULL;
+
+            vm_stop(RUN_STATE_RESTORE_VM);
+            if (replay_snapshot_load(mem_icount, &local_err)) {
+                g_free(snapshot);
+                snapshot = NULL;
+            } else if (snapshot) {
+                /*
+                 * The disk snapshot is older, but still gets us there.
+                 * Load it even when seeking forward, as the failed load
+                 * may have changed guest RAM already.
+                 */
+                warn_report_err(local_err);
+                reload = true;
+            } else {
+                error_propagate(errp, local_err);
+                if (running) {
+                    vm_start();
+                }
+                return;
+            }
+        }
+    }
+    if (snapshot) {
+        if (reload || icount < replay_get_current_icount()
             || replay_get_current_icount() < snapshot_icount) {
             vm_stop(RUN_STATE_RESTORE_VM);
             load_snapshot(snapshot, NULL, false, NULL, errp);
         }
-        g_free(snapshot);
     }
+    g_free(snapshot);
     if (replay_get_current_icount() <= icount) {
         replay_break(icount, callback, NULL);
         vm_start();
@@ -15,6 +15,11 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
+#include "qemu/units.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -29,6 +34,65 @@ static unsigned long mutex_head, mutex_tail;
 /* File for replay writing */
 static bool write_error;
 FILE *replay_file;
+bool replay_log_compressed;
+
+/*
+ * The log is written and read in blocks.  While recording, the vCPU
+ * threads only append to the current block under the replay mutex, and
+ * full blocks are handed to a writer thread.  While replaying, a reader
+ * thread fills blocks ahead of the vCPU.
+ *
+ * Compressed logs store every block as a separate zstd frame, preceded
+ * by its uncompressed and compressed sizes.  All blocks but the last
+ * are full, so replay_log_seek() can find the frame for an offset.
+ * Uncompressed logs are a plain byte stream.
+ */
+#define REPLAY_LOG_BLOCK_SIZE   (256 * KiB)
+#define REPLAY_LOG_MAX_BLOCKS   8
+#define REPLAY_LOG_FRAME_HEADER 8
+#define REPLAY_LOG_ZSTD_LEVEL   3
+
+typedef struct ReplayLogBlock {
+    uint8_t *data;
+    size_t len;
+    QSIMPLEQ_ENTRY(ReplayLogBlock) next;
+} ReplayLogBlock;
+
+typedef struct ReplayLog {
+    QemuMutex lock;
+    QemuCond cond;
+    QemuThread thread;
+    bool running;
+    bool stop;
+    bool eof;
+    bool error;
+    /* Full blocks waiting to be written, or blocks read ahead */
+    QSIMPLEQ_HEAD(, ReplayLogBlock) queue;
+    unsigned int queued;
+    QSIMPLEQ_HEAD(, ReplayLogBlock) free_blocks;
+
+    /* Only accessed with the replay mutex held */
+    ReplayLogBlock *cur;
+    size_t pos;
+    size_t skip;
+    /* Log offset of the beginning of cur */
+    uint64_t offset;
+
+    /* Log offset of the first frame */
+    uint64_t base;
+    /* File offsets of the frames found so far */
+    GArray *frames;
+    /* Index of the next frame to be read */
+    uint64_t read_frame;
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+#endif
+} ReplayLog;
+
+static ReplayLog replay_log;
 
 static void replay_write_error(void)
 {
@@ -44,12 +108,397 @@ static void replay_read_error(void)
     exit(1);
 }
 
+/* Called with replay_log.lock held */
+static ReplayLogBlock *replay_log_get_block_locked(ReplayLog *log)
+{
+    ReplayLogBlock *blk = QSIMPLEQ_FIRST(&log->free_blocks);
+
+    if (blk) {
+        QSIMPLEQ_REMOVE_HEAD(&log->free_blocks, next);
+    } else {
+        blk = g_new0(ReplayLogBlock, 1);
+        blk->data = g_malloc(REPLAY_LOG_BLOCK_SIZE);
+    }
+    blk->len = 0;
+    return blk;
+}
+
+static bool replay_log_write_block(ReplayLog *log, ReplayLogBlock *blk)
+{
+#ifdef CONFIG_ZSTD
+    if (replay_log_compressed) {
+        uint8_t header[REPLAY_LOG_FRAME_HEADER];
+        size_t len;
+
+        len = ZSTD_compressCCtx(log->cctx, log->zbuf, log->zbuf_size,
+                                blk->data, blk->len, REPLAY_LOG_ZSTD_LEVEL);
+        if (ZSTD_isError(len)) {
+            return false;
+        }
+        stl_be_p(header, blk->len);
+        stl_be_p(header + 4, len);
+        return fwrite(header, 1, sizeof(header), replay_file) ==
+               sizeof(header) &&
+               fwrite(log->zbuf, 1, len, replay_file) == len;
+    }
+#endif
+    return fwrite(blk->data, 1, blk->len, replay_file) == blk->len;
+}
+
+static void *replay_log_writer(void *opaque)
+{
+    ReplayLog *log = opaque;
+    ReplayLogBlock *blk;
+    bool ok;
+
+    qemu_mutex_lock(&log->lock);
+    for (;;) {
+        blk = QSIMPLEQ_FIRST(&log->queue);
+        if (!blk) {
+            if (log->stop) {
+                break;
+            }
+            qemu_cond_wait(&log->cond, &log->lock);
+            continue;
+        }
+        qemu_mutex_unlock(&log->lock);
+
+        ok = replay_log_write_block(log, blk);
+
+        qemu_mutex_lock(&log->lock);
+        QSIMPLEQ_REMOVE_HEAD(&log->queue, next);
+        log->queued--;
+        QSIMPLEQ_INSERT_HEAD(&log->free_blocks, blk, next);
+        log->error |= !ok;
+        qemu_cond_broadcast(&log->cond);
+    }
+    qemu_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+/* Returns 1 if a block was read, 0 at the end of the log, -1 on errors */
+static int replay_log_read_block(ReplayLog *log, ReplayLogBlock *blk)
+{
+#ifdef CONFIG_ZSTD
+    if (replay_log_compressed) {
+        uint8_t header[REPLAY_LOG_FRAME_HEADER];
+        uint32_t len, zlen;
+        size_t ret;
+
+        ret = fread(header, 1, sizeof(header), replay_file);
+        if (ret == 0 && feof(replay_file)) {
+            return 0;
+        }
+        if (ret != sizeof(header)) {
+            return -1;
+        }
+        len = ldl_be_p(header);
+        zlen = ldl_be_p(header + 4);
+        if (!len || len > REPLAY_LOG_BLOCK_SIZE || zlen > log->zbuf_size ||
+            fread(log->zbuf, 1, zlen, replay_file) != zlen) {
+            return -1;
+        }
+        ret = ZSTD_decompressDCtx(log->dctx, blk->data, REPLAY_LOG_BLOCK_SIZE,
+                                  log->zbuf, zlen);
+        if (ZSTD_isError(ret) || ret != len) {
+            return -1;
+        }
+        blk->len = len;
+
+        /* Remember where the next frame starts, for replay_log_seek() */
+        if (++log->read_frame == log->frames->len) {
+            uint64_t pos = g_array_index(log->frames, uint64_t,
+                                         log->frames->len - 1);
+
+            pos += sizeof(header) + zlen;
+            g_array_append_val(log->frames, pos);
+        }
+        return 1;
+    }
+#endif
+    blk->len = fread(blk->data, 1, REPLAY_LOG_BLOCK_SIZE, replay_file);
+    if (!blk->len) {
+        return ferror(replay_file) ? -1 : 0;
+    }
+    return 1;
+}
+
+static void *replay_log_reader(void *opaque)
+{
+    ReplayLog *log = opaque;
+    ReplayLogBlock *blk;
+    int ret;
+
+    qemu_mutex_lock(&log->lock);
+    while (!log->stop) {
+        if (log->queued >= REPLAY_LOG_MAX_BLOCKS) {
+            qemu_cond_wait(&log->cond, &log->lock);
+            continue;
+        }
+        blk = replay_log_get_block_locked(log);
+        qemu_mutex_unlock(&log->lock);
+
+        ret = replay_log_read_block(log, blk);
+
+        qemu_mutex_lock(&log->lock);
+        if (ret <= 0) {
+            QSIMPLEQ_INSERT_HEAD(&log->free_blocks, blk, next);
+            log->eof = ret == 0;
+            log->error = ret < 0;
+            qemu_cond_broadcast(&log->cond);
+            break;
+        }
+        QSIMPLEQ_INSERT_TAIL(&log->queue, blk, next);
+        log->queued++;
+        qemu_cond_broadcast(&log->cond);
+    }
+    qemu_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+static void replay_log_start_thread(ReplayLog *log)
+{
+    assert(!log->running);
+    log->stop = false;
+    log->running = true;
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        qemu_thread_create(&log->thread, "replay-writer", replay_log_writer,
+                           log, QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&log->thread, "replay-reader", replay_log_reader,
+                           log, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void replay_log_stop_thread(ReplayLog *log)
+{
+    if (!log->running) {
+        return;
+    }
+    qemu_mutex_lock(&log->lock);
+    log->stop = true;
+    qemu_cond_broadcast(&log->cond);
+    qemu_mutex_unlock(&log->lock);
+    qemu_thread_join(&log->thread);
+    log->running = false;
+}
+
+/* Move all blocks to the free list */
+static void replay_log_drop_blocks(ReplayLog *log)
+{
+    ReplayLogBlock *blk;
+
+    assert(!log->running);
+    if (log->cur) {
+        QSIMPLEQ_INSERT_HEAD(&log->free_blocks, log->cur, next);
+        log->cur = NULL;
+    }
+    while ((blk = QSIMPLEQ_FIRST(&log->queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&log->queue, next);
+        QSIMPLEQ_INSERT_HEAD(&log->free_blocks, blk, next);
+    }
+    log->queued = 0;
+}
+
+/* Hand the current block to the writer thread and start a new one */
+static void replay_log_push_block(ReplayLog *log)
+{
+    bool error;
+
+    qemu_mutex_lock(&log->lock);
+    while (log->queued >= REPLAY_LOG_MAX_BLOCKS) {
+        qemu_cond_wait(&log->cond, &log->lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&log->queue, log->cur, next);
+    log->queued++;
+    log->offset += log->cur->len;
+    log->cur = replay_log_get_block_locked(log);
+    error = log->error;
+    qemu_cond_broadcast(&log->cond);
+    qemu_mutex_unlock(&log->lock);
+
+    if (error) {
+        replay_write_error();
+    }
+}
+
+/* Make the next block read ahead the current one */
+static void replay_log_next_block(ReplayLog *log)
+{
+    ReplayLogBlock *blk;
+
+    qemu_mutex_lock(&log->lock);
+    for (;;) {
+        if (log->cur) {
+            log->offset += log->cur->len;
+            QSIMPLEQ_INSERT_HEAD(&log->free_blocks, log->cur, next);
+            log->cur = NULL;
+        }
+        while (!(blk = QSIMPLEQ_FIRST(&log->queue)) &&
+               !log->eof && !log->error) {
+            qemu_cond_wait(&log->cond, &log->lock);
+        }
+        if (!blk) {
+            qemu_mutex_unlock(&log->lock);
+            replay_read_error();
+        }
+        QSIMPLEQ_REMOVE_HEAD(&log->queue, next);
+        log->queued--;
+        qemu_cond_broadcast(&log->cond);
+
+        log->cur = blk;
+        if (log->skip < blk->len) {
+            break;
+        }
+        log->skip -= blk->len;
+    }
+    qemu_mutex_unlock(&log->lock);
+
+    log->pos = log->skip;
+    log->skip = 0;
+}
+
+/*
+ * Position the file at the frame with index @frame, reading the sizes
+ * of the frames before it if needed.
+ */
+static bool replay_log_find_frame(ReplayLog *log, uint64_t frame)
+{
+    uint8_t header[REPLAY_LOG_FRAME_HEADER];
+    uint64_t pos;
+
+    while (log->frames->len <= frame) {
+        pos = g_array_index(log->frames, uint64_t, log->frames->len - 1);
+        if (fseek(replay_file, pos, SEEK_SET) != 0 ||
+            fread(header, 1, sizeof(header), replay_file) != sizeof(header)) {
+            return false;
+        }
+        pos += sizeof(header) + ldl_be_p(header + 4);
+        g_array_append_val(log->frames, pos);
+    }
+    pos = g_array_index(log->frames, uint64_t, frame);
+    return fseek(replay_file, pos, SEEK_SET) == 0;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    ReplayLog *log = &replay_log;
+
+    assert(replay_mode == REPLAY_MODE_PLAY);
+    replay_log_stop_thread(log);
+    replay_log_drop_blocks(log);
+    log->eof = false;
+    log->error = false;
+
+    if (replay_log_compressed) {
+        uint64_t frame = (offset - log->base) / REPLAY_LOG_BLOCK_SIZE;
+
+        if (!replay_log_find_frame(log, frame)) {
+            replay_read_error();
+        }
+        log->read_frame = frame;
+        log->offset = log->base + frame * REPLAY_LOG_BLOCK_SIZE;
+    } else {
+        if (fseek(replay_file, offset, SEEK_SET) != 0) {
+            replay_read_error();
+        }
+        log->offset = offset;
+    }
+    log->skip = offset - log->offset;
+    log->pos = 0;
+
+    replay_log_start_thread(log);
+}
+
+uint64_t replay_log_tell(void)
+{
+    ReplayLog *log = &replay_log;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        return log->offset + log->cur->len;
+    }
+    return log->offset + (log->cur ? log->pos : log->skip);
+}
+
+void replay_log_start(uint64_t offset)
+{
+    ReplayLog *log = &replay_log;
+
+    qemu_mutex_init(&log->lock);
+    qemu_cond_init(&log->cond);
+    QSIMPLEQ_INIT(&log->queue);
+    QSIMPLEQ_INIT(&log->free_blocks);
+    log->base = offset;
+
+#ifdef CONFIG_ZSTD
+    if (replay_log_compressed) {
+        log->zbuf_size = ZSTD_compressBound(REPLAY_LOG_BLOCK_SIZE);
+        log->zbuf = g_malloc(log->zbuf_size);
+        if (replay_mode == REPLAY_MODE_RECORD) {
+            log->cctx = ZSTD_createCCtx();
+        } else {
+            log->dctx = ZSTD_createDCtx();
+        }
+    }
+#else
+    assert(!replay_log_compressed);
+#endif
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        log->offset = offset;
+        log->cur = replay_log_get_block_locked(log);
+        replay_log_start_thread(log);
+    } else {
+        log->frames = g_array_new(false, false, sizeof(uint64_t));
+        g_array_append_val(log->frames, offset);
+        replay_log_seek(offset);
+    }
+}
+
+void replay_log_stop(void)
+{
+    ReplayLog *log = &replay_log;
+    ReplayLogBlock *blk;
+
+    if (replay_mode == REPLAY_MODE_RECORD && log->cur->len) {
+        replay_log_push_block(log);
+    }
+    replay_log_stop_thread(log);
+    if (log->error && replay_mode == REPLAY_MODE_RECORD) {
+        replay_write_error();
+    }
+
+    replay_log_drop_blocks(log);
+    while ((blk = QSIMPLEQ_FIRST(&log->free_blocks))) {
+        QSIMPLEQ_REMOVE_HEAD(&log->free_blocks, next);
+        g_free(blk->data);
+        g_free(blk);
+    }
+    if (log->frames) {
+        g_array_free(log->frames, true);
+        log->frames = NULL;
+    }
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(log->cctx);
+    log->cctx = NULL;
+    ZSTD_freeDCtx(log->dctx);
+    log->dctx = NULL;
+    g_free(log->zbuf);
+    log->zbuf = NULL;
+#endif
+    qemu_cond_destroy(&log->cond);
+    qemu_mutex_destroy(&log->lock);
+}
+
 void replay_put_byte(uint8_t byte)
 {
+    ReplayLog *log = &replay_log;
+
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        if (unlikely(log->cur->len == REPLAY_LOG_BLOCK_SIZE)) {
+            replay_log_push_block(log);
         }
+        log->cur->data[log->cur->len++] = byte;
     }
 }
 
@@ -80,23 +529,35 @@ void replay_put_qword(int64_t qword)
 
 void replay_put_array(const uint8_t *buf, size_t size)
 {
+    ReplayLog *log = &replay_log;
+
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size) {
+            size_t len;
+
+            if (log->cur->len == REPLAY_LOG_BLOCK_SIZE) {
+                replay_log_push_block(log);
+            }
+            len = MIN(size, REPLAY_LOG_BLOCK_SIZE - log->cur->len);
+            memcpy(log->cur->data + log->cur->len, buf, len);
+            log->cur->len += len;
+            buf += len;
+            size -= len;
         }
     }
 }
 
 uint8_t replay_get_byte(void)
 {
+    ReplayLog *log = &replay_log;
     uint8_t byte = 0;
+
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
+        if (unlikely(!log->cur || log->pos == log->cur->len)) {
+            replay_log_next_block(log);
         }
-        byte = r;
+        byte = log->cur->data[log->pos++];
     }
     return byte;
 }
@@ -134,13 +595,29 @@ int64_t replay_get_qword(void)
     return qword;
 }
 
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    ReplayLog *log = &replay_log;
+
+    while (size) {
+        size_t len;
+
+        if (!log->cur || log->pos == log->cur->len) {
+            replay_log_next_block(log);
+        }
+        len = MIN(size, log->cur->len - log->pos);
+        memcpy(buf, log->cur->data + log->pos, len);
+        log->pos += len;
+        buf += len;
+        size -= len;
+    }
+}
+
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -149,20 +626,55 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
+    }
+}
+
+/*
+ * Whether everything the reader thread queued before it stopped has
+ * been consumed.  Once the current block is used up, this waits for the
+ * reader to either queue the next block or stop, so that the end of the
+ * log is reported right after its last event.
+ */
+static bool replay_log_drained(ReplayLog *log)
+{
+    bool drained;
+
+    if (log->cur && log->pos < log->cur->len) {
+        return false;
     }
+    qemu_mutex_lock(&log->lock);
+    while (QSIMPLEQ_EMPTY(&log->queue) && !log->eof && !log->error) {
+        qemu_cond_wait(&log->cond, &log->lock);
+    }
+    drained = QSIMPLEQ_EMPTY(&log->queue);
+    qemu_mutex_unlock(&log->lock);
+    return drained;
 }
 
 void replay_check_error(void)
 {
+    ReplayLog *log = &replay_log;
+
     if (replay_file) {
-        if (feof(replay_file)) {
-            error_report("replay file is over");
-            qemu_system_vmstop_request_prepare();
-            qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+        if (replay_mode == REPLAY_MODE_PLAY) {
+            /*
+             * The reader stops at the end of the log or at the first
+             * error; the blocks it read before that are still valid.
+             */
+            if (!replay_log_drained(log)) {
+                return;
+            }
+            if (log->eof) {
+                error_report("replay file is over");
+                qemu_system_vmstop_request_prepare();
+                qemu_system_vmstop_request(RUN_STATE_PAUSED);
+            } else {
+                error_report("replay file is over or something goes wrong");
+                qemu_system_vmstop_request_prepare();
+                qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
+            }
+        } else if (qatomic_read(&log->error)) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
@@ -272,6 +784,9 @@ void replay_advance_current_icount(uint64_t current_icount)
             timer_mod_ns(replay_break_timer,
                 qemu_clock_get_ns(QEMU_CLOCK_REALTIME));
         }
+        if (replay_state.current_icount >= replay_snapshot_next_icount) {
+            replay_snapshot_request();
+        }
     }
 }
 
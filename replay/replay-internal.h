@@ -89,11 +89,22 @@ extern ReplayState replay_state;
 
 /* File for replay writing */
 extern FILE *replay_file;
+/* Whether the log is made of zstd frames, see replay-internal.c */
+extern bool replay_log_compressed;
 /* Instruction count of the replay breakpoint */
 extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/*! Starts buffering the log from the given file offset. */
+void replay_log_start(uint64_t offset);
+/*! Writes out or drops the buffered data. */
+void replay_log_stop(void);
+/*! Returns the offset of the next byte to be read or written. */
+uint64_t replay_log_tell(void);
+/*! Continues reading the log at the given offset. */
+void replay_log_seek(uint64_t offset);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
@@ -190,4 +201,24 @@ void *replay_event_net_load(void);
    to make cached timers available for post_load functions. */
 void replay_vmstate_register(void);
 
+/* In-memory snapshots */
+
+/* Number of instructions between the snapshots, 0 if disabled */
+extern uint64_t replay_snapshot_period;
+/* Memory used for the snapshots, not counting the copy of guest RAM */
+extern uint64_t replay_snapshot_budget;
+/* Instruction count at which the next snapshot is due */
+extern uint64_t replay_snapshot_next_icount;
+
+/*! Starts taking the snapshots in replay mode. */
+void replay_snapshots_start(void);
+/*! Frees all the snapshots. */
+void replay_snapshots_finish(void);
+/*! Called from the vCPU thread when the next snapshot is due. */
+void replay_snapshot_request(void);
+/*! Returns the icount of the last snapshot at or before icount, or -1. */
+int64_t replay_snapshot_find(uint64_t icount);
+/*! Loads the snapshot taken at icount and drops the newer ones. */
+bool replay_snapshot_load(uint64_t icount, Error **errp);
+
 #endif
@@ -18,11 +18,86 @@
 #include "qemu/error-report.h"
 #include "migration/vmstate.h"
 #include "migration/snapshot.h"
+#include "migration/qemu-file.h"
+#include "migration/savevm.h"
+#include "io/channel-buffer.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "exec/tb-flush.h"
+#include "hw/core/cpu.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/runstate.h"
+
+/*
+ * In-memory snapshots
+ *
+ * In replay mode a snapshot is taken every replay_snapshot_period
+ * instructions, so that reverse debugging does not have to go back to
+ * the last snapshot on disk.  The device state is saved in full, while
+ * guest RAM is kept as a single copy that matches the newest snapshot.
+ * Every snapshot also keeps the old contents of the pages that changed
+ * since the previous one, so that the copy can be rolled back to any
+ * of them.  Restoring a snapshot then only writes back the pages that
+ * differ between guest RAM and the rolled back copy.
+ *
+ * The oldest snapshots are dropped when the device state and page
+ * contents exceed replay_snapshot_budget bytes.  The copy of guest RAM
+ * comes on top of that.
+ *
+ * Block devices are not part of the snapshots, so they cannot be used
+ * while a guest device can write to a disk: replaying from a snapshot
+ * would then see disk contents that are newer than the snapshot.
+ */
+
+#define REPLAY_SNAPSHOT_BUDGET      (256 * MiB)
+
+typedef struct ReplayRAMBlock {
+    RAMBlock *rb;
+    ram_addr_t length;
+    /* Contents of the block at the newest snapshot */
+    uint8_t *copy;
+} ReplayRAMBlock;
+
+typedef struct ReplayPage {
+    unsigned int block;
+    ram_addr_t offset;
+} ReplayPage;
+
+typedef struct ReplayMemSnapshot {
+    uint64_t icount;
+    /* Output of qemu_save_device_state() */
+    uint8_t *devices;
+    size_t devices_size;
+    /* Pages that changed since the previous snapshot */
+    GArray *pages;
+    /* Contents of these pages at the previous snapshot */
+    uint8_t *undo;
+    size_t undo_size;
+    QTAILQ_ENTRY(ReplayMemSnapshot) next;
+} ReplayMemSnapshot;
+
+static QTAILQ_HEAD(, ReplayMemSnapshot) replay_snapshots =
+    QTAILQ_HEAD_INITIALIZER(replay_snapshots);
+static GArray *replay_snapshot_blocks;
+static size_t replay_snapshot_used;
+static QEMUBH *replay_snapshot_bh;
+static bool replay_snapshot_restoring;
+
+uint64_t replay_snapshot_period;
+uint64_t replay_snapshot_budget = REPLAY_SNAPSHOT_BUDGET;
+uint64_t replay_snapshot_next_icount = -1ULL;
+
+static void replay_snapshots_drop(void);
 
 static int replay_pre_save(void *opaque)
 {
     ReplayState *state = opaque;
-    state->file_offset = ftell(replay_file);
+    state->file_offset = replay_log_tell();
 
     return 0;
 }
@@ -31,7 +106,11 @@ static int replay_post_load(void *opaque, int version_id)
 {
     ReplayState *state = opaque;
     if (replay_mode == REPLAY_MODE_PLAY) {
-        fseek(replay_file, state->file_offset, SEEK_SET);
+        /* Guest RAM no longer matches the in-memory snapshots */
+        if (!replay_snapshot_restoring) {
+            replay_snapshots_drop();
+        }
+        replay_log_seek(state->file_offset);
         /* If this was a vmstate, saved in recording mode,
            we need to initialize replay data fields. */
         replay_fetch_data_kind();
@@ -96,3 +175,371 @@ bool replay_can_snapshot(void)
     return replay_mode == REPLAY_MODE_NONE
         || !replay_has_events();
 }
+
+static size_t replay_snapshot_size(ReplayMemSnapshot *snap)
+{
+    return snap->devices_size + snap->undo_size +
+           snap->pages->len * sizeof(ReplayPage);
+}
+
+static void replay_snapshot_free_undo(ReplayMemSnapshot *snap)
+{
+    replay_snapshot_used -= snap->undo_size +
+                            snap->pages->len * sizeof(ReplayPage);
+    g_array_set_size(snap->pages, 0);
+    g_free(snap->undo);
+    snap->undo = NULL;
+    snap->undo_size = 0;
+}
+
+static void replay_snapshot_free(ReplayMemSnapshot *snap)
+{
+    QTAILQ_REMOVE(&replay_snapshots, snap, next);
+    replay_snapshot_used -= replay_snapshot_size(snap);
+    g_array_free(snap->pages, true);
+    g_free(snap->undo);
+    g_free(snap->devices);
+    g_free(snap);
+}
+
+static void replay_snapshot_free_blocks(void)
+{
+    unsigned int i;
+
+    if (!replay_snapshot_blocks) {
+        return;
+    }
+    for (i = 0; i < replay_snapshot_blocks->len; i++) {
+        g_free(g_array_index(replay_snapshot_blocks, ReplayRAMBlock, i).copy);
+    }
+    g_array_free(replay_snapshot_blocks, true);
+    replay_snapshot_blocks = NULL;
+}
+
+static void replay_snapshots_drop(void)
+{
+    while (!QTAILQ_EMPTY(&replay_snapshots)) {
+        replay_snapshot_free(QTAILQ_FIRST(&replay_snapshots));
+    }
+    replay_snapshot_free_blocks();
+    if (replay_snapshot_period) {
+        /* Take a new one as soon as possible */
+        replay_snapshot_next_icount = 0;
+    }
+}
+
+static int replay_snapshot_add_block(RAMBlock *rb, void *opaque)
+{
+    GArray *blocks = opaque;
+    ReplayRAMBlock b = {
+        .rb = rb,
+        .length = qemu_ram_get_used_length(rb),
+    };
+
+    if (qemu_ram_is_migratable(rb)) {
+        g_array_append_val(blocks, b);
+    }
+    return 0;
+}
+
+/*
+ * Check that guest RAM is laid out like it was at the previous snapshot,
+ * or start over with a fresh copy of it.
+ */
+static bool replay_snapshot_check_blocks(void)
+{
+    g_autoptr(GArray) blocks = g_array_new(false, false,
+                                           sizeof(ReplayRAMBlock));
+    unsigned int i;
+
+    qemu_ram_foreach_block(replay_snapshot_add_block, blocks);
+    if (replay_snapshot_blocks &&
+        replay_snapshot_blocks->len == blocks->len) {
+        for (i = 0; i < blocks->len; i++) {
+            ReplayRAMBlock *a = &g_array_index(blocks, ReplayRAMBlock, i);
+            ReplayRAMBlock *b = &g_array_index(replay_snapshot_blocks,
+                                               ReplayRAMBlock, i);
+
+            if (a->rb != b->rb || a->length != b->length) {
+                break;
+            }
+        }
+        if (i == blocks->len) {
+            return true;
+        }
+    }
+
+    replay_snapshots_drop();
+    for (i = 0; i < blocks->len; i++) {
+        ReplayRAMBlock *b = &g_array_index(blocks, ReplayRAMBlock, i);
+
+        b->copy = g_try_malloc(b->length);
+        if (!b->copy) {
+            while (i--) {
+                g_free(g_array_index(blocks, ReplayRAMBlock, i).copy);
+            }
+            return false;
+        }
+        memcpy(b->copy, qemu_ram_get_host_addr(b->rb), b->length);
+    }
+    replay_snapshot_blocks = g_steal_pointer(&blocks);
+    return true;
+}
+
+/* Bring the copy of guest RAM up to date and remember what changed */
+static void replay_snapshot_save_pages(ReplayMemSnapshot *snap)
+{
+    size_t page = qemu_target_page_size();
+    size_t undo_alloc = 0;
+    unsigned int i;
+
+    for (i = 0; i < replay_snapshot_blocks->len; i++) {
+        ReplayRAMBlock *b = &g_array_index(replay_snapshot_blocks,
+                                           ReplayRAMBlock, i);
+        uint8_t *host = qemu_ram_get_host_addr(b->rb);
+        ram_addr_t offset;
+
+        for (offset = 0; offset < b->length; offset += page) {
+            ReplayPage p = { .block = i, .offset = offset };
+
+            if (memcmp(b->copy + offset, host + offset, page) == 0) {
+                continue;
+            }
+            if (snap->undo_size == undo_alloc) {
+                undo_alloc = MAX(undo_alloc * 2, 64 * page);
+                snap->undo = g_realloc(snap->undo, undo_alloc);
+            }
+            memcpy(snap->undo + snap->undo_size, b->copy + offset, page);
+            snap->undo_size += page;
+            g_array_append_val(snap->pages, p);
+            memcpy(b->copy + offset, host + offset, page);
+        }
+    }
+    snap->undo = g_realloc(snap->undo, snap->undo_size);
+}
+
+static bool replay_snapshot_check_disks(Error **errp)
+{
+    BlockBackend *blk = NULL;
+
+    while ((blk = blk_all_next(blk)) != NULL) {
+        if (blk_get_attached_dev(blk) && blk_is_inserted(blk) &&
+            blk_is_writable(blk)) {
+            g_autofree char *id = blk_get_attached_dev_id(blk);
+
+            error_setg(errp, "rrsnapshot-period cannot be used with the "
+                       "writable block device of '%s'", id);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool replay_snapshot_save(Error **errp)
+{
+    QIOChannelBuffer *bioc;
+    ReplayMemSnapshot *snap;
+    QEMUFile *f;
+    bool first;
+    int ret;
+
+    /* A disk may have been hot-plugged since replay_snapshots_start() */
+    if (!replay_snapshot_check_disks(errp)) {
+        return false;
+    }
+    if (!replay_snapshot_check_blocks()) {
+        error_setg(errp, "cannot allocate a copy of guest RAM");
+        return false;
+    }
+    first = QTAILQ_EMPTY(&replay_snapshots);
+
+    bioc = qio_channel_buffer_new(4096);
+    f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    ret = qemu_save_device_state(f);
+    qemu_fflush(f);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "cannot save device state");
+        qemu_fclose(f);
+        object_unref(OBJECT(bioc));
+        return false;
+    }
+
+    snap = g_new0(ReplayMemSnapshot, 1);
+    snap->icount = replay_get_current_icount();
+    snap->devices = g_memdup2(bioc->data, bioc->usage);
+    snap->devices_size = bioc->usage;
+    snap->pages = g_array_new(false, false, sizeof(ReplayPage));
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+
+    /* The copy of guest RAM was just made, nothing to roll back */
+    if (!first) {
+        replay_snapshot_save_pages(snap);
+    }
+    QTAILQ_INSERT_TAIL(&replay_snapshots, snap, next);
+    replay_snapshot_used += replay_snapshot_size(snap);
+
+    /*
+     * Drop the oldest snapshots.  The next one becomes the oldest, so its
+     * pages are not needed anymore either.
+     */
+    while (replay_snapshot_used > replay_snapshot_budget &&
+           QTAILQ_FIRST(&replay_snapshots) != snap) {
+        replay_snapshot_free(QTAILQ_FIRST(&replay_snapshots));
+        replay_snapshot_free_undo(QTAILQ_FIRST(&replay_snapshots));
+    }
+    return true;
+}
+
+static void replay_snapshot_bh_cb(void *opaque)
+{
+    Error *err = NULL;
+
+    /* Wait for the pending events to be processed, then retry */
+    if (!runstate_is_running() || !replay_can_snapshot()) {
+        replay_snapshot_next_icount = replay_get_current_icount() + 1;
+        return;
+    }
+
+    vm_stop(RUN_STATE_SAVE_VM);
+    if (replay_snapshot_save(&err)) {
+        replay_snapshot_next_icount =
+            replay_get_current_icount() + replay_snapshot_period;
+    } else {
+        error_report_err(err);
+        warn_report("Record/replay: disabling in-memory snapshots");
+        replay_snapshot_period = 0;
+        replay_snapshots_drop();
+    }
+    vm_start();
+}
+
+int64_t replay_snapshot_find(uint64_t icount)
+{
+    ReplayMemSnapshot *snap;
+
+    QTAILQ_FOREACH_REVERSE(snap, &replay_snapshots, next) {
+        if (snap->icount <= icount) {
+            return snap->icount;
+        }
+    }
+    return -1;
+}
+
+/* Write back the pages of guest RAM that differ from the copy */
+static void replay_snapshot_load_pages(void)
+{
+    size_t page = qemu_target_page_size();
+    unsigned int i;
+
+    for (i = 0; i < replay_snapshot_blocks->len; i++) {
+        ReplayRAMBlock *b = &g_array_index(replay_snapshot_blocks,
+                                           ReplayRAMBlock, i);
+        size_t n = DIV_ROUND_UP(b->length, page);
+        g_autofree unsigned long *changed = bitmap_new(n);
+        size_t start, end;
+
+        if (!buffer_copy_changed(qemu_ram_get_host_addr(b->rb), b->copy,
+                                 b->length, page, changed)) {
+            continue;
+        }
+        for (start = find_first_bit(changed, n); start < n;
+             start = find_next_bit(changed, n, end)) {
+            end = find_next_zero_bit(changed, n, start);
+            memory_region_set_dirty(b->rb->mr, start * page,
+                                    MIN((end - start) * page,
+                                        b->length - start * page));
+        }
+    }
+}
+
+bool replay_snapshot_load(uint64_t icount, Error **errp)
+{
+    ReplayMemSnapshot *snap, *prev;
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    int ret;
+
+    /* Roll the copy of guest RAM back to the requested snapshot */
+    QTAILQ_FOREACH_REVERSE_SAFE(snap, &replay_snapshots, next, prev) {
+        size_t page = qemu_target_page_size();
+        unsigned int i;
+
+        if (snap->icount <= icount) {
+            break;
+        }
+        for (i = 0; i < snap->pages->len; i++) {
+            ReplayPage *p = &g_array_index(snap->pages, ReplayPage, i);
+            ReplayRAMBlock *b = &g_array_index(replay_snapshot_blocks,
+                                               ReplayRAMBlock, p->block);
+
+            memcpy(b->copy + p->offset, snap->undo + i * page, page);
+        }
+        replay_snapshot_free(snap);
+    }
+    if (!snap || snap->icount != icount) {
+        error_setg(errp, "no in-memory snapshot at instruction %" PRIu64,
+                   icount);
+        replay_snapshots_drop();
+        return false;
+    }
+
+    replay_snapshot_load_pages();
+    tb_flush(first_cpu);
+
+    bioc = qio_channel_buffer_new(snap->devices_size);
+    memcpy(bioc->data, snap->devices, snap->devices_size);
+    bioc->usage = snap->devices_size;
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    replay_snapshot_restoring = true;
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        ret = -EINVAL;
+    } else {
+        ret = qemu_load_device_state(f);
+    }
+    replay_snapshot_restoring = false;
+    qemu_fclose(f);
+
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "cannot load device state");
+        replay_snapshots_drop();
+        return false;
+    }
+    replay_snapshot_next_icount = icount + replay_snapshot_period;
+    return true;
+}
+
+void replay_snapshots_start(void)
+{
+    Error *err = NULL;
+
+    if (replay_mode != REPLAY_MODE_PLAY || !replay_snapshot_period) {
+        return;
+    }
+    if (!replay_snapshot_check_disks(&err)) {
+        error_reportf_err(err, "Record/replay: ");
+        exit(1);
+    }
+    replay_snapshot_bh = qemu_bh_new(replay_snapshot_bh_cb, NULL);
+    replay_snapshot_next_icount = 0;
+}
+
+void replay_snapshots_finish(void)
+{
+    replay_snapshots_drop();
+    replay_snapshot_next_icount = -1ULL;
+    if (replay_snapshot_bh) {
+        qemu_bh_delete(replay_snapshot_bh);
+        replay_snapshot_bh = NULL;
+    }
+}
+
+void replay_snapshot_request(void)
+{
+    replay_snapshot_next_icount = -1ULL;
+    /* Cannot stop the VM directly from the vCPU thread */
+    qemu_bh_schedule(replay_snapshot_bh);
+}
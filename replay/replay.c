@@ -19,10 +19,13 @@
 #include "qemu/option.h"
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
+#include "qemu/bswap.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
 #define REPLAY_VERSION              0xe0200c
+/* Version of logs that are compressed with zstd */
+#define REPLAY_VERSION_ZSTD         (REPLAY_VERSION | 0x80000000)
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
@@ -263,14 +266,26 @@ static void replay_enable(const char *fname, int mode)
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_start(HEADER_SIZE);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint8_t header[sizeof(uint32_t)];
+        unsigned int version = 0;
+
+        if (fread(header, 1, sizeof(header), replay_file) == sizeof(header)) {
+            version = ldl_be_p(header);
+        }
+        if (version == REPLAY_VERSION_ZSTD) {
+#ifdef CONFIG_ZSTD
+            replay_log_compressed = true;
+#else
+            fprintf(stderr, "Replay: compressed logs are not supported\n");
+            exit(1);
+#endif
+        } else if (version != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_start(HEADER_SIZE);
         replay_fetch_data_kind();
     }
 
@@ -311,6 +326,18 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
+    if (mode == REPLAY_MODE_RECORD &&
+        qemu_opt_get_bool(opts, "rrcompress", false)) {
+#ifdef CONFIG_ZSTD
+        replay_log_compressed = true;
+#else
+        error_report("rrcompress=on requires zstd support");
+        exit(1);
+#endif
+    }
+    replay_snapshot_period = qemu_opt_get_number(opts, "rrsnapshot-period", 0);
+    replay_snapshot_budget = qemu_opt_get_size(opts, "rrsnapshot-budget",
+                                               replay_snapshot_budget);
     replay_vmstate_register();
     replay_enable(fname, mode);
 
@@ -333,7 +360,7 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    replay_snapshots_start();
 
     replay_enable_events();
 }
@@ -348,6 +375,8 @@ void replay_finish(void)
 
     /* finalize the file */
     if (replay_file) {
+        uint8_t header[sizeof(uint32_t)];
+
         if (replay_mode == REPLAY_MODE_RECORD) {
             /*
              * Can't do it in the signal handler, therefore
@@ -356,10 +385,18 @@ void replay_finish(void)
             replay_shutdown_request(SHUTDOWN_CAUSE_HOST_SIGNAL);
             /* write end event */
             replay_put_event(EVENT_END);
+            replay_log_stop();
 
             /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            stl_be_p(header, replay_log_compressed ? REPLAY_VERSION_ZSTD
+                                                   : REPLAY_VERSION);
+            if (fseek(replay_file, 0, SEEK_SET) != 0 ||
+                fwrite(header, 1, sizeof(header), replay_file) !=
+                sizeof(header)) {
+                error_report("replay write error");
+            }
+        } else {
+            replay_log_stop();
         }
 
         fclose(replay_file);
@@ -371,6 +408,7 @@ void replay_finish(void)
     g_free(replay_snapshot);
     replay_snapshot = NULL;
 
+    replay_snapshots_finish();
     replay_finish_events();
     replay_mode = REPLAY_MODE_NONE;
 }
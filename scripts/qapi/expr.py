@@ -234,7 +234,8 @@ def check_flags(expr: QAPIExpression) -> None:
         if key in expr and expr[key] is not False:
             raise QAPISemError(
                 expr.info, "flag '%s' may only use false value" % key)
-    for key in ('boxed', 'allow-oob', 'allow-preconfig', 'coroutine'):
+    for key in ('boxed', 'allow-oob', 'allow-preconfig', 'coroutine',
+                'no-bql'):
         if key in expr and expr[key] is not True:
             raise QAPISemError(
                 expr.info, "flag '%s' may only use true value" % key)
@@ -245,6 +246,11 @@ def check_flags(expr: QAPIExpression) -> None:
         # a use case for it.
         raise QAPISemError(
             expr.info, "flags 'allow-oob' and 'coroutine' are incompatible")
+    if 'no-bql' in expr and 'coroutine' in expr:
+        # Coroutine commands run in the dispatcher coroutine, which
+        # lives in the main loop.
+        raise QAPISemError(
+            expr.info, "flags 'no-bql' and 'coroutine' are incompatible")
 
 
 def check_if(expr: Dict[str, object],
@@ -661,7 +667,7 @@ def check_exprs(exprs: List[QAPIExpression]) -> List[QAPIExpression]:
                        ['command'],
                        ['data', 'returns', 'boxed', 'if', 'features',
                         'gen', 'success-response', 'allow-oob',
-                        'allow-preconfig', 'coroutine'])
+                        'allow-preconfig', 'coroutine', 'no-bql'])
             normalize_members(expr.get('data'))
             check_command(expr)
         elif meta == 'event':
@@ -36,9 +36,11 @@
 #include "exec/address-spaces.h"
 
 //#define DEBUG_UNASSIGNED
+/* #define DEBUG_FLATVIEW_PATCH */
 
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
+static bool memory_region_update_full;
 static bool ioeventfd_update_pending;
 unsigned int global_dirty_tracking;
 
@@ -101,6 +103,14 @@ static AddrRange addrrange_intersection(AddrRange r1, AddrRange r2)
     return addrrange_make(start, int128_sub(end, start));
 }
 
+/* Return true if @inner is empty or lies entirely within @outer. */
+static bool addrrange_covers(AddrRange outer, AddrRange inner)
+{
+    return !int128_nz(inner.size)
+        || (int128_ge(inner.start, outer.start)
+            && int128_le(addrrange_end(inner), addrrange_end(outer)));
+}
+
 enum ListenerDirection { Forward, Reverse };
 
 #define MEMORY_LISTENER_CALL_GLOBAL(_callback, _direction, _args...)    \
@@ -215,6 +225,29 @@ static bool memory_region_ioeventfd_equal(MemoryRegionIoeventfd *a,
     return false;
 }
 
+/*
+ * Record of a MemoryRegion being reached while rendering a FlatView.
+ * @base is the absolute address of the start of the region, @clip the
+ * part of it that was visible and @alias the region that made it visible,
+ * if it was reached as the target of an alias.  @alias is only used as a
+ * key into FlatView::visits and is never dereferenced.
+ */
+typedef struct FlatViewVisit {
+    Int128 base;
+    AddrRange clip;
+    MemoryRegion *alias;
+} FlatViewVisit;
+
+/*
+ * Past this many visits of a single region, a FlatView falls back to full
+ * rendering; the records of a region can pile up if it moves around
+ * outside the visible part of its container.
+ */
+#define FLATVIEW_MAX_VISITS 64
+
+/* Past this many dirty windows, just render the whole view again. */
+#define FLATVIEW_MAX_DIRTY 64
+
 /* Range of memory in the global map.  Addresses are absolute. */
 struct FlatRange {
     MemoryRegion *mr;
@@ -260,6 +293,11 @@ static FlatView *flatview_new(MemoryRegion *mr_root)
     view = g_new0(FlatView, 1);
     view->ref = 1;
     view->root = mr_root;
+    if (mr_root) {
+        view->visits = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL,
+                                             (GDestroyNotify) g_array_unref);
+    }
     memory_region_ref(mr_root);
     trace_flatview_new(view, mr_root);
 
@@ -295,6 +333,12 @@ static void flatview_destroy(FlatView *view)
         memory_region_unref(view->ranges[i].mr);
     }
     g_free(view->ranges);
+    if (view->visits) {
+        g_hash_table_unref(view->visits);
+    }
+    if (view->dirty) {
+        g_array_free(view->dirty, true);
+    }
     memory_region_unref(view->root);
     g_free(view);
 }
@@ -591,15 +635,48 @@ static AddressSpace *memory_region_to_address_space(MemoryRegion *mr)
     return NULL;
 }
 
+static void flatview_add_visit(FlatView *view, MemoryRegion *mr,
+                               Int128 base, AddrRange clip,
+                               MemoryRegion *alias)
+{
+    GArray *visits = g_hash_table_lookup(view->visits, mr);
+    FlatViewVisit visit = {
+        .base = base,
+        .clip = clip,
+        .alias = alias,
+    };
+    unsigned i;
+
+    if (!visits) {
+        visits = g_array_new(false, false, sizeof(FlatViewVisit));
+        g_hash_table_insert(view->visits, mr, visits);
+    }
+
+    for (i = 0; i < visits->len; i++) {
+        FlatViewVisit *old = &g_array_index(visits, FlatViewVisit, i);
+
+        if (int128_eq(old->base, base) && old->alias == alias
+            && addrrange_covers(old->clip, clip)) {
+            return;
+        }
+    }
+
+    if (visits->len == FLATVIEW_MAX_VISITS) {
+        view->rerender = true;
+    }
+    g_array_append_val(visits, visit);
+}
+
 /* Render a memory region into the global view.  Ranges in @view obscure
- * ranges in @mr.
+ * ranges in @mr.  @alias is the alias through which @mr is reached, if any.
  */
 static void render_memory_region(FlatView *view,
                                  MemoryRegion *mr,
                                  Int128 base,
                                  AddrRange clip,
                                  bool readonly,
-                                 bool nonvolatile)
+                                 bool nonvolatile,
+                                 MemoryRegion *alias)
 {
     MemoryRegion *subregion;
     unsigned i;
@@ -608,18 +685,25 @@ static void render_memory_region(FlatView *view,
     Int128 now;
     FlatRange fr;
     AddrRange tmp;
-
-    if (!mr->enabled) {
-        return;
-    }
+    bool visible;
 
     int128_addto(&base, int128_make64(mr->addr));
     readonly |= mr->readonly;
     nonvolatile |= mr->nonvolatile;
 
     tmp = addrrange_make(base, mr->size);
+    visible = addrrange_intersects(tmp, clip);
 
-    if (!addrrange_intersects(tmp, clip)) {
+    /*
+     * Regions that are disabled or out of sight are recorded too, so that
+     * memory_region_topology_changed() knows where they would show up.
+     */
+    flatview_add_visit(view, mr, base,
+                       visible ? addrrange_intersection(tmp, clip)
+                               : addrrange_make(base, int128_zero()),
+                       alias);
+
+    if (!mr->enabled || !visible) {
         return;
     }
 
@@ -629,14 +713,14 @@ static void render_memory_region(FlatView *view,
         int128_subfrom(&base, int128_make64(mr->alias->addr));
         int128_subfrom(&base, int128_make64(mr->alias_offset));
         render_memory_region(view, mr->alias, base, clip,
-                             readonly, nonvolatile);
+                             readonly, nonvolatile, mr);
         return;
     }
 
     /* Render subregions in priority order. */
     QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
         render_memory_region(view, subregion, base, clip,
-                             readonly, nonvolatile);
+                             readonly, nonvolatile, NULL);
     }
 
     if (!mr->terminates) {
@@ -742,10 +826,22 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
+static void flatview_build_dispatch(FlatView *view)
+{
+    int i;
+
+    view->dispatch = address_space_dispatch_new(view);
+    for (i = 0; i < view->nr; i++) {
+        MemoryRegionSection mrs =
+            section_from_flat_range(&view->ranges[i], view);
+        flatview_add_to_dispatch(view, &mrs);
+    }
+    address_space_dispatch_compact(view->dispatch);
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
@@ -753,18 +849,239 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     if (mr) {
         render_memory_region(view, mr, int128_zero(),
                              addrrange_make(int128_zero(), int128_2_64()),
-                             false, false);
+                             false, false, NULL);
     }
     flatview_simplify(view);
+    flatview_build_dispatch(view);
+    g_hash_table_replace(flat_views, mr, view);
 
-    view->dispatch = address_space_dispatch_new(view);
-    for (i = 0; i < view->nr; i++) {
-        MemoryRegionSection mrs =
-            section_from_flat_range(&view->ranges[i], view);
-        flatview_add_to_dispatch(view, &mrs);
+    return view;
+}
+
+static gint addrrange_compare(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    return int128_lt(r1->start, r2->start) ? -1 :
+           int128_gt(r1->start, r2->start) ? 1 : 0;
+}
+
+static void flatview_add_dirty(FlatView *view, AddrRange window)
+{
+    if (!int128_nz(window.size) || view->rerender) {
+        return;
     }
-    address_space_dispatch_compact(view->dispatch);
-    g_hash_table_replace(flat_views, mr, view);
+    if (!view->dirty) {
+        view->dirty = g_array_new(false, false, sizeof(AddrRange));
+    }
+    if (view->dirty->len == FLATVIEW_MAX_DIRTY) {
+        view->rerender = true;
+        return;
+    }
+    g_array_append_val(view->dirty, window);
+}
+
+static bool flatview_is_dirty(FlatView *view)
+{
+    return view->rerender || (view->dirty && view->dirty->len);
+}
+
+/*
+ * Invalidate the parts of @view that @mr may have covered before the
+ * change and may cover after it: wherever @mr was rendered, wherever its
+ * container was rendered over its new position, and the whole window of
+ * any alias through which @mr was reached.
+ */
+static void flatview_region_changed(FlatView *view, MemoryRegion *mr)
+{
+    GArray *visits;
+    unsigned i, j;
+
+    if (!view->visits || view->rerender) {
+        return;
+    }
+    if (mr == view->root) {
+        view->rerender = true;
+        return;
+    }
+
+    visits = g_hash_table_lookup(view->visits, mr);
+    for (i = 0; visits && i < visits->len; i++) {
+        FlatViewVisit *v = &g_array_index(visits, FlatViewVisit, i);
+        GArray *alias_visits;
+
+        flatview_add_dirty(view, v->clip);
+        if (!v->alias) {
+            continue;
+        }
+        alias_visits = g_hash_table_lookup(view->visits, v->alias);
+        for (j = 0; alias_visits && j < alias_visits->len; j++) {
+            flatview_add_dirty(view, g_array_index(alias_visits,
+                                                   FlatViewVisit, j).clip);
+        }
+    }
+
+    if (!mr->container) {
+        return;
+    }
+    visits = g_hash_table_lookup(view->visits, mr->container);
+    for (i = 0; visits && i < visits->len; i++) {
+        FlatViewVisit *c = &g_array_index(visits, FlatViewVisit, i);
+        AddrRange range;
+
+        range = addrrange_make(int128_add(c->base, int128_make64(mr->addr)),
+                               mr->size);
+        if (addrrange_intersects(range, c->clip)) {
+            flatview_add_dirty(view, addrrange_intersection(range, c->clip));
+        }
+    }
+}
+
+/*
+ * Note that the layout of @mr changed, or that everything changed if @mr
+ * is NULL.  The FlatViews are updated when the transaction is committed;
+ * only the windows affected by @mr are rendered again.
+ */
+static void memory_region_topology_changed(MemoryRegion *mr)
+{
+    GHashTableIter iter;
+    FlatView *view;
+
+    memory_region_update_pending = true;
+    if (!mr || !flat_views) {
+        memory_region_update_full = true;
+    }
+    if (memory_region_update_full) {
+        return;
+    }
+
+    g_hash_table_iter_init(&iter, flat_views);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&view)) {
+        flatview_region_changed(view, mr);
+    }
+}
+
+static gboolean flatview_visits_prune(gpointer key, gpointer value,
+                                      gpointer opaque)
+{
+    GArray *visits = value;
+    GArray *dirty = opaque;
+    unsigned i, j;
+
+    for (i = 0; i < visits->len; ) {
+        FlatViewVisit *v = &g_array_index(visits, FlatViewVisit, i);
+        bool stale = false;
+
+        for (j = 0; int128_nz(v->clip.size) && j < dirty->len; j++) {
+            if (addrrange_covers(g_array_index(dirty, AddrRange, j),
+                                 v->clip)) {
+                stale = true;
+                break;
+            }
+        }
+        if (stale) {
+            g_array_remove_index_fast(visits, i);
+        } else {
+            i++;
+        }
+    }
+    return visits->len == 0;
+}
+
+#ifdef DEBUG_FLATVIEW_PATCH
+/* Check that a patched @view is what rendering it from scratch gives. */
+static void flatview_patch_check(FlatView *view)
+{
+    FlatView *full = flatview_new(view->root);
+    unsigned i;
+
+    render_memory_region(full, view->root, int128_zero(),
+                         addrrange_make(int128_zero(), int128_2_64()),
+                         false, false, NULL);
+    flatview_simplify(full);
+
+    assert(full->nr == view->nr);
+    for (i = 0; i < full->nr; i++) {
+        assert(flatrange_equal(&full->ranges[i], &view->ranges[i]));
+    }
+    flatview_unref(full);
+}
+#endif
+
+/*
+ * Build a successor of @old that renders again only the dirty windows,
+ * keeping the ranges of @old everywhere else.  @old stays untouched
+ * except for its visit records, which move to the new view.
+ */
+static FlatView *flatview_patch(FlatView *old)
+{
+    GArray *dirty = old->dirty;
+    FlatView *view;
+    AddrRange *w;
+    unsigned i, j, n;
+
+    /* Sort the windows and merge the ones that overlap or touch. */
+    g_array_sort(dirty, addrrange_compare);
+    w = &g_array_index(dirty, AddrRange, 0);
+    for (i = 1, n = 1; i < dirty->len; i++) {
+        AddrRange *last = &w[n - 1];
+
+        if (int128_le(w[i].start, addrrange_end(*last))) {
+            last->size = int128_sub(int128_max(addrrange_end(*last),
+                                               addrrange_end(w[i])),
+                                    last->start);
+        } else {
+            w[n++] = w[i];
+        }
+    }
+    g_array_set_size(dirty, n);
+    trace_flatview_patch(old, old->root, n);
+
+    view = flatview_new(old->root);
+    g_hash_table_unref(view->visits);
+    view->visits = old->visits;
+    old->visits = NULL;
+    g_hash_table_foreach_remove(view->visits, flatview_visits_prune, dirty);
+
+    /* Keep whatever lies outside the windows... */
+    for (i = 0, j = 0; i < old->nr; i++) {
+        FlatRange *fr = &old->ranges[i];
+        Int128 start = fr->addr.start;
+        Int128 end = addrrange_end(fr->addr);
+
+        while (int128_lt(start, end)) {
+            FlatRange piece = *fr;
+            Int128 piece_end = end;
+
+            while (j < n && int128_le(addrrange_end(w[j]), start)) {
+                j++;
+            }
+            if (j < n && int128_le(w[j].start, start)) {
+                start = addrrange_end(w[j]);
+                continue;
+            }
+            if (j < n) {
+                piece_end = int128_min(end, w[j].start);
+            }
+            piece.addr = addrrange_make(start, int128_sub(piece_end, start));
+            piece.offset_in_region +=
+                int128_get64(int128_sub(start, fr->addr.start));
+            flatview_insert(view, view->nr, &piece);
+            start = piece_end;
+        }
+    }
+
+    /* ... and fill the windows from the memory region tree. */
+    for (i = 0; i < n; i++) {
+        render_memory_region(view, view->root, int128_zero(), w[i],
+                             false, false, NULL);
+    }
+    flatview_simplify(view);
+#ifdef DEBUG_FLATVIEW_PATCH
+    flatview_patch_check(view);
+#endif
+    flatview_build_dispatch(view);
+    g_hash_table_replace(flat_views, view->root, view);
 
     return view;
 }
@@ -1041,6 +1358,47 @@ static void flatviews_reset(void)
     }
 }
 
+/*
+ * Bring flat_views up to date after a memory transaction.  FlatViews that
+ * were not affected by the transaction are reused as they are, the others
+ * are patched or, if too much changed, rendered again from scratch.
+ */
+static void flatviews_update(void)
+{
+    GHashTable *old_views = flat_views;
+    AddressSpace *as;
+
+    if (memory_region_update_full) {
+        memory_region_update_full = false;
+        flatviews_reset();
+        return;
+    }
+
+    flat_views = NULL;
+    flatviews_init();
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
+
+        if (g_hash_table_lookup(flat_views, physmr)) {
+            continue;
+        }
+
+        view = g_hash_table_lookup(old_views, physmr);
+        if (view && !flatview_is_dirty(view)) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+        } else if (view && !view->rerender) {
+            flatview_patch(view);
+        } else {
+            generate_memory_topology(physmr);
+        }
+    }
+
+    g_hash_table_unref(old_views);
+}
+
 static void address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
@@ -1050,6 +1408,14 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /*
+         * The transaction left this view alone, but the listeners got
+         * begin() all the same and rebuild their state from the sections
+         * reported until commit(); report them all as unchanged.
+         */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, new_view, new_view, true);
+        }
         return;
     }
 
@@ -1113,13 +1479,18 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            flatviews_update();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (ioeventfd_update_pending ||
+                    address_space_to_flatview(as) != old_view) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -2239,7 +2610,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_topology_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2369,7 +2742,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_topology_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2379,7 +2754,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_topology_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2389,7 +2766,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_topology_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2634,7 +3013,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_topology_changed(subregion);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2684,7 +3065,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_topology_changed(subregion);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2695,7 +3078,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_topology_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2711,7 +3094,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_topology_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2747,7 +3130,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_topology_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2918,7 +3303,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_topology_changed(NULL);
         memory_region_transaction_commit();
     }
 }
@@ -2933,7 +3318,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_topology_changed(NULL);
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -3105,6 +3490,12 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->bounce_buffer_size = 0;
+    stat64_init(&as->bounce_buffer_maps, 0);
+    stat64_init(&as->bounce_buffer_stalls, 0);
+    qemu_mutex_init(&as->map_client_list_lock);
+    QLIST_INIT(&as->map_client_list);
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -3112,6 +3503,10 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 
 static void do_address_space_destroy(AddressSpace *as)
 {
+    assert(qatomic_read(&as->bounce_buffer_size) == 0);
+    assert(QLIST_EMPTY(&as->map_client_list));
+    qemu_mutex_destroy(&as->map_client_list_lock);
+
     assert(QTAILQ_EMPTY(&as->listeners));
 
     flatview_unref(as->current_map);
@@ -3477,8 +3872,16 @@ static gint address_space_compare_name(gconstpointer a, gconstpointer b)
 static void mtree_print_as_name(gpointer data, gpointer user_data)
 {
     AddressSpace *as = data;
+    uint64_t maps = stat64_get(&as->bounce_buffer_maps);
+    uint64_t stalls = stat64_get(&as->bounce_buffer_stalls);
 
     qemu_printf("address-space: %s\n", as->name);
+    if (maps || stalls) {
+        qemu_printf("  bounce buffers: %" PRIu64 " maps, %" PRIu64
+                    " stalls, %zu/%zu bytes in use\n", maps, stalls,
+                    qatomic_read(&as->bounce_buffer_size),
+                    as->max_bounce_buffer_size);
+    }
 }
 
 static void mtree_print_as(gpointer key, gpointer value, gpointer user_data)
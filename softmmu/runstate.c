@@ -57,6 +57,7 @@
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
 #include "sysemu/runstate-action.h"
+#include "sysemu/stats.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/tpm.h"
 #include "trace.h"
@@ -771,6 +772,7 @@ void qemu_init_subsystems(void)
     precopy_infrastructure_init();
     postcopy_infrastructure_init();
     monitor_init_globals();
+    coroutine_stats_init();
 
     if (qcrypto_init(&err) < 0) {
         error_reportf_err(err, "cannot initialize crypto: ");
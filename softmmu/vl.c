@@ -446,6 +446,15 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
+        }, {
+            .name = "rrsnapshot-period",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "rrsnapshot-budget",
+            .type = QEMU_OPT_SIZE,
         },
         { /* end of list */ }
     },
@@ -3085,7 +3094,7 @@ void qemu_init(int argc, char **argv)
                 QemuOpts *fsdev;
                 QemuOpts *device;
                 const char *writeout, *sock_fd, *socket, *path, *security_model,
-                           *multidevs;
+                           *multidevs, *path_cache_ttl;
 
                 olist = qemu_find_opts("virtfs");
                 if (!olist) {
@@ -3149,6 +3158,11 @@ void qemu_init(int argc, char **argv)
                 if (multidevs) {
                     qemu_opt_set(fsdev, "multidevs", multidevs, &error_abort);
                 }
+                path_cache_ttl = qemu_opt_get(opts, "path_cache_ttl");
+                if (path_cache_ttl) {
+                    qemu_opt_set(fsdev, "path_cache_ttl", path_cache_ttl,
+                                 &error_abort);
+                }
                 device = qemu_opts_create(qemu_find_opts("device"), NULL, 0,
                                           &error_abort);
                 qemu_opt_set(device, "driver", "virtio-9p-pci", &error_abort);
@@ -0,0 +1,93 @@
+/*
+ * Coroutine pool statistics for query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "sysemu/stats.h"
+
+static void coroutine_stats_add(StatsList **stats_list, strList *names,
+                                const char *name, uint64_t val)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return;
+    }
+
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = val;
+    QAPI_LIST_PREPEND(*stats_list, stats);
+}
+
+static void coroutine_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    CoroutinePoolStats pool;
+    StatsList *stats_list = NULL;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    qemu_coroutine_get_pool_stats(&pool);
+    coroutine_stats_add(&stats_list, names, "allocated", pool.allocated);
+    coroutine_stats_add(&stats_list, names, "freed", pool.freed);
+    coroutine_stats_add(&stats_list, names, "pool-grows", pool.pool_grows);
+    coroutine_stats_add(&stats_list, names, "pool-shrinks",
+                        pool.pool_shrinks);
+    coroutine_stats_add(&stats_list, names, "release-pool-refills",
+                        pool.release_pool_refills);
+    coroutine_stats_add(&stats_list, names, "release-pool-size",
+                        pool.release_pool_size);
+    coroutine_stats_add(&stats_list, names, "pool-max-size",
+                        pool.pool_max_size);
+
+    if (stats_list) {
+        add_stats_entry(result, STATS_PROVIDER_COROUTINE, NULL, stats_list);
+    }
+}
+
+static void coroutine_stats_schema_add(StatsSchemaValueList **list,
+                                       const char *name, StatsType type)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    QAPI_LIST_PREPEND(*list, value);
+}
+
+static void coroutine_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    coroutine_stats_schema_add(&stats_list, "allocated",
+                               STATS_TYPE_CUMULATIVE);
+    coroutine_stats_schema_add(&stats_list, "freed", STATS_TYPE_CUMULATIVE);
+    coroutine_stats_schema_add(&stats_list, "pool-grows",
+                               STATS_TYPE_CUMULATIVE);
+    coroutine_stats_schema_add(&stats_list, "pool-shrinks",
+                               STATS_TYPE_CUMULATIVE);
+    coroutine_stats_schema_add(&stats_list, "release-pool-refills",
+                               STATS_TYPE_CUMULATIVE);
+    coroutine_stats_schema_add(&stats_list, "release-pool-size",
+                               STATS_TYPE_INSTANT);
+    coroutine_stats_schema_add(&stats_list, "pool-max-size",
+                               STATS_TYPE_INSTANT);
+
+    add_stats_schema(result, STATS_PROVIDER_COROUTINE, STATS_TARGET_VM,
+                     stats_list);
+}
+
+void coroutine_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_COROUTINE, coroutine_stats_cb,
+                        coroutine_stats_schemas_cb);
+}
@@ -21,6 +21,7 @@
 from avocado.utils import archive
 from avocado.utils import process
 from boot_linux_console import LinuxKernelTest
+from qemu.machine import machine
 
 class ReplayKernelBase(LinuxKernelTest):
     """
@@ -35,7 +36,7 @@ class ReplayKernelBase(LinuxKernelTest):
     KERNEL_COMMON_COMMAND_LINE = 'printk.time=1 panic=-1 '
 
     def run_vm(self, kernel_path, kernel_command_line, console_pattern,
-               record, shift, args, replay_path):
+               record, shift, args, replay_path, rrcompress=None):
         # icount requires TCG to be available
         self.require_accelerator('tcg')
 
@@ -49,15 +50,23 @@ def run_vm(self, kernel_path, kernel_command_line, console_pattern,
         else:
             logger.info('replaying the execution...')
             mode = 'replay'
-        vm.add_args('-icount', 'shift=%s,rr=%s,rrfile=%s' %
-                    (shift, mode, replay_path),
+        icount = 'shift=%s,rr=%s,rrfile=%s' % (shift, mode, replay_path)
+        if rrcompress:
+            icount += ',rrcompress=%s' % rrcompress
+        vm.add_args('-icount', icount,
                     '-kernel', kernel_path,
                     '-append', kernel_command_line,
                     '-net', 'none',
                     '-no-reboot')
         if args:
             vm.add_args(*args)
-        vm.launch()
+        try:
+            vm.launch()
+        except machine.VMLaunchFailure as e:
+            if (e.output and
+                    'rrcompress=on requires zstd support' in e.output):
+                self.cancel('QEMU built without zstd')
+            raise e
         self.wait_for_console_pattern(console_pattern, vm)
         if record:
             vm.shutdown()
@@ -65,28 +74,25 @@ def run_vm(self, kernel_path, kernel_command_line, console_pattern,
                         % os.path.getsize(replay_path))
         else:
             vm.wait()
+            # The whole log must be consumed before any error is reported
+            self.assertNotIn('something goes wrong', vm.get_log() or '')
             logger.info('successfully finished the replay')
         elapsed = time.time() - start_time
         logger.info('elapsed time %.2f sec' % elapsed)
         return elapsed
 
     def run_rr(self, kernel_path, kernel_command_line, console_pattern,
-               shift=7, args=None):
+               shift=7, args=None, rrcompress=None):
         replay_path = os.path.join(self.workdir, 'replay.bin')
         t1 = self.run_vm(kernel_path, kernel_command_line, console_pattern,
-                         True, shift, args, replay_path)
+                         True, shift, args, replay_path, rrcompress)
         t2 = self.run_vm(kernel_path, kernel_command_line, console_pattern,
                          False, shift, args, replay_path)
         logger = logging.getLogger('replay')
         logger.info('replay overhead {:.2%}'.format(t2 / t1 - 1))
 
 class ReplayKernelNormal(ReplayKernelBase):
-    @skipIf(os.getenv('GITLAB_CI'), 'Running on GitLab')
-    def test_x86_64_pc(self):
-        """
-        :avocado: tags=arch:x86_64
-        :avocado: tags=machine:pc
-        """
+    def do_test_x86_64_pc(self, rrcompress=None):
         kernel_url = ('https://archives.fedoraproject.org/pub/archive/fedora'
                       '/linux/releases/29/Everything/x86_64/os/images/pxeboot'
                       '/vmlinuz')
@@ -96,7 +102,37 @@ def test_x86_64_pc(self):
         kernel_command_line = self.KERNEL_COMMON_COMMAND_LINE + 'console=ttyS0'
         console_pattern = 'VFS: Cannot open root device'
 
-        self.run_rr(kernel_path, kernel_command_line, console_pattern, shift=5)
+        self.run_rr(kernel_path, kernel_command_line, console_pattern, shift=5,
+                    rrcompress=rrcompress)
+
+    @skipIf(os.getenv('GITLAB_CI'), 'Running on GitLab')
+    def test_x86_64_pc(self):
+        """
+        :avocado: tags=arch:x86_64
+        :avocado: tags=machine:pc
+        """
+        self.do_test_x86_64_pc()
+
+    @skipIf(os.getenv('GITLAB_CI'), 'Running on GitLab')
+    def test_x86_64_pc_rrcompress_off(self):
+        """
+        Replays the log written by the background writer thread up to
+        the shutdown event at its end.
+
+        :avocado: tags=arch:x86_64
+        :avocado: tags=machine:pc
+        """
+        self.do_test_x86_64_pc(rrcompress='off')
+
+    @skipIf(os.getenv('GITLAB_CI'), 'Running on GitLab')
+    def test_x86_64_pc_rrcompress_on(self):
+        """
+        Same with a zstd compressed log, which is detected on replay.
+
+        :avocado: tags=arch:x86_64
+        :avocado: tags=machine:pc
+        """
+        self.do_test_x86_64_pc(rrcompress='on')
 
     def test_mips_malta(self):
         """
@@ -34,7 +34,8 @@ class ReverseDebugging(LinuxKernelTest):
     STEPS = 10
     endian_is_le = True
 
-    def run_vm(self, record, shift, args, replay_path, image_path, port):
+    def run_vm(self, record, shift, args, replay_path, image_path, port,
+               icount_args=''):
         logger = logging.getLogger('replay')
         vm = self.get_vm()
         vm.set_console()
@@ -45,8 +46,8 @@ def run_vm(self, record, shift, args, replay_path, image_path, port):
             logger.info('replaying the execution...')
             mode = 'replay'
             vm.add_args('-gdb', 'tcp::%d' % port, '-S')
-        vm.add_args('-icount', 'shift=%s,rr=%s,rrfile=%s,rrsnapshot=init' %
-                    (shift, mode, replay_path),
+        vm.add_args('-icount', 'shift=%s,rr=%s,rrfile=%s,rrsnapshot=init%s' %
+                    (shift, mode, replay_path, icount_args),
                     '-net', 'none')
         vm.add_args('-drive', 'file=%s,if=none' % image_path)
         if args:
@@ -94,12 +95,8 @@ def gdb_bstep(g):
     def vm_get_icount(vm):
         return vm.qmp('query-replay')['return']['icount']
 
-    def reverse_debugging(self, shift=7, args=None):
-        logger = logging.getLogger('replay')
-
-        # create qcow2 for snapshots
-        logger.info('creating qcow2 image for VM snapshots')
-        image_path = os.path.join(self.workdir, 'disk.qcow2')
+    def create_image(self, name):
+        image_path = os.path.join(self.workdir, name)
         qemu_img = os.path.join(BUILD_DIR, 'qemu-img')
         if not os.path.exists(qemu_img):
             qemu_img = find_command('qemu-img', False)
@@ -108,21 +105,34 @@ def reverse_debugging(self, shift=7, args=None):
                         'create the temporary qcow2 image')
         cmd = '%s create -f qcow2 %s 128M' % (qemu_img, image_path)
         process.run(cmd)
+        return image_path
 
-        replay_path = os.path.join(self.workdir, 'replay.bin')
-        port = find_free_port()
-
-        # record the log
+    def record(self, shift, args, replay_path, image_path, port):
         vm = self.run_vm(True, shift, args, replay_path, image_path, port)
         while self.vm_get_icount(vm) <= self.STEPS:
             pass
         last_icount = self.vm_get_icount(vm)
         vm.shutdown()
+        return last_icount
+
+    def reverse_debugging(self, shift=7, args=None, icount_args=''):
+        logger = logging.getLogger('replay')
+
+        # create qcow2 for snapshots
+        logger.info('creating qcow2 image for VM snapshots')
+        image_path = self.create_image('disk.qcow2')
+
+        replay_path = os.path.join(self.workdir, 'replay.bin')
+        port = find_free_port()
+
+        # record the log
+        last_icount = self.record(shift, args, replay_path, image_path, port)
 
         logger.info("recorded log with %s+ steps" % last_icount)
 
         # replay and run debug commands
-        vm = self.run_vm(False, shift, args, replay_path, image_path, port)
+        vm = self.run_vm(False, shift, args, replay_path, image_path, port,
+                         icount_args)
         logger.info('connecting to gdbstub')
         g = gdb.GDBRemote('127.0.0.1', port, False, False)
         g.connect()
@@ -193,6 +203,47 @@ def test_x86_64_pc(self):
         # start with BIOS only
         self.reverse_debugging()
 
+    # unidentified gitlab timeout problem
+    @skipIf(os.getenv('GITLAB_CI'), 'Running on GitLab')
+    def test_x86_64_pc_snapshot_period(self):
+        """
+        :avocado: tags=arch:x86_64
+        :avocado: tags=machine:pc
+        """
+        # reverse steps start from the in-memory snapshots
+        self.reverse_debugging(icount_args=',rrsnapshot-period=4')
+
+    def test_x86_64_pc_snapshot_period_disk(self):
+        """
+        :avocado: tags=arch:x86_64
+        :avocado: tags=machine:pc
+        """
+        # The in-memory snapshots do not include the disks, so a reverse
+        # step across a disk write would replay against newer contents.
+        # Replay must refuse them when the guest has a writable disk.
+        image_path = self.create_image('disk.qcow2')
+        data_path = self.create_image('data.qcow2')
+        replay_path = os.path.join(self.workdir, 'replay.bin')
+        port = find_free_port()
+        args = ('-drive', 'file=%s,if=none,id=data-direct' % data_path,
+                '-drive', 'driver=blkreplay,if=none,image=data-direct,id=data',
+                '-device', 'ide-hd,drive=data')
+
+        self.record(7, args, replay_path, image_path, port)
+
+        vm = self.get_vm()
+        vm.add_args('-icount', 'shift=7,rr=replay,rrfile=%s,rrsnapshot=init,'
+                    'rrsnapshot-period=4' % replay_path,
+                    '-net', 'none',
+                    '-drive', 'file=%s,if=none' % image_path, *args)
+        vm.set_qmp_monitor(enabled=False)
+        vm.launch()
+        vm.wait()
+        self.assertEqual(vm.exitcode(), 1)
+        self.assertRegex(vm.get_log(),
+                         r'rrsnapshot-period cannot be used with the '
+                         r'writable block device')
+
 class ReverseDebugging_AArch64(ReverseDebugging):
     """
     :avocado: tags=accel:tcg
@@ -0,0 +1,123 @@
+/*
+ * Coroutine create/enter/terminate benchmark
+ *
+ * Each thread runs rounds of -c coroutines: all of them are created and
+ * entered once, so that they are in flight at the same time, and then
+ * entered again to terminate.  With -c 1 this measures the plain
+ * lifecycle; larger values exercise the per-thread pools the way deep
+ * block job and NBD queues do.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+static unsigned long n_rounds = 100000;
+static unsigned int concurrency = 1;
+static unsigned int n_threads = 1;
+
+static const char commands_string[] =
+    " -n = number of rounds per thread\n"
+    " -c = number of coroutines in flight per round\n"
+    " -t = number of threads";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void coroutine_fn bench_entry(void *opaque)
+{
+    qemu_coroutine_yield();
+}
+
+static void *thread_func(void *arg)
+{
+    g_autofree Coroutine **cos = g_new(Coroutine *, concurrency);
+    unsigned long i;
+    unsigned int j;
+
+    for (i = 0; i < n_rounds; i++) {
+        for (j = 0; j < concurrency; j++) {
+            cos[j] = qemu_coroutine_create(bench_entry, NULL);
+            qemu_coroutine_enter(cos[j]);
+        }
+        for (j = 0; j < concurrency; j++) {
+            qemu_coroutine_enter(cos[j]);
+        }
+    }
+    return NULL;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:c:t:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_rounds = atol(optarg);
+            break;
+        case 'c':
+            concurrency = atoi(optarg);
+            if (!concurrency) {
+                fprintf(stderr, "invalid number of coroutines\n");
+                exit(1);
+            }
+            break;
+        case 't':
+            n_threads = atoi(optarg);
+            if (!n_threads) {
+                fprintf(stderr, "invalid number of threads\n");
+                exit(1);
+            }
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_autofree QemuThread *threads = NULL;
+    CoroutinePoolStats stats;
+    unsigned long total;
+    int64_t start, ns;
+    unsigned int i;
+
+    parse_args(argc, argv);
+
+    threads = g_new(QemuThread, n_threads);
+    start = get_clock();
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_create(&threads[i], "bench", thread_func, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    ns = get_clock() - start;
+
+    total = n_rounds * concurrency * n_threads;
+    qemu_coroutine_get_pool_stats(&stats);
+    printf("coroutines:  %lu (%u threads x %u in flight)\n",
+           total, n_threads, concurrency);
+    printf("time:        %.3f s\n", ns / 1e9);
+    printf("rate:        %.2f M lifecycles/s\n", total * 1e3 / ns);
+    printf("allocated:   %" PRIu64 "\n", stats.allocated);
+    printf("freed:       %" PRIu64 "\n", stats.freed);
+    printf("pool grows:  %" PRIu64 ", shrinks: %" PRIu64 "\n",
+           stats.pool_grows, stats.pool_shrinks);
+    return 0;
+}
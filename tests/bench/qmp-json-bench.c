@@ -0,0 +1,140 @@
+/*
+ * QMP JSON parser benchmark
+ *
+ * Parse a response shaped like query-named-block-nodes on many nodes,
+ * fed to the streaming parser in chunks the way the monitor reads it
+ * from its socket.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/json-parser.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qemu/timer.h"
+
+static unsigned int n_nodes = 500;
+static unsigned int n_iter = 100;
+static size_t chunk_size = 4096;
+static unsigned long parsed;
+
+static const char commands_string[] =
+    " -n = number of block nodes in the response\n"
+    " -i = number of times the response is parsed\n"
+    " -c = size of the chunks fed to the parser";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static char *build_response(void)
+{
+    GString *s = g_string_new("{\"return\": [");
+    unsigned int i;
+
+    for (i = 0; i < n_nodes; i++) {
+        g_string_append_printf(s,
+            "%s{\"iops_rd\": 0, \"detect_zeroes\": \"off\", "
+            "\"image\": {\"virtual-size\": 10737418240, "
+            "\"filename\": \"/var/lib/images/disk%u.qcow2\", "
+            "\"cluster-size\": 65536, \"format\": \"qcow2\", "
+            "\"actual-size\": 2147483648, \"format-specific\": "
+            "{\"type\": \"qcow2\", \"data\": {\"compat\": \"1.1\", "
+            "\"compression-type\": \"zlib\", \"lazy-refcounts\": false, "
+            "\"refcount-bits\": 16, \"corrupt\": false, "
+            "\"extended-l2\": false}}, \"dirty-flag\": false}, "
+            "\"iops_wr\": 0, \"ro\": false, \"node-name\": \"node%u\", "
+            "\"backing_file_depth\": 0, \"drv\": \"qcow2\", "
+            "\"iops\": 0, \"bps_wr\": 0, \"write_threshold\": 0, "
+            "\"encrypted\": false, \"bps\": 0, \"bps_rd\": 0, "
+            "\"cache\": {\"no-flush\": false, \"direct\": true, "
+            "\"writeback\": true}, "
+            "\"file\": \"/var/lib/images/disk%u.qcow2\"}",
+            i ? ", " : "", i, i, i);
+    }
+    g_string_append(s, "]}\r\n");
+    return g_string_free(s, false);
+}
+
+static void emit(void *opaque, QObject *json, Error *err)
+{
+    QDict *rsp = qobject_to(QDict, json);
+    QList *nodes = rsp ? qdict_get_qlist(rsp, "return") : NULL;
+
+    if (err || !nodes || qlist_size(nodes) != n_nodes) {
+        fprintf(stderr, "unexpected parse result\n");
+        exit(1);
+    }
+    qobject_unref(json);
+    parsed++;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:i:c:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_nodes = atoi(optarg);
+            break;
+        case 'i':
+            n_iter = atoi(optarg);
+            break;
+        case 'c':
+            chunk_size = atol(optarg);
+            if (!chunk_size) {
+                fprintf(stderr, "chunk size must be positive\n");
+                exit(1);
+            }
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    JSONMessageParser parser;
+    g_autofree char *rsp = NULL;
+    size_t len, off;
+    unsigned int i;
+    int64_t start, ns;
+
+    parse_args(argc, argv);
+    rsp = build_response();
+    len = strlen(rsp);
+
+    json_message_parser_init(&parser, emit, NULL, NULL);
+    start = get_clock();
+    for (i = 0; i < n_iter; i++) {
+        for (off = 0; off < len; off += chunk_size) {
+            json_message_parser_feed(&parser, rsp + off,
+                                     MIN(chunk_size, len - off));
+        }
+    }
+    ns = get_clock() - start;
+    json_message_parser_destroy(&parser);
+
+    if (parsed != n_iter) {
+        fprintf(stderr, "parsed %lu messages, expected %u\n", parsed, n_iter);
+        return 1;
+    }
+
+    printf("response:    %u nodes, %zu bytes\n", n_nodes, len);
+    printf("chunk size:  %zu\n", chunk_size);
+    printf("time:        %.3f ms per response\n", ns / 1e6 / n_iter);
+    printf("throughput:  %.2f MB/s\n", (double)len * n_iter * 1e3 / ns);
+    return 0;
+}
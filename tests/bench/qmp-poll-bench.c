@@ -0,0 +1,169 @@
+/*
+ * QMP query latency benchmark
+ *
+ * Poll query commands on the QMP socket of a running QEMU, the way a
+ * monitoring agent does, and report the distribution of their round
+ * trip times.  Run a guest workload that keeps the vCPUs and devices
+ * busy to see how much polling contends with them, e.g.
+ *
+ *   qemu-system-x86_64 ... -qmp unix:/tmp/qmp.sock,server=on,wait=off
+ *   qmp-poll-bench -s /tmp/qmp.sock -c query-status,query-cpus-fast
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
+#include "qemu/sockets.h"
+#include "qemu/timer.h"
+
+static const char *socket_path;
+static const char *commands = "query-status,query-cpus-fast,query-migrate";
+static unsigned int n_iter = 1000;
+static unsigned int interval_ms = 10;
+static FILE *qmp_in;
+static int qmp_fd;
+
+static const char commands_string[] =
+    " -s = path of the QMP UNIX socket (mandatory)\n"
+    " -c = comma separated list of commands to poll\n"
+    " -n = number of times each command is executed\n"
+    " -i = interval between polls in milliseconds";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/* Return the next message from QEMU that is not an event */
+static QDict *qmp_receive(void)
+{
+    g_autofree char *line = NULL;
+    size_t len = 0;
+
+    for (;;) {
+        QDict *rsp;
+
+        if (getline(&line, &len, qmp_in) < 0) {
+            fprintf(stderr, "QMP connection closed\n");
+            exit(1);
+        }
+        rsp = qobject_to(QDict, qobject_from_json(line, &error_fatal));
+        if (!rsp) {
+            fprintf(stderr, "QMP message is not an object\n");
+            exit(1);
+        }
+        if (!qdict_haskey(rsp, "event")) {
+            return rsp;
+        }
+        qobject_unref(rsp);
+    }
+}
+
+static void qmp_execute(const char *command)
+{
+    g_autofree char *req = g_strdup_printf("{\"execute\": \"%s\"}\n",
+                                           command);
+    QDict *rsp;
+
+    if (qemu_write_full(qmp_fd, req, strlen(req)) != (ssize_t)strlen(req)) {
+        perror("write");
+        exit(1);
+    }
+    rsp = qmp_receive();
+    if (!qdict_haskey(rsp, "return")) {
+        fprintf(stderr, "%s failed\n", command);
+        exit(1);
+    }
+    qobject_unref(rsp);
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hs:c:n:i:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'c':
+            commands = optarg;
+            break;
+        case 'n':
+            n_iter = atoi(optarg);
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        }
+    }
+    if (!socket_path || !n_iter) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_auto(GStrv) cmds = NULL;
+    g_autofree int64_t *lat = NULL;
+    unsigned int n_cmds, i, j;
+
+    parse_args(argc, argv);
+    cmds = g_strsplit(commands, ",", -1);
+    n_cmds = g_strv_length(cmds);
+    lat = g_new(int64_t, (size_t)n_cmds * n_iter);
+
+    qmp_fd = unix_connect(socket_path, &error_fatal);
+    qmp_in = fdopen(dup(qmp_fd), "r");
+    qobject_unref(qmp_receive());       /* greeting */
+    qmp_execute("qmp_capabilities");
+
+    for (i = 0; i < n_iter; i++) {
+        for (j = 0; j < n_cmds; j++) {
+            int64_t start = get_clock();
+
+            qmp_execute(cmds[j]);
+            lat[(size_t)j * n_iter + i] = get_clock() - start;
+        }
+        g_usleep(interval_ms * 1000);
+    }
+
+    printf("%-24s %10s %10s %10s %10s %10s\n",
+           "command", "min us", "avg us", "p50 us", "p99 us", "max us");
+    for (j = 0; j < n_cmds; j++) {
+        int64_t *l = lat + (size_t)j * n_iter;
+        int64_t sum = 0;
+
+        qsort(l, n_iter, sizeof(*l), cmp_int64);
+        for (i = 0; i < n_iter; i++) {
+            sum += l[i];
+        }
+        printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n", cmds[j],
+               l[0] / 1e3, sum / 1e3 / n_iter, l[n_iter / 2] / 1e3,
+               l[(size_t)n_iter * 99 / 100] / 1e3, l[n_iter - 1] / 1e3);
+    }
+
+    fclose(qmp_in);
+    close(qmp_fd);
+    return 0;
+}
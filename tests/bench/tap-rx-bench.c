@@ -0,0 +1,240 @@
+/*
+ * Packet receive benchmark for the tap backend's batched receive
+ *
+ * A SOCK_SEQPACKET socketpair stands in for the tap device: like a tap
+ * file descriptor it returns exactly one packet per read.  A sender
+ * thread pushes small packets as fast as it can while the main thread
+ * receives them either with one read() per packet, as tap_send() does,
+ * or with a multishot io_uring read into a ring of provided buffers, as
+ * tap_send_batch() does with rx-batch=n.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include <poll.h>
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+#include <liburing.h>
+#endif
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+
+#define BUF_SIZE 2048
+
+static unsigned long n_packets = 1000000;
+static unsigned int pkt_size = 64;
+static unsigned int batch = 64;
+static bool use_uring;
+static int fds[2];
+
+static const char commands_string[] =
+    " -n = number of packets\n"
+    " -s = packet size in bytes\n"
+    " -b = number of receive buffers (rounded up to pow2)\n"
+    " -u = receive with multishot io_uring reads instead of read()";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void *sender_func(void *arg)
+{
+    g_autofree uint8_t *pkt = g_malloc0(pkt_size);
+    unsigned long i;
+
+    for (i = 0; i < n_packets; i++) {
+        stl_le_p(pkt, i);
+        if (RETRY_ON_EINTR(write(fds[1], pkt, pkt_size)) != pkt_size) {
+            perror("write");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static void receive_read(void)
+{
+    uint8_t buf[BUF_SIZE];
+    unsigned long received = 0;
+
+    while (received < n_packets) {
+        ssize_t len = read(fds[0], buf, sizeof(buf));
+
+        if (len < 0 && errno == EAGAIN) {
+            struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (len != pkt_size || ldl_le_p(buf) != (uint32_t)received) {
+            fprintf(stderr, "bad packet %lu\n", received);
+            exit(1);
+        }
+        received++;
+    }
+}
+
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+static void uring_arm(struct io_uring *ring)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+    io_uring_prep_read_multishot(sqe, fds[0], 0, 0, 0);
+    io_uring_submit(ring);
+}
+
+static void receive_uring(void)
+{
+    g_autofree uint8_t *bufs = g_malloc((size_t)batch * BUF_SIZE);
+    struct io_uring_buf_ring *br;
+    struct io_uring ring;
+    unsigned long received = 0;
+    unsigned i;
+    int ret;
+
+    ret = io_uring_queue_init(8, &ring, 0);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+        exit(1);
+    }
+    br = io_uring_setup_buf_ring(&ring, batch, 0, 0, &ret);
+    if (!br) {
+        fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-ret));
+        exit(1);
+    }
+    for (i = 0; i < batch; i++) {
+        io_uring_buf_ring_add(br, bufs + (size_t)i * BUF_SIZE, BUF_SIZE, i,
+                              io_uring_buf_ring_mask(batch), i);
+    }
+    io_uring_buf_ring_advance(br, batch);
+    uring_arm(&ring);
+
+    while (received < n_packets) {
+        struct io_uring_cqe *cqe;
+        unsigned slot;
+        uint8_t *buf;
+
+        ret = io_uring_wait_cqe(&ring, &cqe);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+            exit(1);
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                fprintf(stderr, "multishot read: %s\n", strerror(-cqe->res));
+                exit(1);
+            }
+            uring_arm(&ring);
+        }
+        if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+            io_uring_cqe_seen(&ring, cqe);
+            continue;
+        }
+
+        slot = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = bufs + (size_t)slot * BUF_SIZE;
+        if (cqe->res != pkt_size || ldl_le_p(buf) != (uint32_t)received) {
+            fprintf(stderr, "bad packet %lu\n", received);
+            exit(1);
+        }
+        received++;
+        io_uring_cqe_seen(&ring, cqe);
+        io_uring_buf_ring_add(br, buf, BUF_SIZE, slot,
+                              io_uring_buf_ring_mask(batch), 0);
+        io_uring_buf_ring_advance(br, 1);
+    }
+
+    io_uring_free_buf_ring(&ring, br, batch, 0);
+    io_uring_queue_exit(&ring);
+}
+#endif
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:s:b:u");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_packets = atol(optarg);
+            break;
+        case 's':
+            pkt_size = atoi(optarg);
+            if (pkt_size < 4 || pkt_size > BUF_SIZE) {
+                fprintf(stderr, "packet size must be between 4 and %d\n",
+                        BUF_SIZE);
+                exit(1);
+            }
+            break;
+        case 'b':
+            batch = pow2ceil(atoi(optarg));
+            if (!batch || batch > 32768) {
+                fprintf(stderr, "invalid number of buffers\n");
+                exit(1);
+            }
+            break;
+        case 'u':
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+            use_uring = true;
+            break;
+#else
+            fprintf(stderr, "multishot io_uring reads are not supported\n");
+            exit(1);
+#endif
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QemuThread sender;
+    int64_t start, ns;
+
+    parse_args(argc, argv);
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    if (!g_unix_set_fd_nonblocking(fds[0], true, NULL)) {
+        perror("fcntl");
+        return 1;
+    }
+
+    start = get_clock();
+    qemu_thread_create(&sender, "sender", sender_func, NULL,
+                       QEMU_THREAD_JOINABLE);
+#ifdef HAVE_IO_URING_PREP_READ_MULTISHOT
+    if (use_uring) {
+        receive_uring();
+    } else {
+        receive_read();
+    }
+#else
+    receive_read();
+#endif
+    ns = get_clock() - start;
+    qemu_thread_join(&sender);
+
+    printf("mode:        %s\n", use_uring ? "io_uring multishot" : "read");
+    printf("packets:     %lu x %u bytes\n", n_packets, pkt_size);
+    if (use_uring) {
+        printf("buffers:     %u\n", batch);
+    }
+    printf("time:        %.3f s\n", ns / 1e9);
+    printf("throughput:  %.2f Mpps\n", n_packets * 1e3 / ns);
+    return 0;
+}
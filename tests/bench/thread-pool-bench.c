@@ -0,0 +1,136 @@
+/*
+ * Thread pool submission benchmark
+ *
+ * The main thread keeps -d requests in flight in the thread pool of its
+ * AioContext, and refills the queue after every aio_poll().  Each request
+ * spins for -w iterations, so that short requests stress the queues and
+ * the wakeups, while long ones measure the scaling of the workers.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+
+static unsigned long n_requests = 1000000;
+static unsigned int depth = 64;
+static unsigned long work = 100;
+static int max_threads = THREAD_POOL_MAX_THREADS_DEFAULT;
+static bool batch;
+
+static unsigned long completed;
+static unsigned int in_flight;
+
+static const char commands_string[] =
+    " -n = number of requests\n"
+    " -d = number of requests in flight\n"
+    " -w = loop iterations per request\n"
+    " -t = maximum number of worker threads\n"
+    " -b = submit each refill as one batch";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static int worker_cb(void *opaque)
+{
+    unsigned long i;
+
+    for (i = 0; i < work; i++) {
+        /* keep the compiler from removing the loop */
+        barrier();
+    }
+    return 0;
+}
+
+static void done_cb(void *opaque, int ret)
+{
+    completed++;
+    in_flight--;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:d:w:t:b");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_requests = atol(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            if (!depth) {
+                fprintf(stderr, "invalid queue depth\n");
+                exit(1);
+            }
+            break;
+        case 'w':
+            work = atol(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            if (max_threads <= 0) {
+                fprintf(stderr, "invalid number of threads\n");
+                exit(1);
+            }
+            break;
+        case 'b':
+            batch = true;
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long submitted = 0;
+    AioContext *ctx;
+    ThreadPool *pool;
+    int64_t start, ns;
+
+    parse_args(argc, argv);
+
+    qemu_init_main_loop(&error_fatal);
+    ctx = qemu_get_current_aio_context();
+    aio_context_set_thread_pool_params(ctx, 0, max_threads, &error_fatal);
+    pool = aio_get_thread_pool(ctx);
+
+    start = get_clock();
+    while (completed < n_requests) {
+        if (batch) {
+            thread_pool_batch_begin(pool);
+        }
+        while (in_flight < depth && submitted < n_requests) {
+            thread_pool_submit_aio(worker_cb, NULL, done_cb, NULL);
+            in_flight++;
+            submitted++;
+        }
+        if (batch) {
+            thread_pool_batch_end(pool);
+        }
+        aio_poll(ctx, true);
+    }
+    ns = get_clock() - start;
+
+    printf("requests:    %lu, %u in flight, %lu iterations each\n",
+           n_requests, depth, work);
+    printf("threads:     %d max%s\n", max_threads, batch ? ", batched" : "");
+    printf("time:        %.3f s\n", ns / 1e9);
+    printf("throughput:  %.2f Mreq/s\n", n_requests * 1e3 / ns);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Benchmark for the VNC server surface refresh
+ *
+ * Two 3840x2160 32bpp surfaces stand in for the guest framebuffer and
+ * the VNC server copy of it.  Every round marks some 16 pixel chunks
+ * dirty, like the display's dirty hints do, changes the guest contents
+ * of some of them, and then brings the server copy up to date.  The
+ * update either compares and copies one chunk at a time with memcmp()
+ * and memcpy(), like vnc_refresh_server_surface() used to, or passes
+ * runs of dirty chunks to buffer_copy_changed().
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
+
+#define PIXELS_PER_BIT  16
+#define BYTES_PER_PIXEL 4
+#define CHUNK_BYTES     (PIXELS_PER_BIT * BYTES_PER_PIXEL)
+
+static unsigned int width = 3840;
+static unsigned int height = 2160;
+static unsigned int n_rounds = 200;
+static unsigned int dirty_pct = 25;
+static unsigned int changed_pct = 50;
+static bool use_scalar;
+
+static const char commands_string[] =
+    " -n = number of refresh rounds\n"
+    " -x = surface width in pixels\n"
+    " -y = surface height in pixels\n"
+    " -d = percentage of chunks that are marked dirty\n"
+    " -c = percentage of dirty chunks whose contents change\n"
+    " -s = compare one chunk at a time with memcmp()";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static size_t refresh_scalar(uint8_t *server, const uint8_t *guest,
+                             unsigned long *dirty, size_t bits,
+                             unsigned long *server_dirty)
+{
+    size_t stride = (size_t)width * BYTES_PER_PIXEL;
+    size_t n = 0;
+    size_t x, y;
+
+    for (y = 0; y < height; y++) {
+        unsigned long *line = dirty + y * BITS_TO_LONGS(bits);
+
+        for (x = 0; x < bits; x++) {
+            size_t off = y * stride + x * CHUNK_BYTES;
+
+            if (!test_and_clear_bit(x, line)) {
+                continue;
+            }
+            if (memcmp(server + off, guest + off, CHUNK_BYTES) == 0) {
+                continue;
+            }
+            memcpy(server + off, guest + off, CHUNK_BYTES);
+            set_bit(x, server_dirty + y * BITS_TO_LONGS(bits));
+            n++;
+        }
+    }
+    return n;
+}
+
+static size_t refresh_runs(uint8_t *server, const uint8_t *guest,
+                           unsigned long *dirty, size_t bits,
+                           unsigned long *server_dirty)
+{
+    size_t stride = (size_t)width * BYTES_PER_PIXEL;
+    unsigned long *changed = bitmap_new(bits);
+    size_t n = 0;
+    size_t y, x, x2, i;
+
+    for (y = 0; y < height; y++) {
+        unsigned long *line = dirty + y * BITS_TO_LONGS(bits);
+
+        for (x = find_first_bit(line, bits); x < bits;
+             x = find_next_bit(line, bits, x2)) {
+            size_t off = y * stride + x * CHUNK_BYTES;
+
+            x2 = find_next_zero_bit(line, bits, x);
+            bitmap_clear(line, x, x2 - x);
+            bitmap_zero(changed, x2 - x);
+            if (!buffer_copy_changed(server + off, guest + off,
+                                     (x2 - x) * CHUNK_BYTES, CHUNK_BYTES,
+                                     changed)) {
+                continue;
+            }
+            for (i = find_first_bit(changed, x2 - x); i < x2 - x;
+                 i = find_next_bit(changed, x2 - x, i + 1)) {
+                set_bit(x + i, server_dirty + y * BITS_TO_LONGS(bits));
+                n++;
+            }
+        }
+    }
+    g_free(changed);
+    return n;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:x:y:d:c:s");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_rounds = atoi(optarg);
+            break;
+        case 'x':
+            width = ROUND_UP(atoi(optarg), PIXELS_PER_BIT);
+            break;
+        case 'y':
+            height = atoi(optarg);
+            break;
+        case 'd':
+            dirty_pct = MIN(atoi(optarg), 100);
+            break;
+        case 'c':
+            changed_pct = MIN(atoi(optarg), 100);
+            break;
+        case 's':
+            use_scalar = true;
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+    if (!width || !height) {
+        fprintf(stderr, "invalid surface size\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t bits, longs, fb_size, total = 0, flagged = 0;
+    unsigned long *dirty, *server_dirty;
+    uint8_t *guest, *server;
+    int64_t ns = 0;
+    unsigned int round;
+    GRand *rand;
+
+    parse_args(argc, argv);
+
+    bits = width / PIXELS_PER_BIT;
+    longs = BITS_TO_LONGS(bits) * height;
+    fb_size = (size_t)width * height * BYTES_PER_PIXEL;
+    guest = g_malloc0(fb_size);
+    server = g_malloc0(fb_size);
+    dirty = g_new0(unsigned long, longs);
+    server_dirty = g_new0(unsigned long, longs);
+    rand = g_rand_new_with_seed(1);
+
+    for (round = 0; round < n_rounds; round++) {
+        size_t x, y;
+        int64_t start;
+
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < bits; x++) {
+                if (g_rand_int_range(rand, 0, 100) >= dirty_pct) {
+                    continue;
+                }
+                set_bit(x, dirty + y * BITS_TO_LONGS(bits));
+                flagged++;
+                if (g_rand_int_range(rand, 0, 100) < changed_pct) {
+                    guest[(y * bits + x) * CHUNK_BYTES +
+                          g_rand_int_range(rand, 0, CHUNK_BYTES)]++;
+                }
+            }
+        }
+
+        start = get_clock();
+        if (use_scalar) {
+            total += refresh_scalar(server, guest, dirty, bits, server_dirty);
+        } else {
+            total += refresh_runs(server, guest, dirty, bits, server_dirty);
+        }
+        ns += get_clock() - start;
+        memset(server_dirty, 0, longs * sizeof(unsigned long));
+    }
+
+    if (memcmp(guest, server, fb_size) != 0) {
+        fprintf(stderr, "server surface is out of date\n");
+        return 1;
+    }
+
+    printf("mode:        %s\n", use_scalar ? "memcmp" : "buffer_copy_changed");
+    printf("surface:     %ux%u\n", width, height);
+    printf("rounds:      %u\n", n_rounds);
+    printf("dirty:       %zu chunks, %zu changed\n", flagged, total);
+    printf("time:        %.3f ms/round\n", ns / 1e6 / n_rounds);
+    printf("throughput:  %.2f GB/s compared\n",
+           (double)flagged * CHUNK_BYTES / ns);
+
+    g_rand_free(rand);
+    g_free(dirty);
+    g_free(server_dirty);
+    g_free(guest);
+    g_free(server);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Check that per-vCPU inline ops and conditional callbacks agree with
+ * the equivalent plain callbacks.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* a conditional callback fires every COND_PERIOD instructions */
+#define COND_PERIOD 1000
+
+typedef struct {
+    uint64_t tb_cb;
+    uint64_t tb_inline;
+    uint64_t tb_stored;
+    uint64_t tb_cond;
+    uint64_t insn_cb;
+    uint64_t insn_inline;
+    uint64_t insn_period;
+    uint64_t insn_cond;
+    uint64_t mem_cb;
+    uint64_t mem_inline;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_cb;
+static qemu_plugin_u64 tb_inline;
+static qemu_plugin_u64 tb_stored;
+static qemu_plugin_u64 tb_cond;
+static qemu_plugin_u64 insn_cb;
+static qemu_plugin_u64 insn_inline;
+static qemu_plugin_u64 insn_period;
+static qemu_plugin_u64 insn_cond;
+static qemu_plugin_u64 mem_cb;
+static qemu_plugin_u64 mem_inline;
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) report = g_string_new("");
+
+    for (int i = 0; i < qemu_plugin_num_vcpus(); i++) {
+        uint64_t insns = qemu_plugin_u64_get(insn_inline, i);
+
+        g_assert(qemu_plugin_u64_get(tb_cb, i) ==
+                 qemu_plugin_u64_get(tb_inline, i));
+        g_assert(qemu_plugin_u64_get(tb_cond, i) ==
+                 qemu_plugin_u64_get(tb_inline, i));
+        g_assert(qemu_plugin_u64_get(insn_cb, i) == insns);
+        g_assert(qemu_plugin_u64_get(insn_cond, i) * COND_PERIOD +
+                 qemu_plugin_u64_get(insn_period, i) == insns);
+        g_assert(qemu_plugin_u64_get(mem_cb, i) ==
+                 qemu_plugin_u64_get(mem_inline, i));
+    }
+
+    g_string_printf(report, "tb: %" PRIu64 ", insn: %" PRIu64
+                    ", mem: %" PRIu64 "\n",
+                    qemu_plugin_u64_sum(tb_inline),
+                    qemu_plugin_u64_sum(insn_inline),
+                    qemu_plugin_u64_sum(mem_inline));
+    qemu_plugin_outs(report->str);
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_cb, cpu_index, 1);
+}
+
+/* runs after the inline ops of the block stored 1 */
+static void vcpu_tb_cond(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_set(tb_stored, cpu_index, 0);
+    qemu_plugin_u64_add(tb_cond, cpu_index, 1);
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(insn_cb, cpu_index, 1);
+}
+
+static void vcpu_insn_cond(unsigned int cpu_index, void *udata)
+{
+    g_assert(qemu_plugin_u64_get(insn_period, cpu_index) == COND_PERIOD);
+    qemu_plugin_u64_set(insn_period, cpu_index, 0);
+    qemu_plugin_u64_add(insn_cond, cpu_index, 1);
+}
+
+static void vcpu_mem_access(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    qemu_plugin_u64_add(mem_cb, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_STORE_U64, tb_stored, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond, QEMU_PLUGIN_CB_NO_REGS,
+        QEMU_PLUGIN_COND_EQ, tb_stored, 1, NULL);
+
+    for (size_t i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS, NULL);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_inline, 1);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_period, 1);
+        qemu_plugin_register_vcpu_insn_exec_cond_cb(
+            insn, vcpu_insn_cond, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_GE, insn_period, COND_PERIOD, NULL);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            mem_inline, 1);
+    }
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, tb_cb);
+    tb_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     tb_inline);
+    tb_stored = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     tb_stored);
+    tb_cond = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, tb_cond);
+    insn_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, insn_cb);
+    insn_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                       insn_inline);
+    insn_period = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                       insn_period);
+    insn_cond = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     insn_cond);
+    mem_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, mem_cb);
+    mem_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      mem_inline);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -278,6 +278,116 @@ static void test_i440fx_pam(gconstpointer opaque)
     qtest_end();
 }
 
+#define I440FX_PAM 0x59
+#define I440FX_PAM_SIZE 7
+#define I440FX_SMRAM 0x72
+#define SMRAM_D_OPEN 0x40
+#define SMRAM_G_SMRAME 0x08
+#define PAM_AREAS 14
+
+static gint compare_strings(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Return the flat views printed by "info mtree -f" without their numbers
+ * and sorted, because the order in which they are printed is not stable.
+ */
+static char *flatviews_get(void)
+{
+    g_autofree char *out = qtest_hmp(global_qtest, "info mtree -f");
+    g_auto(GStrv) views = g_strsplit(out, "FlatView #", -1);
+    g_autoptr(GPtrArray) blocks = g_ptr_array_new();
+    int i;
+
+    /* views[0] is whatever comes before the first view */
+    for (i = 1; views[i]; i++) {
+        const char *body = strchr(views[i], '\n');
+
+        g_ptr_array_add(blocks, (gpointer)(body ? body : ""));
+    }
+    g_ptr_array_sort(blocks, compare_strings);
+    g_ptr_array_add(blocks, NULL);
+
+    return g_strjoinv("FlatView\n", (char **)blocks->pdata);
+}
+
+/*
+ * The PAM and SMRAM registers enable and disable aliases that overlap RAM
+ * and PCI memory with a higher priority.  FlatViews are only rendered again
+ * where a transaction changed something, so check that the flat memory map
+ * only depends on the register values and not on the order in which they
+ * were written.
+ */
+static void test_i440fx_pam_flatview(gconstpointer opaque)
+{
+    const TestData *s = opaque;
+    g_autoptr(GRand) rand = g_rand_new_with_seed(0x440f);
+    g_autofree char *initial = NULL;
+    uint8_t initial_pam[I440FX_PAM_SIZE];
+    uint8_t initial_smram;
+    uint8_t flags[PAM_AREAS];
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    int round, i;
+
+    bus = test_start_get_bus(s);
+    dev = qpci_device_find(bus, QPCI_DEVFN(0, 0));
+    g_assert(dev != NULL);
+
+    for (i = 0; i < I440FX_PAM_SIZE; i++) {
+        initial_pam[i] = qpci_config_readb(dev, I440FX_PAM + i);
+    }
+    initial_smram = qpci_config_readb(dev, I440FX_SMRAM);
+    initial = flatviews_get();
+
+    for (round = 0; round < 8; round++) {
+        g_autofree char *forward = NULL;
+        g_autofree char *reverted = NULL;
+        g_autofree char *backward = NULL;
+        uint8_t smram = 0x02;
+
+        /* PAM area 0 is reserved */
+        for (i = 1; i < PAM_AREAS; i++) {
+            flags[i] = g_rand_int_range(rand, 0, (PAM_RE | PAM_WE) + 1);
+        }
+        if (g_rand_boolean(rand)) {
+            smram |= SMRAM_D_OPEN;
+        }
+        if (g_rand_boolean(rand)) {
+            smram |= SMRAM_G_SMRAME;
+        }
+
+        /* Apply the settings front to back... */
+        for (i = 1; i < PAM_AREAS; i++) {
+            pam_set(dev, i, flags[i]);
+        }
+        qpci_config_writeb(dev, I440FX_SMRAM, smram);
+        forward = flatviews_get();
+
+        /* ... go back to the initial state... */
+        qpci_config_writeb(dev, I440FX_SMRAM, initial_smram);
+        for (i = 0; i < I440FX_PAM_SIZE; i++) {
+            qpci_config_writeb(dev, I440FX_PAM + i, initial_pam[i]);
+        }
+        reverted = flatviews_get();
+        g_assert_cmpstr(reverted, ==, initial);
+
+        /* ... and apply them back to front */
+        qpci_config_writeb(dev, I440FX_SMRAM, smram);
+        for (i = PAM_AREAS - 1; i >= 1; i--) {
+            pam_set(dev, i, flags[i]);
+        }
+        backward = flatviews_get();
+        g_assert_cmpstr(backward, ==, forward);
+    }
+
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_end();
+}
+
 #define BLOB_SIZE ((size_t)65536)
 #define ISA_BIOS_MAXSZ ((size_t)(128 * 1024))
 
@@ -386,6 +496,8 @@ int main(int argc, char **argv)
 
     qtest_add_data_func("i440fx/defaults", &data, test_i440fx_defaults);
     qtest_add_data_func("i440fx/pam", &data, test_i440fx_pam);
+    qtest_add_data_func("i440fx/pam-flatview", &data,
+                        test_i440fx_pam_flatview);
     add_firmware_test("i440fx/firmware/bios", request_bios);
     add_firmware_test("i440fx/firmware/pflash", request_pflash);
 
@@ -239,6 +239,10 @@ static const char *rmessage_name(uint8_t id)
         id == P9_RUNLINKAT ? "RUNLINKAT" :
         id == P9_RFLUSH ? "RFLUSH" :
         id == P9_RREADDIR ? "READDIR" :
+        id == P9_ROPEN ? "ROPEN" :
+        id == P9_RREAD ? "RREAD" :
+        id == P9_RRENAMEAT ? "RRENAMEAT" :
+        id == P9_RERROR ? "RERROR" :
         "<unknown>";
 }
 
@@ -250,6 +254,41 @@ void v9fs_req_wait_for_reply(P9Req *req, uint32_t *len)
                            QVIRTIO_9P_TIMEOUT_US);
 }
 
+/*
+ * Waits until all @nreqs requests in @reqs were completed by the server,
+ * in whatever order it completes them.
+ */
+void v9fs_req_wait_for_replies(P9Req **reqs, size_t nreqs)
+{
+    QVirtio9P *v9p = reqs[0]->v9p;
+    QTestState *qts = reqs[0]->qts;
+    gint64 start_time = g_get_monotonic_time();
+    g_autofree bool *done = g_new0(bool, nreqs);
+    size_t ndone = 0;
+
+    while (ndone < nreqs) {
+        uint32_t desc_idx;
+        size_t i;
+
+        qtest_clock_step(qts, 100);
+
+        if (v9p->vdev->bus->get_queue_isr_status(v9p->vdev, v9p->vq)) {
+            while (qvirtqueue_get_buf(qts, v9p->vq, &desc_idx, NULL)) {
+                for (i = 0; i < nreqs; i++) {
+                    if (!done[i] && reqs[i]->free_head == desc_idx) {
+                        break;
+                    }
+                }
+                g_assert_cmpint(i, <, nreqs);
+                done[i] = true;
+                ndone++;
+            }
+        }
+
+        g_assert(g_get_monotonic_time() - start_time <= QVIRTIO_9P_TIMEOUT_US);
+    }
+}
+
 void v9fs_req_recv(P9Req *req, uint8_t id)
 {
     P9Hdr hdr;
@@ -1052,3 +1091,144 @@ void v9fs_runlinkat(P9Req *req)
     v9fs_req_recv(req, P9_RUNLINKAT);
     v9fs_req_free(req);
 }
+
+/* size[4] Topen tag[2] fid[4] mode[1] */
+TOpenRes v9fs_topen(TOpenOpt opt)
+{
+    P9Req *req;
+
+    g_assert(opt.client);
+
+    req = v9fs_req_init(opt.client, 4 + 1, P9_TOPEN, opt.tag);
+    v9fs_uint32_write(req, opt.fid);
+    v9fs_memwrite(req, &opt.mode, 1);
+    v9fs_req_send(req);
+
+    if (!opt.requestOnly) {
+        v9fs_req_wait_for_reply(req, NULL);
+        v9fs_ropen(req, opt.ropen.qid, opt.ropen.iounit);
+        req = NULL; /* request was freed */
+    }
+
+    return (TOpenRes) { .req = req };
+}
+
+/* size[4] Ropen tag[2] qid[13] iounit[4] */
+void v9fs_ropen(P9Req *req, v9fs_qid *qid, uint32_t *iounit)
+{
+    v9fs_req_recv(req, P9_ROPEN);
+    if (qid) {
+        v9fs_memread(req, qid, 13);
+    } else {
+        v9fs_memskip(req, 13);
+    }
+    if (iounit) {
+        v9fs_uint32_read(req, iounit);
+    }
+    v9fs_req_free(req);
+}
+
+/* size[4] Tread tag[2] fid[4] offset[8] count[4] */
+TReadRes v9fs_tread(TReadOpt opt)
+{
+    P9Req *req;
+    uint32_t err;
+
+    g_assert(opt.client);
+    /* expecting either Rread or Rlerror, but obviously not both */
+    g_assert(!opt.expectErr || !(opt.rread.count || opt.rread.data));
+
+    req = v9fs_req_init(opt.client, 4 + 8 + 4, P9_TREAD, opt.tag);
+    v9fs_uint32_write(req, opt.fid);
+    v9fs_uint64_write(req, opt.offset);
+    v9fs_uint32_write(req, opt.count);
+    v9fs_req_send(req);
+
+    if (!opt.requestOnly) {
+        v9fs_req_wait_for_reply(req, NULL);
+        if (opt.expectErr) {
+            v9fs_rlerror(req, &err);
+            g_assert_cmpint(err, ==, opt.expectErr);
+        } else {
+            v9fs_rread(req, opt.rread.count, opt.rread.data);
+        }
+        req = NULL; /* request was freed */
+    }
+
+    return (TReadRes) { .req = req };
+}
+
+/* size[4] Rread tag[2] count[4] data[count] */
+void v9fs_rread(P9Req *req, uint32_t *count, void *data)
+{
+    uint32_t local_count;
+
+    v9fs_req_recv(req, P9_RREAD);
+    v9fs_uint32_read(req, &local_count);
+    g_assert_cmpint(local_count, <=, P9_MAX_SIZE - 11);
+
+    if (count) {
+        *count = local_count;
+    }
+    if (data) {
+        v9fs_memread(req, data, local_count);
+    }
+    v9fs_req_free(req);
+}
+
+/* size[4] Trenameat tag[2] olddirfid[4] oldname[s] newdirfid[4] newname[s] */
+TrenameatRes v9fs_trenameat(TrenameatOpt opt)
+{
+    P9Req *req;
+    uint32_t err;
+
+    g_assert(opt.client);
+    /* expecting either hi-level atPath or low-level dirfid, but not both */
+    g_assert(!opt.oldAtPath || !opt.olddirfid);
+    g_assert(!opt.newAtPath || !opt.newdirfid);
+
+    if (opt.oldAtPath) {
+        opt.olddirfid = v9fs_twalk((TWalkOpt) { .client = opt.client,
+                                                .path = opt.oldAtPath }).newfid;
+    }
+    if (opt.newAtPath) {
+        opt.newdirfid = v9fs_twalk((TWalkOpt) { .client = opt.client,
+                                                .path = opt.newAtPath }).newfid;
+    }
+
+    uint32_t body_size = 4 + 4;
+    uint16_t string_size = v9fs_string_size(opt.oldname);
+
+    g_assert_cmpint(body_size, <=, UINT32_MAX - string_size);
+    body_size += string_size;
+    string_size = v9fs_string_size(opt.newname);
+    g_assert_cmpint(body_size, <=, UINT32_MAX - string_size);
+    body_size += string_size;
+
+    req = v9fs_req_init(opt.client, body_size, P9_TRENAMEAT, opt.tag);
+    v9fs_uint32_write(req, opt.olddirfid);
+    v9fs_string_write(req, opt.oldname);
+    v9fs_uint32_write(req, opt.newdirfid);
+    v9fs_string_write(req, opt.newname);
+    v9fs_req_send(req);
+
+    if (!opt.requestOnly) {
+        v9fs_req_wait_for_reply(req, NULL);
+        if (opt.expectErr) {
+            v9fs_rlerror(req, &err);
+            g_assert_cmpint(err, ==, opt.expectErr);
+        } else {
+            v9fs_rrenameat(req);
+        }
+        req = NULL; /* request was freed */
+    }
+
+    return (TrenameatRes) { .req = req };
+}
+
+/* size[4] Rrenameat tag[2] */
+void v9fs_rrenameat(P9Req *req)
+{
+    v9fs_req_recv(req, P9_RRENAMEAT);
+    v9fs_req_free(req);
+}
@@ -441,6 +441,91 @@ typedef struct TunlinkatRes {
     P9Req *req;
 } TunlinkatRes;
 
+/* options for 'Topen' 9p request (9P2000.u) */
+typedef struct TOpenOpt {
+    /* 9P client being used (mandatory) */
+    QVirtio9P *client;
+    /* user supplied tag number being returned with response (optional) */
+    uint16_t tag;
+    /* file ID of file / directory to be opened (required) */
+    uint32_t fid;
+    /* 9P2000.u open mode, 0 being read only (optional) */
+    uint8_t mode;
+    /* data being received from 9p server as 'Ropen' response (optional) */
+    struct {
+        v9fs_qid *qid;
+        uint32_t *iounit;
+    } ropen;
+    /* only send Topen request but not wait for a reply? (optional) */
+    bool requestOnly;
+} TOpenOpt;
+
+/* result of 'Topen' 9p request */
+typedef struct TOpenRes {
+    /* if requestOnly was set: request object for further processing */
+    P9Req *req;
+} TOpenRes;
+
+/* options for 'Tread' 9p request */
+typedef struct TReadOpt {
+    /* 9P client being used (mandatory) */
+    QVirtio9P *client;
+    /* user supplied tag number being returned with response (optional) */
+    uint16_t tag;
+    /* file ID of file / directory to read from (required) */
+    uint32_t fid;
+    /* start position of read from beginning of file (optional) */
+    uint64_t offset;
+    /* maximum amount of bytes to read (required) */
+    uint32_t count;
+    /* data being received from 9p server as 'Rread' response (optional) */
+    struct {
+        uint32_t *count;
+        /* buffer of at least 'count' bytes receiving the data */
+        void *data;
+    } rread;
+    /* only send Tread request but not wait for a reply? (optional) */
+    bool requestOnly;
+    /* do we expect an Rlerror response, if yes which error code? (optional) */
+    uint32_t expectErr;
+} TReadOpt;
+
+/* result of 'Tread' 9p request */
+typedef struct TReadRes {
+    /* if requestOnly was set: request object for further processing */
+    P9Req *req;
+} TReadRes;
+
+/* options for 'Trenameat' 9p request */
+typedef struct TrenameatOpt {
+    /* 9P client being used (mandatory) */
+    QVirtio9P *client;
+    /* user supplied tag number being returned with response (optional) */
+    uint16_t tag;
+    /* low-level variant of directory the entry is moved from */
+    uint32_t olddirfid;
+    /* high-level variant of directory the entry is moved from */
+    const char *oldAtPath;
+    /* name of directory entry to be moved (required) */
+    const char *oldname;
+    /* low-level variant of directory the entry is moved to */
+    uint32_t newdirfid;
+    /* high-level variant of directory the entry is moved to */
+    const char *newAtPath;
+    /* new name of the directory entry (required) */
+    const char *newname;
+    /* only send Trenameat request but not wait for a reply? (optional) */
+    bool requestOnly;
+    /* do we expect an Rlerror response, if yes which error code? (optional) */
+    uint32_t expectErr;
+} TrenameatOpt;
+
+/* result of 'Trenameat' 9p request */
+typedef struct TrenameatRes {
+    /* if requestOnly was set: request object for further processing */
+    P9Req *req;
+} TrenameatRes;
+
 void v9fs_set_allocator(QGuestAllocator *t_alloc);
 void v9fs_memwrite(P9Req *req, const void *addr, size_t len);
 void v9fs_memskip(P9Req *req, size_t len);
@@ -459,6 +544,7 @@ P9Req *v9fs_req_init(QVirtio9P *v9p, uint32_t size, uint8_t id,
                      uint16_t tag);
 void v9fs_req_send(P9Req *req);
 void v9fs_req_wait_for_reply(P9Req *req, uint32_t *len);
+void v9fs_req_wait_for_replies(P9Req **reqs, size_t nreqs);
 void v9fs_req_recv(P9Req *req, uint8_t id);
 void v9fs_req_free(P9Req *req);
 void v9fs_rlerror(P9Req *req, uint32_t *err);
@@ -490,5 +576,11 @@ TlinkRes v9fs_tlink(TlinkOpt);
 void v9fs_rlink(P9Req *req);
 TunlinkatRes v9fs_tunlinkat(TunlinkatOpt);
 void v9fs_runlinkat(P9Req *req);
+TOpenRes v9fs_topen(TOpenOpt);
+void v9fs_ropen(P9Req *req, v9fs_qid *qid, uint32_t *iounit);
+TReadRes v9fs_tread(TReadOpt);
+void v9fs_rread(P9Req *req, uint32_t *count, void *data);
+TrenameatRes v9fs_trenameat(TrenameatOpt);
+void v9fs_rrenameat(P9Req *req);
 
 #endif
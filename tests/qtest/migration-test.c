@@ -600,10 +600,17 @@ typedef struct {
      */
     bool hide_stderr;
     bool use_shmem;
+    /*
+     * Back guest RAM by a file in tmpfs that the source shares and the
+     * target maps as a template; the caller removes the file.
+     */
+    bool use_template;
     /* only launch the target process */
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Use TCG only, with its dirty ring */
+    bool use_tcg_dirty_ring;
     const char *opts_source;
     const char *opts_target;
 } MigrateStart;
@@ -710,6 +717,8 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     g_autofree char *bootpath = NULL;
     g_autofree char *shmem_opts = NULL;
     g_autofree char *shmem_path = NULL;
+    g_autofree char *template_opts = NULL;
+    g_autofree char *accel_opts = NULL;
     const char *arch = qtest_get_arch();
     const char *memory_size;
 
@@ -780,19 +789,36 @@ static int test_migrate_start(QTestState **from, QTestState **to,
             "-object memory-backend-file,id=mem0,size=%s"
             ",mem-path=%s,share=on -numa node,memdev=mem0",
             memory_size, shmem_path);
+    } else if (args->use_template) {
+        shmem_path = g_strdup_printf("%s/template-ram", tmpfs);
+        shmem_opts = g_strdup_printf(
+            "-object memory-backend-file,id=mem0,size=%s"
+            ",mem-path=%s,share=on -machine memory-backend=mem0",
+            memory_size, shmem_path);
+        template_opts = g_strdup_printf(
+            "-object memory-backend-file,id=mem0,size=%s"
+            ",mem-path=%s,share=off,template=on -machine memory-backend=mem0",
+            memory_size, shmem_path);
     } else {
         shmem_path = NULL;
         shmem_opts = g_strdup("");
     }
 
-    cmd_source = g_strdup_printf("-accel kvm%s -accel tcg "
+    if (args->use_tcg_dirty_ring) {
+        /* Small enough that the rings fill up between harvests */
+        accel_opts = g_strdup("-accel tcg,dirty-ring-size=256");
+    } else {
+        accel_opts = g_strdup_printf("-accel kvm%s -accel tcg",
+                                     args->use_dirty_ring ?
+                                     ",dirty-ring-size=4096" : "");
+    }
+
+    cmd_source = g_strdup_printf("%s "
                                  "-name source,debug-threads=on "
                                  "-m %s "
                                  "-serial file:%s/src_serial "
                                  "%s %s %s %s %s",
-                                 args->use_dirty_ring ?
-                                 ",dirty-ring-size=4096" : "",
-                                 memory_size, tmpfs,
+                                 accel_opts, memory_size, tmpfs,
                                  arch_opts ? arch_opts : "",
                                  arch_source ? arch_source : "",
                                  shmem_opts,
@@ -805,18 +831,16 @@ static int test_migrate_start(QTestState **from, QTestState **to,
                                      &got_src_stop);
     }
 
-    cmd_target = g_strdup_printf("-accel kvm%s -accel tcg "
+    cmd_target = g_strdup_printf("%s "
                                  "-name target,debug-threads=on "
                                  "-m %s "
                                  "-serial file:%s/dest_serial "
                                  "-incoming %s "
                                  "%s %s %s %s %s",
-                                 args->use_dirty_ring ?
-                                 ",dirty-ring-size=4096" : "",
-                                 memory_size, tmpfs, uri,
+                                 accel_opts, memory_size, tmpfs, uri,
                                  arch_opts ? arch_opts : "",
                                  arch_target ? arch_target : "",
-                                 shmem_opts,
+                                 template_opts ? template_opts : shmem_opts,
                                  args->opts_target ? args->opts_target : "",
                                  ignore_stderr);
     *to = qtest_init(cmd_target);
@@ -1589,6 +1613,66 @@ static void test_precopy_common(MigrateCommon *args)
     test_migrate_end(from, to, args->result == MIG_TEST_SUCCEED);
 }
 
+#ifndef _WIN32
+static void *test_migrate_template_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "x-ignore-shared", true);
+    migrate_set_capability(to, "x-ignore-shared", true);
+
+    return NULL;
+}
+
+static char *template_checksum(void)
+{
+    g_autofree char *path = g_strdup_printf("%s/template-ram", tmpfs);
+    g_autofree char *contents = NULL;
+    gsize length;
+
+    g_assert(g_file_get_contents(path, &contents, &length, NULL));
+    return g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                       (guchar *)contents, length);
+}
+
+static void test_migrate_template_finish(QTestState *from, QTestState *to,
+                                         void *opaque)
+{
+    g_autofree char *before = template_checksum();
+    g_autofree char *after = NULL;
+    unsigned char byte_a, byte_b;
+
+    /* The clone is running; its writes must stay in private copies */
+    qtest_memread(to, start_address, &byte_a, 1);
+    do {
+        qtest_memread(to, start_address, &byte_b, 1);
+        usleep(1000 * 10);
+    } while (byte_a == byte_b);
+
+    after = template_checksum();
+    g_assert_cmpstr(before, ==, after);
+}
+
+/*
+ * Clone a guest from its RAM file: the source shares its RAM with the file
+ * and skips it with x-ignore-shared, the target maps the file as a template.
+ */
+static void test_precopy_unix_template(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start = {
+            .use_template = true,
+        },
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_template_start,
+        .finish_hook = test_migrate_template_finish,
+    };
+
+    test_precopy_common(&args);
+    cleanup("template-ram");
+}
+#endif
+
 static void test_precopy_unix_plain(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -1606,6 +1690,77 @@ static void test_precopy_unix_plain(void)
 }
 
 
+/*
+ * Return a checksum of the memory that the guest workload writes to, as
+ * saved by @who.
+ */
+static char *guest_mem_checksum(QTestState *who, const char *name)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", tmpfs, name);
+    g_autofree char *data = NULL;
+    gsize len;
+
+    qtest_qmp_assert_success(who, "{ 'execute': 'pmemsave',"
+                             "  'arguments': { 'val': %u, 'size': %u,"
+                             "                 'filename': %s } }",
+                             start_address, end_address - start_address,
+                             path);
+    g_assert_true(g_file_get_contents(path, &data, &len, NULL));
+    g_assert_cmpint(len, ==, end_address - start_address);
+    unlink(path);
+
+    return g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+                                       (const guchar *)data, len);
+}
+
+/*
+ * Live migration with the dirty ring of TCG.  The destination is started
+ * with -S, so that it does not run the guest after the migration until
+ * its memory was compared with the memory of the stopped source.
+ */
+static void test_precopy_unix_tcg_dirty_ring(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    g_autofree char *src_sum = NULL;
+    g_autofree char *dst_sum = NULL;
+    MigrateStart args = {
+        .use_tcg_dirty_ring = true,
+        .opts_target = "-S",
+    };
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, uri, &args)) {
+        return;
+    }
+
+    wait_for_serial("src_serial");
+    migrate_ensure_non_converge(from);
+    migrate_prepare_for_dirty_mem(from);
+
+    migrate_qmp(from, uri, "{}");
+
+    migrate_wait_for_dirty_mem(from, to);
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    if (!got_src_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(to);
+
+    /* Neither side runs the guest now, so its memory must be the same */
+    src_sum = guest_mem_checksum(from, "src_mem");
+    dst_sum = guest_mem_checksum(to, "dst_mem");
+    g_assert_cmpstr(src_sum, ==, dst_sum);
+
+    qtest_qmp_assert_success(to, "{ 'execute' : 'cont'}");
+    if (!got_dst_resume) {
+        qtest_qmp_eventwait(to, "RESUME");
+    }
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+}
+
 static void test_precopy_unix_dirty_ring(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -2200,6 +2355,13 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -2233,6 +2395,20 @@ static void test_multifd_tcp_zlib(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        /*
+         * Pages keep changing while being sent, so that the deltas
+         * against the per-channel caches are exercised.
+         */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
@@ -2830,6 +3006,10 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+#ifndef _WIN32
+    qtest_add_func("/migration/precopy/unix/template",
+                   test_precopy_unix_template);
+#endif
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -2922,6 +3102,8 @@ int main(int argc, char **argv)
     }
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
                    test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/tcp/plain/xbzrle",
+                   test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/plain/zstd",
                    test_multifd_tcp_zstd);
@@ -2945,6 +3127,11 @@ int main(int argc, char **argv)
 #endif /* CONFIG_TASN1 */
 #endif /* CONFIG_GNUTLS */
 
+    if (has_tcg) {
+        qtest_add_func("/migration/tcg_dirty_ring",
+                       test_precopy_unix_tcg_dirty_ring);
+    }
+
     if (g_str_equal(arch, "x86_64") && has_kvm && kvm_dirty_ring_supported()) {
         qtest_add_func("/migration/dirty_ring",
                        test_precopy_unix_dirty_ring);
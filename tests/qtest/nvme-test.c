@@ -142,6 +142,233 @@ static void nvmetest_pmr_reg_test(void *obj, void *data, QGuestAllocator *alloc)
     qpci_iounmap(pdev, pmr_bar);
 }
 
+typedef struct QNvmeQueue {
+    uint16_t qid;
+    uint16_t size;
+    uint64_t sq_addr;
+    uint64_t cq_addr;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t phase;
+} QNvmeQueue;
+
+static void nvmetest_queue_init(QNvmeQueue *q, QGuestAllocator *alloc,
+                                uint16_t qid, uint16_t size)
+{
+    q->qid = qid;
+    q->size = size;
+    q->sq_addr = guest_alloc(alloc, size * sizeof(NvmeCmd));
+    q->cq_addr = guest_alloc(alloc, size * sizeof(NvmeCqe));
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+}
+
+/* Submit @cmd to @q and wait until the controller posted its completion */
+static uint16_t nvmetest_submit(QPCIDevice *pdev, QPCIBar bar, QNvmeQueue *q,
+                                NvmeCmd *cmd, uint32_t *result)
+{
+    QTestState *qts = pdev->bus->qts;
+    gint64 end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+    NvmeCqe cqe;
+    uint16_t status;
+
+    cmd->cid = cpu_to_le16(q->sq_tail);
+    qtest_memwrite(qts, q->sq_addr + q->sq_tail * sizeof(*cmd),
+                   cmd, sizeof(*cmd));
+    q->sq_tail = (q->sq_tail + 1) % q->size;
+    qpci_io_writel(pdev, bar, 0x1000 + (q->qid << 3), q->sq_tail);
+
+    for (;;) {
+        qtest_memread(qts, q->cq_addr + q->cq_head * sizeof(cqe),
+                      &cqe, sizeof(cqe));
+        status = le16_to_cpu(cqe.status);
+        if ((status & 0x1) == q->phase) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() < end_time);
+        g_usleep(1000);
+    }
+
+    g_assert_cmpint(le16_to_cpu(cqe.sq_id), ==, q->qid);
+    g_assert_cmpint(le16_to_cpu(cqe.cid), ==, le16_to_cpu(cmd->cid));
+
+    q->cq_head = (q->cq_head + 1) % q->size;
+    if (!q->cq_head) {
+        q->phase ^= 1;
+    }
+    qpci_io_writel(pdev, bar, 0x1000 + (q->qid << 3) + 4, q->cq_head);
+
+    if (result) {
+        *result = le32_to_cpu(cqe.result);
+    }
+
+    return status >> 1;
+}
+
+static void nvmetest_enable(QPCIDevice *pdev, QPCIBar bar, QNvmeQueue *admin)
+{
+    gint64 end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+    uint32_t cc = 0;
+
+    qpci_io_writel(pdev, bar, 0x24,
+                   (admin->size - 1) << 16 | (admin->size - 1));
+    qpci_io_writeq(pdev, bar, 0x28, admin->sq_addr);
+    qpci_io_writeq(pdev, bar, 0x30, admin->cq_addr);
+
+    NVME_SET_CC_EN(cc, 1);
+    NVME_SET_CC_IOSQES(cc, 6);
+    NVME_SET_CC_IOCQES(cc, 4);
+    qpci_io_writel(pdev, bar, 0x14, cc);
+
+    while (!(qpci_io_readl(pdev, bar, 0x1c) & NVME_CSTS_READY)) {
+        g_assert(g_get_monotonic_time() < end_time);
+        g_usleep(1000);
+    }
+}
+
+static void nvmetest_create_qp(QPCIDevice *pdev, QPCIBar bar,
+                               QNvmeQueue *admin, QNvmeQueue *q)
+{
+    NvmeCmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADM_CMD_CREATE_CQ;
+    cmd.dptr.prp1 = cpu_to_le64(q->cq_addr);
+    cmd.cdw10 = cpu_to_le32((q->size - 1) << 16 | q->qid);
+    /* physically contiguous, interrupts enabled, vector 0 */
+    cmd.cdw11 = cpu_to_le32(0x3);
+    g_assert_cmpint(nvmetest_submit(pdev, bar, admin, &cmd, NULL), ==,
+                    NVME_SUCCESS);
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADM_CMD_CREATE_SQ;
+    cmd.dptr.prp1 = cpu_to_le64(q->sq_addr);
+    cmd.cdw10 = cpu_to_le32((q->size - 1) << 16 | q->qid);
+    cmd.cdw11 = cpu_to_le32(q->qid << 16 | 0x1);
+    g_assert_cmpint(nvmetest_submit(pdev, bar, admin, &cmd, NULL), ==,
+                    NVME_SUCCESS);
+}
+
+static void nvmetest_delete_qp(QPCIDevice *pdev, QPCIBar bar,
+                               QNvmeQueue *admin, QNvmeQueue *q)
+{
+    NvmeCmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADM_CMD_DELETE_SQ;
+    cmd.cdw10 = cpu_to_le32(q->qid);
+    g_assert_cmpint(nvmetest_submit(pdev, bar, admin, &cmd, NULL), ==,
+                    NVME_SUCCESS);
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADM_CMD_DELETE_CQ;
+    cmd.cdw10 = cpu_to_le32(q->qid);
+    g_assert_cmpint(nvmetest_submit(pdev, bar, admin, &cmd, NULL), ==,
+                    NVME_SUCCESS);
+}
+
+/* Write block @lba through @q and read it back */
+static void nvmetest_rw(QPCIDevice *pdev, QPCIBar bar, QNvmeQueue *q,
+                        uint64_t buf, uint32_t lba)
+{
+    NvmeCmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_CMD_WRITE;
+    cmd.nsid = cpu_to_le32(1);
+    cmd.dptr.prp1 = cpu_to_le64(buf);
+    cmd.cdw10 = cpu_to_le32(lba);
+    g_assert_cmpint(nvmetest_submit(pdev, bar, q, &cmd, NULL), ==,
+                    NVME_SUCCESS);
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_CMD_READ;
+    cmd.nsid = cpu_to_le32(1);
+    cmd.dptr.prp1 = cpu_to_le64(buf);
+    cmd.cdw10 = cpu_to_le32(lba);
+    g_assert_cmpint(nvmetest_submit(pdev, bar, q, &cmd, NULL), ==,
+                    NVME_SUCCESS);
+}
+
+/*
+ * The controller at 05.0 processes I/O queue pair 1 in iothread0 and queue
+ * pair 2 in iothread1, see nvme_register_nodes().
+ */
+static void nvmetest_iothread_qp_mapping_test(void *obj, void *data,
+                                              QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    g_autofree QPCIDevice *pdev = qpci_device_find(nvme->dev.bus,
+                                                   QPCI_DEVFN(5, 0));
+    QNvmeQueue admin, qp[2];
+    uint64_t buf;
+    uint32_t result;
+    QPCIBar bar;
+    NvmeCmd cmd;
+    int round, i;
+
+    g_assert(pdev);
+    qpci_device_enable(pdev);
+    bar = qpci_iomap(pdev, 0, NULL);
+    buf = guest_alloc(alloc, 4096);
+
+    for (round = 0; round < 2; round++) {
+        nvmetest_queue_init(&admin, alloc, 0, 8);
+        nvmetest_enable(pdev, bar, &admin);
+
+        /* aggregate up to 4 completions or 100 microseconds */
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.opcode = NVME_ADM_CMD_SET_FEATURES;
+        cmd.cdw10 = cpu_to_le32(NVME_INTERRUPT_COALESCING);
+        cmd.cdw11 = cpu_to_le32(1 << 8 | 3);
+        g_assert_cmpint(nvmetest_submit(pdev, bar, &admin, &cmd, NULL), ==,
+                        NVME_SUCCESS);
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.opcode = NVME_ADM_CMD_GET_FEATURES;
+        cmd.cdw10 = cpu_to_le32(NVME_INTERRUPT_COALESCING);
+        g_assert_cmpint(nvmetest_submit(pdev, bar, &admin, &cmd, &result), ==,
+                        NVME_SUCCESS);
+        g_assert_cmpint(result, ==, 1 << 8 | 3);
+
+        for (i = 0; i < ARRAY_SIZE(qp); i++) {
+            nvmetest_queue_init(&qp[i], alloc, i + 1, 8);
+            nvmetest_create_qp(pdev, bar, &admin, &qp[i]);
+        }
+
+        /* wrap the completion queues to check the phase tag, too */
+        for (i = 0; i < 2 * qp[0].size; i++) {
+            nvmetest_rw(pdev, bar, &qp[i % ARRAY_SIZE(qp)], buf, i);
+        }
+
+        /* let the aggregation timers fire */
+        qtest_clock_step(pdev->bus->qts, 1000 * 1000);
+
+        /* deleting a queue pair leaves the other IOThread working */
+        nvmetest_delete_qp(pdev, bar, &admin, &qp[1]);
+        nvmetest_rw(pdev, bar, &qp[0], buf, 0);
+
+        if (round) {
+            nvmetest_delete_qp(pdev, bar, &admin, &qp[0]);
+        }
+
+        /* controller reset with I/O queue pairs in IOThreads */
+        qpci_io_writel(pdev, bar, 0x14, 0);
+        g_assert_false(qpci_io_readl(pdev, bar, 0x1c) & NVME_CSTS_READY);
+
+        for (i = 0; i < ARRAY_SIZE(qp); i++) {
+            guest_free(alloc, qp[i].sq_addr);
+            guest_free(alloc, qp[i].cq_addr);
+        }
+        guest_free(alloc, admin.sq_addr);
+        guest_free(alloc, admin.cq_addr);
+    }
+
+    guest_free(alloc, buf);
+    qpci_iounmap(pdev, bar);
+}
+
 static void nvme_register_nodes(void)
 {
     QOSGraphEdgeOptions opts = {
@@ -168,6 +395,19 @@ static void nvme_register_nodes(void)
     });
 
     qos_add_test("reg-read", "nvme", nvmetest_reg_read_test, NULL);
+
+    qos_add_test("iothread-qp-mapping", "nvme",
+                 nvmetest_iothread_qp_mapping_test, &(QOSGraphTestOptions) {
+        .edge.before_cmd_line =
+            "-object iothread,id=iothread0 "
+            "-object iothread,id=iothread1 "
+            "-drive id=drv1,if=none,file=null-co://,format=raw "
+            "-device '{\"driver\":\"nvme\",\"addr\":\"05.0\","
+            "\"drive\":\"drv1\",\"serial\":\"bar\","
+            "\"max_ioqpairs\":2,\"iothread-qp-mapping\":"
+            "[{\"iothread\":\"iothread0\"},"
+            "{\"iothread\":\"iothread1\"}]}'"
+    });
 }
 
 libqos_init(nvme_register_nodes);
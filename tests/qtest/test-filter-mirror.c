@@ -71,10 +71,110 @@ static void test_mirror(void)
     qtest_quit(qts);
 }
 
+/* Release filter-buffer until there is something to read from @fd */
+static void release_until_readable(QTestState *qts, int fd)
+{
+    GPollFD pfd = { .fd = fd, .events = G_IO_IN };
+    int tries;
+
+    for (tries = 0; tries < 100; tries++) {
+        qtest_clock_step(qts, 1000000);
+        if (g_poll(&pfd, 1, 100) == 1) {
+            return;
+        }
+    }
+    g_assert_not_reached();
+}
+
+/*
+ * Packets held by filter-buffer are passed on to the next filter by
+ * reference when the buffer is released.  Make sure that they reach
+ * filter-mirror only then, complete and in order.
+ */
+static void test_mirror_after_buffer(void)
+{
+    int send_sock[2], recv_sock[2];
+    const char *packets[] = {
+        "Hello! filter-buffer~",
+        "Hello again! filter-buffer~",
+        "Goodbye! filter-buffer~",
+    };
+    uint32_t ret, len, size;
+    GPollFD pfd;
+    QTestState *qts;
+    int i;
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, send_sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, recv_sock);
+    g_assert_cmpint(ret, !=, -1);
+
+    qts = qtest_initf(
+        "-nic socket,id=qtest-bn0,fd=%d "
+        "-chardev socket,id=mirror0,fd=%d "
+        "-object filter-buffer,id=qtest-f0,netdev=qtest-bn0,queue=tx,"
+        "interval=1000000 "
+        "-object filter-mirror,id=qtest-f1,netdev=qtest-bn0,queue=tx,"
+        "outdev=mirror0 "
+        , send_sock[1], recv_sock[1]);
+
+    /* send a qmp command to guarantee that 'connected' is setting to true. */
+    qtest_qmp_assert_success(qts, "{ 'execute' : 'query-status'}");
+    for (i = 0; i < ARRAY_SIZE(packets); i++) {
+        struct iovec iov[] = {
+            {
+                .iov_base = &size,
+                .iov_len = sizeof(size),
+            }, {
+                .iov_base = (void *)packets[i],
+                .iov_len = strlen(packets[i]) + 1,
+            },
+        };
+
+        size = htonl(iov[1].iov_len);
+        ret = iov_send(send_sock[0], iov, 2, 0,
+                       sizeof(size) + iov[1].iov_len);
+        g_assert_cmpint(ret, ==, sizeof(size) + iov[1].iov_len);
+    }
+
+    /* Nothing gets through before the buffer is released */
+    qtest_qmp_assert_success(qts, "{ 'execute' : 'query-status'}");
+    pfd.fd = recv_sock[0];
+    pfd.events = G_IO_IN;
+    g_assert_cmpint(g_poll(&pfd, 1, 100), ==, 0);
+
+    /*
+     * QEMU may not have read all packets from the socket when the buffer
+     * is released first, so keep releasing it until each one comes out.
+     */
+    for (i = 0; i < ARRAY_SIZE(packets); i++) {
+        g_autofree char *recv_buf = NULL;
+
+        release_until_readable(qts, recv_sock[0]);
+        ret = recv(recv_sock[0], &len, sizeof(len), MSG_WAITALL);
+        g_assert_cmpint(ret, ==, sizeof(len));
+        len = ntohl(len);
+        g_assert_cmpint(len, ==, strlen(packets[i]) + 1);
+
+        recv_buf = g_malloc(len);
+        ret = recv(recv_sock[0], recv_buf, len, MSG_WAITALL);
+        g_assert_cmpint(ret, ==, len);
+        g_assert_cmpstr(recv_buf, ==, packets[i]);
+    }
+
+    close(send_sock[0]);
+    close(send_sock[1]);
+    close(recv_sock[0]);
+    close(recv_sock[1]);
+    qtest_quit(qts);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
 
     qtest_add_func("/netfilter/mirror", test_mirror);
+    qtest_add_func("/netfilter/mirror/after-buffer", test_mirror_after_buffer);
     return g_test_run();
 }
@@ -37,6 +37,7 @@ static const char *hmp_cmds[] = {
     "device_del mouse1",
     "dump-guest-memory /dev/null 0 4096",
     "dump-guest-memory /dev/null",
+    "dump-guest-memory -z /dev/null",
     "gdbserver",
     "gva2gpa 0",
     "hostfwd_add tcp::43210-:43210",
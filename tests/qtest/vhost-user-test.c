@@ -27,6 +27,7 @@
 
 #include "libqos/malloc-pc.h"
 #include "libqos/qgraph_internal.h"
+#include "hw/pci/pci_regs.h"
 #include "hw/virtio/virtio-net.h"
 
 #include "standard-headers/linux/vhost_types.h"
@@ -999,6 +1000,41 @@ static void test_vhost_user_started(void *obj, void *arg, QGuestAllocator *alloc
     wait_for_rings_started(s, 2);
 }
 
+/*
+ * Toggling the I/O decoding of the device changes the I/O address space
+ * only.  The vhost memory listener still gets begin() and commit() for
+ * the system memory, and must keep its memory table across them.
+ */
+static void test_unrelated_update(void *obj, void *arg,
+                                  QGuestAllocator *alloc)
+{
+    QOSGraphObject *net_object = obj;
+    QPCIDevice *pci_dev = net_object->get_driver(net_object, "pci-device");
+    TestServer *s = arg;
+    uint16_t cmd;
+
+    if (!wait_for_fds(s)) {
+        return;
+    }
+    wait_for_rings_started(s, 2);
+
+    cmd = qpci_config_readw(pci_dev, PCI_COMMAND);
+    qpci_config_writew(pci_dev, PCI_COMMAND, cmd & ~PCI_COMMAND_IO);
+    qpci_config_writew(pci_dev, PCI_COMMAND, cmd);
+
+    /*
+     * Stopping the VM stops the rings; once the backend has seen that,
+     * it has also seen any memory table sent before.
+     */
+    qtest_qmp_assert_success(global_qtest, "{ 'execute': 'stop' }");
+    wait_for_rings_started(s, 0);
+
+    g_mutex_lock(&s->data_mutex);
+    g_assert_cmpint(s->memory.nregions, >, 0);
+    g_assert_cmpint(s->fds_num, ==, s->memory.nregions);
+    g_mutex_unlock(&s->data_mutex);
+}
+
 static void *vhost_user_test_setup_multiqueue(GString *cmd_line, void *arg)
 {
     TestServer *s = vhost_user_test_setup(cmd_line, arg);
@@ -1104,6 +1140,10 @@ static void register_vhost_user_test(void)
     qos_add_test("vhost-user/flags-mismatch", "virtio-net",
                  test_vhost_user_started, &opts);
 
+    opts.before = vhost_user_test_setup;
+    qos_add_test("vhost-user/unrelated-update", "virtio-net-pci",
+                 test_unrelated_update, &opts);
+
     opts.before = vhost_user_test_setup_multiqueue;
     opts.edge.extra_device_opts = "mq=on";
     qos_add_test("vhost-user/multiqueue",
@@ -29,6 +29,9 @@
 #define tsymlink(...) v9fs_tsymlink((TsymlinkOpt) __VA_ARGS__)
 #define tlink(...) v9fs_tlink((TlinkOpt) __VA_ARGS__)
 #define tunlinkat(...) v9fs_tunlinkat((TunlinkatOpt) __VA_ARGS__)
+#define topen(...) v9fs_topen((TOpenOpt) __VA_ARGS__)
+#define tread(...) v9fs_tread((TReadOpt) __VA_ARGS__)
+#define trenameat(...) v9fs_trenameat((TrenameatOpt) __VA_ARGS__)
 
 static void pci_config(void *obj, void *data, QGuestAllocator *t_alloc)
 {
@@ -693,12 +696,212 @@ static void fs_unlinkat_hardlink(void *obj, void *data,
     g_assert(stat(real_file, &st_real) == 0);
 }
 
+static void fs_path_cache_unlinkat_dir(void *obj, void *data,
+                                       QGuestAllocator *t_alloc)
+{
+    QVirtio9P *v9p = obj;
+    v9fs_set_allocator(t_alloc);
+    struct stat st;
+    g_autofree char *new_file = virtio_9p_test_path("09/sub/file");
+
+    tattach({ .client = v9p });
+    tmkdir({ .client = v9p, .atPath = "/", .name = "09" });
+    tmkdir({ .client = v9p, .atPath = "09", .name = "sub" });
+    tlcreate({ .client = v9p, .atPath = "09/sub", .name = "file" });
+    g_assert(stat(new_file, &st) == 0);
+
+    /* remove the directory that is cached now ... */
+    tunlinkat({ .client = v9p, .atPath = "09/sub", .name = "file" });
+    tunlinkat({
+        .client = v9p, .atPath = "09", .name = "sub",
+        .flags = P9_DOTL_AT_REMOVEDIR
+    });
+    g_assert(stat(new_file, &st) != 0);
+
+    /* ... and make sure the new one with the same name is used */
+    tmkdir({ .client = v9p, .atPath = "09", .name = "sub" });
+    tlcreate({ .client = v9p, .atPath = "09/sub", .name = "file" });
+    g_assert(stat(new_file, &st) == 0);
+    g_assert((st.st_mode & S_IFMT) == S_IFREG);
+}
+
+/* attach with protocol version 9P2000.u instead of 9P2000.L */
+static void do_attach_dotu(QVirtio9P *v9p)
+{
+    P9Req *req;
+
+    tversion({ .client = v9p, .version = "9P2000.u" });
+    req = tattach({ .client = v9p, .requestOnly = true }).req;
+    v9fs_req_wait_for_reply(req, NULL);
+    v9fs_rattach(req, NULL);
+}
+
+/*
+ * Adds the names of the 9P2000.u stat structures returned by reading a
+ * directory to @names, failing if a name was returned before.
+ */
+static void dotu_stats_add_names(const uint8_t *data, uint32_t count,
+                                 GHashTable *names)
+{
+    /* type[2] dev[4] qid[13] mode[4] atime[4] mtime[4] length[8] */
+    const uint32_t name_off = 2 + 39;
+    uint32_t off = 0;
+
+    while (off < count) {
+        uint16_t size, len;
+        char *name;
+
+        g_assert_cmpint(count - off, >=, 2);
+        size = lduw_le_p(data + off);
+        g_assert_cmpint(count - off - 2, >=, size);
+        g_assert_cmpint(size, >=, name_off);
+        len = lduw_le_p(data + off + name_off);
+        g_assert_cmpint(size, >=, name_off + len);
+
+        name = g_strndup((const char *)data + off + name_off + 2, len);
+        g_assert_false(g_hash_table_contains(names, name));
+        g_hash_table_add(names, name);
+        off += 2 + size;
+    }
+}
+
+/* 9P2000.u readdir test where the entries are split over several messages */
+static void do_readdir_dotu_split(QVirtio9P *v9p, uint32_t count)
+{
+    g_autoptr(GHashTable) names = g_hash_table_new_full(g_str_hash,
+                                                        g_str_equal,
+                                                        g_free, NULL);
+    g_autofree char *dir = virtio_9p_test_path("10");
+    g_autofree uint8_t *data = g_malloc(count);
+    const int nfiles = 100;
+    uint64_t offset = 0;
+    uint32_t fid, nread;
+
+    g_assert(g_mkdir_with_parents(dir, 0700) == 0);
+    for (int i = 0; i < nfiles; i++) {
+        g_autofree char *file = g_strdup_printf("%s/file%d", dir, i);
+        g_assert(g_file_set_contents(file, "", 0, NULL));
+    }
+
+    do_attach_dotu(v9p);
+    fid = twalk({ .client = v9p, .path = "10" }).newfid;
+    topen({ .client = v9p, .fid = fid });
+
+    /*
+     * The server fetches the entries based on the size of 9P2000.L
+     * entries, so most reads have to put some of them back.
+     */
+    do {
+        tread({
+            .client = v9p, .fid = fid, .offset = offset, .count = count,
+            .rread = { .count = &nread, .data = data }
+        });
+        dotu_stats_add_names(data, nread, names);
+        offset += nread;
+    } while (nread);
+
+    g_assert_cmpint(g_hash_table_size(names), ==, nfiles + 2);
+    g_assert_true(g_hash_table_contains(names, "."));
+    g_assert_true(g_hash_table_contains(names, ".."));
+    for (int i = 0; i < nfiles; i++) {
+        g_autofree char *name = g_strdup_printf("file%d", i);
+        g_assert_true(g_hash_table_contains(names, name));
+    }
+}
+
+static void fs_readdir_dotu_split_256(void *obj, void *data,
+                                      QGuestAllocator *t_alloc)
+{
+    v9fs_set_allocator(t_alloc);
+    do_readdir_dotu_split(obj, 256);
+}
+
+static void fs_readdir_dotu_split_max(void *obj, void *data,
+                                      QGuestAllocator *t_alloc)
+{
+    v9fs_set_allocator(t_alloc);
+    do_readdir_dotu_split(obj, P9_MAX_SIZE - 11);
+}
+
+#define RENAME_RACE_ROUNDS  50
+#define RENAME_RACE_READERS 8
+#define RENAME_RACE_NFILES  32
+
+/*
+ * 9P2000.u reads of a directory stat its entries without taking the rename
+ * lock, so they may add a directory to the path cache under its old name
+ * while it is being renamed. Make sure that a new directory with the old
+ * name is used afterwards. The window for this is small, so the test runs
+ * many rounds but is not guaranteed to hit it on every run.
+ */
+static void fs_path_cache_rename_race(void *obj, void *data,
+                                      QGuestAllocator *t_alloc)
+{
+    QVirtio9P *v9p = obj;
+    v9fs_set_allocator(t_alloc);
+    g_autofree char *dir = virtio_9p_test_path("11/a");
+    g_autofree char *probe = virtio_9p_test_path("11/a/probe");
+    P9Req *reqs[RENAME_RACE_READERS + 1];
+    uint32_t dirfid;
+    struct stat st;
+
+    g_assert(g_mkdir_with_parents(dir, 0700) == 0);
+
+    do_attach_dotu(v9p);
+    dirfid = twalk({ .client = v9p, .path = "11" }).newfid;
+
+    for (int round = 0; round < RENAME_RACE_ROUNDS; round++) {
+        g_autofree char *newname = g_strdup_printf("b%d", round);
+        int i;
+
+        for (i = 0; i < RENAME_RACE_NFILES; i++) {
+            g_autofree char *file = g_strdup_printf("%s/file%d", dir, i);
+            g_assert(g_file_set_contents(file, "", 0, NULL));
+        }
+
+        for (i = 0; i < RENAME_RACE_READERS; i++) {
+            uint32_t fid = twalk({ .client = v9p, .path = "11/a" }).newfid;
+
+            topen({ .client = v9p, .fid = fid });
+            reqs[i] = tread({
+                .client = v9p, .tag = i + 1, .fid = fid,
+                .count = P9_MAX_SIZE - 11, .requestOnly = true
+            }).req;
+        }
+        reqs[i] = trenameat({
+            .client = v9p, .tag = i + 1,
+            .olddirfid = dirfid, .oldname = "a",
+            .newdirfid = dirfid, .newname = newname,
+            .requestOnly = true
+        }).req;
+
+        v9fs_req_wait_for_replies(reqs, RENAME_RACE_READERS + 1);
+        /* the reads fail if the directory is renamed under them, ignore */
+        for (i = 0; i < RENAME_RACE_READERS; i++) {
+            v9fs_req_free(reqs[i]);
+        }
+        v9fs_rrenameat(reqs[i]);
+
+        /* a file created in the new directory must end up there */
+        g_assert(mkdir(dir, 0700) == 0);
+        tlcreate({ .client = v9p, .atPath = "11/a", .name = "probe" });
+        g_assert(stat(probe, &st) == 0);
+    }
+}
+
 static void *assign_9p_local_driver(GString *cmd_line, void *arg)
 {
     virtio_9p_assign_local_driver(cmd_line, "security_model=mapped-xattr");
     return arg;
 }
 
+static void *assign_9p_local_driver_path_cache(GString *cmd_line, void *arg)
+{
+    virtio_9p_assign_local_driver(cmd_line, "security_model=mapped-xattr,"
+                                  "path_cache_ttl=60000");
+    return arg;
+}
+
 static void register_virtio_9p_test(void)
 {
 
@@ -756,6 +959,16 @@ static void register_virtio_9p_test(void)
     qos_add_test("local/hardlink_file", "virtio-9p", fs_hardlink_file, &opts);
     qos_add_test("local/unlinkat_hardlink", "virtio-9p", fs_unlinkat_hardlink,
                  &opts);
+    qos_add_test("local/readdir/dotu_split_256", "virtio-9p",
+                 fs_readdir_dotu_split_256, &opts);
+    qos_add_test("local/readdir/dotu_split_max", "virtio-9p",
+                 fs_readdir_dotu_split_max, &opts);
+
+    opts.before = assign_9p_local_driver_path_cache;
+    qos_add_test("local/path_cache/unlinkat_dir", "virtio-9p",
+                 fs_path_cache_unlinkat_dir, &opts);
+    qos_add_test("local/path_cache/rename_race", "virtio-9p",
+                 fs_path_cache_rename_race, &opts);
 }
 
 libqos_init(register_virtio_9p_test);
@@ -721,6 +721,128 @@ static void pci_hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
     qpci_unplug_acpi_device_test(qts, "drv1", PCI_SLOT_HP);
 }
 
+/* Write @sector through @vq, read it back and check the data */
+static void rw_check(QVirtioDevice *dev, QGuestAllocator *alloc,
+                     QVirtQueue *vq, uint64_t sector)
+{
+    g_autofree char *expected = g_strdup_printf("TEST%" PRIu64, sector);
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t status;
+    char *data;
+    QTestState *qts = global_qtest;
+
+    /* Write request */
+    req.type = VIRTIO_BLK_T_OUT;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    strcpy(req.data, expected);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    guest_free(alloc, req_addr);
+
+    /* Read request */
+    req.type = VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, true, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    data = g_malloc0(512);
+    memread(req_addr + 16, data, 512);
+    g_assert_cmpstr(data, ==, expected);
+    g_free(data);
+
+    guest_free(alloc, req_addr);
+}
+
+/*
+ * The device at 05.0 has four virtqueues, spread round-robin over
+ * iothread0 and iothread1, see register_virtio_blk_test().
+ */
+static void iothread_vq_mapping(void *obj, void *data,
+                                QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev1 = obj;
+    QVirtioPCIDevice *pdev;
+    QVirtioDevice *dev;
+    QVirtQueue *vq[4];
+    uint64_t features;
+    int round, i;
+
+    pdev = virtio_pci_new(dev1->pdev->bus,
+                          &(QPCIAddress) { .devfn = QPCI_DEVFN(5, 0) });
+    g_assert_nonnull(pdev);
+    g_assert_cmpint(pdev->vdev.device_type, ==, VIRTIO_ID_BLOCK);
+    qvirtio_pci_device_enable(pdev);
+    dev = &pdev->vdev;
+
+    /* the reset at the end of a round stops the vqs in both IOThreads */
+    for (round = 0; round < 2; round++) {
+        qvirtio_start_device(dev);
+
+        features = qvirtio_get_features(dev);
+        g_assert(features & (1u << VIRTIO_BLK_F_MQ));
+        features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                                (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                                (1u << VIRTIO_RING_F_EVENT_IDX) |
+                                (1u << VIRTIO_BLK_F_SCSI));
+        qvirtio_set_features(dev, features);
+
+        g_assert_cmpint(qvirtio_config_readw(dev,
+                            offsetof(struct virtio_blk_config, num_queues)),
+                        ==, ARRAY_SIZE(vq));
+
+        for (i = 0; i < ARRAY_SIZE(vq); i++) {
+            vq[i] = qvirtqueue_setup(dev, t_alloc, i);
+        }
+
+        qvirtio_set_driver_ok(dev);
+
+        /* go around twice so that each IOThread sees every vq it owns */
+        for (i = 0; i < 2 * ARRAY_SIZE(vq); i++) {
+            rw_check(dev, t_alloc, vq[i % ARRAY_SIZE(vq)], i);
+        }
+
+        qvirtio_reset(dev);
+
+        for (i = 0; i < ARRAY_SIZE(vq); i++) {
+            qvirtqueue_cleanup(dev->bus, vq[i], t_alloc);
+        }
+    }
+
+    qvirtio_pci_device_disable(pdev);
+    qos_object_destroy((QOSGraphObject *)pdev);
+}
+
 /*
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
@@ -785,6 +907,18 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_blk_vq_mapping_setup(GString *cmd_line, void *arg)
+{
+    char *tmp_path = drive_create();
+
+    g_string_append_printf(cmd_line,
+                           " -drive if=none,id=drive2,file=%s,"
+                           "format=raw,auto-read-only=off ",
+                           tmp_path);
+
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -802,6 +936,19 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    qos_add_test("iothread-vq-mapping", "virtio-blk-pci", iothread_vq_mapping,
+                 &(QOSGraphTestOptions) {
+        .before = virtio_blk_vq_mapping_setup,
+        .edge.before_cmd_line =
+            "-object iothread,id=iothread0 "
+            "-object iothread,id=iothread1 "
+            "-device '{\"driver\":\"virtio-blk-pci\",\"addr\":\"05.0\","
+            "\"drive\":\"drive2\",\"num-queues\":4,"
+            "\"iothread-vq-mapping\":"
+            "[{\"iothread\":\"iothread0\"},"
+            "{\"iothread\":\"iothread1\"}]}'"
+    });
 }
 
 libqos_init(register_virtio_blk_test);
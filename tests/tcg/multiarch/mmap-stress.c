@@ -0,0 +1,216 @@
+/*
+ * Stress concurrent mapping changes on disjoint ranges.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Each mutator thread owns a range of pages in a common reservation and
+ * repeatedly maps it, changes the protection of one half and unmaps the
+ * other half, checking after every step that system calls can or cannot
+ * read the pages.  Checker threads meanwhile pass an always mapped buffer,
+ * a never mapped page and a range that another thread keeps replacing with
+ * MAP_FIXED to system calls, which look up the page flags while they are
+ * being changed.  The replaced range is mapped before and after each
+ * replacement, so it must never fault.  The elapsed time is printed, so
+ * that the test doubles as a benchmark for contention on the mmap lock.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define N_MUTATORS       4
+#define N_CHECKERS       2
+#define PAGES_PER_THREAD 16
+#define REMAP_PAGES      4
+#define ITERATIONS       500
+
+static int pagesize;
+static char *area;
+static char *remap;
+static char *hole;
+static volatile bool done; /* stops the checker threads */
+
+/*
+ * Pass @len bytes at @p to write(), then drain the pipe again.
+ * Return false if the system call could not read the buffer.
+ */
+static bool check_read(int *fds, const char *p, size_t len)
+{
+    char buf[len];
+    ssize_t ret;
+
+    ret = write(fds[1], p, len);
+    if (ret < 0) {
+        assert(errno == EFAULT);
+        return false;
+    }
+    assert(ret == len);
+    ret = read(fds[0], buf, len);
+    assert(ret == len);
+    assert(memcmp(buf, p, len) == 0);
+    return true;
+}
+
+static void expect_readable(int *fds, const char *p, size_t len)
+{
+    bool ok = check_read(fds, p, len);
+
+    assert(ok);
+}
+
+static void expect_fault(int *fds, const char *p, size_t len)
+{
+    bool ok = check_read(fds, p, len);
+
+    assert(!ok);
+}
+
+static void *thread_mutate(void *arg)
+{
+    int id = (int)(long)arg;
+    size_t size = (size_t)PAGES_PER_THREAD * pagesize;
+    size_t half = size / 2;
+    char *start = area + id * size;
+    int fds[2];
+    char *p;
+    int i, ret;
+
+    ret = pipe(fds);
+    assert(ret == 0);
+
+    for (i = 0; i < ITERATIONS; i++) {
+        p = mmap(start, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        assert(p == start);
+        memset(p, id + i, size);
+        expect_readable(fds, p, pagesize);
+        expect_readable(fds, p + size - pagesize, pagesize);
+
+        ret = mprotect(p, half, PROT_NONE);
+        assert(ret == 0);
+        expect_fault(fds, p, pagesize);
+        expect_readable(fds, p + half, pagesize);
+
+        ret = munmap(p + half, half);
+        assert(ret == 0);
+        expect_fault(fds, p + half, pagesize);
+
+        ret = mprotect(p, half, PROT_READ);
+        assert(ret == 0);
+        expect_readable(fds, p + half - pagesize, pagesize);
+    }
+
+    /* Leave the range reserved. */
+    p = mmap(start, size, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    assert(p == start);
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+}
+
+static void *thread_remap(void *arg)
+{
+    unsigned long *count = arg;
+    char *p;
+
+    while (!done) {
+        p = mmap(remap, REMAP_PAGES * pagesize, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        assert(p == remap);
+        (*count)++;
+    }
+    return NULL;
+}
+
+static void *thread_check(void *arg)
+{
+    static char buf[256];
+    unsigned long *count = arg;
+    int fds[2];
+    int ret;
+
+    ret = pipe(fds);
+    assert(ret == 0);
+    while (!done) {
+        expect_readable(fds, buf, sizeof(buf));
+        expect_fault(fds, hole, sizeof(buf));
+        /* Cross a page boundary of the range being replaced. */
+        expect_readable(fds, remap + pagesize - sizeof(buf) / 2, sizeof(buf));
+        (*count)++;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t mutators[N_MUTATORS], checkers[N_CHECKERS], remapper;
+    unsigned long counts[N_CHECKERS] = { 0 };
+    unsigned long checks = 0, remaps = 0;
+    size_t size;
+    char *p;
+    struct timespec t0, t1;
+    double secs;
+    long i;
+    int ret;
+
+    pagesize = getpagesize();
+
+    /*
+     * The mutators' ranges are followed by the replaced range; the last
+     * page of the reservation stays unmapped.
+     */
+    size = (N_MUTATORS * PAGES_PER_THREAD + REMAP_PAGES) * pagesize;
+    area = mmap(NULL, size + pagesize,
+                PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(area != MAP_FAILED);
+    remap = area + N_MUTATORS * PAGES_PER_THREAD * pagesize;
+    p = mmap(remap, REMAP_PAGES * pagesize, PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    assert(p == remap);
+    hole = area + size;
+    ret = munmap(hole, pagesize);
+    assert(ret == 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ret = pthread_create(&remapper, NULL, thread_remap, &remaps);
+    assert(ret == 0);
+    for (i = 0; i < N_CHECKERS; i++) {
+        ret = pthread_create(&checkers[i], NULL, thread_check, &counts[i]);
+        assert(ret == 0);
+    }
+    for (i = 0; i < N_MUTATORS; i++) {
+        ret = pthread_create(&mutators[i], NULL, thread_mutate, (void *)i);
+        assert(ret == 0);
+    }
+    for (i = 0; i < N_MUTATORS; i++) {
+        ret = pthread_join(mutators[i], NULL);
+        assert(ret == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    done = true;
+    for (i = 0; i < N_CHECKERS; i++) {
+        ret = pthread_join(checkers[i], NULL);
+        assert(ret == 0);
+        checks += counts[i];
+    }
+    ret = pthread_join(remapper, NULL);
+    assert(ret == 0);
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%d threads x %d iterations: %.3f s, %.0f iterations/s, "
+           "%lu checks, %lu remaps\n", N_MUTATORS, ITERATIONS, secs,
+           N_MUTATORS * ITERATIONS / secs, checks, remaps);
+
+    ret = munmap(area, size);
+    assert(ret == 0);
+    return EXIT_SUCCESS;
+}
@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 
 #include "qapi/error.h"
+#include "qapi/qmp/json-parser.h"
 #include "qapi/qmp/qbool.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlit.h"
@@ -1457,6 +1458,43 @@ static void limits_nesting(void)
     g_assert(obj == NULL);
 }
 
+static void split_input_emit(void *opaque, QObject *json, Error *err)
+{
+    QObject **ret = opaque;
+
+    g_assert(!err);
+    g_assert(!*ret);
+    *ret = json;
+}
+
+static void split_input(void)
+{
+    /* Tokens that straddle the chunks fed to the parser */
+    const char *json = "{ \"name\": \"node0\", \"size\": 1234567890, "
+        "\"esc\": \"a\\u00e9\\n\", \"list\": [ true, null, -1.5e3 ] }";
+    QObject *expected = qobject_from_json(json, &error_abort);
+    size_t len = strlen(json);
+    size_t chunk, off;
+
+    for (chunk = 1; chunk <= 7; chunk++) {
+        JSONMessageParser parser;
+        QObject *obj = NULL;
+
+        json_message_parser_init(&parser, split_input_emit, &obj, NULL);
+        for (off = 0; off < len; off += chunk) {
+            json_message_parser_feed(&parser, json + off,
+                                     MIN(chunk, len - off));
+        }
+        json_message_parser_flush(&parser);
+        json_message_parser_destroy(&parser);
+
+        g_assert(obj);
+        g_assert(qobject_is_equal(obj, expected));
+        qobject_unref(obj);
+    }
+    qobject_unref(expected);
+}
+
 static void multiple_values(void)
 {
     Error *err = NULL;
@@ -1495,6 +1533,7 @@ int main(int argc, char **argv)
 
     g_test_add_func("/mixed/simple_whitespace", simple_whitespace);
     g_test_add_func("/mixed/interpolation", simple_interpolation);
+    g_test_add_func("/mixed/split_input", split_input);
 
     g_test_add_func("/errors/empty", empty_input);
     g_test_add_func("/errors/blank", blank_input);
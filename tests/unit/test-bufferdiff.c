@@ -0,0 +1,85 @@
+/*
+ * QEMU buffer_copy_changed test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/bitmap.h"
+
+#define MAX_CHUNKS 64
+
+static uint8_t src[MAX_CHUNKS * 128];
+static uint8_t dst[MAX_CHUNKS * 128];
+
+static void test_chunk(size_t chunk, size_t len)
+{
+    unsigned long *changed = bitmap_new(MAX_CHUNKS + 1);
+    size_t n = DIV_ROUND_UP(len, chunk);
+    size_t i, copied;
+
+    /* Identical buffers */
+    memset(src, 0x5a, sizeof(src));
+    memset(dst, 0x5a, sizeof(dst));
+    g_assert_cmpuint(buffer_copy_changed(dst, src, len, chunk, changed),
+                     ==, 0);
+    g_assert(bitmap_empty(changed, MAX_CHUNKS + 1));
+
+    /* One changed byte in some of the chunks, at every offset */
+    for (i = 0; i < n; i += 3) {
+        size_t off = i * chunk + (i * 7) % MIN(chunk, len - i * chunk);
+
+        src[off] ^= 0xff;
+    }
+    copied = buffer_copy_changed(dst, src, len, chunk, changed);
+    g_assert_cmpuint(copied, ==, DIV_ROUND_UP(n, 3));
+    for (i = 0; i < n; i++) {
+        g_assert_cmpint(test_bit(i, changed), ==, i % 3 == 0);
+    }
+    g_assert(memcmp(dst, src, len) == 0);
+
+    /* Nothing past @len is touched */
+    g_assert_cmpint(dst[len], ==, 0x5a);
+
+    /* The copy made the buffers equal again */
+    bitmap_zero(changed, MAX_CHUNKS + 1);
+    g_assert_cmpuint(buffer_copy_changed(dst, src, len, chunk, changed),
+                     ==, 0);
+    g_assert(bitmap_empty(changed, MAX_CHUNKS + 1));
+
+    g_free(changed);
+}
+
+static void test_1(void)
+{
+    static const size_t chunks[] = { 1, 12, 16, 32, 48, 64, 128 };
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(chunks); i++) {
+        size_t chunk = chunks[i];
+
+        test_chunk(chunk, chunk);
+        test_chunk(chunk, chunk * (MAX_CHUNKS - 1));
+        test_chunk(chunk, chunk * (MAX_CHUNKS - 1) + 1);
+        if (chunk > 1) {
+            test_chunk(chunk, chunk * (MAX_CHUNKS / 2) - 1);
+        }
+    }
+}
+
+static void test_2(void)
+{
+    do {
+        test_1();
+    } while (test_buffer_copy_changed_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/bufferdiff", test_2);
+
+    return g_test_run();
+}
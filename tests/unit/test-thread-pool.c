@@ -134,6 +134,31 @@ static void test_submit_many(void)
     }
 }
 
+static void test_submit_batch(void)
+{
+    ThreadPool *pool = aio_get_thread_pool(ctx);
+    WorkerTestData data[100];
+    int i;
+
+    /* Workers are only woken up at the end of the batch.  */
+    thread_pool_batch_begin(pool);
+    for (i = 0; i < 100; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(worker_cb, &data[i], done_cb, &data[i]);
+    }
+    thread_pool_batch_end(pool);
+
+    active = 100;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    for (i = 0; i < 100; i++) {
+        g_assert_cmpint(data[i].n, ==, 1);
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -240,6 +265,7 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-batch", test_submit_batch);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
@@ -0,0 +1,250 @@
+/*
+ * Simple trace backend unit-tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <glib/gstdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#include "qemu/atomic.h"
+#include "qemu/units.h"
+#include "trace/simple.h"
+
+#define HEADER_EVENT_ID     (~(uint64_t)0)
+#define HEADER_MAGIC        0xf2b177cb0aa429b4ULL
+#define DROPPED_EVENT_ID    (~(uint64_t)0 - 1)
+
+#define TEST_EVENT_ID       0
+#define NUM_THREADS         4
+/* Tags the events emitted from the signal handler */
+#define FROM_SIGNAL         (1ULL << 32)
+
+typedef struct {
+    uint64_t event;
+    uint64_t timestamp_ns;
+    uint32_t length;
+    uint32_t pid;
+    uint64_t arguments[];
+} TestRecord;
+
+static char *tmpdir;
+static unsigned n_events;
+static unsigned started;
+static unsigned finished;
+static unsigned signal_events;
+static __thread uint64_t thread_index;
+static __thread uint64_t signal_seq;
+
+static void emit(uint64_t tag, uint64_t seq)
+{
+    TraceBufferRecord rec;
+
+    if (trace_record_start(&rec, TEST_EVENT_ID, 2 * sizeof(uint64_t)) == 0) {
+        trace_record_write_u64(&rec, tag);
+        trace_record_write_u64(&rec, seq);
+        trace_record_finish(&rec);
+    }
+}
+
+static void sigusr1_handler(int sig)
+{
+    qatomic_inc(&signal_events);
+    emit(thread_index | FROM_SIGNAL, signal_seq++);
+}
+
+static void *emit_thread(void *opaque)
+{
+    unsigned i;
+
+    thread_index = (uintptr_t)opaque;
+
+    /* As QEMU threads do, so that signal handlers find the buffer */
+    st_thread_init();
+    qatomic_inc(&started);
+
+    for (i = 0; i < n_events; i++) {
+        emit(thread_index, i);
+    }
+    qatomic_inc(&finished);
+    return NULL;
+}
+
+/*
+ * Check that the trace file only contains well-formed records, that the
+ * events of each producer are in order, and that every event emitted was
+ * either written or accounted for as dropped.
+ */
+static void check_trace_file(const char *name, uint64_t emitted)
+{
+    uint64_t last_seq[NUM_THREADS][2];
+    uint64_t written = 0, dropped = 0;
+    g_autofree char *contents = NULL;
+    const uint64_t *header;
+    size_t len, off;
+
+    g_assert_true(g_file_get_contents(name, &contents, &len, NULL));
+    g_assert_cmpuint(len, >=, 3 * sizeof(uint64_t));
+    header = (const uint64_t *)contents;
+    g_assert_cmphex(header[0], ==, HEADER_EVENT_ID);
+    g_assert_cmphex(header[1], ==, HEADER_MAGIC);
+
+    memset(last_seq, 0xff, sizeof(last_seq));
+    off = 3 * sizeof(uint64_t);
+    while (off < len) {
+        uint64_t type;
+
+        g_assert_cmpuint(len - off, >=, sizeof(type));
+        memcpy(&type, contents + off, sizeof(type));
+        off += sizeof(type);
+
+        if (type == 0) {
+            uint32_t namelen;
+
+            /* Event mapping: id, name length, name */
+            off += sizeof(uint64_t);
+            g_assert_cmpuint(len - off, >=, sizeof(namelen));
+            memcpy(&namelen, contents + off, sizeof(namelen));
+            off += sizeof(namelen) + namelen;
+            g_assert_cmpuint(off, <=, len);
+        } else {
+            TestRecord rec;
+            uint64_t args[2];
+
+            g_assert_cmpuint(type, ==, 1);
+            g_assert_cmpuint(len - off, >=, sizeof(rec));
+            memcpy(&rec, contents + off, sizeof(rec));
+            g_assert_cmpuint(len - off, >=, rec.length);
+            if (rec.event == DROPPED_EVENT_ID) {
+                g_assert_cmpuint(rec.length, ==,
+                                 sizeof(rec) + sizeof(uint64_t));
+                memcpy(args, contents + off + sizeof(rec), sizeof(uint64_t));
+                dropped += args[0];
+            } else {
+                unsigned idx, src;
+
+                g_assert_cmpuint(rec.event, ==, TEST_EVENT_ID);
+                g_assert_cmpuint(rec.length, ==, sizeof(rec) + sizeof(args));
+                memcpy(args, contents + off + sizeof(rec), sizeof(args));
+                idx = args[0] & ~FROM_SIGNAL;
+                src = !!(args[0] & FROM_SIGNAL);
+                g_assert_cmpuint(idx, <, NUM_THREADS);
+                g_assert_true(last_seq[idx][src] == UINT64_MAX ||
+                              args[1] > last_seq[idx][src]);
+                last_seq[idx][src] = args[1];
+                written++;
+            }
+            off += rec.length;
+        }
+    }
+
+    g_assert_cmpuint(written + dropped, ==, emitted);
+}
+
+/*
+ * Trace from several threads at once.  With @signals, the threads are
+ * also interrupted by a signal handler that emits events of its own,
+ * often while the interrupted thread is in the middle of a record.
+ */
+static void run_threads(bool signals)
+{
+    g_autofree char *name = g_build_filename(tmpdir, "trace", NULL);
+    pthread_t threads[NUM_THREADS];
+    uintptr_t i;
+
+    g_assert_true(st_init());
+    st_set_trace_file(name);
+    st_set_trace_file_enabled(true);
+    g_assert_true(st_set_trace_file_enabled(true));
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        g_assert_cmpint(pthread_create(&threads[i], NULL, emit_thread,
+                                       (void *)i), ==, 0);
+    }
+    if (signals) {
+        while (qatomic_read(&started) < NUM_THREADS) {
+            sched_yield();
+        }
+        while (qatomic_read(&finished) < NUM_THREADS) {
+            for (i = 0; i < NUM_THREADS; i++) {
+                pthread_kill(threads[i], SIGUSR1);
+            }
+            sched_yield();
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    st_flush_trace_buffer();
+    st_set_trace_file_enabled(false);
+    check_trace_file(name, (uint64_t)NUM_THREADS * n_events +
+                     qatomic_read(&signal_events));
+    g_unlink(name);
+}
+
+static void test_threads_signals(void)
+{
+    if (g_test_subprocess()) {
+        struct sigaction act = {
+            .sa_handler = sigusr1_handler,
+            .sa_flags = SA_RESTART,
+        };
+
+        sigaction(SIGUSR1, &act, NULL);
+
+        /* Enough data to go past the first 16 MiB window of the file */
+        n_events = 100000;
+        run_threads(true);
+        return;
+    }
+
+    g_test_trap_subprocess(NULL, 0, 0);
+    g_test_trap_assert_passed();
+}
+
+/*
+ * Preallocating the first window of the file fails with EFBIG because
+ * of the file size limit, so everything has to go through pwrite().
+ */
+static void test_pwrite_fallback(void)
+{
+    if (g_test_subprocess()) {
+        struct rlimit rl;
+
+        g_assert_cmpint(getrlimit(RLIMIT_FSIZE, &rl), ==, 0);
+        rl.rlim_cur = MIN(rl.rlim_max, 8 * MiB);
+        g_assert_cmpint(setrlimit(RLIMIT_FSIZE, &rl), ==, 0);
+        signal(SIGXFSZ, SIG_IGN);
+
+        n_events = 2000;
+        run_threads(false);
+        return;
+    }
+
+    g_test_trap_subprocess(NULL, 0, 0);
+    g_test_trap_assert_passed();
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    tmpdir = g_dir_make_tmp("test-trace-simple-XXXXXX", NULL);
+    g_assert_nonnull(tmpdir);
+
+    g_test_add_func("/trace-simple/threads-signals", test_threads_signals);
+    g_test_add_func("/trace-simple/pwrite-fallback", test_pwrite_fallback);
+
+    ret = g_test_run();
+
+    g_rmdir(tmpdir);
+    g_free(tmpdir);
+    return ret;
+}
@@ -25,6 +25,7 @@
 #endif
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/host-utils.h"
 #include "qemu/config-file.h"
 #include "monitor/monitor.h"
 #include "trace/trace-root.h"
@@ -41,6 +42,7 @@ static uint32_t next_id;
 static uint32_t next_vcpu_id;
 static bool init_trace_on_startup;
 static char *trace_opts_file;
+static uint64_t trace_opts_bufsize;
 
 QemuOptsList qemu_trace_opts = {
     .name = "trace",
@@ -57,6 +59,9 @@ QemuOptsList qemu_trace_opts = {
         },{
             .name = "file",
             .type = QEMU_OPT_STRING,
+        },{
+            .name = "bufsize",
+            .type = QEMU_OPT_SIZE,
         },
         { /* end of list */ }
     },
@@ -265,6 +270,9 @@ void trace_init_file(void)
 bool trace_init_backends(void)
 {
 #ifdef CONFIG_TRACE_SIMPLE
+    if (trace_opts_bufsize) {
+        st_set_trace_buffer_size(trace_opts_bufsize);
+    }
     if (!st_init()) {
         fprintf(stderr, "failed to initialize simple tracing backend.\n");
         return false;
@@ -285,6 +293,13 @@ bool trace_init_backends(void)
     return true;
 }
 
+void trace_init_thread(void)
+{
+#ifdef CONFIG_TRACE_SIMPLE
+    st_thread_init();
+#endif
+}
+
 void trace_opt_parse(const char *optarg)
 {
     QemuOpts *opts = qemu_opts_parse_noisily(qemu_find_opts("trace"),
@@ -299,6 +314,23 @@ void trace_opt_parse(const char *optarg)
     init_trace_on_startup = true;
     g_free(trace_opts_file);
     trace_opts_file = g_strdup(qemu_opt_get(opts, "file"));
+
+    trace_opts_bufsize = qemu_opt_get_size(opts, "bufsize", 0);
+    if (trace_opts_bufsize) {
+#ifdef CONFIG_TRACE_SIMPLE
+        if (!is_power_of_2(trace_opts_bufsize) ||
+            trace_opts_bufsize < TRACE_BUF_SIZE_MIN ||
+            trace_opts_bufsize > TRACE_BUF_SIZE_MAX) {
+            error_report("--trace bufsize must be a power of 2 between "
+                         "64K and 1G");
+            exit(1);
+        }
+#else
+        error_report("--trace bufsize=...: option not supported by the "
+                     "selected tracing backends");
+        exit(1);
+#endif
+    }
     qemu_opts_del(opts);
 }
 
@@ -164,6 +164,15 @@ void trace_event_set_state_dynamic(TraceEvent *ev, bool state);
  */
 bool trace_init_backends(void);
 
+/**
+ * trace_init_thread:
+ *
+ * Set up the per-thread state of the tracing backend for the calling
+ * thread, so that events emitted from its signal handlers need not
+ * allocate anything.  Called when QEMU starts a thread.
+ */
+void trace_init_thread(void);
+
 /**
  * trace_init_file:
  *
@@ -11,8 +11,12 @@
 #include "qemu/osdep.h"
 #ifndef _WIN32
 #include <pthread.h>
+#include <sys/mman.h>
 #endif
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
+#include "qemu/units.h"
 #include "trace/control.h"
 #include "trace/simple.h"
 #include "qemu/error-report.h"
@@ -30,8 +34,8 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
+/** Rest of the buffer is unused, next record is at its start */
+#define PADDING_EVENT_ID (~(uint64_t)0 - 2)
 
 /*
  * Trace records are written out by a dedicated thread.  The thread waits for
@@ -44,19 +48,49 @@ static GCond trace_empty_cond;
 static bool trace_available;
 static bool trace_writeout_enabled;
 
+/*
+ * Every thread that emits events gets its own ring buffer, so recording an
+ * event needs neither locks nor atomic read-modify-write operations: the
+ * thread is the only producer and the writeout thread the only consumer.
+ *
+ * Records are 8-byte aligned and never wrap around the end of the buffer;
+ * a record that would is preceded by a PADDING_EVENT_ID marker instead.
+ * @head and @tail are free running byte counts, @head is only written by
+ * the owning thread and @tail only by the writeout thread.
+ *
+ * Buffers are never freed.  When a thread exits its buffer is left for the
+ * writeout thread to drain and can then be taken over by a new thread.
+ */
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
-    TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
+    TRACE_BUF_OWNED,
+    TRACE_BUF_EXITED,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+struct TraceThreadBuffer {
+    struct TraceThreadBuffer *next;
+    uint8_t *data;
+    size_t size;
+    size_t head;
+    size_t tail;
+    /* head of the buffer when the current writeout round started */
+    size_t round_head;
+    unsigned int dropped;
+    int state;
+    /* a record is being filled in, catches events from signal handlers */
+    bool busy;
+};
+
+static size_t trace_buf_size = TRACE_BUF_SIZE_DEFAULT;
+static TraceThreadBuffer *trace_buffers;
+static __thread TraceThreadBuffer *trace_thread_buf;
+static unsigned int dropped_events;
+static bool trace_initialized;
 static uint32_t trace_pid;
-static FILE *trace_fp;
 static char *trace_file_name;
 
+static void trace_buffer_release(gpointer opaque);
+static GPrivate trace_buffer_key = G_PRIVATE_INIT(trace_buffer_release);
+
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
 
@@ -75,54 +109,208 @@ typedef struct {
     uint64_t header_version;  /* HEADER_VERSION  */
 } TraceLogHeader;
 
+/*
+ * Output to the trace file, protected by trace_out_lock since event
+ * mappings for late registered groups are written from other threads.
+ *
+ * On POSIX hosts records are copied into a shared mapping of the file,
+ * which is grown one window at a time and trimmed to the amount of data
+ * actually written whenever the trace buffer is flushed or the file is
+ * closed.  Each window is preallocated, because a store to a page that
+ * the filesystem cannot back raises SIGBUS; if that is not possible the
+ * file is written with pwrite() until it is reopened.
+ */
+static GMutex trace_out_lock;
+static bool trace_out_open;
+
+#ifdef _WIN32
+static FILE *trace_fp;
+
+static bool trace_out_create(const char *name)
+{
+    trace_fp = fopen(name, "wb");
+    return trace_fp != NULL;
+}
+
+static bool trace_out_write(const void *data, size_t len)
+{
+    return fwrite(data, len, 1, trace_fp) == 1;
+}
+
+static void trace_out_sync(void)
+{
+    fflush(trace_fp);
+}
+
+static void trace_out_close(void)
+{
+    fclose(trace_fp);
+    trace_fp = NULL;
+}
+#else
+#define TRACE_MAP_WINDOW (16 * MiB)
+
+static int trace_fd = -1;
+static uint8_t *trace_map;
+static off_t trace_map_start;
+static off_t trace_file_size;
+static bool trace_map_failed;
+
+static void trace_out_unmap(void)
+{
+    if (trace_map) {
+        munmap(trace_map, TRACE_MAP_WINDOW);
+        trace_map = NULL;
+    }
+}
+
+static bool trace_out_map(void)
+{
+    off_t start = QEMU_ALIGN_DOWN(trace_file_size,
+                                  qemu_real_host_page_size());
+    void *map;
+
+    trace_out_unmap();
+    if (trace_map_failed) {
+        return false;
+    }
+#ifdef CONFIG_POSIX_FALLOCATE
+    if (posix_fallocate(trace_fd, start, TRACE_MAP_WINDOW) != 0) {
+        trace_map_failed = true;
+        return false;
+    }
+#else
+    trace_map_failed = true;
+    return false;
+#endif
+    map = mmap(NULL, TRACE_MAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED,
+               trace_fd, start);
+    if (map == MAP_FAILED) {
+        trace_map_failed = true;
+        return false;
+    }
+    trace_map = map;
+    trace_map_start = start;
+    return true;
+}
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static bool trace_out_create(const char *name)
+{
+    trace_fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    trace_file_size = 0;
+    trace_map_failed = false;
+    return trace_fd >= 0;
+}
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static bool trace_out_write(const void *data, size_t len)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
+    const uint8_t *p = data;
+
+    while (len) {
+        size_t off, n;
+
+        if (!trace_map ||
+            trace_file_size >= trace_map_start + TRACE_MAP_WINDOW) {
+            if (!trace_out_map()) {
+                /* Could not grow the mapping, fall back to plain writes */
+                if (pwrite(trace_fd, p, len, trace_file_size) != (ssize_t)len) {
+                    return false;
+                }
+                trace_file_size += len;
+                return true;
+            }
         }
-        trace_buf[idx++] = 0;
-        num++;
+
+        off = trace_file_size - trace_map_start;
+        n = MIN(len, TRACE_MAP_WINDOW - off);
+        memcpy(trace_map + off, p, n);
+        trace_file_size += n;
+        p += n;
+        len -= n;
     }
+    return true;
+}
+
+/* Drop the unwritten part of the window so that the file can be parsed */
+static void trace_out_sync(void)
+{
+    trace_out_unmap();
+    if (ftruncate(trace_fd, trace_file_size) < 0) {
+        /* Leaves zeroes at the end of the file, nothing better to do */
+    }
+}
+
+static void trace_out_close(void)
+{
+    trace_out_sync();
+    close(trace_fd);
+    trace_fd = -1;
 }
+#endif
+
+static void trace_buffer_release(gpointer opaque)
+{
+    TraceThreadBuffer *buf = opaque;
+
+    qatomic_store_release(&buf->state, TRACE_BUF_EXITED);
+}
+
 /**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * Find a ring buffer for the current thread
  *
- * Returns false if the record is not valid.
+ * Take over the buffer of a thread that has exited, or allocate a new one.
+ * Don't use g_malloc, can deadlock when traced.  Not async-signal-safe.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static TraceThreadBuffer *trace_buffer_get(void)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
+    TraceThreadBuffer *buf, *head;
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
+    for (buf = qatomic_load_acquire(&trace_buffers); buf; buf = buf->next) {
+        if (qatomic_read(&buf->state) == TRACE_BUF_EXITED &&
+            qatomic_cmpxchg(&buf->state, TRACE_BUF_EXITED,
+                            TRACE_BUF_OWNED) == TRACE_BUF_EXITED) {
+            goto found;
+        }
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
+    buf = calloc(1, sizeof(*buf));
+    if (!buf) {
+        return NULL;
+    }
+    buf->size = qatomic_read(&trace_buf_size);
+    buf->data = malloc(buf->size);
+    if (!buf->data) {
+        free(buf);
+        return NULL;
+    }
+    buf->state = TRACE_BUF_OWNED;
+
+    do {
+        head = qatomic_read(&trace_buffers);
+        buf->next = head;
+    } while (qatomic_cmpxchg(&trace_buffers, head, buf) != head);
+
+found:
+    g_private_set(&trace_buffer_key, buf);
+    trace_thread_buf = buf;
+    return buf;
+}
+
+/**
+ * Return the oldest record of a buffer that is part of this writeout round
+ */
+static TraceRecord *trace_buffer_peek(TraceThreadBuffer *buf)
+{
+    while (buf->tail != buf->round_head) {
+        TraceRecord *record;
+
+        record = (TraceRecord *)(buf->data + (buf->tail & (buf->size - 1)));
+        if (record->event != PADDING_EVENT_ID) {
+            return record;
+        }
+        qatomic_store_release(&buf->tail, (buf->tail | (buf->size - 1)) + 1);
+    }
+    return NULL;
 }
 
 /**
@@ -150,133 +338,189 @@ static void wait_for_trace_records_available(void)
         g_cond_signal(&trace_empty_cond);
         g_cond_wait(&trace_available_cond, &trace_lock);
     }
-    trace_available = false;
+    qatomic_set(&trace_available, false);
     g_mutex_unlock(&trace_lock);
 }
 
-static gpointer writeout_thread(gpointer opaque)
+static void write_dropped_record(void)
 {
-    TraceRecord *recordptr;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
-    size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    TraceThreadBuffer *buf;
+    uint64_t dropped_count;
+
+    dropped_count = qatomic_xchg(&dropped_events, 0);
+    for (buf = qatomic_load_acquire(&trace_buffers); buf; buf = buf->next) {
+        dropped_count += qatomic_xchg(&buf->dropped, 0);
+    }
+    if (!dropped_count) {
+        return;
+    }
+
+    dropped.rec.event = DROPPED_EVENT_ID;
+    dropped.rec.timestamp_ns = get_clock();
+    dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
+    dropped.rec.pid = trace_pid;
+    dropped.rec.arguments[0] = dropped_count;
+    trace_out_write(&type, sizeof(type));
+    trace_out_write(&dropped.rec, dropped.rec.length);
+}
+
+/*
+ * Write out the records that were published when the round started,
+ * merging the per-thread buffers in timestamp order.  Records published
+ * while the round is in progress are left for the next one.
+ */
+static void write_records(void)
+{
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    TraceThreadBuffer *buffers, *buf;
+
+    buffers = qatomic_load_acquire(&trace_buffers);
+    for (buf = buffers; buf; buf = buf->next) {
+        buf->round_head = qatomic_load_acquire(&buf->head);
+    }
 
     for (;;) {
-        wait_for_trace_records_available();
+        TraceThreadBuffer *oldest_buf = NULL;
+        TraceRecord *oldest = NULL;
 
-        if (g_atomic_int_get(&dropped_events)) {
-            dropped.rec.event = DROPPED_EVENT_ID;
-            dropped.rec.timestamp_ns = get_clock();
-            dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
-            dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
-        }
+        for (buf = buffers; buf; buf = buf->next) {
+            TraceRecord *record = trace_buffer_peek(buf);
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+            if (record &&
+                (!oldest || record->timestamp_ns < oldest->timestamp_ns)) {
+                oldest = record;
+                oldest_buf = buf;
+            }
+        }
+        if (!oldest) {
+            break;
         }
 
-        fflush(trace_fp);
+        trace_out_write(&type, sizeof(type));
+        trace_out_write(oldest, oldest->length);
+        qatomic_store_release(&oldest_buf->tail,
+                              oldest_buf->tail + ROUND_UP(oldest->length, 8));
+    }
+}
+
+static gpointer writeout_thread(gpointer opaque)
+{
+    for (;;) {
+        wait_for_trace_records_available();
+
+        g_mutex_lock(&trace_out_lock);
+        write_dropped_record();
+        write_records();
+#ifdef _WIN32
+        trace_out_sync();
+#endif
+        g_mutex_unlock(&trace_out_lock);
     }
     return NULL;
 }
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    memcpy(rec->rec + rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off += sizeof(uint64_t);
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    memcpy(rec->rec + rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off += sizeof(slen);
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    memcpy(rec->rec + rec->rec_off, s, slen);
+    rec->rec_off += slen;
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuffer *buf = trace_thread_buf;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
+    size_t len = ROUND_UP(rec_len, 8);
     uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
+    TraceRecord *record;
+    size_t head, off, pad;
+
+    if (unlikely(!buf)) {
+        /*
+         * Only threads that QEMU did not create get here, see
+         * st_thread_init(); they do not run QEMU's signal handlers.
+         */
+        buf = trace_buffer_get();
+        if (!buf) {
+            qatomic_inc(&dropped_events);
+            return -ENOMEM;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
-
-    idx = old_idx % TRACE_BUF_LEN;
-
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    }
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
-    return 0;
-}
+    if (unlikely(qatomic_read(&buf->busy))) {
+        /* Event from a signal handler that interrupted this thread */
+        qatomic_inc(&buf->dropped);
+        return -EBUSY;
+    }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
+    /*
+     * Claim the buffer before looking at head: a signal handler that
+     * runs after this point drops its event instead of reserving the
+     * same space.  One that ran before has already published its record.
+     */
+    qatomic_set(&buf->busy, true);
+    signal_barrier();
+
+    head = buf->head;
+    off = head & (buf->size - 1);
+    pad = off + len > buf->size ? buf->size - off : 0;
+    if (head + pad + len - qatomic_load_acquire(&buf->tail) > buf->size) {
+        /* Trace Buffer Full, Event dropped ! */
+        qatomic_inc(&buf->dropped);
+        signal_barrier();
+        qatomic_set(&buf->busy, false);
+        return -ENOSPC;
     }
-}
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
-{
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
+    if (pad) {
+        record = (TraceRecord *)(buf->data + off);
+        record->event = PADDING_EVENT_ID;
+        head += pad;
+        off = 0;
     }
-    return idx; /* most callers wants to know where to write next */
+
+    record = (TraceRecord *)(buf->data + off);
+    record->event = event;
+    record->timestamp_ns = timestamp_ns;
+    record->length = rec_len;
+    record->pid = trace_pid;
+
+    rec->tbuf = buf;
+    rec->rec = buf->data + off;
+    rec->rec_off = sizeof(TraceRecord);
+    rec->next_head = head + len;
+    return 0;
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
-        flush_trace_file(false);
+    TraceThreadBuffer *buf = rec->tbuf;
+
+    qatomic_store_release(&buf->head, rec->next_head);
+    /* A signal handler must see the new head once busy is clear */
+    signal_barrier();
+    qatomic_set(&buf->busy, false);
+
+    if (rec->next_head - qatomic_read(&buf->tail) > buf->size / 4) {
+        /* Order the head update before checking for a pending kick */
+        smp_mb();
+        if (!qatomic_read(&trace_available)) {
+            flush_trace_file(false);
+        }
     }
 }
 
@@ -289,10 +533,10 @@ static int st_write_event_mapping(TraceEventIter *iter)
         uint64_t id = trace_event_get_id(ev);
         const char *name = trace_event_get_name(ev);
         uint32_t len = strlen(name);
-        if (fwrite(&type, sizeof(type), 1, trace_fp) != 1 ||
-            fwrite(&id, sizeof(id), 1, trace_fp) != 1 ||
-            fwrite(&len, sizeof(len), 1, trace_fp) != 1 ||
-            fwrite(name, len, 1, trace_fp) != 1) {
+        if (!trace_out_write(&type, sizeof(type)) ||
+            !trace_out_write(&id, sizeof(id)) ||
+            !trace_out_write(&len, sizeof(len)) ||
+            !trace_out_write(name, len)) {
             return -1;
         }
     }
@@ -308,9 +552,9 @@ static int st_write_event_mapping(TraceEventIter *iter)
 bool st_set_trace_file_enabled(bool enable)
 {
     TraceEventIter iter;
-    bool was_enabled = trace_fp;
+    bool was_enabled = trace_out_open;
 
-    if (enable == !!trace_fp) {
+    if (enable == trace_out_open) {
         return was_enabled;     /* no change */
     }
 
@@ -319,6 +563,7 @@ bool st_set_trace_file_enabled(bool enable)
     trace_writeout_enabled = false;
     flush_trace_file(true);
 
+    g_mutex_lock(&trace_out_lock);
     if (enable) {
         static const TraceLogHeader header = {
             .header_event_id = HEADER_EVENT_ID,
@@ -327,25 +572,28 @@ bool st_set_trace_file_enabled(bool enable)
             .header_version = HEADER_VERSION,
         };
 
-        trace_fp = fopen(trace_file_name, "wb");
-        if (!trace_fp) {
+        if (!trace_out_create(trace_file_name)) {
+            g_mutex_unlock(&trace_out_lock);
             return was_enabled;
         }
 
         trace_event_iter_init_all(&iter);
-        if (fwrite(&header, sizeof header, 1, trace_fp) != 1 ||
+        if (!trace_out_write(&header, sizeof header) ||
             st_write_event_mapping(&iter) < 0) {
-            fclose(trace_fp);
-            trace_fp = NULL;
+            trace_out_close();
+            g_mutex_unlock(&trace_out_lock);
             return was_enabled;
         }
+        trace_out_open = true;
+        g_mutex_unlock(&trace_out_lock);
 
         /* Resume trace writeout */
         trace_writeout_enabled = true;
         flush_trace_file(false);
     } else {
-        fclose(trace_fp);
-        trace_fp = NULL;
+        trace_out_close();
+        trace_out_open = false;
+        g_mutex_unlock(&trace_out_lock);
     }
     return was_enabled;
 }
@@ -372,15 +620,36 @@ void st_set_trace_file(const char *file)
     st_set_trace_file_enabled(saved_enable);
 }
 
+/**
+ * Set the size of the per-thread trace buffers
+ *
+ * Only affects buffers of threads that start afterwards, so this should be
+ * called before st_init().
+ *
+ * @size        Size in bytes, a power of two
+ */
+void st_set_trace_buffer_size(size_t size)
+{
+    assert(is_power_of_2(size) &&
+           size >= TRACE_BUF_SIZE_MIN && size <= TRACE_BUF_SIZE_MAX);
+    qatomic_set(&trace_buf_size, size);
+}
+
 void st_print_trace_file_status(void)
 {
     qemu_printf("Trace file \"%s\" %s.\n",
-                trace_file_name, trace_fp ? "on" : "off");
+                trace_file_name, trace_out_open ? "on" : "off");
 }
 
 void st_flush_trace_buffer(void)
 {
     flush_trace_file(true);
+
+    g_mutex_lock(&trace_out_lock);
+    if (trace_out_open) {
+        trace_out_sync();
+    }
+    g_mutex_unlock(&trace_out_lock);
 }
 
 /* Helper function to create a thread with signals blocked.  Use glib's
@@ -420,9 +689,24 @@ bool st_init(void)
     }
 
     atexit(st_flush_trace_buffer);
+    qatomic_set(&trace_initialized, true);
+    st_thread_init();
     return true;
 }
 
+/**
+ * Allocate the ring buffer of the calling thread
+ *
+ * A thread's first event would otherwise allocate it, which is not
+ * async-signal-safe when that event comes from a signal handler.
+ */
+void st_thread_init(void)
+{
+    if (qatomic_read(&trace_initialized) && !trace_thread_buf) {
+        trace_buffer_get();
+    }
+}
+
 void st_init_group(size_t group)
 {
     TraceEventIter iter;
@@ -431,6 +715,10 @@ void st_init_group(size_t group)
         return;
     }
 
-    trace_event_iter_init_group(&iter, group);
-    st_write_event_mapping(&iter);
+    g_mutex_lock(&trace_out_lock);
+    if (trace_out_open) {
+        trace_event_iter_init_group(&iter, group);
+        st_write_event_mapping(&iter);
+    }
+    g_mutex_unlock(&trace_out_lock);
 }
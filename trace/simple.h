@@ -15,18 +15,30 @@ void st_print_trace_file_status(void);
 bool st_set_trace_file_enabled(bool enable);
 void st_set_trace_file(const char *file);
 bool st_init(void);
+void st_thread_init(void);
 void st_init_group(size_t group);
 void st_flush_trace_buffer(void);
+void st_set_trace_buffer_size(size_t size);
+
+/* Per-thread trace buffer sizes, in bytes */
+#define TRACE_BUF_SIZE_DEFAULT  (256 * 1024)
+#define TRACE_BUF_SIZE_MIN      (64 * 1024)
+#define TRACE_BUF_SIZE_MAX      (1024 * 1024 * 1024)
+
+typedef struct TraceThreadBuffer TraceThreadBuffer;
 
 typedef struct {
-    unsigned int tbuf_idx;
-    unsigned int rec_off;
+    TraceThreadBuffer *tbuf;
+    uint8_t *rec;       /* start of the record in the buffer */
+    size_t rec_off;     /* where the next argument goes */
+    size_t next_head;   /* buffer head once the record is finished */
 } TraceBufferRecord;
 
 /* Note for hackers: Make sure MAX_TRACE_LEN < sizeof(uint32_t) */
 #define MAX_TRACE_STRLEN 512
 /**
- * Initialize a trace record and claim space for it in the buffer
+ * Initialize a trace record and claim space for it in the buffer of the
+ * calling thread
  *
  * @arglen  number of bytes required for arguments
  */
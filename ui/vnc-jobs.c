@@ -39,34 +39,70 @@
  *
  * There are three levels of locking:
  * - jobs queue lock: for each operation on the queue (push, pop, isEmpty?)
+ *                    and on the tiles being encoded
  * - VncDisplay global lock: mainly used for framebuffer updates to avoid
  *                      screen corruption if the framebuffer is updated
  *                      while the worker is doing something.
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
+ * While a VNC worker thread is working, the VncDisplay global lock is held
  * to avoid screen corruption (this does not block vnc_refresh() because it
  * uses trylock()) but the output lock is not held because the thread works on
  * its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Jobs for different clients are encoded in parallel by a pool of worker
+ * threads, but jobs for the same client are processed one at a time and in
+ * order, because the encoders keep per-client state across updates.
+ * Large updates are further split into tiles that the other workers help
+ * encode, while the thread that owns the job keeps holding the display
+ * lock on their behalf.
  */
 
+/* Updates smaller than this are not worth splitting into tiles */
+#define VNC_JOB_SPLIT_MIN_PIXELS (256 * 256)
+#define VNC_JOB_TILE_SIZE        128
+#define VNC_WORKER_MAX_THREADS   16
+
+typedef struct VncTile {
+    VncRect rect;
+    Buffer output;
+    int n_rectangles;
+} VncTile;
+
+typedef struct VncTileSet {
+    VncState *vs;       /* Local copy of the client state of the job */
+    VncTile *tiles;
+    int n_tiles;
+    int next;           /* First tile that was not picked up yet */
+    int done;           /* Number of tiles that were encoded */
+    QTAILQ_ENTRY(VncTileSet) next_set;
+} VncTileSet;
+
+typedef struct VncJobQueue VncJobQueue;
+
+typedef struct VncWorker {
+    VncJobQueue *queue;
+    QemuThread thread;
+    /*
+     * Tight streams and scratch buffers used when encoding tiles on
+     * behalf of any client.  The streams are restarted for every tile.
+     */
+    VncTight tight;
+} VncWorker;
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
     bool exit;
+    int n_workers;
+    int running_workers;
     QTAILQ_HEAD(, VncJob) jobs;
+    QTAILQ_HEAD(, VncTileSet) tile_sets;
 };
 
-typedef struct VncJobQueue VncJobQueue;
-
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -235,25 +271,203 @@ static bool vnc_worker_clamp_rect(VncState *vs, VncJob *job, VncRect *rect)
     return false;
 }
 
-static int vnc_worker_thread_loop(VncJobQueue *queue)
+/* Called with the queue lock held */
+static VncJob *vnc_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        /* Jobs stay queued until done, so this also skips busy clients */
+        for (prev = QTAILQ_FIRST(&queue->jobs); prev != job;
+             prev = QTAILQ_NEXT(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static bool vnc_worker_should_split(VncJobQueue *queue, VncState *vs,
+                                    VncJob *job)
+{
+    VncRectEntry *entry;
+    size_t pixels = 0;
+
+    if (queue->n_workers < 2) {
+        return false;
+    }
+
+    switch (vs->vnc_encoding) {
+    case VNC_ENCODING_ZLIB:
+    case VNC_ENCODING_ZRLE:
+    case VNC_ENCODING_ZYWRLE:
+        /*
+         * These compress all rectangles into a single zlib stream, which
+         * the client has no way to restart, so they must be encoded in
+         * order.  Tight can restart its streams, see tight_reset_stream().
+         */
+        return false;
+    default:
+        break;
+    }
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        pixels += entry->rect.w * entry->rect.h;
+    }
+    return pixels >= VNC_JOB_SPLIT_MIN_PIXELS;
+}
+
+static void vnc_worker_encode_tile(VncWorker *worker, VncTileSet *set,
+                                   VncTile *tile)
 {
-    VncJob *job;
-    VncRectEntry *entry, *tmp;
     VncState vs = {};
-    int n_rectangles;
-    int saved_offset;
+    int n;
+
+    vnc_async_encoding_start(set->vs, &vs);
+    vs.magic = VNC_MAGIC;
+
+    /*
+     * Tiles are concatenated in order, but may be compressed by any
+     * worker: start each one from fresh zlib streams and tell the
+     * client to do the same.
+     */
+    worker->tight.quality = set->vs->tight->quality;
+    worker->tight.compression = set->vs->tight->compression;
+    worker->tight.stream_reset = VNC_TIGHT_CCB_RESET_MASK;
+    vs.tight = &worker->tight;
+
+    n = vnc_send_framebuffer_update(&vs, tile->rect.x, tile->rect.y,
+                                    tile->rect.w, tile->rect.h);
+    tile->n_rectangles = MAX(n, 0);
+
+    buffer_move_empty(&tile->output, &vs.output);
+    buffer_free(&vs.output);
+    vs.magic = 0;
+}
+
+/*
+ * Pick up the next tile of @set and encode it.  Called with the queue
+ * lock held, which is dropped while encoding.  Returns false if all
+ * tiles were already picked up.
+ */
+static bool vnc_worker_run_tile_locked(VncWorker *worker, VncTileSet *set)
+{
+    VncJobQueue *queue = worker->queue;
+    VncTile *tile;
+
+    if (set->next == set->n_tiles) {
+        return false;
+    }
+
+    tile = &set->tiles[set->next++];
+    if (set->next == set->n_tiles) {
+        QTAILQ_REMOVE(&queue->tile_sets, set, next_set);
+    }
+    vnc_unlock_queue(queue);
+
+    vnc_worker_encode_tile(worker, set, tile);
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    if (++set->done == set->n_tiles) {
+        qemu_cond_broadcast(&queue->cond);
+    }
+    return true;
+}
+
+/*
+ * Split the rectangles of @job into tiles, encode them with the help of
+ * the other workers and append the result to @vs's output.  Called with
+ * the display lock held.
+ */
+static int vnc_worker_encode_tiles(VncWorker *worker, VncJob *job,
+                                   VncState *vs)
+{
+    VncJobQueue *queue = worker->queue;
+    VncTileSet set = { .vs = vs };
+    VncRectEntry *entry, *tmp;
+    int n_rectangles = 0;
+    int size = 0;
+    int i, x, y;
+
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        VncRect *rect = &entry->rect;
+
+        if (!vnc_worker_clamp_rect(vs, job, rect)) {
+            g_free(entry);
+            continue;
+        }
+
+        for (y = rect->y; y < rect->y + rect->h; y += VNC_JOB_TILE_SIZE) {
+            for (x = rect->x; x < rect->x + rect->w; x += VNC_JOB_TILE_SIZE) {
+                VncTile *tile;
+
+                if (set.n_tiles == size) {
+                    size = MAX(size * 2, 64);
+                    set.tiles = g_renew(VncTile, set.tiles, size);
+                }
+                tile = &set.tiles[set.n_tiles++];
+                *tile = (VncTile) {
+                    .rect.x = x,
+                    .rect.y = y,
+                    .rect.w = MIN(VNC_JOB_TILE_SIZE, rect->x + rect->w - x),
+                    .rect.h = MIN(VNC_JOB_TILE_SIZE, rect->y + rect->h - y),
+                };
+            }
+        }
+        g_free(entry);
+    }
+    QLIST_INIT(&job->rectangles);
+
+    if (!set.n_tiles) {
+        return 0;
+    }
+
+    vnc_lock_queue(queue);
+    QTAILQ_INSERT_TAIL(&queue->tile_sets, &set, next_set);
+    qemu_cond_broadcast(&queue->cond);
+
+    /*
+     * Take part in the encoding, so that the job completes even if all
+     * other workers are busy.
+     */
+    while (vnc_worker_run_tile_locked(worker, &set)) {
+        /* nothing */
+    }
+    while (set.done < set.n_tiles) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
     vnc_unlock_queue(queue);
 
-    if (queue->exit) {
-        return -1;
+    for (i = 0; i < set.n_tiles; i++) {
+        n_rectangles += set.tiles[i].n_rectangles;
+        buffer_move(&vs->output, &set.tiles[i].output);
+    }
+    g_free(set.tiles);
+
+    trace_vnc_job_tiles(vs, job, set.n_tiles);
+
+    /* The tiles restarted the client's side of the tight streams */
+    if (vs->vnc_encoding == VNC_ENCODING_TIGHT ||
+        vs->vnc_encoding == VNC_ENCODING_TIGHT_PNG) {
+        vs->tight->stream_reset = VNC_TIGHT_CCB_RESET_MASK;
     }
+    return n_rectangles;
+}
+
+static void vnc_worker_run_job(VncWorker *worker, VncJob *job)
+{
+    VncJobQueue *queue = worker->queue;
+    VncRectEntry *entry, *tmp;
+    VncState vs = {};
+    int n_rectangles;
+    int saved_offset;
 
     assert(job->vs->magic == VNC_MAGIC);
 
@@ -284,6 +498,15 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     vnc_write_u16(&vs, 0);
 
     vnc_lock_display(job->vs->vd);
+    if (vnc_worker_should_split(queue, &vs, job)) {
+        if (job->vs->ioc == NULL) {
+            vnc_unlock_display(job->vs->vd);
+            /* Copy persistent encoding data */
+            vnc_async_encoding_end(job->vs, &vs);
+            goto disconnected;
+        }
+        n_rectangles = vnc_worker_encode_tiles(worker, job, &vs);
+    }
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
@@ -332,6 +555,37 @@ disconnected:
     qemu_cond_broadcast(&queue->cond);
     g_free(job);
     vs.magic = 0;
+}
+
+static int vnc_worker_thread_loop(VncWorker *worker)
+{
+    VncJobQueue *queue = worker->queue;
+    VncTileSet *set;
+    VncJob *job;
+
+    vnc_lock_queue(queue);
+    for (;;) {
+        if (queue->exit) {
+            vnc_unlock_queue(queue);
+            return -1;
+        }
+        /* Help with tiles first, their job is holding the display lock */
+        set = QTAILQ_FIRST(&queue->tile_sets);
+        if (set) {
+            vnc_worker_run_tile_locked(worker, set);
+            vnc_unlock_queue(queue);
+            return 0;
+        }
+        job = vnc_next_job_locked(queue);
+        if (job) {
+            break;
+        }
+        qemu_cond_wait(&queue->cond, &queue->mutex);
+    }
+    job->running = true;
+    vnc_unlock_queue(queue);
+
+    vnc_worker_run_job(worker, job);
     return 0;
 }
 
@@ -342,6 +596,7 @@ static VncJobQueue *vnc_queue_init(void)
     qemu_cond_init(&queue->cond);
     qemu_mutex_init(&queue->mutex);
     QTAILQ_INIT(&queue->jobs);
+    QTAILQ_INIT(&queue->tile_sets);
     return queue;
 }
 
@@ -353,14 +608,32 @@ static void vnc_queue_clear(VncJobQueue *q)
     queue = NULL; /* Unset global queue */
 }
 
+static void vnc_worker_cleanup(VncWorker *worker)
+{
+    VncState vs = { .tight = &worker->tight };
+
+    vnc_tight_clear(&vs);
+    g_free(worker);
+}
+
 static void *vnc_worker_thread(void *arg)
 {
-    VncJobQueue *queue = arg;
+    VncWorker *worker = arg;
+    VncJobQueue *queue = worker->queue;
+    bool last;
 
-    qemu_thread_get_self(&queue->thread);
+    while (!vnc_worker_thread_loop(worker)) {
+        /* nothing */
+    }
 
-    while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+    vnc_lock_queue(queue);
+    last = --queue->running_workers == 0;
+    vnc_unlock_queue(queue);
+
+    vnc_worker_cleanup(worker);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -372,12 +645,21 @@ static bool vnc_worker_thread_running(void)
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
+    int i;
 
     if (vnc_worker_thread_running())
         return;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    q->n_workers = MIN(g_get_num_processors(), VNC_WORKER_MAX_THREADS);
+    q->running_workers = q->n_workers;
+    for (i = 0; i < q->n_workers; i++) {
+        VncWorker *worker = g_new0(VncWorker, 1);
+        g_autofree char *name = g_strdup_printf("vnc_worker/%d", i);
+
+        worker->queue = q;
+        qemu_thread_create(&worker->thread, name, vnc_worker_thread, worker,
+                           QEMU_THREAD_DETACHED);
+    }
     queue = q; /* Set global queue */
 }
@@ -3090,8 +3090,9 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     int has_dirty = 0;
     pixman_image_t *tmpbuf = NULL;
     unsigned long offset;
-    int x;
+    int x, x2, x_end, x_max, guest_x0, i;
     uint8_t *guest_ptr, *server_ptr;
+    DECLARE_BITMAP(changed, VNC_DIRTY_BITS);
 
     struct timeval tv = { 0, 0 };
 
@@ -3129,45 +3130,68 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                    * DIV_ROUND_UP(guest_bpp, 8);
     }
     line_bytes = MIN(server_stride, guest_ll);
+    x_max = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
 
     for (;;) {
+        unsigned long *dirty;
+
         y = offset / VNC_DIRTY_BPL(&vd->guest);
         x = offset % VNC_DIRTY_BPL(&vd->guest);
+        dirty = vd->guest.dirty[y];
 
-        server_ptr = server_row0 + y * server_stride + x * cmp_bytes;
+        if (x >= x_max) {
+            goto next_line;
+        }
 
+        /*
+         * Only the dirty part of the line needs to be converted and
+         * compared, and bits past the end of the surface are left alone.
+         */
+        x_end = find_last_bit(dirty, x_max) + 1;
         if (vd->guest.format != VNC_SERVER_FB_FORMAT) {
-            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb, width, 0, y);
+            qemu_pixman_linebuf_fill(tmpbuf, vd->guest.fb,
+                                     MIN(x_end * VNC_DIRTY_PIXELS_PER_BIT,
+                                         width) -
+                                     x * VNC_DIRTY_PIXELS_PER_BIT,
+                                     x * VNC_DIRTY_PIXELS_PER_BIT, y);
             guest_ptr = (uint8_t *)pixman_image_get_data(tmpbuf);
+            guest_x0 = x;
         } else {
             guest_ptr = guest_row0 + y * guest_stride;
+            guest_x0 = 0;
         }
-        guest_ptr += x * cmp_bytes;
-
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
-             x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
-            int _cmp_bytes = cmp_bytes;
-            if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
-                continue;
-            }
-            if ((x + 1) * cmp_bytes > line_bytes) {
-                _cmp_bytes = line_bytes - x * cmp_bytes;
-            }
-            assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
-                continue;
-            }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
-            if (!vd->non_adaptive) {
-                vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
-                                 y, &tv);
-            }
-            QTAILQ_FOREACH(vs, &vd->clients, next) {
-                set_bit(x, vs->dirty[y]);
+        server_ptr = server_row0 + y * server_stride;
+
+        /* Compare and copy each run of dirty chunks in one go */
+        while (x < x_end) {
+            int run_bytes;
+
+            x2 = find_next_zero_bit(dirty, x_end, x);
+            bitmap_clear(dirty, x, x2 - x);
+
+            run_bytes = MIN(x2 * cmp_bytes, line_bytes) - x * cmp_bytes;
+            assert(run_bytes >= 0);
+            bitmap_zero(changed, x2 - x);
+            if (buffer_copy_changed(server_ptr + x * cmp_bytes,
+                                    guest_ptr + (x - guest_x0) * cmp_bytes,
+                                    run_bytes, cmp_bytes, changed)) {
+                for (i = find_first_bit(changed, x2 - x); i < x2 - x;
+                     i = find_next_bit(changed, x2 - x, i + 1)) {
+                    if (!vd->non_adaptive) {
+                        vnc_rect_updated(vd,
+                                         (x + i) * VNC_DIRTY_PIXELS_PER_BIT,
+                                         y, &tv);
+                    }
+                    QTAILQ_FOREACH(vs, &vd->clients, next) {
+                        set_bit(x + i, vs->dirty[y]);
+                    }
+                    has_dirty++;
+                }
             }
-            has_dirty++;
+            x = find_next_bit(dirty, x_end, x2);
         }
 
+next_line:
         y++;
         offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                height * VNC_DIRTY_BPL(&vd->guest),
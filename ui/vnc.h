@@ -205,6 +205,7 @@ typedef struct VncTight {
 #endif
     int levels[4];
     z_stream stream[4];
+    uint8_t stream_reset; /* Streams to restart before their next use */
 } VncTight;
 
 typedef struct VncHextile {
@@ -251,6 +252,7 @@ struct VncJob
     VncState *vs;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
+    bool running; /* Picked up by a worker thread */
     QTAILQ_ENTRY(VncJob) next;
 };
 
@@ -30,6 +30,7 @@
 #include "block/graph-lock.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
+#include "qemu/bitmap.h"
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
@@ -367,6 +368,7 @@ aio_ctx_finalize(GSource     *source)
     unsigned flags;
 
     thread_pool_free(ctx->thread_pool);
+    g_free(ctx->thread_pool_affinity);
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -770,3 +772,28 @@ void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
         thread_pool_update_params(ctx->thread_pool, ctx);
     }
 }
+
+void aio_context_set_thread_pool_affinity(AioContext *ctx,
+                                          unsigned long *host_cpus,
+                                          unsigned long nbits, Error **errp)
+{
+#ifndef CONFIG_PTHREAD_AFFINITY_NP
+    if (host_cpus) {
+        error_setg(errp, "thread-pool-affinity is not supported on this host");
+        return;
+    }
+#endif
+
+    g_free(ctx->thread_pool_affinity);
+    ctx->thread_pool_affinity = NULL;
+    ctx->thread_pool_affinity_nbits = 0;
+    if (host_cpus) {
+        ctx->thread_pool_affinity = bitmap_new(nbits);
+        bitmap_copy(ctx->thread_pool_affinity, host_cpus, nbits);
+        ctx->thread_pool_affinity_nbits = nbits;
+    }
+
+    if (ctx->thread_pool) {
+        thread_pool_update_params(ctx->thread_pool, ctx);
+    }
+}
@@ -0,0 +1,188 @@
+/*
+ * Copy the chunks of a buffer that differ from a reference copy
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/bitops.h"
+#include "host/cpuinfo.h"
+
+typedef size_t (*buffer_copy_changed_fn)(uint8_t *dst, const uint8_t *src,
+                                         size_t chunk, size_t n,
+                                         unsigned long *changed);
+
+static size_t
+buffer_copy_changed_int(uint8_t *dst, const uint8_t *src, size_t chunk,
+                        size_t n, unsigned long *changed)
+{
+    size_t copied = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++, dst += chunk, src += chunk) {
+        if (memcmp(dst, src, chunk) != 0) {
+            memcpy(dst, src, chunk);
+            set_bit(i, changed);
+            copied++;
+        }
+    }
+    return copied;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+#include <immintrin.h>
+
+/*
+ * The vectorized functions require the chunk size to be a multiple of
+ * the vector size.  Each chunk is compared in full with unaligned loads,
+ * and copied back from the registers only if it differs.
+ */
+
+static size_t __attribute__((target("sse2")))
+buffer_copy_changed_sse2(uint8_t *dst, const uint8_t *src, size_t chunk,
+                         size_t n, unsigned long *changed)
+{
+    __m128i zero = _mm_setzero_si128();
+    size_t copied = 0;
+    size_t i, j;
+
+    for (i = 0; i < n; i++, dst += chunk, src += chunk) {
+        __m128i t = zero;
+
+        __builtin_prefetch(src + chunk);
+        for (j = 0; j < chunk; j += 16) {
+            t |= _mm_xor_si128(_mm_loadu_si128((__m128i *)(src + j)),
+                               _mm_loadu_si128((__m128i *)(dst + j)));
+        }
+        if (likely(_mm_movemask_epi8(_mm_cmpeq_epi8(t, zero)) == 0xFFFF)) {
+            continue;
+        }
+        for (j = 0; j < chunk; j += 16) {
+            _mm_storeu_si128((__m128i *)(dst + j),
+                             _mm_loadu_si128((__m128i *)(src + j)));
+        }
+        set_bit(i, changed);
+        copied++;
+    }
+    return copied;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static size_t __attribute__((target("avx2")))
+buffer_copy_changed_avx2(uint8_t *dst, const uint8_t *src, size_t chunk,
+                         size_t n, unsigned long *changed)
+{
+    size_t copied = 0;
+    size_t i, j;
+
+    for (i = 0; i < n; i++, dst += chunk, src += chunk) {
+        __m256i t = _mm256_setzero_si256();
+
+        __builtin_prefetch(src + chunk);
+        for (j = 0; j < chunk; j += 32) {
+            t |= _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(src + j)),
+                                  _mm256_loadu_si256((__m256i *)(dst + j)));
+        }
+        if (likely(_mm256_testz_si256(t, t))) {
+            continue;
+        }
+        for (j = 0; j < chunk; j += 32) {
+            _mm256_storeu_si256((__m256i *)(dst + j),
+                                _mm256_loadu_si256((__m256i *)(src + j)));
+        }
+        set_bit(i, changed);
+        copied++;
+    }
+    return copied;
+}
+#endif /* CONFIG_AVX2_OPT */
+
+static unsigned used_accel;
+static size_t accel_chunk_align = 1;
+static buffer_copy_changed_fn buffer_accel = buffer_copy_changed_int;
+
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        size_t align;
+        buffer_copy_changed_fn fn;
+    } all[] = {
+#ifdef CONFIG_AVX2_OPT
+        { CPUINFO_AVX2,   32, buffer_copy_changed_avx2 },
+#endif
+        { CPUINFO_SSE2,   16, buffer_copy_changed_sse2 },
+        { CPUINFO_ALWAYS,  1, buffer_copy_changed_int },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            accel_chunk_align = all[i].align;
+            buffer_accel = all[i].fn;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+
+bool test_buffer_copy_changed_next_accel(void)
+{
+    /*
+     * Accumulate the accelerators that we've already tested, and
+     * remove them from the set to test this round.  We'll get back
+     * a zero from select_accel_cpuinfo when there are no more.
+     */
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
+}
+
+static size_t select_accel_fn(uint8_t *dst, const uint8_t *src, size_t chunk,
+                              size_t n, unsigned long *changed)
+{
+    if (likely(chunk % accel_chunk_align == 0)) {
+        return buffer_accel(dst, src, chunk, n, changed);
+    }
+    return buffer_copy_changed_int(dst, src, chunk, n, changed);
+}
+
+#else
+#define select_accel_fn  buffer_copy_changed_int
+bool test_buffer_copy_changed_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Compare @len bytes of @src against @dst in chunks of @chunk bytes, the
+ * last of which may be shorter, and copy the chunks that differ to @dst.
+ * Bit i of @changed is set if chunk i was copied; other bits are left
+ * untouched.  Returns the number of chunks that were copied.
+ */
+size_t buffer_copy_changed(void *dst, const void *src, size_t len,
+                           size_t chunk, unsigned long *changed)
+{
+    size_t n = len / chunk;
+    size_t tail = len % chunk;
+    size_t copied = 0;
+
+    if (n) {
+        copied = select_accel_fn(dst, src, chunk, n, changed);
+    }
+    if (tail && memcmp(dst + n * chunk, src + n * chunk, tail) != 0) {
+        memcpy(dst + n * chunk, src + n * chunk, tail);
+        set_bit(n, changed);
+        copied++;
+    }
+    return copied;
+}
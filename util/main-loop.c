@@ -199,6 +199,14 @@ static void main_loop_update_params(EventLoopBase *base, Error **errp)
 
     aio_context_set_thread_pool_params(qemu_aio_context, base->thread_pool_min,
                                        base->thread_pool_max, errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_thread_pool_affinity(qemu_aio_context,
+                                         base->thread_pool_affinity,
+                                         base->thread_pool_affinity_nbits,
+                                         errp);
 }
 
 MainLoop *mloop;
@@ -16,6 +16,7 @@
 #include "trace.h"
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/stats64.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
 #include "block/aio.h"
@@ -25,10 +26,19 @@
  * reused as soon as there are 64 coroutines in it. The maximum pool size starts
  * with 64 and is increased on demand so that coroutines are not deleted even if
  * they are not immediately reused.
+ *
+ * Terminated coroutines go to the per-thread alloc_pool first, and only
+ * overflow to the release_pool.  The size of the alloc_pool adapts to the
+ * number of coroutines that the thread keeps in flight: it doubles whenever
+ * the thread has to allocate a coroutine after deleting one because the
+ * pools were full, and it is halved when more than half of it stayed
+ * unused for POOL_TRIM_PERIOD terminations.
  */
 enum {
     POOL_MIN_BATCH_SIZE = 64,
     POOL_INITIAL_MAX_SIZE = 64,
+    POOL_LOCAL_MAX_SIZE = 4096,
+    POOL_TRIM_PERIOD = 4096,
 };
 
 /** Free list to speed up creation */
@@ -36,20 +46,98 @@ static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
 static unsigned int pool_max_size = POOL_INITIAL_MAX_SIZE;
 static unsigned int release_pool_size;
 
-typedef QSLIST_HEAD(, Coroutine) CoroutineQSList;
-QEMU_DEFINE_STATIC_CO_TLS(CoroutineQSList, alloc_pool);
-QEMU_DEFINE_STATIC_CO_TLS(unsigned int, alloc_pool_size);
+static Stat64 coroutines_allocated;
+static Stat64 coroutines_freed;
+static Stat64 pool_grows;
+static Stat64 pool_shrinks;
+static Stat64 release_pool_refills;
+
+typedef struct CoroutinePool {
+    QSLIST_HEAD(, Coroutine) list;
+    unsigned int size;          /* number of coroutines in list */
+    unsigned int max_size;      /* adaptive limit for size, 0 if unused */
+    unsigned int low;           /* smallest size in the current period */
+    unsigned int ops;           /* terminations in the current period */
+    bool overflowed;            /* deleted a coroutine since the last grow */
+} CoroutinePool;
+
+QEMU_DEFINE_STATIC_CO_TLS(CoroutinePool, alloc_pool);
 QEMU_DEFINE_STATIC_CO_TLS(Notifier, coroutine_pool_cleanup_notifier);
 
+static void coroutine_free(Coroutine *co)
+{
+    stat64_add(&coroutines_freed, 1);
+    qemu_coroutine_delete(co);
+}
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
     Coroutine *tmp;
-    CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
+    CoroutinePool *pool = get_ptr_alloc_pool();
+
+    QSLIST_FOREACH_SAFE(co, &pool->list, pool_next, tmp) {
+        QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+        coroutine_free(co);
+    }
+    pool->size = 0;
+}
+
+/* Slow path, on the first use of the pool by this thread */
+static void coroutine_pool_init(CoroutinePool *pool)
+{
+    Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
+
+    notifier->notify = coroutine_pool_cleanup;
+    qemu_thread_atexit_add(notifier);
+    pool->max_size = POOL_MIN_BATCH_SIZE;
+    pool->low = pool->size;
+}
+
+static unsigned int coroutine_pool_limit(CoroutinePool *pool)
+{
+    return MAX(pool->max_size, qatomic_read(&pool_max_size));
+}
+
+/*
+ * Called every POOL_TRIM_PERIOD terminations: if more than half of the
+ * pool was never needed, give back the excess.
+ */
+static void coroutine_pool_trim(CoroutinePool *pool)
+{
+    if (pool->max_size > POOL_MIN_BATCH_SIZE &&
+        pool->low > pool->max_size / 2) {
+        unsigned int old_size = pool->max_size;
+
+        pool->max_size = MAX(pool->max_size / 2, POOL_MIN_BATCH_SIZE);
+        trace_qemu_coroutine_pool_resize(old_size, pool->max_size);
+        stat64_add(&pool_shrinks, 1);
+
+        while (pool->size > coroutine_pool_limit(pool)) {
+            Coroutine *co = QSLIST_FIRST(&pool->list);
 
-    QSLIST_FOREACH_SAFE(co, alloc_pool, pool_next, tmp) {
-        QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-        qemu_coroutine_delete(co);
+            QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+            pool->size--;
+            coroutine_free(co);
+        }
+    }
+    pool->ops = 0;
+    pool->low = pool->size;
+}
+
+/*
+ * The thread deleted coroutines that it now needs again: the pool is too
+ * small for the number of coroutines that the thread keeps in flight.
+ */
+static void coroutine_pool_grow(CoroutinePool *pool)
+{
+    unsigned int old_size = pool->max_size;
+
+    pool->overflowed = false;
+    if (pool->max_size < POOL_LOCAL_MAX_SIZE) {
+        pool->max_size = MIN(pool->max_size * 2, POOL_LOCAL_MAX_SIZE);
+        trace_qemu_coroutine_pool_resize(old_size, pool->max_size);
+        stat64_add(&pool_grows, 1);
     }
 }
 
@@ -58,34 +146,36 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     Coroutine *co = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        CoroutineQSList *alloc_pool = get_ptr_alloc_pool();
+        CoroutinePool *pool = get_ptr_alloc_pool();
 
-        co = QSLIST_FIRST(alloc_pool);
+        co = QSLIST_FIRST(&pool->list);
         if (!co) {
+            /* Slow path; a good place to set up the destructor, too.  */
+            if (!pool->max_size) {
+                coroutine_pool_init(pool);
+            }
             if (release_pool_size > POOL_MIN_BATCH_SIZE) {
-                /* Slow path; a good place to register the destructor, too.  */
-                Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
-                if (!notifier->notify) {
-                    notifier->notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(notifier);
-                }
-
                 /* This is not exact; there could be a little skew between
                  * release_pool_size and the actual size of release_pool.  But
                  * it is just a heuristic, it does not need to be perfect.
                  */
-                set_alloc_pool_size(qatomic_xchg(&release_pool_size, 0));
-                QSLIST_MOVE_ATOMIC(alloc_pool, &release_pool);
-                co = QSLIST_FIRST(alloc_pool);
+                pool->size = qatomic_xchg(&release_pool_size, 0);
+                QSLIST_MOVE_ATOMIC(&pool->list, &release_pool);
+                co = QSLIST_FIRST(&pool->list);
+                stat64_add(&release_pool_refills, 1);
+            } else if (pool->overflowed) {
+                coroutine_pool_grow(pool);
             }
         }
         if (co) {
-            QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-            set_alloc_pool_size(get_alloc_pool_size() - 1);
+            QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+            pool->size--;
+            pool->low = MIN(pool->low, pool->size);
         }
     }
 
     if (!co) {
+        stat64_add(&coroutines_allocated, 1);
         co = qemu_coroutine_new();
     }
 
@@ -100,19 +190,28 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
+        CoroutinePool *pool = get_ptr_alloc_pool();
+
+        if (!pool->max_size) {
+            coroutine_pool_init(pool);
+        }
+        if (++pool->ops == POOL_TRIM_PERIOD) {
+            coroutine_pool_trim(pool);
+        }
+        if (pool->size < coroutine_pool_limit(pool)) {
+            QSLIST_INSERT_HEAD(&pool->list, co, pool_next);
+            pool->size++;
+            return;
+        }
         if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
             QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
             qatomic_inc(&release_pool_size);
             return;
         }
-        if (get_alloc_pool_size() < qatomic_read(&pool_max_size)) {
-            QSLIST_INSERT_HEAD(get_ptr_alloc_pool(), co, pool_next);
-            set_alloc_pool_size(get_alloc_pool_size() + 1);
-            return;
-        }
+        pool->overflowed = true;
     }
 
-    qemu_coroutine_delete(co);
+    coroutine_free(co);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
@@ -230,3 +329,14 @@ void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
 {
     qatomic_sub(&pool_max_size, removing_pool_size);
 }
+
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats)
+{
+    stats->allocated = stat64_get(&coroutines_allocated);
+    stats->freed = stat64_get(&coroutines_freed);
+    stats->pool_grows = stat64_get(&pool_grows);
+    stats->pool_shrinks = stat64_get(&pool_shrinks);
+    stats->release_pool_refills = stat64_get(&release_pool_refills);
+    stats->release_pool_size = qatomic_read(&release_pool_size);
+    stats->pool_max_size = qatomic_read(&pool_max_size);
+}
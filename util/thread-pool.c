@@ -15,6 +15,7 @@
  * GNU GPL, version 2 or (at your option) any later version.
  */
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
@@ -26,6 +27,21 @@ static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
 
+/*
+ * Requests are spread over up to THREAD_POOL_MAX_QUEUES queues, each
+ * with its own lock.  Every worker has a home queue, and steals from
+ * the others when its own is empty, so that the lock is only contended
+ * by the submitter and the workers that happen to hit the same queue.
+ */
+#define THREAD_POOL_MAX_QUEUES 16
+
+typedef struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* Written under lock, read locklessly to skip empty queues.  */
+    int size;
+} ThreadPoolQueue;
+
 enum ThreadState {
     THREAD_QUEUED,
     THREAD_ACTIVE,
@@ -35,17 +51,19 @@ enum ThreadState {
 struct ThreadPoolElement {
     BlockAIOCB common;
     ThreadPool *pool;
+    ThreadPoolQueue *queue;
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /*
+     * Moving state out of THREAD_QUEUED is protected by queue->lock.
+     * After that, only the worker thread can write to it.  Reads and
+     * writes of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Access to this list is protected by queue->lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
@@ -62,63 +80,162 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    unsigned int next_queue;
+    bool batching;       /* wake up workers in thread_pool_batch_end() */
+    int batched_reqs;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    ThreadPoolQueue queues[THREAD_POOL_MAX_QUEUES];
+    int n_queues;
+
+    /* Queued requests in all queues; updated with atomic operations.  */
+    int queued;
+
+    /*
+     * The following variables are protected by lock.  cur_threads,
+     * max_threads and idle_threads are also read locklessly by the
+     * submitter and by busy workers.
+     */
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+    unsigned int next_worker;
+    unsigned long *affinity;
+    unsigned long affinity_nbits;
+    unsigned int affinity_gen;
 };
 
+static void worker_update_affinity(ThreadPool *pool, unsigned int *gen)
+{
+    QemuThread self;
+    int ret;
+
+    /* Runs with lock taken.  */
+    *gen = pool->affinity_gen;
+    if (!pool->affinity) {
+        return;
+    }
+
+    qemu_thread_get_self(&self);
+    ret = qemu_thread_set_affinity(&self, pool->affinity,
+                                   pool->affinity_nbits);
+    trace_thread_pool_worker_affinity(pool, ret);
+}
+
+/*
+ * Take the oldest request from the home queue of the worker, or steal
+ * one from the other queues if it is empty.
+ */
+static ThreadPoolElement *thread_pool_dequeue(ThreadPool *pool, int home)
+{
+    for (int i = 0; i < pool->n_queues; i++) {
+        ThreadPoolQueue *q = &pool->queues[(home + i) % pool->n_queues];
+        ThreadPoolElement *req;
+
+        if (!qatomic_read(&q->size)) {
+            continue;
+        }
+
+        qemu_mutex_lock(&q->lock);
+        req = QTAILQ_FIRST(&q->request_list);
+        if (req) {
+            QTAILQ_REMOVE(&q->request_list, req, reqs);
+            qatomic_set(&q->size, q->size - 1);
+            req->state = THREAD_ACTIVE;
+        }
+        qemu_mutex_unlock(&q->lock);
+
+        if (req) {
+            qatomic_dec(&pool->queued);
+            if (i) {
+                trace_thread_pool_steal(pool, req, home, (home + i) %
+                                        pool->n_queues);
+            }
+            return req;
+        }
+    }
+    return NULL;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    unsigned int affinity_gen;
+    int home;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    home = pool->next_worker++ % pool->n_queues;
+    worker_update_affinity(pool, &affinity_gen);
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (pool->cur_threads <= pool->max_threads) {
+    for (;;) {
         ThreadPoolElement *req;
         int ret;
 
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
+        if (qatomic_read(&pool->cur_threads) >
+            qatomic_read(&pool->max_threads) ||
+            qatomic_read(&pool->affinity_gen) != affinity_gen) {
+            qemu_mutex_lock(&pool->lock);
+            if (pool->cur_threads > pool->max_threads) {
+                break;
+            }
+            if (pool->affinity_gen != affinity_gen) {
+                worker_update_affinity(pool, &affinity_gen);
+            }
+            qemu_mutex_unlock(&pool->lock);
+        }
+
+        req = thread_pool_dequeue(pool, home);
+        if (req) {
+            ret = req->func(req->arg);
+
+            req->ret = ret;
+            /* Write ret before state.  */
+            smp_wmb();
+            req->state = THREAD_DONE;
+
+            qemu_bh_schedule(pool->completion_bh);
+            continue;
+        }
+
+        qemu_mutex_lock(&pool->lock);
+        if (pool->cur_threads > pool->max_threads) {
+            break;
+        }
+
+        qatomic_set(&pool->idle_threads, pool->idle_threads + 1);
+        /*
+         * Write idle_threads before reading queued; pairs with the
+         * increment of queued in thread_pool_submit_aio().  Either we
+         * see the new request, or the submitter sees us idle and
+         * signals request_cond, which it does with lock taken.
+         */
+        smp_mb();
+        if (!qatomic_read(&pool->queued)) {
             ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
             if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
+                !qatomic_read(&pool->queued) &&
                 pool->cur_threads > pool->min_threads) {
                 /* Timed out + no work to do + no need for warm threads = exit.  */
+                qatomic_set(&pool->idle_threads, pool->idle_threads - 1);
                 break;
             }
-            /*
-             * Even if there was some work to do, check if there aren't
-             * too many worker threads before picking it up.
-             */
-            continue;
         }
+        qatomic_set(&pool->idle_threads, pool->idle_threads - 1);
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
+        /*
+         * Even if there was some work to do, check if there aren't
+         * too many worker threads before picking it up.
+         */
         qemu_mutex_unlock(&pool->lock);
-
-        ret = req->func(req->arg);
-
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
-
-        qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
     }
 
-    pool->cur_threads--;
+    /* Runs with lock taken.  */
+    qatomic_set(&pool->cur_threads, pool->cur_threads - 1);
     qemu_cond_signal(&pool->worker_stopped);
 
     /*
@@ -156,7 +273,7 @@ static void spawn_thread_bh_fn(void *opaque)
 
 static void spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    qatomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -217,15 +334,16 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&elem->queue->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        QTAILQ_REMOVE(&elem->queue->request_list, elem, reqs);
+        qatomic_set(&elem->queue->size, elem->queue->size - 1);
+        qatomic_dec(&pool->queued);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
     }
-
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -241,36 +359,95 @@ static const AIOCBInfo thread_pool_aiocb_info = {
     .get_aio_context    = thread_pool_get_aio_context,
 };
 
+/*
+ * Make sure that @n new requests will be picked up: wake up idle workers,
+ * and spawn new ones if there are not enough.  When all workers are busy
+ * and the pool is at its maximum size, they will find the requests on
+ * their own without anyone touching the pool lock.
+ */
+static void thread_pool_kick(ThreadPool *pool, int n)
+{
+    if (!qatomic_read(&pool->idle_threads) &&
+        qatomic_read(&pool->cur_threads) >= qatomic_read(&pool->max_threads)) {
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    for (int i = pool->idle_threads; i < n; i++) {
+        if (pool->cur_threads >= pool->max_threads) {
+            break;
+        }
+        spawn_thread(pool);
+    }
+    if (n >= pool->idle_threads) {
+        qemu_cond_broadcast(&pool->request_cond);
+    } else {
+        while (n--) {
+            qemu_cond_signal(&pool->request_cond);
+        }
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolQueue *q;
     AioContext *ctx = qemu_get_current_aio_context();
     ThreadPool *pool = aio_get_thread_pool(ctx);
 
     /* Assert that the thread submitting work is the same running the pool */
     assert(pool->ctx == qemu_get_current_aio_context());
 
+    q = &pool->queues[pool->next_queue++ % pool->n_queues];
+
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->queue = q;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    qemu_mutex_lock(&q->lock);
+    QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    qatomic_set(&q->size, q->size + 1);
+    qemu_mutex_unlock(&q->lock);
+
+    /* Write queued before reading idle_threads; pairs with worker_thread().  */
+    qatomic_inc(&pool->queued);
+
+    if (pool->batching) {
+        pool->batched_reqs++;
+    } else {
+        thread_pool_kick(pool, 1);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
+void thread_pool_batch_begin(ThreadPool *pool)
+{
+    assert(pool->ctx == qemu_get_current_aio_context());
+    pool->batching = true;
+}
+
+void thread_pool_batch_end(ThreadPool *pool)
+{
+    int n = pool->batched_reqs;
+
+    assert(pool->ctx == qemu_get_current_aio_context());
+    pool->batching = false;
+    pool->batched_reqs = 0;
+    if (n) {
+        trace_thread_pool_batch_end(pool, n);
+        thread_pool_kick(pool, n);
+    }
+}
+
 typedef struct ThreadPoolCo {
     Coroutine *co;
     int ret;
@@ -303,7 +480,22 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
+
+    if (ctx->thread_pool_affinity_nbits != pool->affinity_nbits ||
+        (pool->affinity &&
+         !bitmap_equal(ctx->thread_pool_affinity, pool->affinity,
+                       pool->affinity_nbits))) {
+        g_free(pool->affinity);
+        pool->affinity = NULL;
+        pool->affinity_nbits = ctx->thread_pool_affinity_nbits;
+        if (pool->affinity_nbits) {
+            pool->affinity = bitmap_new(pool->affinity_nbits);
+            bitmap_copy(pool->affinity, ctx->thread_pool_affinity,
+                        pool->affinity_nbits);
+        }
+        qatomic_set(&pool->affinity_gen, pool->affinity_gen + 1);
+    }
 
     /*
      * We either have to:
@@ -340,7 +532,11 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    pool->n_queues = MAX(MIN(ctx->thread_pool_max, THREAD_POOL_MAX_QUEUES), 1);
+    for (int i = 0; i < pool->n_queues; i++) {
+        qemu_mutex_init(&pool->queues[i].lock);
+        QTAILQ_INIT(&pool->queues[i].request_list);
+    }
 
     thread_pool_update_params(pool, ctx);
 }
@@ -364,11 +560,11 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - pool->new_threads);
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
+    qatomic_set(&pool->max_threads, 0);
     qemu_cond_broadcast(&pool->request_cond);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
@@ -377,8 +573,12 @@ void thread_pool_free(ThreadPool *pool)
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
+    for (int i = 0; i < pool->n_queues; i++) {
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
+    g_free(pool->affinity);
     g_free(pool);
 }